@@ -0,0 +1,61 @@
+import math
+import time
+import numpy as np
+import rtx
+
+# 大きな高さ場をノードの並べ方ごとに描画して時間を比べる
+# Renders a large height field with each BVH node layout and prints the best frame time.
+# The layouts only change the order of the nodes in memory, so every image is identical.
+
+grid_size = 2000
+settings = [
+    (rtx.BVHNodeLayout.DepthFirst, 4096),
+    (rtx.BVHNodeLayout.VanEmdeBoas, 4096),
+    (rtx.BVHNodeLayout.SubtreeClusters, 64),
+    (rtx.BVHNodeLayout.SubtreeClusters, 4096),
+]
+
+x, z = np.meshgrid(np.linspace(-1, 1, grid_size + 1), np.linspace(-1, 1, grid_size + 1), indexing="ij")
+y = 0.15 * np.sin(13 * x) * np.cos(11 * z) + 0.02 * np.sin(97 * x + 31 * z) - 0.5
+vertices = np.stack([x, y, z], axis=-1).reshape((-1, 3)).astype(np.float32)
+index = np.arange((grid_size + 1) * (grid_size + 1)).reshape((grid_size + 1, grid_size + 1))
+a = index[:-1, :-1].ravel()
+b = index[:-1, 1:].ravel()
+c = index[1:, :-1].ravel()
+d = index[1:, 1:].ravel()
+faces = np.concatenate([np.stack([a, b, c], axis=1), np.stack([b, d, c], axis=1)]).astype(np.int32)
+
+rt_args = rtx.RayTracingArguments()
+rt_args.num_rays_per_pixel = 4
+rt_args.max_bounce = 4
+cpu_args = rtx.CPUKernelLaunchArguments()
+camera = rtx.PerspectiveCamera(
+    eye=(0, 0.8, 2),
+    center=(0, -0.4, 0),
+    up=(0, 1, 0),
+    fov_rad=math.pi / 3,
+    aspect_ratio=1,
+    z_near=0.01,
+    z_far=100)
+render_buffer = np.zeros((256, 256, 3), dtype="float32")
+
+print("faces={}".format(len(faces)))
+for layout, cluster_bytes in settings:
+    geometry = rtx.StandardGeometry(faces, vertices, 4)
+    geometry.set_bvh_node_layout(layout)
+    geometry.set_bvh_node_cluster_bytes(cluster_bytes)
+    scene = rtx.Scene((0, 0, 0))
+    scene.add(rtx.Object(geometry, rtx.LambertMaterial(0.8), rtx.SolidColorMapping((1, 1, 1))))
+    light = rtx.SphereGeometry(0.4)
+    light.set_position((0, 1.5, 0.5))
+    scene.add(rtx.Object(light, rtx.EmissiveMaterial(3.0), rtx.SolidColorMapping((1, 1, 1))))
+
+    renderer = rtx.Renderer()
+    # 1回目はBVHの構築を含む
+    renderer.render(scene, camera, rt_args, cpu_args, render_buffer)
+    best = float("inf")
+    for _ in range(3):
+        start = time.time()
+        renderer.render(scene, camera, rt_args, cpu_args, render_buffer)
+        best = min(best, time.time() - start)
+    print("{:16s} {:6d} bytes {:8.1f}ms mean={:.6f}".format(layout.name, cluster_bytes, best * 1000, np.mean(render_buffer)))
@@ -0,0 +1,50 @@
+import math
+import numpy as np
+import rtx
+import geometry as gm
+
+# 各メッシュを全てのビルダーと葉のサイズで構築し、BVHの統計を並べて表示する
+# Builds every mesh with each builder and leaf size and prints the BVH statistics side by side.
+
+builders = [rtx.BVHBuilder.Median, rtx.BVHBuilder.BinnedSAH, rtx.BVHBuilder.SBVH]
+leaf_sizes = [1, 2, 4, 8, 16, 25, 32, 64]
+meshes = ["bunny", "teapot"]
+# 最後にコストモデルによる自動選択の結果も表示する
+settings = [(builder, leaf_size) for builder in builders for leaf_size in leaf_sizes]
+settings.append((rtx.BVHBuilder.Auto, rtx.BVH_AUTO_TRIANGLES_PER_NODE))
+
+rt_args = rtx.RayTracingArguments()
+rt_args.num_rays_per_pixel = 1
+rt_args.max_bounce = 1
+cpu_args = rtx.CPUKernelLaunchArguments()
+camera = rtx.PerspectiveCamera(
+    eye=(0, 0, 3),
+    center=(0, 0, 0),
+    up=(0, 1, 0),
+    fov_rad=math.pi / 4,
+    aspect_ratio=1,
+    z_near=0.01,
+    z_far=100)
+render_buffer = np.zeros((1, 1, 3), dtype="float32")
+
+print("{:8s} {:10s} {:>5s} {:>9s} {:>8s} {:>7s} {:>6s} {:>9s} {:>8s} {:>8s} {:>10s} {:>10s}".format(
+    "mesh", "builder", "leaf", "sah", "overlap", "empty", "depth", "leaf avg", "refs", "build", "nodes KB", "wide KB"))
+for name in meshes:
+    faces, vertices = gm.load("../geometries/" + name)
+    for builder, leaf_size in settings:
+        geometry = rtx.StandardGeometry(faces, vertices, leaf_size)
+        geometry.set_bvh_builder(builder)
+        scene = rtx.Scene()
+        scene.add(rtx.Object(geometry, rtx.LambertMaterial(1.0), rtx.SolidColorMapping((1, 1, 1))))
+
+        renderer = rtx.Renderer()
+        renderer.render(scene, camera, rt_args, cpu_args, render_buffer)
+        stats = renderer.bvh_stats()[0]
+        # 自動選択の場合は選ばれた値を表示する
+        builder_name = builder.name
+        if builder == rtx.BVHBuilder.Auto:
+            builder_name = "Auto:" + rtx.BVHBuilder(stats.builder).name
+        print("{:8s} {:10s} {:5d} {:9.2f} {:8.2f} {:7.3f} {:6d} {:9.2f} {:8d} {:6.1f}ms {:10.1f} {:10.1f}".format(
+            name, builder_name, stats.max_triangles_per_node, stats.sah_cost, stats.overlap, stats.empty_space, stats.max_depth,
+            stats.average_leaf_size, stats.num_face_references, stats.build_time_ms,
+            stats.threaded_node_bytes / 1024, stats.wide_node_bytes / 1024))
@@ -80,4 +80,44 @@ int Geometry::bvh_max_triangles_per_node() const
 {
     return BVH_DEFAULT_TRIANGLES_PER_NODE;
 }
+int Geometry::bvh_builder() const
+{
+    return BVH_DEFAULT_BUILDER;
+}
+float Geometry::bvh_sah_traversal_cost() const
+{
+    return BVH_DEFAULT_SAH_TRAVERSAL_COST;
+}
+float Geometry::bvh_refit_rebuild_threshold() const
+{
+    return BVH_DEFAULT_REFIT_REBUILD_THRESHOLD;
+}
+float Geometry::bvh_spatial_split_budget() const
+{
+    return BVH_DEFAULT_SPATIAL_SPLIT_BUDGET;
+}
+int Geometry::bvh_node_layout() const
+{
+    return BVH_DEFAULT_NODE_LAYOUT;
+}
+int Geometry::bvh_node_cluster_bytes() const
+{
+    return BVH_DEFAULT_NODE_CLUSTER_BYTES;
+}
+int Geometry::bvh_treelet_iterations() const
+{
+    return BVH_DEFAULT_TREELET_ITERATIONS;
+}
+float Geometry::bvh_treelet_time_budget_ms() const
+{
+    return BVH_DEFAULT_TREELET_TIME_BUDGET_MS;
+}
+bool Geometry::vertices_updated()
+{
+    return _vertices_updated;
+}
+void Geometry::set_vertices_updated(bool updated)
+{
+    _vertices_updated = updated;
+}
 }
\ No newline at end of file
@@ -28,14 +28,31 @@ public:
 };
 
 class Geometry : public Shape {
+protected:
+    // 頂点の位置だけが変わった（面の構成は同じ）
+    // Set when only vertex positions changed, so the renderer can refit the BVH instead of rebuilding it.
+    bool _vertices_updated = false;
+
 public:
     Geometry(){};
     virtual int bvh_max_triangles_per_node() const;
+    virtual int bvh_builder() const;
+    virtual float bvh_sah_traversal_cost() const;
+    virtual float bvh_refit_rebuild_threshold() const;
+    virtual float bvh_spatial_split_budget() const;
+    virtual int bvh_node_layout() const;
+    virtual int bvh_node_cluster_bytes() const;
+    virtual int bvh_treelet_iterations() const;
+    virtual float bvh_treelet_time_budget_ms() const;
+    bool vertices_updated();
+    void set_vertices_updated(bool updated);
     virtual int type() const = 0;
     virtual int num_faces() const = 0;
     virtual int num_vertices() const = 0;
     virtual void serialize_vertices(rtx::array<rtxVertex>& array, int offset) const = 0;
     virtual void serialize_faces(rtx::array<rtxFaceVertexIndex>& array, int array_offset) const = 0;
+    // 変換後のジオメトリ全体を囲むAABB
+    virtual void compute_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max) const = 0;
     virtual std::shared_ptr<Geometry> transoform(glm::mat4& transformation_matrix) const = 0;
 };
 }
\ No newline at end of file
@@ -8,6 +8,7 @@ Scene::Scene(pybind11::tuple ambient_color)
         ambient_color[1].cast<float>(),
         ambient_color[2].cast<float>(),
     };
+    _updated = true;
 }
 void Scene::add(std::shared_ptr<Object> object)
 {
@@ -21,9 +22,14 @@ void Scene::add(std::shared_ptr<ObjectGroup> group)
 }
 bool Scene::updated()
 {
-    if (_updated) {
-        return true;
-    }
+    return structure_updated() || transforms_updated();
+}
+bool Scene::structure_updated()
+{
+    return _updated;
+}
+bool Scene::transforms_updated()
+{
     for (auto& object : _object_array) {
         if (object->geometry()->updated()) {
             return true;
@@ -54,6 +60,33 @@ void Scene::set_updated(bool updated)
         group->set_updated(updated);
     }
 }
+bool Scene::vertices_updated()
+{
+    for (auto& object : _object_array) {
+        if (object->geometry()->vertices_updated()) {
+            return true;
+        }
+    }
+    for (auto& group : _object_group_array) {
+        for (auto& object : group->_object_array) {
+            if (object->geometry()->vertices_updated()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+void Scene::set_vertices_updated(bool updated)
+{
+    for (auto& object : _object_array) {
+        object->geometry()->set_vertices_updated(updated);
+    }
+    for (auto& group : _object_group_array) {
+        for (auto& object : group->_object_array) {
+            object->geometry()->set_vertices_updated(updated);
+        }
+    }
+}
 int Scene::num_triangles()
 {
     int num_triangles = 0;
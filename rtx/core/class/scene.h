@@ -18,7 +18,13 @@ public:
     void add(std::shared_ptr<Object> object);
     void add(std::shared_ptr<ObjectGroup> object);
     bool updated();
+    // オブジェクトの追加など、シーンの構成が変わった
+    bool structure_updated();
+    // オブジェクトかグループの位置・回転・拡大率が変わった
+    bool transforms_updated();
     void set_updated(bool updated);
+    bool vertices_updated();
+    void set_vertices_updated(bool updated);
     int num_triangles();
 };
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "cone.h"
 #include "../header/enum.h"
+#include <cmath>
 
 namespace rtx {
 ConeGeometry::ConeGeometry(float radius, float height)
@@ -50,6 +51,22 @@ void ConeGeometry::serialize_faces(rtx::array<rtxFaceVertexIndex>& array, int of
     // Inverse transformation matrix
     array[2 + offset] = { 4, 5, 6, -1 };
 }
+// 底面の円と頂点の凸包を囲む
+// The intersection kernel offsets the ray origin by height / 2 along y, so the cone sits that much lower.
+void ConeGeometry::compute_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max) const
+{
+    const glm::mat4f& m = _transformation_matrix;
+    glm::vec3f base = glm::vec3f(m * glm::vec4f(0.0f, 0.0f, 0.0f, 1.0f));
+    glm::vec3f apex = glm::vec3f(m * glm::vec4f(0.0f, _height, 0.0f, 1.0f));
+    glm::vec3f extent;
+    for (int axis = 0; axis < 3; axis++) {
+        extent[axis] = _radius * sqrtf(m[0][axis] * m[0][axis] + m[2][axis] * m[2][axis]);
+    }
+    aabb_min = glm::min(base - extent, apex);
+    aabb_max = glm::max(base + extent, apex);
+    aabb_min.y -= _height / 2.0f;
+    aabb_max.y -= _height / 2.0f;
+}
 void ConeGeometry::set_transformation_matrix(glm::mat4f& transformation_matrix)
 {
     _transformation_matrix = transformation_matrix;
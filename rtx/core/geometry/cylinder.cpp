@@ -1,5 +1,6 @@
 #include "cylinder.h"
 #include "../header/enum.h"
+#include <cmath>
 
 namespace rtx {
 CylinderGeometry::CylinderGeometry(float radius, float height)
@@ -52,6 +53,20 @@ void CylinderGeometry::serialize_faces(rtx::array<rtxFaceVertexIndex>& array, in
     // Inverse transformation matrix
     array[2 + offset] = { 4, 5, 6, -1 };
 }
+// 端面の円は変換すると楕円になり、各軸方向の広がりは半径と行列のx列・z列から求まる
+// The bounds are exact: both cap centers widened by the extent of the transformed cap disk.
+void CylinderGeometry::compute_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max) const
+{
+    const glm::mat4f& m = _transformation_matrix;
+    glm::vec3f top = glm::vec3f(m * glm::vec4f(0.0f, _y_max, 0.0f, 1.0f));
+    glm::vec3f bottom = glm::vec3f(m * glm::vec4f(0.0f, _y_min, 0.0f, 1.0f));
+    glm::vec3f extent;
+    for (int axis = 0; axis < 3; axis++) {
+        extent[axis] = _radius * sqrtf(m[0][axis] * m[0][axis] + m[2][axis] * m[2][axis]);
+    }
+    aabb_min = glm::min(top, bottom) - extent;
+    aabb_max = glm::max(top, bottom) + extent;
+}
 void CylinderGeometry::set_transformation_matrix(glm::mat4f& transformation_matrix)
 {
     _transformation_matrix = transformation_matrix;
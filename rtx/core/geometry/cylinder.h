@@ -19,6 +19,7 @@ public:
     int num_vertices() const override;
     void serialize_vertices(rtx::array<rtxVertex>& array, int offset) const override;
     void serialize_faces(rtx::array<rtxFaceVertexIndex>& array, int offset) const override;
+    void compute_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max) const override;
     void set_transformation_matrix(glm::mat4f& transformation_matrix);
     std::shared_ptr<Geometry> transoform(glm::mat4& transformation_matrix) const override;
 };
@@ -34,6 +34,11 @@ void SphereGeometry::serialize_faces(rtx::array<rtxFaceVertexIndex>& array, int
 {
     array[0 + array_offset] = { 0, 1, -1 };
 }
+void SphereGeometry::compute_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max) const
+{
+    aabb_min = glm::vec3f(_center) - _radius;
+    aabb_max = glm::vec3f(_center) + _radius;
+}
 std::shared_ptr<Geometry> SphereGeometry::transoform(glm::mat4& transformation_matrix) const
 {
     auto sphere = std::make_shared<SphereGeometry>(_radius);
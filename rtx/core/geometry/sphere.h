@@ -17,6 +17,7 @@ public:
     int num_vertices() const override;
     void serialize_vertices(rtx::array<rtxVertex>& array, int offset) const override;
     void serialize_faces(rtx::array<rtxFaceVertexIndex>& array, int array_offset) const override;
+    void compute_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max) const override;
     std::shared_ptr<Geometry> transoform(glm::mat4& transformation_matrix) const override;
 };
 }
\ No newline at end of file
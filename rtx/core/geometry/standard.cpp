@@ -67,8 +67,99 @@ void StandardGeometry::add_vertex(glm::vec3f vertex)
 }
 void StandardGeometry::set_bvh_max_triangles_per_node(int bvh_max_triangles_per_node)
 {
+    if (bvh_max_triangles_per_node < 0) {
+        throw std::runtime_error("(bvh_max_triangles_per_node >= 0) -> false");
+    }
     _bvh_max_triangles_per_node = bvh_max_triangles_per_node;
 }
+void StandardGeometry::set_bvh_builder(int builder)
+{
+    if (builder != RTXBVHBuilderMedian && builder != RTXBVHBuilderBinnedSAH && builder != RTXBVHBuilderSBVH && builder != RTXBVHBuilderAuto) {
+        throw std::runtime_error("Invalid BVH builder");
+    }
+    _bvh_builder = builder;
+}
+void StandardGeometry::set_bvh_sah_traversal_cost(float traversal_cost)
+{
+    if (traversal_cost < 0.0f) {
+        throw std::runtime_error("(traversal_cost >= 0) -> false");
+    }
+    _bvh_sah_traversal_cost = traversal_cost;
+}
+void StandardGeometry::set_bvh_refit_rebuild_threshold(float threshold)
+{
+    _bvh_refit_rebuild_threshold = threshold;
+}
+void StandardGeometry::set_bvh_spatial_split_budget(float budget)
+{
+    if (budget < 0.0f) {
+        throw std::runtime_error("(budget >= 0) -> false");
+    }
+    _bvh_spatial_split_budget = budget;
+}
+void StandardGeometry::set_bvh_node_layout(int layout)
+{
+    if (layout != RTXBVHNodeLayoutDepthFirst && layout != RTXBVHNodeLayoutVanEmdeBoas && layout != RTXBVHNodeLayoutSubtreeClusters) {
+        throw std::runtime_error("Invalid BVH node layout");
+    }
+    _bvh_node_layout = layout;
+}
+void StandardGeometry::set_bvh_node_cluster_bytes(int cluster_bytes)
+{
+    if (cluster_bytes <= 0) {
+        throw std::runtime_error("(cluster_bytes > 0) -> false");
+    }
+    _bvh_node_cluster_bytes = cluster_bytes;
+}
+void StandardGeometry::set_bvh_treelet_iterations(int iterations)
+{
+    if (iterations < 0) {
+        throw std::runtime_error("(iterations >= 0) -> false");
+    }
+    _bvh_treelet_iterations = iterations;
+}
+void StandardGeometry::set_bvh_treelet_time_budget_ms(float time_budget_ms)
+{
+    _bvh_treelet_time_budget_ms = time_budget_ms;
+}
+void StandardGeometry::update_vertices(py::array_t<float, py::array::c_style> np_vertices)
+{
+    if (np_vertices.ndim() != 2) {
+        throw std::runtime_error("(np_vertices.ndim() != 2) -> false");
+    }
+    if (np_vertices.shape(0) != (int)_vertex_array.size()) {
+        throw std::runtime_error("(np_vertices.shape(0) != num_vertices) -> false");
+    }
+    update_vertices(np_vertices, 0);
+}
+void StandardGeometry::update_vertices(py::array_t<float, py::array::c_style> np_vertices, int offset)
+{
+    if (np_vertices.ndim() != 2) {
+        throw std::runtime_error("(np_vertices.ndim() != 2) -> false");
+    }
+    int num_vertices = np_vertices.shape(0);
+    int ndim_vertex = np_vertices.shape(1);
+    if (ndim_vertex != 3 && ndim_vertex != 4) {
+        throw std::runtime_error("(ndim_vertex != 3 && ndim_vertex != 4) -> false");
+    }
+    if (offset < 0 || offset + num_vertices > (int)_vertex_array.size()) {
+        throw std::runtime_error("(0 <= offset && offset + np_vertices.shape(0) <= num_vertices) -> false");
+    }
+    auto vertices = np_vertices.mutable_unchecked<2>();
+    for (int n = 0; n < num_vertices; n++) {
+        if (ndim_vertex == 3) {
+            _vertex_array[n + offset] = glm::vec4f(vertices(n, 0), vertices(n, 1), vertices(n, 2), 1.0f);
+        } else {
+            _vertex_array[n + offset] = glm::vec4f(vertices(n, 0), vertices(n, 1), vertices(n, 2), vertices(n, 3));
+        }
+    }
+    _vertices_updated = true;
+}
+void StandardGeometry::update_vertex(int vertex_index, glm::vec3f vertex)
+{
+    _vertex_array.at(vertex_index) = glm::vec4f(vertex.x, vertex.y, vertex.z, 1.0f);
+    _vertices_updated = true;
+}
 int StandardGeometry::type() const
 {
     return RTXGeometryTypeStandard;
@@ -95,10 +186,27 @@ void StandardGeometry::serialize_faces(rtx::array<rtxFaceVertexIndex>& buffer, i
         buffer[j + array_offset] = { face[0], face[1], face[2], -1 };
     }
 }
+void StandardGeometry::compute_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max) const
+{
+    aabb_min = glm::vec3f(FLT_MAX);
+    aabb_max = glm::vec3f(-FLT_MAX);
+    for (auto& vertex : _vertex_array) {
+        aabb_min = glm::min(aabb_min, glm::vec3f(vertex));
+        aabb_max = glm::max(aabb_max, glm::vec3f(vertex));
+    }
+}
 std::shared_ptr<Geometry> StandardGeometry::transoform(glm::mat4& transformation_matrix) const
 {
     auto geometry = std::make_shared<StandardGeometry>();
     geometry->_bvh_max_triangles_per_node = _bvh_max_triangles_per_node;
+    geometry->_bvh_builder = _bvh_builder;
+    geometry->_bvh_sah_traversal_cost = _bvh_sah_traversal_cost;
+    geometry->_bvh_refit_rebuild_threshold = _bvh_refit_rebuild_threshold;
+    geometry->_bvh_spatial_split_budget = _bvh_spatial_split_budget;
+    geometry->_bvh_node_layout = _bvh_node_layout;
+    geometry->_bvh_node_cluster_bytes = _bvh_node_cluster_bytes;
+    geometry->_bvh_treelet_iterations = _bvh_treelet_iterations;
+    geometry->_bvh_treelet_time_budget_ms = _bvh_treelet_time_budget_ms;
     geometry->_face_vertex_indices_array = _face_vertex_indices_array;
     geometry->_vertex_array.resize(_vertex_array.size());
 
@@ -108,8 +216,47 @@ std::shared_ptr<Geometry> StandardGeometry::transoform(glm::mat4& transformation
     }
     return geometry;
 }
+void StandardGeometry::transform_vertices(glm::mat4& transformation_matrix, StandardGeometry& transformed) const
+{
+    assert(transformed._vertex_array.size() == _vertex_array.size());
+    for (unsigned int index = 0; index < _vertex_array.size(); index++) {
+        transformed._vertex_array[index] = transformation_matrix * _vertex_array[index];
+    }
+}
 int StandardGeometry::bvh_max_triangles_per_node() const
 {
     return _bvh_max_triangles_per_node;
 }
+int StandardGeometry::bvh_builder() const
+{
+    return _bvh_builder;
+}
+float StandardGeometry::bvh_sah_traversal_cost() const
+{
+    return _bvh_sah_traversal_cost;
+}
+float StandardGeometry::bvh_refit_rebuild_threshold() const
+{
+    return _bvh_refit_rebuild_threshold;
+}
+float StandardGeometry::bvh_spatial_split_budget() const
+{
+    return _bvh_spatial_split_budget;
+}
+int StandardGeometry::bvh_node_layout() const
+{
+    return _bvh_node_layout;
+}
+int StandardGeometry::bvh_node_cluster_bytes() const
+{
+    return _bvh_node_cluster_bytes;
+}
+int StandardGeometry::bvh_treelet_iterations() const
+{
+    return _bvh_treelet_iterations;
+}
+float StandardGeometry::bvh_treelet_time_budget_ms() const
+{
+    return _bvh_treelet_time_budget_ms;
+}
 }
\ No newline at end of file
@@ -12,6 +12,14 @@ namespace rtx {
 class StandardGeometry : public Geometry {
 protected:
     int _bvh_max_triangles_per_node = BVH_DEFAULT_TRIANGLES_PER_NODE;
+    int _bvh_builder = BVH_DEFAULT_BUILDER;
+    float _bvh_sah_traversal_cost = BVH_DEFAULT_SAH_TRAVERSAL_COST;
+    float _bvh_refit_rebuild_threshold = BVH_DEFAULT_REFIT_REBUILD_THRESHOLD;
+    float _bvh_spatial_split_budget = BVH_DEFAULT_SPATIAL_SPLIT_BUDGET;
+    int _bvh_node_layout = BVH_DEFAULT_NODE_LAYOUT;
+    int _bvh_node_cluster_bytes = BVH_DEFAULT_NODE_CLUSTER_BYTES;
+    int _bvh_treelet_iterations = BVH_DEFAULT_TREELET_ITERATIONS;
+    float _bvh_treelet_time_budget_ms = BVH_DEFAULT_TREELET_TIME_BUDGET_MS;
     void init(pybind11::array_t<int, pybind11::array::c_style> face_vertex_indeces,
         pybind11::array_t<float, pybind11::array::c_style> vertices,
         int bvh_max_triangles_per_node);
@@ -27,6 +35,10 @@ public:
     StandardGeometry();
     StandardGeometry(pybind11::array_t<int, pybind11::array::c_style> face_vertex_indeces,
         pybind11::array_t<float, pybind11::array::c_style> vertices);
+    // bvh_max_triangles_per_nodeはBVHの葉が持つ面の数の上限
+    // Every builder splits a node with more faces than this. The SAH builders (BinnedSAH, SBVH) also split smaller
+    // nodes whenever that lowers the SAH cost, so leaves are usually smaller: it is a hard limit, not a target size.
+    // BVH_AUTO_TRIANGLES_PER_NODE picks the limit per mesh with the calibrated cost model.
     StandardGeometry(pybind11::array_t<int, pybind11::array::c_style> face_vertex_indeces,
         pybind11::array_t<float, pybind11::array::c_style> vertices,
         int bvh_max_triangles_per_node);
@@ -36,9 +48,33 @@ public:
     void add_face(glm::vec3i face);
     void add_vertex(glm::vec3f vertex);
     void set_bvh_max_triangles_per_node(int bvh_max_triangles_per_node);
+    void set_bvh_builder(int builder);
+    void set_bvh_sah_traversal_cost(float traversal_cost);
+    void set_bvh_refit_rebuild_threshold(float threshold);
+    void set_bvh_spatial_split_budget(float budget);
+    void set_bvh_node_layout(int layout);
+    void set_bvh_node_cluster_bytes(int cluster_bytes);
+    void set_bvh_treelet_iterations(int iterations);
+    void set_bvh_treelet_time_budget_ms(float time_budget_ms);
+    // 面の構成を変えずに頂点の位置を更新する
+    // offsetから始まる連続した頂点を置き換える
+    void update_vertices(pybind11::array_t<float, pybind11::array::c_style> vertices);
+    void update_vertices(pybind11::array_t<float, pybind11::array::c_style> vertices, int offset);
+    void update_vertex(int vertex_index, glm::vec3f vertex);
     void serialize_vertices(rtx::array<rtxVertex>& array, int offset) const override;
     void serialize_faces(rtx::array<rtxFaceVertexIndex>& array, int array_offset) const override;
+    void compute_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max) const override;
     std::shared_ptr<Geometry> transoform(glm::mat4& transformation_matrix) const override;
+    // transoformで作ったジオメトリの頂点だけを書き換える
+    void transform_vertices(glm::mat4& transformation_matrix, StandardGeometry& transformed) const;
     int bvh_max_triangles_per_node() const override;
+    int bvh_builder() const override;
+    float bvh_sah_traversal_cost() const override;
+    float bvh_refit_rebuild_threshold() const override;
+    float bvh_spatial_split_budget() const override;
+    int bvh_node_layout() const override;
+    int bvh_node_cluster_bytes() const override;
+    int bvh_treelet_iterations() const override;
+    float bvh_treelet_time_budget_ms() const override;
 };
 }
\ No newline at end of file
@@ -31,4 +31,98 @@ enum RTXCameraType {
     RTXCameraTypeOrthographic,
 };
 
-#define BVH_DEFAULT_TRIANGLES_PER_NODE 25
\ No newline at end of file
+enum RTXBackend {
+    RTXBackendCUDA = 1,
+    RTXBackendCPU,
+};
+
+enum RTXBVHBuilder {
+    RTXBVHBuilderMedian = 1,
+    RTXBVHBuilderBinnedSAH,
+    // 空間分割で面を複数の葉から参照することを許すSAH（SBVH）
+    RTXBVHBuilderSBVH,
+    // メッシュごとにコストモデルで選ぶ
+    RTXBVHBuilderAuto,
+};
+
+// CPUのカーネルに渡す多分岐BVHのノードの形式
+enum RTXBVHNodeFormat {
+    RTXBVHNodeFormatFull = 1,
+    // 子のAABBを親の枠に対して8bitで量子化する
+    RTXBVHNodeFormatQuantized,
+};
+
+// CPUのカーネルが葉の三角形をどう読むか
+enum RTXTriangleFormat {
+    // 面の頂点番号から頂点を読む
+    RTXTriangleFormatIndexed = 1,
+    // 頂点A・2辺・単位法線を葉の順に並べた配列を読む
+    // Costs 48 bytes per face reference on top of the indexed arrays.
+    RTXTriangleFormatPrecomputed,
+    // 同じ値をSIMDの幅（4・8・16）ずつ成分ごとにまとめて読み、葉の三角形をまとめて判定する
+    // The width follows the widest instruction set of the running CPU; a leaf whose faces straddle a group
+    // boundary reads the neighbouring lanes too and masks them.
+    RTXTriangleFormatGrouped,
+};
+
+// BVHのノードを配列に並べる順
+// Every layout keeps the root at index 0 and parents in front of their children.
+enum RTXBVHNodeLayout {
+    // 構築の再帰の順（前順）
+    RTXBVHNodeLayoutDepthFirst = 1,
+    // 木を高さの半分で上下に分けて再帰的に並べる（キャッシュの大きさに依らない）
+    RTXBVHNodeLayoutVanEmdeBoas,
+    // 根に近い部分木をbvh_node_cluster_bytesに収まる塊にまとめる
+    RTXBVHNodeLayoutSubtreeClusters,
+};
+
+// CPUのカーネルが画面のタイルを配る順
+// Each thread starts on a contiguous run of this order, so nearby tiles stay on one thread until stolen.
+enum RTXTileOrder {
+    // 行ごとに左から右へ
+    RTXTileOrderScanline = 1,
+    // タイルの座標のZ順（Morton順）
+    RTXTileOrderMorton,
+    // 画面の中心に近いタイルから
+    RTXTileOrderSpiral,
+};
+
+#define BVH_DEFAULT_TRIANGLES_PER_NODE 25
+// 葉の面数の上限をメッシュごとにコストモデルで選ぶ
+// Leaf sizes tried are powers of two up to BVH_AUTO_MAX_TRIANGLES_PER_NODE.
+#define BVH_AUTO_TRIANGLES_PER_NODE 0
+#define BVH_AUTO_MAX_TRIANGLES_PER_NODE 32
+// 自動選択のコストモデルを合わせる合成メッシュの格子の大きさとレイの数
+#define BVH_AUTO_CALIBRATION_GRID_SIZE 64
+#define BVH_AUTO_CALIBRATION_NUM_RAYS 8192
+#define BVH_DEFAULT_BUILDER RTXBVHBuilderBinnedSAH
+#define BVH_DEFAULT_NODE_FORMAT RTXBVHNodeFormatFull
+#define BVH_DEFAULT_TRIANGLE_FORMAT RTXTriangleFormatIndexed
+#define BVH_DEFAULT_NODE_LAYOUT RTXBVHNodeLayoutDepthFirst
+// 部分木の塊の大きさ（64ならキャッシュライン、4096ならページ）
+// Byte size of one subtree cluster; the node count per cluster depends on the node format.
+#define BVH_DEFAULT_NODE_CLUSTER_BYTES 4096
+// 三角形1枚との交差判定を1としたときのノード1つの走査コスト
+// Cost of traversing one node relative to one ray-triangle test.
+#define BVH_DEFAULT_SAH_TRAVERSAL_COST 1.0f
+#define BVH_SAH_NUM_BINS 16
+// SBVHで空間分割によって増やしてよい面の参照の数（面数に対する割合）
+// Upper bound on duplicated references as a fraction of the face count.
+#define BVH_DEFAULT_SPATIAL_SPLIT_BUDGET 0.3f
+// 物体分割の左右のAABBの重なりの表面積が根のこの割合を超えたら空間分割を試す
+// The alpha of "Spatial Splits in Bounding Volume Hierarchies" [Stich et al. 2009].
+#define BVH_SBVH_OVERLAP_THRESHOLD 1e-5f
+// 頂点の更新でBVHをリフィットした後のSAHコストが構築時のこの倍を超えたら作り直す
+// 0以下なら常にリフィットする
+// Refitted trees whose SAH cost exceeds this multiple of the cost at build time are rebuilt; <= 0 always refits.
+#define BVH_DEFAULT_REFIT_REBUILD_THRESHOLD 0.0f
+// 構築後に小さな部分木（treelet）をSAHが最小の形に組み直す回数（0なら行わない）
+// Each iteration visits every node bottom-up; 3 iterations get most of the gain.
+#define BVH_DEFAULT_TREELET_ITERATIONS 0
+// 組み直しに使ってよい時間（ミリ秒、0以下なら無制限）
+#define BVH_DEFAULT_TREELET_TIME_BUDGET_MS 0.0f
+// treeletの葉の数（部分集合の動的計画法なので計算量は3^nで増える）
+#define BVH_TREELET_NUM_LEAVES 7
+// CPUのカーネルのタイルの1辺の画素数
+#define CPU_DEFAULT_TILE_SIZE 16
+#define CPU_DEFAULT_TILE_ORDER RTXTileOrderMorton
\ No newline at end of file
@@ -24,6 +24,13 @@ typedef struct rtxThreadedBVHNode {
     rtxVector4f aabb_min;
 } rtxThreadedBVHNode;
 
+// レイの向きの象限ごとのhit/missリンク
+// Stored node-major: the links of serialized node n for octant k are at [n * RTX_THREADED_BVH_NUM_OCTANTS + k].
+typedef struct rtxThreadedBVHLink {
+    int hit_node_index;
+    int miss_node_index;
+} rtxThreadedBVHLink;
+
 typedef struct rtxThreadedBVH {
     int num_nodes;
     int serial_node_index_offset; // offset of the node from the start of the serialzied node array
@@ -101,6 +108,10 @@ typedef struct rtxMCRTKernelArguments {
     int screen_width;
     int screen_height;
     RTXCameraType camera_type;
+    // カメラ座標系からワールド座標系への変換行列の上3行
+    rtxVector4f inv_view_matrix_a;
+    rtxVector4f inv_view_matrix_b;
+    rtxVector4f inv_view_matrix_c;
     rtxRGBAColor ambient_color;
     int face_vertex_index_array_size;
     int vertex_array_size;
@@ -123,6 +134,10 @@ typedef struct rtxNEEKernelArguments {
     int screen_width;
     int screen_height;
     RTXCameraType camera_type;
+    // カメラ座標系からワールド座標系への変換行列の上3行
+    rtxVector4f inv_view_matrix_a;
+    rtxVector4f inv_view_matrix_b;
+    rtxVector4f inv_view_matrix_c;
     rtxRGBAColor ambient_color;
     int face_vertex_index_array_size;
     int vertex_array_size;
@@ -70,4 +70,15 @@ void TextureMapping::serialize_uv_coordinates(rtx::array<rtxUVCoordinate>& array
         array[n + offset] = _uv_coordinates[n];
     }
 }
-}
\ No newline at end of file
+void TextureMapping::serialize_uv_coordinates(rtx::array<rtxUVCoordinate>& array, int offset, const std::vector<int>& vertex_index_array) const
+{
+    // 頂点とUVの数が合わない場合は元の順のまま
+    if ((int)vertex_index_array.size() != _uv_coordinates.size()) {
+        serialize_uv_coordinates(array, offset);
+        return;
+    }
+    for (int n = 0; n < _uv_coordinates.size(); n++) {
+        array[n + offset] = _uv_coordinates[vertex_index_array[n]];
+    }
+}
+}
@@ -3,6 +3,7 @@
 #include "../header/array.h"
 #include "../header/struct.h"
 #include <pybind11/numpy.h>
+#include <vector>
 
 namespace rtx {
 class TextureMapping : public Mapping {
@@ -22,6 +23,8 @@ public:
     int num_uv_coordinates();
     int type() const override;
     void serialize_uv_coordinates(rtx::array<rtxUVCoordinate>& array, int offset) const;
+    // BVHが頂点の番号を振り直した場合はUVも同じ順に並べる
+    void serialize_uv_coordinates(rtx::array<rtxUVCoordinate>& array, int offset, const std::vector<int>& vertex_index_array) const;
     rtxRGBAPixel* data();
 };
 }
\ No newline at end of file
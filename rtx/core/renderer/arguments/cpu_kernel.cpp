@@ -0,0 +1,102 @@
+#include "cpu_kernel.h"
+#include <omp.h>
+#include <stdexcept>
+
+namespace rtx {
+CPUKernelLaunchArguments::CPUKernelLaunchArguments()
+{
+    _num_threads = omp_get_max_threads();
+    _bvh_node_format = BVH_DEFAULT_NODE_FORMAT;
+    _triangle_format = BVH_DEFAULT_TRIANGLE_FORMAT;
+    _lazy_bvh_construction_enabled = false;
+    _ray_packets_enabled = true;
+    _wavefront_enabled = false;
+    _tile_size = CPU_DEFAULT_TILE_SIZE;
+    _tile_order = CPU_DEFAULT_TILE_ORDER;
+    _num_rays_per_thread = 0;
+}
+int CPUKernelLaunchArguments::num_threads()
+{
+    return _num_threads;
+}
+void CPUKernelLaunchArguments::set_num_threads(int num)
+{
+    if (num <= 0) {
+        throw std::runtime_error("(num > 0) -> false");
+    }
+    _num_threads = num;
+}
+RTXBVHNodeFormat CPUKernelLaunchArguments::bvh_node_format()
+{
+    return _bvh_node_format;
+}
+void CPUKernelLaunchArguments::set_bvh_node_format(RTXBVHNodeFormat format)
+{
+    _bvh_node_format = format;
+}
+RTXTriangleFormat CPUKernelLaunchArguments::triangle_format()
+{
+    return _triangle_format;
+}
+void CPUKernelLaunchArguments::set_triangle_format(RTXTriangleFormat format)
+{
+    _triangle_format = format;
+}
+bool CPUKernelLaunchArguments::lazy_bvh_construction_enabled()
+{
+    return _lazy_bvh_construction_enabled;
+}
+void CPUKernelLaunchArguments::set_lazy_bvh_construction_enabled(bool enabled)
+{
+    _lazy_bvh_construction_enabled = enabled;
+}
+bool CPUKernelLaunchArguments::ray_packets_enabled()
+{
+    return _ray_packets_enabled;
+}
+void CPUKernelLaunchArguments::set_ray_packets_enabled(bool enabled)
+{
+    _ray_packets_enabled = enabled;
+}
+bool CPUKernelLaunchArguments::wavefront_enabled()
+{
+    return _wavefront_enabled;
+}
+void CPUKernelLaunchArguments::set_wavefront_enabled(bool enabled)
+{
+    _wavefront_enabled = enabled;
+}
+int CPUKernelLaunchArguments::tile_size()
+{
+    return _tile_size;
+}
+void CPUKernelLaunchArguments::set_tile_size(int size)
+{
+    if (size <= 0) {
+        throw std::runtime_error("(size > 0) -> false");
+    }
+    _tile_size = size;
+}
+RTXTileOrder CPUKernelLaunchArguments::tile_order()
+{
+    return _tile_order;
+}
+void CPUKernelLaunchArguments::set_tile_order(RTXTileOrder order)
+{
+    if (order != RTXTileOrderScanline && order != RTXTileOrderMorton && order != RTXTileOrderSpiral) {
+        throw std::runtime_error("Invalid tile order");
+    }
+    _tile_order = order;
+}
+int CPUKernelLaunchArguments::num_rays_per_thread()
+{
+    return _num_rays_per_thread;
+}
+void CPUKernelLaunchArguments::set_num_rays_per_thread(int num)
+{
+    if (num < 0) {
+        throw std::runtime_error("(num >= 0) -> false");
+    }
+    _num_rays_per_thread = num;
+}
+}
\ No newline at end of file
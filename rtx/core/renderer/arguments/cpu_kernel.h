@@ -0,0 +1,43 @@
+#pragma once
+#include "../../header/enum.h"
+
+namespace rtx {
+class CPUKernelLaunchArguments {
+private:
+    int _num_threads;
+    RTXBVHNodeFormat _bvh_node_format;
+    RTXTriangleFormat _triangle_format;
+    // オブジェクトのBVHをレイが初めて当たった時に構築する
+    bool _lazy_bvh_construction_enabled;
+    // タイルの4x2画素のブロックごとに一次レイをまとめて辿る
+    bool _ray_packets_enabled;
+    // 経路を1本ずつ追跡する代わりに、多数の経路を処理の段階ごとにまとめて進める
+    bool _wavefront_enabled;
+    // 画面を分けるタイルの1辺の画素数と、スレッドに配る順
+    int _tile_size;
+    RTXTileOrder _tile_order;
+    // 1スレッドが担当する1画素あたりのサンプル数（0なら全サンプル）
+    int _num_rays_per_thread;
+
+public:
+    CPUKernelLaunchArguments();
+    int num_threads();
+    void set_num_threads(int num);
+    RTXBVHNodeFormat bvh_node_format();
+    void set_bvh_node_format(RTXBVHNodeFormat format);
+    RTXTriangleFormat triangle_format();
+    void set_triangle_format(RTXTriangleFormat format);
+    bool lazy_bvh_construction_enabled();
+    void set_lazy_bvh_construction_enabled(bool enabled);
+    bool ray_packets_enabled();
+    void set_ray_packets_enabled(bool enabled);
+    bool wavefront_enabled();
+    void set_wavefront_enabled(bool enabled);
+    int tile_size();
+    void set_tile_size(int size);
+    RTXTileOrder tile_order();
+    void set_tile_order(RTXTileOrder order);
+    int num_rays_per_thread();
+    void set_num_rays_per_thread(int num);
+};
+}
\ No newline at end of file
@@ -1,10 +1,17 @@
 #include "bvh.h"
 #include "../../header/enum.h"
+#include "../header/bridge.h"
+#include "cache.h"
 #include <algorithm>
-#include <bitset>
 #include <cassert>
 #include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <numeric>
+#include <omp.h>
+#include <stdexcept>
 #include <utility>
 
 namespace rtx {
@@ -53,396 +60,2028 @@ int detect_longest_axis(const glm::vec3f& axis_length)
     }
     return RTXAxisZ;
 }
-bool compare_position(const std::pair<int, float>& a, const std::pair<int, float>& b)
-{
-    return a.second < b.second;
-}
-Node::Node(std::vector<int> assigned_face_indices,
-    std::shared_ptr<StandardGeometry>& geometry,
-    int& current_node_index,
-    int& current_assigned_face_index_offset)
-{
-    // std::cout << "===================================" << std::endl;
-    assert(assigned_face_indices.size() > 0);
-    _assigned_face_indices = assigned_face_indices;
-    _index = current_node_index;
-    _assigned_face_index_start = -1;
-    _assigned_face_index_end = -1;
-    _is_leaf = false;
-    // std::cout << "id: " << _index << std::endl;
-    current_node_index++;
-    _aabb_max = glm::vec3f(-FLT_MAX);
-    _aabb_min = glm::vec3f(FLT_MAX);
-
-    for (int face_index : assigned_face_indices) {
-        auto& face = geometry->_face_vertex_indices_array.at(face_index);
-        auto& va = geometry->_vertex_array[face[0]];
-        merge_aabb_max(_aabb_max, va, _aabb_max);
-        merge_aabb_min(_aabb_min, va, _aabb_min);
-
-        auto& vb = geometry->_vertex_array[face[1]];
-        merge_aabb_max(_aabb_max, vb, _aabb_max);
-        merge_aabb_min(_aabb_min, vb, _aabb_min);
-
-        auto& vc = geometry->_vertex_array[face[2]];
-        merge_aabb_max(_aabb_max, vc, _aabb_max);
-        merge_aabb_min(_aabb_min, vc, _aabb_min);
-    }
-
-    if ((int)assigned_face_indices.size() <= geometry->bvh_max_triangles_per_node()) {
-        _is_leaf = true;
-        _assigned_face_index_start = current_assigned_face_index_offset;
-        _assigned_face_index_end = current_assigned_face_index_offset + assigned_face_indices.size() - 1;
-        current_assigned_face_index_offset += (int)assigned_face_indices.size();
+// 面数がこれ以上のノードは子ノードの構築を別タスクにする
+// Subtrees smaller than this are built by the task that reached them.
+#define BVH_PARALLEL_BUILD_MIN_FACES 4096
+// 上位のノードでは面のループを分割して並列に処理する
+// Loops over the faces of nodes larger than one chunk are split into tasks.
+#define BVH_PARALLEL_BUILD_CHUNK_FACES 32768
+// treeletの組み直しで1つのタスクが受け持つ根の数
+#define BVH_TREELET_TASK_SIZE 256
+int compute_num_chunks(int num_faces)
+{
+    return (num_faces + BVH_PARALLEL_BUILD_CHUNK_FACES - 1) / BVH_PARALLEL_BUILD_CHUNK_FACES;
+}
+// function(chunk_index, begin, end)
+// chunk_indexはチャンクごとの部分結果を書く場所にだけ使う（使わない呼び出し側は名前を省く）
+// 結果はチャンクごとに持たせて呼び出し側でまとめるのでスレッド数によらず同じ木になる
+// Each chunk writes its own partial result, so the tree does not depend on the number of threads.
+template <typename Function>
+void parallel_for_chunks(int begin, int end, Function function)
+{
+    const int num_chunks = compute_num_chunks(end - begin);
+    if (num_chunks <= 1) {
+        function(0, begin, end);
         return;
     }
-    const glm::vec3f axis_length = _aabb_max - _aabb_min;
-    int longest_axis = detect_longest_axis(axis_length);
-    // if (_index == 0) {
-    //     longest_axis = RTXAxisX;
-    // }
-
-    // std::cout << "longest: " << longest_axis << std::endl;
-    std::vector<std::pair<int, float>> object_center_array;
-
-    for (int face_index : assigned_face_indices) {
-        auto& face = geometry->_face_vertex_indices_array.at(face_index);
-        auto& va = geometry->_vertex_array[face[0]];
-        auto& vb = geometry->_vertex_array[face[1]];
-        auto& vc = geometry->_vertex_array[face[2]];
-        auto center = (va + vb + vc) / 3.0f;
-        if (longest_axis == RTXAxisX) {
-            object_center_array.emplace_back(face_index, center.x);
-        } else if (longest_axis == RTXAxisY) {
-            object_center_array.emplace_back(face_index, center.y);
+    for (int chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+        const int chunk_begin = begin + chunk_index * BVH_PARALLEL_BUILD_CHUNK_FACES;
+        const int chunk_end = std::min(chunk_begin + BVH_PARALLEL_BUILD_CHUNK_FACES, end);
+#pragma omp task firstprivate(chunk_index, chunk_begin, chunk_end)
+        function(chunk_index, chunk_begin, chunk_end);
+    }
+#pragma omp taskwait
+}
+// チャンクごとの部分結果
+// 1チャンクに収まるノードではスタック上の領域を使いヒープ確保をしない
+template <typename T, int InlineSize>
+class ChunkArray {
+private:
+    T _inline_array[InlineSize];
+    std::vector<T> _heap_array;
+    T* _data;
+
+public:
+    ChunkArray(int size, const T& value)
+    {
+        if (size <= InlineSize) {
+            std::fill(_inline_array, _inline_array + size, value);
+            _data = _inline_array;
         } else {
-            object_center_array.emplace_back(face_index, center.z);
+            _heap_array.assign(size, value);
+            _data = _heap_array.data();
+        }
+    }
+    T& operator[](int index)
+    {
+        return _data[index];
+    }
+};
+// 親が子より前に並んだノードのhit/missリンクを張る
+void link_threaded_nodes(std::vector<Node>& node_array)
+{
+    // 親は必ず子より前にあるので先頭から順に決まる
+    node_array[0].miss = -1;
+    for (Node& node : node_array) {
+        if (node.is_leaf()) {
+            node.hit = -1;
+            continue;
+        }
+        node.hit = node.left;
+        node_array[node.left].miss = node.right;
+        node_array[node.right].miss = node.miss;
+    }
+}
+// 8つの象限ごとにhit/missリンクを張る
+// 各分割は子のAABBの中心が最も離れた軸で、レイの進む向きに手前の子を先に辿る
+// link_threaded_nodes always descends left first; a ray travelling from right to left then finds its
+// nearest hit last and cannot cull the far subtrees. Any child order gives a valid threaded traversal,
+// so each octant simply gets the order its rays want.
+void serialize_octant_links(const std::vector<Node>& node_array, rtx::array<rtxThreadedBVHLink>& link_array, int serialization_offset)
+{
+    const int num_nodes = node_array.size();
+    // 分割の軸と、その軸で左の子が下側にあるか
+    std::vector<int> split_axis_array(num_nodes, -1);
+    std::vector<char> left_is_lower_array(num_nodes, 1);
+    for (int node_index = 0; node_index < num_nodes; node_index++) {
+        const Node& node = node_array[node_index];
+        // 球などの根は子が1つだけ
+        if (node.is_leaf() || node.right == -1) {
+            continue;
+        }
+        const Node& left = node_array[node.left];
+        const Node& right = node_array[node.right];
+        // 中心の差（2倍）
+        const glm::vec3f offset = (right.aabb_min + right.aabb_max) - (left.aabb_min + left.aabb_max);
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+            if (fabsf(offset[k]) > fabsf(offset[axis])) {
+                axis = k;
+            }
+        }
+        split_axis_array[node_index] = axis;
+        left_is_lower_array[node_index] = offset[axis] >= 0.0f;
+    }
+    std::vector<int> miss_array(num_nodes);
+    for (int octant = 0; octant < RTX_THREADED_BVH_NUM_OCTANTS; octant++) {
+        // 親は必ず子より前にあるので先頭から順に決まる
+        miss_array[0] = THREADED_BVH_TERMINAL_NODE;
+        for (int node_index = 0; node_index < num_nodes; node_index++) {
+            const Node& node = node_array[node_index];
+            rtxThreadedBVHLink& link = link_array[(node_index + serialization_offset) * RTX_THREADED_BVH_NUM_OCTANTS + octant];
+            link.miss_node_index = miss_array[node_index];
+            if (node.is_leaf()) {
+                link.hit_node_index = THREADED_BVH_TERMINAL_NODE;
+                continue;
+            }
+            if (node.right == -1) {
+                link.hit_node_index = node.left;
+                miss_array[node.left] = miss_array[node_index];
+                continue;
+            }
+            const bool negative_direction = (octant >> split_axis_array[node_index]) & 1;
+            const bool left_first = left_is_lower_array[node_index] != negative_direction;
+            const int near_child = left_first ? node.left : node.right;
+            const int far_child = left_first ? node.right : node.left;
+            link.hit_node_index = near_child;
+            miss_array[near_child] = far_child;
+            miss_array[far_child] = miss_array[node_index];
+        }
+    }
+}
+// 子の一覧（CSR形式）を作る
+// children(node_index, function)はnode_indexの子を左から順にfunctionに渡す
+struct NodeChildren {
+    std::vector<int> offset_array;
+    std::vector<int> index_array;
+};
+template <typename Children>
+NodeChildren collect_node_children(int num_nodes, Children children)
+{
+    NodeChildren node_children;
+    node_children.offset_array.resize(num_nodes + 1);
+    node_children.index_array.reserve(num_nodes);
+    for (int node_index = 0; node_index < num_nodes; node_index++) {
+        node_children.offset_array[node_index] = node_children.index_array.size();
+        children(node_index, [&](int child_index) {
+            node_children.index_array.push_back(child_index);
+        });
+    }
+    node_children.offset_array[num_nodes] = node_children.index_array.size();
+    return node_children;
+}
+// 根からnum_levels段の部分木を並べ、その下の部分木は左から順に同じように並べる
+// The top half of the levels is laid out first and then each subtree hanging below it,
+// so any root-to-leaf path crosses O(log_B N) blocks for every block size B.
+void layout_van_emde_boas(int root, int num_levels, const NodeChildren& node_children, const std::vector<int>& height_array, std::vector<int>& order)
+{
+    if (num_levels == 1) {
+        order.push_back(root);
+        return;
+    }
+    const int num_top_levels = num_levels / 2;
+    layout_van_emde_boas(root, num_top_levels, node_children, height_array, order);
+    std::vector<int> bottom_root_array;
+    std::vector<std::pair<int, int>> stack = { { root, 0 } };
+    while (stack.empty() == false) {
+        const int node_index = stack.back().first;
+        const int depth = stack.back().second;
+        stack.pop_back();
+        if (depth == num_top_levels) {
+            bottom_root_array.push_back(node_index);
+            continue;
+        }
+        for (int n = node_children.offset_array[node_index + 1] - 1; n >= node_children.offset_array[node_index]; n--) {
+            stack.emplace_back(node_children.index_array[n], depth + 1);
+        }
+    }
+    for (int bottom_root : bottom_root_array) {
+        layout_van_emde_boas(bottom_root, std::min(num_levels - num_top_levels, height_array[bottom_root]), node_children, height_array, order);
+    }
+}
+// ノードを並べる順を決める（order[新しい番号] = 元の番号）
+// どの並べ方でも親は子より前に来るので、前順を前提にしたリフィットやリンクの計算はそのまま使える
+// The input must already have parents in front of their children.
+std::vector<int> compute_node_layout(const NodeChildren& node_children, int layout, int cluster_size)
+{
+    const int num_nodes = node_children.offset_array.size() - 1;
+    std::vector<int> order;
+    order.reserve(num_nodes);
+    if (layout == RTXBVHNodeLayoutVanEmdeBoas) {
+        // 葉の高さを1とする部分木の高さ
+        std::vector<int> height_array(num_nodes, 1);
+        for (int node_index = num_nodes - 1; node_index >= 0; node_index--) {
+            for (int n = node_children.offset_array[node_index]; n < node_children.offset_array[node_index + 1]; n++) {
+                height_array[node_index] = std::max(height_array[node_index], height_array[node_children.index_array[n]] + 1);
+            }
+        }
+        layout_van_emde_boas(0, height_array[0], node_children, height_array, order);
+    } else if (layout == RTXBVHNodeLayoutSubtreeClusters) {
+        // 塊の根から幅優先でcluster_size個までを1つの塊にする
+        // 入りきらなかったノードはそれぞれ新しい塊の根になり、塊は深さ優先で並べる
+        // A ray that enters a cluster near its root usually descends several levels before leaving it.
+        std::vector<int> cluster_root_stack = { 0 };
+        std::vector<int> queue;
+        while (cluster_root_stack.empty() == false) {
+            const int cluster_root = cluster_root_stack.back();
+            cluster_root_stack.pop_back();
+            queue.clear();
+            queue.push_back(cluster_root);
+            int head = 0;
+            while (head < (int)queue.size() && head < cluster_size) {
+                const int node_index = queue[head++];
+                order.push_back(node_index);
+                for (int n = node_children.offset_array[node_index]; n < node_children.offset_array[node_index + 1]; n++) {
+                    queue.push_back(node_children.index_array[n]);
+                }
+            }
+            for (int n = queue.size() - 1; n >= head; n--) {
+                cluster_root_stack.push_back(queue[n]);
+            }
+        }
+    } else {
+        std::vector<int> stack = { 0 };
+        while (stack.empty() == false) {
+            const int node_index = stack.back();
+            stack.pop_back();
+            order.push_back(node_index);
+            for (int n = node_children.offset_array[node_index + 1] - 1; n >= node_children.offset_array[node_index]; n--) {
+                stack.push_back(node_children.index_array[n]);
+            }
+        }
+    }
+    assert((int)order.size() == num_nodes);
+    return order;
+}
+rtxThreadedBVHNode serialize_node(const Node& node)
+{
+    rtxThreadedBVHNode cuda_node;
+    cuda_node.hit_node_index = node.hit;
+    cuda_node.miss_node_index = node.miss;
+    cuda_node.assigned_face_index_start = node.assigned_face_index_start;
+    cuda_node.assigned_face_index_end = node.assigned_face_index_end;
+    cuda_node.aabb_max.x = node.aabb_max.x;
+    cuda_node.aabb_max.y = node.aabb_max.y;
+    cuda_node.aabb_max.z = node.aabb_max.z;
+    cuda_node.aabb_min.x = node.aabb_min.x;
+    cuda_node.aabb_min.y = node.aabb_min.y;
+    cuda_node.aabb_min.z = node.aabb_min.z;
+    return cuda_node;
+}
+// 1軸分の子のAABBを親の枠の原点からの8bitの整数に量子化する
+// 刻み幅は2のべきなので origin + q * scale の丸めは加算の1回だけになり、
+// 復元した箱が元の箱を含むかをカーネルと同じ式で確かめられる
+// The step starts at the smallest power of two that spans the frame in 255 steps and is doubled
+// whenever rounding pushes a coordinate outside [0, 255].
+void quantize_lane_aabbs(float origin, const float* lane_min, const float* lane_max, int num_lanes, float& scale, uint8_t* quantized_min, uint8_t* quantized_max)
+{
+    float extent = 0.0f;
+    for (int lane = 0; lane < num_lanes; lane++) {
+        extent = std::max(extent, lane_max[lane] - origin);
+    }
+    int exponent = -100;
+    if (extent > 0.0f) {
+        std::frexp(extent / 255.0f, &exponent);
+        exponent = std::max(exponent, -100);
+    }
+    for (;; exponent++) {
+        scale = std::ldexp(1.0f, exponent);
+        bool fits = true;
+        for (int lane = 0; lane < num_lanes; lane++) {
+            int q_min = std::max(0, (int)std::floor((lane_min[lane] - origin) / scale));
+            int q_max = std::max(0, (int)std::ceil((lane_max[lane] - origin) / scale));
+            while (q_min > 0 && origin + q_min * scale > lane_min[lane]) {
+                q_min--;
+            }
+            while (origin + q_max * scale < lane_max[lane]) {
+                q_max++;
+            }
+            if (q_max > 255) {
+                fits = false;
+                break;
+            }
+            quantized_min[lane] = q_min;
+            quantized_max[lane] = q_max;
+        }
+        if (fits) {
+            return;
+        }
+    }
+}
+struct SAHBin {
+    glm::vec3f aabb_max = glm::vec3f(-FLT_MAX);
+    glm::vec3f aabb_min = glm::vec3f(FLT_MAX);
+    int num_faces = 0;
+};
+int BVH::allocate_build_nodes(int num_nodes)
+{
+    int node_index = _num_build_nodes.fetch_add(num_nodes);
+    assert(node_index + num_nodes <= (int)_build_node_array.size());
+    return node_index;
+}
+void BVH::compute_aabb(int begin, int end, Node& node)
+{
+    ChunkArray<glm::vec3f, 1> chunk_aabb_max_array(compute_num_chunks(end - begin), glm::vec3f(-FLT_MAX));
+    ChunkArray<glm::vec3f, 1> chunk_aabb_min_array(compute_num_chunks(end - begin), glm::vec3f(FLT_MAX));
+    parallel_for_chunks(begin, end, [&](int chunk_index, int chunk_begin, int chunk_end) {
+        glm::vec3f aabb_max(-FLT_MAX);
+        glm::vec3f aabb_min(FLT_MAX);
+        for (int n = chunk_begin; n < chunk_end; n++) {
+            int face_index = _face_index_array[n];
+            merge_aabb_max(aabb_max, _face_aabb_max_array[face_index], aabb_max);
+            merge_aabb_min(aabb_min, _face_aabb_min_array[face_index], aabb_min);
+        }
+        chunk_aabb_max_array[chunk_index] = aabb_max;
+        chunk_aabb_min_array[chunk_index] = aabb_min;
+    });
+    node.aabb_max = glm::vec3f(-FLT_MAX);
+    node.aabb_min = glm::vec3f(FLT_MAX);
+    for (int chunk_index = 0; chunk_index < compute_num_chunks(end - begin); chunk_index++) {
+        merge_aabb_max(node.aabb_max, chunk_aabb_max_array[chunk_index], node.aabb_max);
+        merge_aabb_min(node.aabb_min, chunk_aabb_min_array[chunk_index], node.aabb_min);
+    }
+}
+// Binned SAH
+// 重心をBVH_SAH_NUM_BINS個のビンに振り分け、3軸すべてのビン境界でコストを評価する
+// See "On fast Construction of SAH-based Bounding Volume Hierarchies" [Wald 2007].
+// Costs are in units of one ray-triangle test, so a leaf with N faces costs N.
+// Returns false when no split is cheaper than the leaf (only checked if can_be_leaf)
+// or when all centroids coincide.
+// On success _face_index_array[begin, end) is stably partitioned at split.
+bool BVH::split_by_binned_sah(int begin, int end, const Node& node, bool can_be_leaf, const std::shared_ptr<StandardGeometry>& geometry, int& split)
+{
+    const int num_faces = end - begin;
+    const int num_chunks = compute_num_chunks(num_faces);
+    const float surface_area = compute_surface_area(node.aabb_max, node.aabb_min);
+    if (surface_area <= 0.0f) {
+        return false;
+    }
+    const float traversal_cost = geometry->bvh_sah_traversal_cost();
+
+    ChunkArray<glm::vec3f, 1> chunk_center_max_array(num_chunks, glm::vec3f(-FLT_MAX));
+    ChunkArray<glm::vec3f, 1> chunk_center_min_array(num_chunks, glm::vec3f(FLT_MAX));
+    parallel_for_chunks(begin, end, [&](int chunk_index, int chunk_begin, int chunk_end) {
+        glm::vec3f center_max(-FLT_MAX);
+        glm::vec3f center_min(FLT_MAX);
+        for (int n = chunk_begin; n < chunk_end; n++) {
+            const glm::vec3f& center = _face_center_array[_face_index_array[n]];
+            merge_aabb_max(center_max, center, center_max);
+            merge_aabb_min(center_min, center, center_min);
         }
+        chunk_center_max_array[chunk_index] = center_max;
+        chunk_center_min_array[chunk_index] = center_min;
+    });
+    glm::vec3f center_max(-FLT_MAX);
+    glm::vec3f center_min(FLT_MAX);
+    for (int chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+        merge_aabb_max(center_max, chunk_center_max_array[chunk_index], center_max);
+        merge_aabb_min(center_min, chunk_center_min_array[chunk_index], center_min);
     }
 
-    std::sort(object_center_array.begin(), object_center_array.end(), compare_position);
-    // std::cout << "sort:" << std::endl;
-    // for (auto& pair : object_center_array) {
-    //     std::cout << pair.first << ": " << pair.second << std::endl;
-    // }
+    // 重心の範囲が0の軸は評価しない
+    glm::vec3f bin_scale;
+    for (int axis = 0; axis < 3; axis++) {
+        const float extent = center_max[axis] - center_min[axis];
+        bin_scale[axis] = extent > 0.0f ? BVH_SAH_NUM_BINS / extent : 0.0f;
+    }
+    auto compute_bin_index = [&](int n, int axis) {
+        return std::min(BVH_SAH_NUM_BINS - 1, int((_face_center_array[_face_index_array[n]][axis] - center_min[axis]) * bin_scale[axis]));
+    };
 
-    glm::vec3f volume_a_max(0);
-    glm::vec3f volume_a_min(0);
-    glm::vec3f volume_b_max(0);
-    glm::vec3f volume_b_min(0);
-    // std::cout << "==============================================================" << std::endl;
+    // 3軸分のビンを1回のループで埋める
+    ChunkArray<SAHBin, 3 * BVH_SAH_NUM_BINS> chunk_bin_array(num_chunks * 3 * BVH_SAH_NUM_BINS, SAHBin());
+    parallel_for_chunks(begin, end, [&](int chunk_index, int chunk_begin, int chunk_end) {
+        SAHBin* bins = &chunk_bin_array[chunk_index * 3 * BVH_SAH_NUM_BINS];
+        for (int n = chunk_begin; n < chunk_end; n++) {
+            int face_index = _face_index_array[n];
+            for (int axis = 0; axis < 3; axis++) {
+                SAHBin& bin = bins[axis * BVH_SAH_NUM_BINS + compute_bin_index(n, axis)];
+                merge_aabb_max(bin.aabb_max, _face_aabb_max_array[face_index], bin.aabb_max);
+                merge_aabb_min(bin.aabb_min, _face_aabb_min_array[face_index], bin.aabb_min);
+                bin.num_faces++;
+            }
+        }
+    });
 
     float min_cost = FLT_MAX;
-    int min_cost_split_index = 0;
-    if (true) {
-        min_cost_split_index = object_center_array.size() / 2;
-    } else {
-        for (unsigned int split_index = 1; split_index <= object_center_array.size() - 1; split_index++) {
-            int volume_a_num_faces = 0;
-            int volume_b_num_faces = 0;
-            for (unsigned int position = 0; position < split_index; position++) {
-                int face_index = object_center_array[position].first;
-                auto& face = geometry->_face_vertex_indices_array.at(face_index);
-
-                glm::vec3f max = glm::vec3f(-FLT_MAX);
-                glm::vec3f min = glm::vec3f(FLT_MAX);
+    int min_cost_axis = -1;
+    int min_cost_bin = -1;
+    for (int axis = 0; axis < 3; axis++) {
+        if (bin_scale[axis] == 0.0f) {
+            continue;
+        }
+        SAHBin bins[BVH_SAH_NUM_BINS];
+        for (int chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+            for (int bin_index = 0; bin_index < BVH_SAH_NUM_BINS; bin_index++) {
+                SAHBin& chunk_bin = chunk_bin_array[(chunk_index * 3 + axis) * BVH_SAH_NUM_BINS + bin_index];
+                SAHBin& bin = bins[bin_index];
+                merge_aabb_max(bin.aabb_max, chunk_bin.aabb_max, bin.aabb_max);
+                merge_aabb_min(bin.aabb_min, chunk_bin.aabb_min, bin.aabb_min);
+                bin.num_faces += chunk_bin.num_faces;
+            }
+        }
 
-                auto& va = geometry->_vertex_array[face[0]];
-                merge_aabb_max(max, va, max);
-                merge_aabb_min(min, va, min);
+        // 右側から累積した表面積と面数
+        float right_area[BVH_SAH_NUM_BINS];
+        int right_num_faces[BVH_SAH_NUM_BINS];
+        glm::vec3f max(-FLT_MAX);
+        glm::vec3f min(FLT_MAX);
+        int count = 0;
+        for (int bin_index = BVH_SAH_NUM_BINS - 1; bin_index > 0; bin_index--) {
+            SAHBin& bin = bins[bin_index];
+            if (bin.num_faces > 0) {
+                merge_aabb_max(max, bin.aabb_max, max);
+                merge_aabb_min(min, bin.aabb_min, min);
+                count += bin.num_faces;
+            }
+            right_area[bin_index] = count > 0 ? compute_surface_area(max, min) : 0.0f;
+            right_num_faces[bin_index] = count;
+        }
 
-                auto& vb = geometry->_vertex_array[face[1]];
-                merge_aabb_max(max, vb, max);
-                merge_aabb_min(min, vb, min);
+        max = glm::vec3f(-FLT_MAX);
+        min = glm::vec3f(FLT_MAX);
+        count = 0;
+        for (int bin_index = 0; bin_index < BVH_SAH_NUM_BINS - 1; bin_index++) {
+            SAHBin& bin = bins[bin_index];
+            if (bin.num_faces > 0) {
+                merge_aabb_max(max, bin.aabb_max, max);
+                merge_aabb_min(min, bin.aabb_min, min);
+                count += bin.num_faces;
+            }
+            if (count == 0 || right_num_faces[bin_index + 1] == 0) {
+                continue;
+            }
+            float left_area = compute_surface_area(max, min);
+            float cost = traversal_cost + (left_area * count + right_area[bin_index + 1] * right_num_faces[bin_index + 1]) / surface_area;
+            if (cost < min_cost) {
+                min_cost = cost;
+                min_cost_axis = axis;
+                min_cost_bin = bin_index;
+            }
+        }
+    }
 
-                auto& vc = geometry->_vertex_array[face[2]];
-                merge_aabb_max(max, vc, max);
-                merge_aabb_min(min, vc, min);
+    if (min_cost_axis == -1) {
+        return false;
+    }
+    if (can_be_leaf && min_cost >= float(num_faces)) {
+        return false;
+    }
 
-                if (position == 0) {
-                    volume_a_max = max;
-                    volume_a_min = min;
-                } else {
-                    merge_aabb_max(volume_a_max, max, volume_a_max);
-                    merge_aabb_min(volume_a_min, min, volume_a_min);
-                }
-                volume_a_num_faces += 1;
+    // チャンクごとに左右の面数を数えてから書き込み位置を決める
+    // Stable partition: count per chunk, prefix sum, scatter into the scratch array, then copy back.
+    ChunkArray<int, 1> chunk_num_left_array(num_chunks, 0);
+    parallel_for_chunks(begin, end, [&](int chunk_index, int chunk_begin, int chunk_end) {
+        int num_left = 0;
+        for (int n = chunk_begin; n < chunk_end; n++) {
+            if (compute_bin_index(n, min_cost_axis) <= min_cost_bin) {
+                num_left++;
             }
-            for (unsigned int position = split_index; position < object_center_array.size(); position++) {
-                int face_index = object_center_array[position].first;
-                auto& face = geometry->_face_vertex_indices_array.at(face_index);
+        }
+        chunk_num_left_array[chunk_index] = num_left;
+    });
+    ChunkArray<int, 1> chunk_left_offset_array(num_chunks, 0);
+    int num_left = 0;
+    for (int chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+        chunk_left_offset_array[chunk_index] = num_left;
+        num_left += chunk_num_left_array[chunk_index];
+    }
+    parallel_for_chunks(begin, end, [&](int chunk_index, int chunk_begin, int chunk_end) {
+        int left_offset = begin + chunk_left_offset_array[chunk_index];
+        int right_offset = begin + num_left + (chunk_begin - begin) - chunk_left_offset_array[chunk_index];
+        for (int n = chunk_begin; n < chunk_end; n++) {
+            if (compute_bin_index(n, min_cost_axis) <= min_cost_bin) {
+                _scratch_face_index_array[left_offset++] = _face_index_array[n];
+            } else {
+                _scratch_face_index_array[right_offset++] = _face_index_array[n];
+            }
+        }
+    });
+    parallel_for_chunks(begin, end, [&](int, int chunk_begin, int chunk_end) {
+        std::copy(_scratch_face_index_array.begin() + chunk_begin, _scratch_face_index_array.begin() + chunk_end, _face_index_array.begin() + chunk_begin);
+    });
+    split = begin + num_left;
+    return true;
+}
+// 中央値で分割
+// Used by RTXBVHBuilderMedian and as the fallback when every centroid is at the same position.
+void BVH::split_by_median(int begin, int end, const Node& node, int& split)
+{
+    const glm::vec3f axis_length = node.aabb_max - node.aabb_min;
+    const int longest_axis = detect_longest_axis(axis_length) - RTXAxisX;
+    split = begin + (end - begin) / 2;
+    std::nth_element(_face_index_array.begin() + begin, _face_index_array.begin() + split, _face_index_array.begin() + end,
+        [&](int a, int b) {
+            float position_a = _face_center_array[a][longest_axis];
+            float position_b = _face_center_array[b][longest_axis];
+            if (position_a == position_b) {
+                return a < b;
+            }
+            return position_a < position_b;
+        });
+}
+void BVH::build_node(int node_index, int begin, int end, const std::shared_ptr<StandardGeometry>& geometry)
+{
+    assert(end > begin);
+    // _build_node_arrayは構築前に確保済みなので参照は無効にならない
+    Node& node = _build_node_array[node_index];
+    node.left = -1;
+    node.right = -1;
+    node.hit = -1;
+    node.miss = -1;
+    node.assigned_face_index_start = -1;
+    node.assigned_face_index_end = -1;
+    compute_aabb(begin, end, node);
 
-                glm::vec3f max = glm::vec3f(-FLT_MAX);
-                glm::vec3f min = glm::vec3f(FLT_MAX);
+    const int num_assigned_faces = end - begin;
+    bool should_be_leaf = num_assigned_faces <= _max_triangles_per_node;
+    int split = -1;
 
-                auto& va = geometry->_vertex_array[face[0]];
-                merge_aabb_max(max, va, max);
-                merge_aabb_min(min, va, min);
+    if (_builder != RTXBVHBuilderMedian && num_assigned_faces > 1) {
+        // 葉の上限以下でもSAHコストが下がるなら分割する
+        if (split_by_binned_sah(begin, end, node, should_be_leaf, geometry, split)) {
+            should_be_leaf = false;
+        }
+    }
 
-                auto& vb = geometry->_vertex_array[face[1]];
-                merge_aabb_max(max, vb, max);
-                merge_aabb_min(min, vb, min);
+    if (should_be_leaf) {
+        node.assigned_face_index_start = begin;
+        node.assigned_face_index_end = end - 1;
+        return;
+    }
+    if (split == -1) {
+        split_by_median(begin, end, node, split);
+    }
 
-                auto& vc = geometry->_vertex_array[face[2]];
-                merge_aabb_max(max, vc, max);
-                merge_aabb_min(min, vc, min);
+    // 兄弟ノードは隣り合わせに確保する
+    // ノード番号は構築後にfinalize_nodesで前順に振り直す
+    const int left = allocate_build_nodes(2);
+    node.left = left;
+    node.right = left + 1;
+
+    // 左右の部分木は面の配列の別々の範囲を扱うので並列に構築できる
+    if (num_assigned_faces >= BVH_PARALLEL_BUILD_MIN_FACES) {
+#pragma omp task shared(geometry)
+        build_node(left, begin, split, geometry);
+        build_node(left + 1, split, end, geometry);
+#pragma omp taskwait
+    } else {
+        build_node(left, begin, split, geometry);
+        build_node(left + 1, split, end, geometry);
+    }
+}
+// 面の参照を平面 axis = position で2つに分け、それぞれを元の参照のAABBと交差させる
+// The triangle's edges are clipped against the plane, so each side gets the tight box of its part.
+// A side that does not contain any part of the triangle comes back with aabb_min > aabb_max.
+void split_reference(const Reference& reference, const StandardGeometry& geometry, int axis, float position, Reference& left, Reference& right)
+{
+    left.face_index = reference.face_index;
+    right.face_index = reference.face_index;
+    left.aabb_max = glm::vec3f(-FLT_MAX);
+    left.aabb_min = glm::vec3f(FLT_MAX);
+    right.aabb_max = glm::vec3f(-FLT_MAX);
+    right.aabb_min = glm::vec3f(FLT_MAX);
+    const glm::vec3i& face = geometry._face_vertex_indices_array[reference.face_index];
+    for (int k = 0; k < 3; k++) {
+        const glm::vec3f v0 = glm::vec3f(geometry._vertex_array[face[k]]);
+        const glm::vec3f v1 = glm::vec3f(geometry._vertex_array[face[(k + 1) % 3]]);
+        const float p0 = v0[axis];
+        const float p1 = v1[axis];
+        if (p0 <= position) {
+            merge_aabb_max(left.aabb_max, v0, left.aabb_max);
+            merge_aabb_min(left.aabb_min, v0, left.aabb_min);
+        }
+        if (p0 >= position) {
+            merge_aabb_max(right.aabb_max, v0, right.aabb_max);
+            merge_aabb_min(right.aabb_min, v0, right.aabb_min);
+        }
+        // 辺が平面と交わる点は両側に入る
+        if ((p0 < position && position < p1) || (p1 < position && position < p0)) {
+            const float t = glm::clamp((position - p0) / (p1 - p0), 0.0f, 1.0f);
+            glm::vec3f intersection = v0 + (v1 - v0) * t;
+            intersection[axis] = position;
+            merge_aabb_max(left.aabb_max, intersection, left.aabb_max);
+            merge_aabb_min(left.aabb_min, intersection, left.aabb_min);
+            merge_aabb_max(right.aabb_max, intersection, right.aabb_max);
+            merge_aabb_min(right.aabb_min, intersection, right.aabb_min);
+        }
+    }
+    left.aabb_max[axis] = std::min(left.aabb_max[axis], position);
+    right.aabb_min[axis] = std::max(right.aabb_min[axis], position);
+    merge_aabb_min(left.aabb_max, reference.aabb_max, left.aabb_max);
+    merge_aabb_max(left.aabb_min, reference.aabb_min, left.aabb_min);
+    merge_aabb_min(right.aabb_max, reference.aabb_max, right.aabb_max);
+    merge_aabb_max(right.aabb_min, reference.aabb_min, right.aabb_min);
+}
+bool is_valid_reference(const Reference& reference)
+{
+    return reference.aabb_min.x <= reference.aabb_max.x && reference.aabb_min.y <= reference.aabb_max.y && reference.aabb_min.z <= reference.aabb_max.z;
+}
+// SBVHの分割候補
+struct SBVHSplit {
+    float cost = FLT_MAX;
+    int axis = -1;
+    // 左側に入る最後のビン
+    int bin = -1;
+    // ビンの番号 = (座標 - bin_origin) * bin_scale
+    float bin_origin = 0.0f;
+    float bin_scale = 0.0f;
+    glm::vec3f left_aabb_max = glm::vec3f(-FLT_MAX);
+    glm::vec3f left_aabb_min = glm::vec3f(FLT_MAX);
+    glm::vec3f right_aabb_max = glm::vec3f(-FLT_MAX);
+    glm::vec3f right_aabb_min = glm::vec3f(FLT_MAX);
+    int num_left = 0;
+    int num_right = 0;
+    int compute_bin_index(float position) const
+    {
+        return glm::clamp(int((position - bin_origin) * bin_scale), 0, BVH_SAH_NUM_BINS - 1);
+    }
+    // 空間分割の平面の位置
+    float position() const
+    {
+        return bin_origin + float(bin + 1) / bin_scale;
+    }
+};
+// 参照のAABBの中心をビンに振り分ける物体分割
+// Same sweep as BVH::split_by_binned_sah, but over references instead of the face permutation.
+void find_object_split(const std::vector<Reference>& references, float surface_area, float traversal_cost, SBVHSplit& split)
+{
+    glm::vec3f center_max(-FLT_MAX);
+    glm::vec3f center_min(FLT_MAX);
+    for (const Reference& reference : references) {
+        const glm::vec3f center = (reference.aabb_min + reference.aabb_max) * 0.5f;
+        merge_aabb_max(center_max, center, center_max);
+        merge_aabb_min(center_min, center, center_min);
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        const float extent = center_max[axis] - center_min[axis];
+        if (extent <= 0.0f) {
+            continue;
+        }
+        SBVHSplit candidate;
+        candidate.axis = axis;
+        candidate.bin_origin = center_min[axis];
+        candidate.bin_scale = BVH_SAH_NUM_BINS / extent;
+        SAHBin bins[BVH_SAH_NUM_BINS];
+        for (const Reference& reference : references) {
+            const float center = (reference.aabb_min[axis] + reference.aabb_max[axis]) * 0.5f;
+            SAHBin& bin = bins[candidate.compute_bin_index(center)];
+            merge_aabb_max(bin.aabb_max, reference.aabb_max, bin.aabb_max);
+            merge_aabb_min(bin.aabb_min, reference.aabb_min, bin.aabb_min);
+            bin.num_faces++;
+        }
+
+        // 右側から累積したAABBと面数
+        glm::vec3f right_aabb_max[BVH_SAH_NUM_BINS];
+        glm::vec3f right_aabb_min[BVH_SAH_NUM_BINS];
+        int right_num_faces[BVH_SAH_NUM_BINS];
+        glm::vec3f max(-FLT_MAX);
+        glm::vec3f min(FLT_MAX);
+        int count = 0;
+        for (int bin_index = BVH_SAH_NUM_BINS - 1; bin_index > 0; bin_index--) {
+            merge_aabb_max(max, bins[bin_index].aabb_max, max);
+            merge_aabb_min(min, bins[bin_index].aabb_min, min);
+            count += bins[bin_index].num_faces;
+            right_aabb_max[bin_index] = max;
+            right_aabb_min[bin_index] = min;
+            right_num_faces[bin_index] = count;
+        }
+        max = glm::vec3f(-FLT_MAX);
+        min = glm::vec3f(FLT_MAX);
+        count = 0;
+        for (int bin_index = 0; bin_index < BVH_SAH_NUM_BINS - 1; bin_index++) {
+            merge_aabb_max(max, bins[bin_index].aabb_max, max);
+            merge_aabb_min(min, bins[bin_index].aabb_min, min);
+            count += bins[bin_index].num_faces;
+            const int num_right = right_num_faces[bin_index + 1];
+            if (count == 0 || num_right == 0) {
+                continue;
+            }
+            const float cost = traversal_cost
+                + (compute_surface_area(max, min) * count + compute_surface_area(right_aabb_max[bin_index + 1], right_aabb_min[bin_index + 1]) * num_right) / surface_area;
+            if (cost < split.cost) {
+                split = candidate;
+                split.cost = cost;
+                split.bin = bin_index;
+                split.left_aabb_max = max;
+                split.left_aabb_min = min;
+                split.right_aabb_max = right_aabb_max[bin_index + 1];
+                split.right_aabb_min = right_aabb_min[bin_index + 1];
+                split.num_left = count;
+                split.num_right = num_right;
+            }
+        }
+    }
+}
+struct SpatialBin {
+    glm::vec3f aabb_max = glm::vec3f(-FLT_MAX);
+    glm::vec3f aabb_min = glm::vec3f(FLT_MAX);
+    // このビンで始まる参照と終わる参照の数
+    int num_entries = 0;
+    int num_exits = 0;
+};
+// ノードのAABBを等間隔のビンに分け、参照をビンの境界で切り刻んで数える空間分割
+// A reference is counted as entering its first bin and exiting its last one,
+// so a plane between bins puts every straddling reference on both sides.
+void find_spatial_split(const std::vector<Reference>& references, const Node& node, const StandardGeometry& geometry, float surface_area, float traversal_cost, SBVHSplit& split)
+{
+    for (int axis = 0; axis < 3; axis++) {
+        const float extent = node.aabb_max[axis] - node.aabb_min[axis];
+        if (extent <= 0.0f) {
+            continue;
+        }
+        SBVHSplit candidate;
+        candidate.axis = axis;
+        candidate.bin_origin = node.aabb_min[axis];
+        candidate.bin_scale = BVH_SAH_NUM_BINS / extent;
+        SpatialBin bins[BVH_SAH_NUM_BINS];
+        for (const Reference& reference : references) {
+            const int first_bin = candidate.compute_bin_index(reference.aabb_min[axis]);
+            const int last_bin = candidate.compute_bin_index(reference.aabb_max[axis]);
+            Reference remaining = reference;
+            for (int bin_index = first_bin; bin_index < last_bin; bin_index++) {
+                candidate.bin = bin_index;
+                Reference left, right;
+                split_reference(remaining, geometry, axis, candidate.position(), left, right);
+                if (is_valid_reference(left)) {
+                    merge_aabb_max(bins[bin_index].aabb_max, left.aabb_max, bins[bin_index].aabb_max);
+                    merge_aabb_min(bins[bin_index].aabb_min, left.aabb_min, bins[bin_index].aabb_min);
+                }
+                remaining = right;
+            }
+            if (is_valid_reference(remaining)) {
+                merge_aabb_max(bins[last_bin].aabb_max, remaining.aabb_max, bins[last_bin].aabb_max);
+                merge_aabb_min(bins[last_bin].aabb_min, remaining.aabb_min, bins[last_bin].aabb_min);
+            }
+            bins[first_bin].num_entries++;
+            bins[last_bin].num_exits++;
+        }
 
-                if (position == split_index) {
-                    volume_b_max = max;
-                    volume_b_min = min;
+        glm::vec3f right_aabb_max[BVH_SAH_NUM_BINS];
+        glm::vec3f right_aabb_min[BVH_SAH_NUM_BINS];
+        int right_num_faces[BVH_SAH_NUM_BINS];
+        glm::vec3f max(-FLT_MAX);
+        glm::vec3f min(FLT_MAX);
+        int count = 0;
+        for (int bin_index = BVH_SAH_NUM_BINS - 1; bin_index > 0; bin_index--) {
+            merge_aabb_max(max, bins[bin_index].aabb_max, max);
+            merge_aabb_min(min, bins[bin_index].aabb_min, min);
+            count += bins[bin_index].num_exits;
+            right_aabb_max[bin_index] = max;
+            right_aabb_min[bin_index] = min;
+            right_num_faces[bin_index] = count;
+        }
+        max = glm::vec3f(-FLT_MAX);
+        min = glm::vec3f(FLT_MAX);
+        count = 0;
+        for (int bin_index = 0; bin_index < BVH_SAH_NUM_BINS - 1; bin_index++) {
+            merge_aabb_max(max, bins[bin_index].aabb_max, max);
+            merge_aabb_min(min, bins[bin_index].aabb_min, min);
+            count += bins[bin_index].num_entries;
+            const int num_right = right_num_faces[bin_index + 1];
+            if (count == 0 || num_right == 0) {
+                continue;
+            }
+            const float cost = traversal_cost
+                + (compute_surface_area(max, min) * count + compute_surface_area(right_aabb_max[bin_index + 1], right_aabb_min[bin_index + 1]) * num_right) / surface_area;
+            if (cost < split.cost) {
+                split = candidate;
+                split.cost = cost;
+                split.bin = bin_index;
+                split.left_aabb_max = max;
+                split.left_aabb_min = min;
+                split.right_aabb_max = right_aabb_max[bin_index + 1];
+                split.right_aabb_min = right_aabb_min[bin_index + 1];
+                split.num_left = count;
+                split.num_right = num_right;
+            }
+        }
+    }
+}
+// 物体分割と、左右の重なりが大きい場合は空間分割も評価して安い方で参照を分ける
+// See "Spatial Splits in Bounding Volume Hierarchies" [Stich et al. 2009].
+// Spatial splits draw the duplicated references from _num_remaining_spatial_split_references;
+// once the budget is spent the builder falls back to object splits.
+// Returns false when the node should become a leaf; references are left untouched in that case.
+bool BVH::split_sbvh_references(std::vector<Reference>& references, const Node& node, bool can_be_leaf, const std::shared_ptr<StandardGeometry>& geometry,
+    std::vector<Reference>& left_references, std::vector<Reference>& right_references)
+{
+    const int num_references = references.size();
+    const float surface_area = compute_surface_area(node.aabb_max, node.aabb_min);
+    const float traversal_cost = geometry->bvh_sah_traversal_cost();
+
+    SBVHSplit object_split;
+    SBVHSplit spatial_split;
+    if (surface_area > 0.0f) {
+        find_object_split(references, surface_area, traversal_cost, object_split);
+        bool should_try_spatial_split = _num_remaining_spatial_split_references > 0;
+        if (should_try_spatial_split && object_split.axis != -1) {
+            glm::vec3f overlap_max, overlap_min;
+            merge_aabb_min(object_split.left_aabb_max, object_split.right_aabb_max, overlap_max);
+            merge_aabb_max(object_split.left_aabb_min, object_split.right_aabb_min, overlap_min);
+            const bool overlapped = overlap_min.x <= overlap_max.x && overlap_min.y <= overlap_max.y && overlap_min.z <= overlap_max.z;
+            should_try_spatial_split = overlapped && compute_surface_area(overlap_max, overlap_min) > BVH_SBVH_OVERLAP_THRESHOLD * _root_surface_area;
+        }
+        if (should_try_spatial_split) {
+            find_spatial_split(references, node, *geometry, surface_area, traversal_cost, spatial_split);
+        }
+    }
+
+    if (spatial_split.cost < object_split.cost && (can_be_leaf == false || spatial_split.cost < float(num_references))) {
+        const int num_duplicates = spatial_split.num_left + spatial_split.num_right - num_references;
+        if (_num_remaining_spatial_split_references.fetch_sub(num_duplicates) >= num_duplicates) {
+            const int axis = spatial_split.axis;
+            const float position = spatial_split.position();
+            for (const Reference& reference : references) {
+                const int first_bin = spatial_split.compute_bin_index(reference.aabb_min[axis]);
+                const int last_bin = spatial_split.compute_bin_index(reference.aabb_max[axis]);
+                if (last_bin <= spatial_split.bin) {
+                    left_references.push_back(reference);
+                } else if (first_bin > spatial_split.bin) {
+                    right_references.push_back(reference);
                 } else {
-                    merge_aabb_max(volume_b_max, max, volume_b_max);
-                    merge_aabb_min(volume_b_min, min, volume_b_min);
+                    Reference left, right;
+                    split_reference(reference, *geometry, axis, position, left, right);
+                    if (is_valid_reference(left)) {
+                        left_references.push_back(left);
+                    }
+                    if (is_valid_reference(right)) {
+                        right_references.push_back(right);
+                    }
                 }
-                volume_b_num_faces += 1;
             }
-            float surface_a = compute_surface_area(volume_a_max, volume_a_min);
-            float surface_b = compute_surface_area(volume_b_max, volume_b_min);
-            float cost = surface_a * volume_a_num_faces + surface_b * volume_b_num_faces;
-            if (cost < min_cost) {
-                min_cost = cost;
-                min_cost_split_index = split_index;
+            // 切り取った結果が予約より少なければ残りを返す
+            const int num_unused = num_duplicates - (int(left_references.size() + right_references.size()) - num_references);
+            _num_remaining_spatial_split_references += num_unused;
+            if (left_references.empty() == false && right_references.empty() == false) {
+                return true;
             }
+            _num_remaining_spatial_split_references += int(left_references.size() + right_references.size()) - num_references;
+            left_references.clear();
+            right_references.clear();
+        } else {
+            _num_remaining_spatial_split_references += num_duplicates;
         }
     }
 
-    int split_index = min_cost_split_index;
-    // std::cout << "split: " << split_index << std::endl;
-    std::vector<int> left_assigned_indices;
-    std::vector<int> right_assigned_indices;
-    for (int n = 0; n < split_index; n++) {
-        auto& pair = object_center_array.at(n);
-        left_assigned_indices.push_back(pair.first);
+    if (object_split.axis != -1) {
+        if (can_be_leaf && object_split.cost >= float(num_references)) {
+            return false;
+        }
+        const int axis = object_split.axis;
+        for (const Reference& reference : references) {
+            const float center = (reference.aabb_min[axis] + reference.aabb_max[axis]) * 0.5f;
+            if (object_split.compute_bin_index(center) <= object_split.bin) {
+                left_references.push_back(reference);
+            } else {
+                right_references.push_back(reference);
+            }
+        }
+        return true;
     }
-    for (int n = split_index; n < (int)assigned_face_indices.size(); n++) {
-        auto& pair = object_center_array.at(n);
-        right_assigned_indices.push_back(pair.first);
+    if (can_be_leaf) {
+        return false;
     }
-    // std::cout << "left:" << std::endl;
-    // for (auto index : left_assigned_indices) {
-    //     std::cout << index << std::endl;
-    // }
-    // std::cout << "right:" << std::endl;
-    // for (auto index : right_assigned_indices) {
-    //     std::cout << index << std::endl;
-    // }
-    _left = std::make_shared<Node>(left_assigned_indices, geometry, current_node_index, current_assigned_face_index_offset);
-    _right = std::make_shared<Node>(right_assigned_indices, geometry, current_node_index, current_assigned_face_index_offset);
+    // 全ての参照の中心が一致する場合は半分に分ける
+    const int half = num_references / 2;
+    left_references.assign(references.begin(), references.begin() + half);
+    right_references.assign(references.begin() + half, references.end());
+    return true;
 }
-Node::Node(std::vector<int> assigned_face_indices,
-    std::shared_ptr<SphereGeometry>& geometry)
+void BVH::build_sbvh_node(int node_index, std::vector<Reference>& references, const std::shared_ptr<StandardGeometry>& geometry)
 {
-    assert(assigned_face_indices.size() > 0);
-    _assigned_face_indices = assigned_face_indices;
-    _index = 0;
-    _assigned_face_index_start = 0;
-    _assigned_face_index_end = 0;
+    assert(references.empty() == false);
+    Node& node = _build_node_array[node_index];
+    node.left = -1;
+    node.right = -1;
+    node.hit = -1;
+    node.miss = -1;
+    node.assigned_face_index_start = -1;
+    node.assigned_face_index_end = -1;
+    node.aabb_max = glm::vec3f(-FLT_MAX);
+    node.aabb_min = glm::vec3f(FLT_MAX);
+    for (const Reference& reference : references) {
+        merge_aabb_max(node.aabb_max, reference.aabb_max, node.aabb_max);
+        merge_aabb_min(node.aabb_min, reference.aabb_min, node.aabb_min);
+    }
 
-    // AABBは使わない
-    _aabb_max = glm::vec3f(0.0f);
-    _aabb_min = glm::vec3f(0.0f);
+    const int num_references = references.size();
+    const bool can_be_leaf = num_references <= _max_triangles_per_node;
+    std::vector<Reference> left_references;
+    std::vector<Reference> right_references;
+    if (num_references == 1 || split_sbvh_references(references, node, can_be_leaf, geometry, left_references, right_references) == false) {
+        // 葉の面はまず確保した順に書き込み、構築後にcompact_sbvh_leavesで前順に並べ直す
+        const int start = _num_face_references.fetch_add(num_references);
+        for (int k = 0; k < num_references; k++) {
+            _face_index_array[start + k] = references[k].face_index;
+        }
+        node.assigned_face_index_start = start;
+        node.assigned_face_index_end = start + num_references - 1;
+        return;
+    }
+    std::vector<Reference>().swap(references);
 
-    _is_leaf = true;
+    const int left = allocate_build_nodes(2);
+    node.left = left;
+    node.right = left + 1;
+    if (num_references >= BVH_PARALLEL_BUILD_MIN_FACES) {
+#pragma omp task shared(geometry, left_references)
+        build_sbvh_node(left, left_references, geometry);
+        build_sbvh_node(left + 1, right_references, geometry);
+#pragma omp taskwait
+    } else {
+        build_sbvh_node(left, left_references, geometry);
+        build_sbvh_node(left + 1, right_references, geometry);
+    }
 }
-Node::Node(std::vector<int> assigned_face_indices,
-    std::shared_ptr<CylinderGeometry>& geometry)
+// 葉の面の範囲を前順に詰め直す
+// Also used after restructure_treelets, which moves leaves to other parents.
+void BVH::compact_sbvh_leaves(int num_face_references)
 {
-    assert(assigned_face_indices.size() > 0);
-    _assigned_face_indices = assigned_face_indices;
-    _index = 0;
-    _assigned_face_index_start = 0;
-    _assigned_face_index_end = 0;
+    std::vector<int> face_index_array;
+    face_index_array.reserve(num_face_references);
+    std::vector<int> stack = { 0 };
+    while (stack.empty() == false) {
+        Node& node = _build_node_array[stack.back()];
+        stack.pop_back();
+        if (node.is_leaf()) {
+            const int start = face_index_array.size();
+            face_index_array.insert(face_index_array.end(), _face_index_array.begin() + node.assigned_face_index_start, _face_index_array.begin() + node.assigned_face_index_end + 1);
+            node.assigned_face_index_start = start;
+            node.assigned_face_index_end = face_index_array.size() - 1;
+            continue;
+        }
+        stack.push_back(node.right);
+        stack.push_back(node.left);
+    }
+    _face_index_array.swap(face_index_array);
+}
+int lowest_bit_index(int set)
+{
+    int index = 0;
+    while ((set & 1) == 0) {
+        set >>= 1;
+        index++;
+    }
+    return index;
+}
+// 根が root_index のtreeletをSAHが最小の形に組み直す
+// The treelet is grown from the root by repeatedly expanding the treelet leaf with the largest surface area,
+// then the optimal binary tree over its leaves is found by dynamic programming over the subsets of leaves.
+// The internal nodes are reused, so nodes outside the treelet keep their indices.
+// Returns true if the treelet was changed.
+bool BVH::restructure_treelet(int root_index, std::vector<float>& cost_array, float traversal_cost)
+{
+    const int max_subsets = 1 << BVH_TREELET_NUM_LEAVES;
+    int leaf_array[BVH_TREELET_NUM_LEAVES];
+    int internal_node_array[BVH_TREELET_NUM_LEAVES - 1];
+    const Node& root = _build_node_array[root_index];
+    leaf_array[0] = root.left;
+    leaf_array[1] = root.right;
+    internal_node_array[0] = root_index;
+    int num_leaves = 2;
+    while (num_leaves < BVH_TREELET_NUM_LEAVES) {
+        int expanded = -1;
+        float max_surface_area = -1.0f;
+        for (int n = 0; n < num_leaves; n++) {
+            const Node& node = _build_node_array[leaf_array[n]];
+            if (node.is_leaf()) {
+                continue;
+            }
+            const float surface_area = compute_surface_area(node.aabb_max, node.aabb_min);
+            if (surface_area > max_surface_area) {
+                max_surface_area = surface_area;
+                expanded = n;
+            }
+        }
+        if (expanded == -1) {
+            break;
+        }
+        const Node& expanded_node = _build_node_array[leaf_array[expanded]];
+        internal_node_array[num_leaves - 1] = leaf_array[expanded];
+        leaf_array[expanded] = expanded_node.left;
+        leaf_array[num_leaves++] = expanded_node.right;
+    }
+    if (num_leaves < 3) {
+        return false;
+    }
+    // 子孫はすでに組み直されているので根のコストを求め直す
+    cost_array[root_index] = traversal_cost * compute_surface_area(root.aabb_max, root.aabb_min) + cost_array[root.left] + cost_array[root.right];
 
-    // AABBは使わない
-    _aabb_max = glm::vec3f(0.0f);
-    _aabb_min = glm::vec3f(0.0f);
+    // 葉の部分集合ごとのAABBと最小コスト
+    // partition_array[s]は最適な分け方の左側（sの最下位ビットを含む側）
+    glm::vec3f aabb_max_array[max_subsets];
+    glm::vec3f aabb_min_array[max_subsets];
+    float optimal_cost_array[max_subsets];
+    int partition_array[max_subsets];
+    const int full_set = (1 << num_leaves) - 1;
+    for (int set = 1; set <= full_set; set++) {
+        const int lowest_bit = set & -set;
+        if (set == lowest_bit) {
+            const int leaf_index = leaf_array[lowest_bit_index(set)];
+            const Node& leaf = _build_node_array[leaf_index];
+            aabb_max_array[set] = leaf.aabb_max;
+            aabb_min_array[set] = leaf.aabb_min;
+            optimal_cost_array[set] = cost_array[leaf_index];
+            partition_array[set] = 0;
+            continue;
+        }
+        merge_aabb_max(aabb_max_array[set ^ lowest_bit], aabb_max_array[lowest_bit], aabb_max_array[set]);
+        merge_aabb_min(aabb_min_array[set ^ lowest_bit], aabb_min_array[lowest_bit], aabb_min_array[set]);
+        // 左右を入れ替えただけの分け方は数えない
+        const int rest = set ^ lowest_bit;
+        float min_cost = FLT_MAX;
+        int best_partition = lowest_bit;
+        for (int subset = (rest - 1) & rest;; subset = (subset - 1) & rest) {
+            const int left = subset | lowest_bit;
+            const float cost = optimal_cost_array[left] + optimal_cost_array[set ^ left];
+            if (cost < min_cost) {
+                min_cost = cost;
+                best_partition = left;
+            }
+            if (subset == 0) {
+                break;
+            }
+        }
+        optimal_cost_array[set] = traversal_cost * compute_surface_area(aabb_max_array[set], aabb_min_array[set]) + min_cost;
+        partition_array[set] = best_partition;
+    }
+    // 計算誤差で組み直しを繰り返さないように、はっきり良くなる場合だけ書き換える
+    if (optimal_cost_array[full_set] >= cost_array[root_index] * (1.0f - 1e-5f)) {
+        return false;
+    }
 
-    _is_leaf = true;
+    // 中間ノードを再利用して上から組み立てる
+    int num_used_internal_nodes = 1;
+    std::pair<int, int> stack[BVH_TREELET_NUM_LEAVES];
+    int stack_size = 0;
+    stack[stack_size++] = { root_index, full_set };
+    while (stack_size > 0) {
+        const int node_index = stack[stack_size - 1].first;
+        const int set = stack[stack_size - 1].second;
+        stack_size--;
+        Node& node = _build_node_array[node_index];
+        node.aabb_max = aabb_max_array[set];
+        node.aabb_min = aabb_min_array[set];
+        cost_array[node_index] = optimal_cost_array[set];
+        const int children[2] = { partition_array[set], set ^ partition_array[set] };
+        int child_index_array[2];
+        for (int k = 0; k < 2; k++) {
+            const int child_set = children[k];
+            if ((child_set & (child_set - 1)) == 0) {
+                child_index_array[k] = leaf_array[lowest_bit_index(child_set)];
+                continue;
+            }
+            child_index_array[k] = internal_node_array[num_used_internal_nodes++];
+            stack[stack_size++] = { child_index_array[k], child_set };
+        }
+        node.left = child_index_array[0];
+        node.right = child_index_array[1];
+    }
+    assert(num_used_internal_nodes == num_leaves - 1);
+    return true;
 }
-Node::Node(std::vector<int> assigned_face_indices,
-    std::shared_ptr<ConeGeometry>& geometry)
+// 全てのノードを下から順にtreeletの根として組み直す
+// "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies" [Karras and Aila 2013]
+// A treelet only contains nodes lower than its root, so the roots of one height are disjoint
+// and are processed in parallel; the result does not depend on the number of threads.
+// Returns true if any treelet was changed.
+bool BVH::restructure_treelets(float traversal_cost)
 {
-    assert(assigned_face_indices.size() > 0);
-    _assigned_face_indices = assigned_face_indices;
-    _index = 0;
-    _assigned_face_index_start = 0;
-    _assigned_face_index_end = 0;
+    auto start = std::chrono::steady_clock::now();
+    const int num_nodes = _num_build_nodes;
+    std::vector<int> order;
+    order.reserve(num_nodes);
+    std::vector<int> height_array(num_nodes);
+    std::vector<float> cost_array(num_nodes);
+    std::vector<int> node_index_array(num_nodes);
+    std::vector<int> height_offset_array;
+    bool restructured = false;
+    for (int iteration = 0; iteration < _treelet_iterations; iteration++) {
+        // 前順に並べて後ろから高さと部分木のSAHコストを求める
+        order.clear();
+        std::vector<int> stack = { 0 };
+        while (stack.empty() == false) {
+            const int node_index = stack.back();
+            stack.pop_back();
+            order.push_back(node_index);
+            const Node& node = _build_node_array[node_index];
+            if (node.is_leaf() == false) {
+                stack.push_back(node.right);
+                stack.push_back(node.left);
+            }
+        }
+        int max_height = 0;
+        for (int n = order.size() - 1; n >= 0; n--) {
+            const int node_index = order[n];
+            const Node& node = _build_node_array[node_index];
+            const float surface_area = compute_surface_area(node.aabb_max, node.aabb_min);
+            if (node.is_leaf()) {
+                height_array[node_index] = 0;
+                cost_array[node_index] = surface_area * (node.assigned_face_index_end - node.assigned_face_index_start + 1);
+                continue;
+            }
+            height_array[node_index] = std::max(height_array[node.left], height_array[node.right]) + 1;
+            cost_array[node_index] = traversal_cost * surface_area + cost_array[node.left] + cost_array[node.right];
+            max_height = std::max(max_height, height_array[node_index]);
+        }
+        // 高さごとにノードをまとめる（計数ソート）
+        height_offset_array.assign(max_height + 2, 0);
+        for (int node_index : order) {
+            height_offset_array[height_array[node_index] + 1]++;
+        }
+        for (int height = 0; height <= max_height; height++) {
+            height_offset_array[height + 1] += height_offset_array[height];
+        }
+        std::vector<int> next_array(height_offset_array.begin(), height_offset_array.end() - 1);
+        for (int node_index : order) {
+            node_index_array[next_array[height_array[node_index]]++] = node_index;
+        }
 
-    // AABBは使わない
-    _aabb_max = glm::vec3f(0.0f);
-    _aabb_min = glm::vec3f(0.0f);
+        std::atomic<int> num_restructured(0);
+        bool out_of_time = false;
+        // 葉が3つ以上あるのは高さ2以上のノード
+        for (int height = 2; height <= max_height; height++) {
+            const int begin = height_offset_array[height];
+            const int end = height_offset_array[height + 1];
+            for (int chunk_begin = begin; chunk_begin < end; chunk_begin += BVH_TREELET_TASK_SIZE) {
+                const int chunk_end = std::min(chunk_begin + BVH_TREELET_TASK_SIZE, end);
+#pragma omp task firstprivate(chunk_begin, chunk_end) shared(num_restructured, cost_array, node_index_array)
+                for (int n = chunk_begin; n < chunk_end; n++) {
+                    if (restructure_treelet(node_index_array[n], cost_array, traversal_cost)) {
+                        num_restructured++;
+                    }
+                }
+            }
+#pragma omp taskwait
+            if (_treelet_time_budget_ms > 0.0f && std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() > _treelet_time_budget_ms) {
+                out_of_time = true;
+                break;
+            }
+        }
+        restructured |= num_restructured > 0;
+        if (num_restructured == 0 || out_of_time) {
+            break;
+        }
+    }
+    return restructured;
+}
+// 前順に並べ替えてThreaded BVHのリンクを張る
+// hit: 中間ノードは左の子、葉は-1
+// miss: 左の子は右の兄弟、右の子は親のmiss
+void BVH::finalize_nodes()
+{
+    const int num_nodes = _num_build_nodes;
+    std::vector<int> serial_index_array(num_nodes);
+    std::vector<int> stack = { 0 };
+    int serial_index = 0;
+    while (stack.empty() == false) {
+        int node_index = stack.back();
+        stack.pop_back();
+        serial_index_array[node_index] = serial_index++;
+        const Node& node = _build_node_array[node_index];
+        if (node.is_leaf() == false) {
+            stack.push_back(node.right);
+            stack.push_back(node.left);
+        }
+    }
 
-    _is_leaf = true;
+    _node_array.resize(num_nodes);
+    for (int node_index = 0; node_index < num_nodes; node_index++) {
+        Node node = _build_node_array[node_index];
+        if (node.is_leaf() == false) {
+            node.left = serial_index_array[node.left];
+            node.right = serial_index_array[node.right];
+        }
+        _node_array[serial_index_array[node_index]] = node;
+    }
+
+    link_threaded_nodes(_node_array);
 }
-void Node::set_hit_and_miss_links()
+// 前順に並んだノードを_node_layoutの順に並べ替えてリンクを張り直す
+// Run after finalize_nodes, so a cached tree is stored in its final layout.
+void BVH::layout_nodes()
 {
-    if (_left) {
-        _hit = _left;
-        if (_right) {
-            _left->_miss = _right;
-        } else {
-            _left->_miss = _miss;
+    if (_node_layout == RTXBVHNodeLayoutDepthFirst) {
+        return;
+    }
+    const int num_nodes = _node_array.size();
+    const NodeChildren node_children = collect_node_children(num_nodes, [&](int node_index, auto function) {
+        const Node& node = _node_array[node_index];
+        if (node.is_leaf() == false) {
+            function(node.left);
+            function(node.right);
         }
-        _left->set_hit_and_miss_links();
+    });
+    const int cluster_size = std::max(1, _node_cluster_bytes / (int)sizeof(rtxThreadedBVHNode));
+    const std::vector<int> order = compute_node_layout(node_children, _node_layout, cluster_size);
+    std::vector<int> serial_index_array(num_nodes);
+    for (int serial_index = 0; serial_index < num_nodes; serial_index++) {
+        serial_index_array[order[serial_index]] = serial_index;
     }
-    if (_right) {
-        _right->_miss = _miss;
-        _right->set_hit_and_miss_links();
+    std::vector<Node> node_array(num_nodes);
+    for (int serial_index = 0; serial_index < num_nodes; serial_index++) {
+        Node node = _node_array[order[serial_index]];
+        if (node.is_leaf() == false) {
+            node.left = serial_index_array[node.left];
+            node.right = serial_index_array[node.right];
+        }
+        node_array[serial_index] = node;
     }
+    _node_array.swap(node_array);
+    link_threaded_nodes(_node_array);
 }
-int Node::num_children()
+// 子の中で表面積が最大の中間ノードをその子で置き換えることを繰り返し、
+// RTX_CPU_WIDE_BVH_WIDTH個までの子を1つのノードにまとめる
+// Returns the index of the new wide node; nodes are emitted in pre-order.
+int BVH::collapse_node(int node_index)
 {
-    int num_children = 0;
-    if (_left) {
-        num_children += _left->num_children() + 1;
+    int lane_node_index_array[RTX_CPU_WIDE_BVH_WIDTH];
+    int num_lanes = 0;
+    const Node& node = _node_array[node_index];
+    if (node.is_leaf()) {
+        // 根が葉の場合
+        lane_node_index_array[num_lanes++] = node_index;
+    } else {
+        lane_node_index_array[num_lanes++] = node.left;
+        // 球・円柱・円錐の根は子が1つしかない
+        if (node.right != -1) {
+            lane_node_index_array[num_lanes++] = node.right;
+        }
+    }
+    while (num_lanes < RTX_CPU_WIDE_BVH_WIDTH) {
+        int expanded_lane = -1;
+        float max_surface_area = -1.0f;
+        for (int lane = 0; lane < num_lanes; lane++) {
+            const Node& lane_node = _node_array[lane_node_index_array[lane]];
+            if (lane_node.is_leaf()) {
+                continue;
+            }
+            const float surface_area = compute_surface_area(lane_node.aabb_max, lane_node.aabb_min);
+            if (surface_area > max_surface_area) {
+                max_surface_area = surface_area;
+                expanded_lane = lane;
+            }
+        }
+        if (expanded_lane == -1) {
+            break;
+        }
+        const Node& expanded_node = _node_array[lane_node_index_array[expanded_lane]];
+        lane_node_index_array[expanded_lane] = expanded_node.left;
+        if (expanded_node.right != -1) {
+            lane_node_index_array[num_lanes++] = expanded_node.right;
+        }
     }
-    if (_right) {
-        num_children += _right->num_children() + 1;
+
+    // 子を作ると配列が伸びるので、値は最後に書き込む
+    const int wide_node_index = _wide_node_array.size();
+    _wide_node_array.emplace_back();
+    WideNode wide_node;
+    for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+        wide_node.node_index[lane] = -1;
+        wide_node.child_node_index[lane] = -1;
     }
-    return num_children;
+    for (int lane = 0; lane < num_lanes; lane++) {
+        const int lane_node_index = lane_node_index_array[lane];
+        wide_node.node_index[lane] = lane_node_index;
+        if (_node_array[lane_node_index].is_leaf() == false) {
+            wide_node.child_node_index[lane] = collapse_node(lane_node_index);
+        }
+    }
+    _wide_node_array[wide_node_index] = wide_node;
+    return wide_node_index;
 }
-void Node::collect_children(std::vector<std::shared_ptr<Node>>& children)
+void BVH::collapse_to_wide_nodes()
 {
-    if (_left) {
-        children.push_back(_left);
-        _left->collect_children(children);
+    _wide_node_array.clear();
+    collapse_node(0);
+    if (_node_layout == RTXBVHNodeLayoutDepthFirst) {
+        return;
+    }
+    // 多分岐ノードも同じ方法で並べ替える
+    // The cluster size is counted in full-precision wide nodes; quantized nodes then use a quarter of each cluster.
+    const int num_wide_nodes = _wide_node_array.size();
+    const NodeChildren node_children = collect_node_children(num_wide_nodes, [&](int wide_node_index, auto function) {
+        const WideNode& wide_node = _wide_node_array[wide_node_index];
+        for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+            if (wide_node.child_node_index[lane] != -1) {
+                function(wide_node.child_node_index[lane]);
+            }
+        }
+    });
+    const int cluster_size = std::max(1, _node_cluster_bytes / (int)sizeof(rtxCPUWideBVHNode));
+    const std::vector<int> order = compute_node_layout(node_children, _node_layout, cluster_size);
+    std::vector<int> serial_index_array(num_wide_nodes);
+    for (int serial_index = 0; serial_index < num_wide_nodes; serial_index++) {
+        serial_index_array[order[serial_index]] = serial_index;
     }
-    if (_right) {
-        children.push_back(_right);
-        _right->collect_children(children);
+    std::vector<WideNode> wide_node_array(num_wide_nodes);
+    for (int serial_index = 0; serial_index < num_wide_nodes; serial_index++) {
+        WideNode wide_node = _wide_node_array[order[serial_index]];
+        for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+            if (wide_node.child_node_index[lane] != -1) {
+                wide_node.child_node_index[lane] = serial_index_array[wide_node.child_node_index[lane]];
+            }
+        }
+        wide_node_array[serial_index] = wide_node;
     }
+    _wide_node_array.swap(wide_node_array);
 }
-void Node::collect_leaves(std::vector<std::shared_ptr<Node>>& leaves)
+// 葉を前から順に見て、初めて使われた頂点から番号を振る
+// Input meshes are often ordered by how they were modelled, so the three vertices of a face
+// and the faces of one leaf can be megabytes apart; after this a leaf usually touches one or two cache lines.
+// Faces duplicated by spatial splits keep the number from their first leaf.
+void BVH::reorder_vertices(const std::shared_ptr<StandardGeometry>& geometry)
 {
-    if (_left) {
-        if (_left->_is_leaf) {
-            leaves.push_back(_left);
-        } else {
-            _left->collect_leaves(leaves);
+    const int num_vertices = geometry->_vertex_array.size();
+    _serial_vertex_index_array.assign(num_vertices, -1);
+    _vertex_index_array.clear();
+    _vertex_index_array.reserve(num_vertices);
+    for (int face_index : _face_index_array) {
+        const glm::vec3i& face = geometry->_face_vertex_indices_array[face_index];
+        for (int k = 0; k < 3; k++) {
+            if (_serial_vertex_index_array[face[k]] == -1) {
+                _serial_vertex_index_array[face[k]] = _vertex_index_array.size();
+                _vertex_index_array.push_back(face[k]);
+            }
+        }
+    }
+    // どの面からも使われない頂点は末尾に元の順で置く
+    for (int vertex_index = 0; vertex_index < num_vertices; vertex_index++) {
+        if (_serial_vertex_index_array[vertex_index] == -1) {
+            _serial_vertex_index_array[vertex_index] = _vertex_index_array.size();
+            _vertex_index_array.push_back(vertex_index);
+        }
+    }
+}
+namespace {
+    // このCPUで一度だけ測るコストモデルの定数（ns）
+    // cost = node_cost * node_term + triangle_cost * triangle_term
+    struct BVHCostModel {
+        float node_cost;
+        float triangle_cost;
+    };
+    // 合成したメッシュを葉の大きさとビルダーを変えて構築して実際に辿り、
+    // かかった時間に2つの項を最小二乗で合わせる
+    // Fitting end-to-end traversal times folds stack handling, child sorting and cache misses
+    // into the two constants, which timing the box and triangle tests alone would miss.
+    BVHCostModel calibrate_cost_model()
+    {
+        const int grid_size = BVH_AUTO_CALIBRATION_GRID_SIZE;
+        auto standard = std::make_shared<StandardGeometry>();
+        for (int i = 0; i <= grid_size; i++) {
+            for (int j = 0; j <= grid_size; j++) {
+                const float x = float(i) / grid_size;
+                const float z = float(j) / grid_size;
+                const float y = 0.1f * sinf(17.0f * x) * cosf(13.0f * z) + 0.02f * sinf(71.0f * x + 37.0f * z);
+                standard->add_vertex(glm::vec3f(x, y, z));
+            }
+        }
+        for (int i = 0; i < grid_size; i++) {
+            for (int j = 0; j < grid_size; j++) {
+                const int a = i * (grid_size + 1) + j;
+                const int c = a + grid_size + 1;
+                standard->add_face(glm::vec3i(a, a + 1, c));
+                standard->add_face(glm::vec3i(a + 1, c + 1, c));
+            }
+        }
+        std::shared_ptr<Geometry> geometry = standard;
+        const int num_faces = standard->num_faces();
+        const int num_vertices = standard->num_vertices();
+
+        const int candidate_array[][2] = {
+            { RTXBVHBuilderBinnedSAH, 1 },
+            { RTXBVHBuilderBinnedSAH, 4 },
+            { RTXBVHBuilderMedian, 2 },
+            { RTXBVHBuilderMedian, 8 },
+            { RTXBVHBuilderMedian, 32 },
+        };
+        // 正規方程式
+        double sum_nn = 0.0, sum_nt = 0.0, sum_tt = 0.0, sum_n_time = 0.0, sum_t_time = 0.0;
+        for (const auto& candidate : candidate_array) {
+            standard->set_bvh_builder(candidate[0]);
+            standard->set_bvh_max_triangles_per_node(candidate[1]);
+            BVH bvh(geometry, false);
+            float node_term, triangle_term;
+            bvh.compute_traversal_cost_terms(node_term, triangle_term);
+            rtx::array<rtxFaceVertexIndex> face_array(num_faces);
+            bvh.serialize_faces(face_array, 0);
+            rtx::array<rtxVertex> vertex_array(num_vertices);
+            bvh.serialize_vertices(vertex_array, 0);
+            rtx::array<rtxCPUWideBVHNode> wide_node_array(bvh.num_wide_nodes());
+            bvh.serialize_wide_nodes(wide_node_array, 0);
+            const float time = rtx_cpu_measure_wide_bvh_traversal(face_array.data(), vertex_array.data(), num_faces, num_vertices,
+                wide_node_array.data(), BVH_AUTO_CALIBRATION_NUM_RAYS);
+            sum_nn += node_term * node_term;
+            sum_nt += node_term * triangle_term;
+            sum_tt += triangle_term * triangle_term;
+            sum_n_time += node_term * time;
+            sum_t_time += triangle_term * time;
         }
+        BVHCostModel model;
+        const double determinant = sum_nn * sum_tt - sum_nt * sum_nt;
+        model.node_cost = (sum_n_time * sum_tt - sum_t_time * sum_nt) / determinant;
+        model.triangle_cost = (sum_t_time * sum_nn - sum_n_time * sum_nt) / determinant;
+        // 計測が乱れて負になった場合でも候補の順位が付けられるように正に保つ
+        if (model.node_cost <= 0.0f || model.triangle_cost <= 0.0f || std::isfinite(determinant) == false) {
+            model.node_cost = std::max(model.node_cost, 1e-3f);
+            model.triangle_cost = std::max(model.triangle_cost, 1e-3f);
+        }
+        return model;
+    }
+    const BVHCostModel& calibrated_cost_model()
+    {
+        static const BVHCostModel cost_model = calibrate_cost_model();
+        return cost_model;
+    }
+}
+void BVH::prepare_cost_model(const std::shared_ptr<Geometry>& geometry)
+{
+    if (geometry->type() != RTXGeometryTypeStandard) {
+        return;
+    }
+    const StandardGeometry* standard = static_cast<const StandardGeometry*>(geometry.get());
+    if (standard->bvh_builder() == RTXBVHBuilderAuto || standard->bvh_max_triangles_per_node() == BVH_AUTO_TRIANGLES_PER_NODE) {
+        calibrated_cost_model();
     }
-    if (_right) {
-        if (_right->_is_leaf) {
-            leaves.push_back(_right);
+}
+void BVH::build(const std::shared_ptr<StandardGeometry>& standard)
+{
+    if (standard->bvh_builder() == RTXBVHBuilderAuto || standard->bvh_max_triangles_per_node() == BVH_AUTO_TRIANGLES_PER_NODE) {
+        select_and_build(standard);
+        return;
+    }
+    build(standard, standard->bvh_builder(), standard->bvh_max_triangles_per_node());
+}
+// 多分岐ノードのAは子のレーンのAABBの和集合（子を調べる時にレイが当たっている箱）
+// A of a wide node is the union of its lanes, i.e. the box a ray must hit for the node to be visited.
+void BVH::compute_traversal_cost_terms(float& node_term, float& triangle_term)
+{
+    node_term = 0.0f;
+    triangle_term = 0.0f;
+    const float root_surface_area = compute_surface_area(_node_array[0].aabb_max, _node_array[0].aabb_min);
+    if (root_surface_area <= 0.0f) {
+        return;
+    }
+    double node_sum = 0.0;
+    double triangle_sum = 0.0;
+    for (const WideNode& wide_node : _wide_node_array) {
+        glm::vec3f aabb_max(-FLT_MAX);
+        glm::vec3f aabb_min(FLT_MAX);
+        for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+            if (wide_node.node_index[lane] == -1) {
+                continue;
+            }
+            const Node& node = _node_array[wide_node.node_index[lane]];
+            merge_aabb_max(aabb_max, node.aabb_max, aabb_max);
+            merge_aabb_min(aabb_min, node.aabb_min, aabb_min);
+        }
+        node_sum += compute_surface_area(aabb_max, aabb_min);
+    }
+    for (const Node& node : _node_array) {
+        if (node.is_leaf()) {
+            triangle_sum += compute_surface_area(node.aabb_max, node.aabb_min) * (node.assigned_face_index_end - node.assigned_face_index_start + 1);
+        }
+    }
+    node_term = node_sum / root_surface_area;
+    triangle_term = triangle_sum / root_surface_area;
+}
+// 候補のビルダーと葉の面数の上限で実際に構築し、測ったコストモデルで最も安い木を残す
+// Leaf sizes are tried in increasing order until the estimate gets worse or the tree stops changing
+// (SAH builders make leaves on their own below the limit). SBVH is only tried at the leaf size
+// that won for binned SAH, since it is several times slower to build.
+void BVH::select_and_build(const std::shared_ptr<StandardGeometry>& standard)
+{
+    auto start = std::chrono::steady_clock::now();
+    const BVHCostModel& cost_model = calibrated_cost_model();
+    const bool auto_builder = standard->bvh_builder() == RTXBVHBuilderAuto;
+    const bool auto_leaf_size = standard->bvh_max_triangles_per_node() == BVH_AUTO_TRIANGLES_PER_NODE;
+
+    std::vector<int> builder_array = { RTXBVHBuilderBinnedSAH, RTXBVHBuilderMedian };
+    if (auto_builder == false) {
+        builder_array = { standard->bvh_builder() };
+    }
+    std::vector<int> leaf_size_array;
+    if (auto_leaf_size) {
+        for (int leaf_size = 1; leaf_size <= BVH_AUTO_MAX_TRIANGLES_PER_NODE; leaf_size *= 2) {
+            leaf_size_array.push_back(leaf_size);
+        }
+    } else {
+        leaf_size_array = { standard->bvh_max_triangles_per_node() };
+    }
+
+    float best_cost = FLT_MAX;
+    int best_builder = -1;
+    int best_leaf_size = -1;
+    float best_sah_cost = 0.0f;
+    std::vector<Node> best_node_array;
+    std::vector<int> best_face_index_array;
+    std::vector<WideNode> best_wide_node_array;
+    // 構築して見積もり、最良なら退避する
+    auto try_candidate = [&](int builder, int max_triangles_per_node, int& num_nodes) {
+        build(standard, builder, max_triangles_per_node);
+        num_nodes = _node_array.size();
+        float node_term, triangle_term;
+        compute_traversal_cost_terms(node_term, triangle_term);
+        const float cost = cost_model.node_cost * node_term + cost_model.triangle_cost * triangle_term;
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_builder = builder;
+            best_leaf_size = max_triangles_per_node;
+            best_sah_cost = _sah_cost_at_build;
+            _node_array.swap(best_node_array);
+            _face_index_array.swap(best_face_index_array);
+            _wide_node_array.swap(best_wide_node_array);
+        }
+        return cost;
+    };
+
+    int best_binned_sah_leaf_size = leaf_size_array.front();
+    float best_binned_sah_cost = FLT_MAX;
+    for (int builder : builder_array) {
+        float prev_cost = FLT_MAX;
+        int prev_num_nodes = -1;
+        for (int leaf_size : leaf_size_array) {
+            int num_nodes;
+            const float cost = try_candidate(builder, leaf_size, num_nodes);
+            if (builder == RTXBVHBuilderBinnedSAH && cost < best_binned_sah_cost) {
+                best_binned_sah_cost = cost;
+                best_binned_sah_leaf_size = leaf_size;
+            }
+            if (cost > prev_cost || num_nodes == prev_num_nodes) {
+                break;
+            }
+            prev_cost = cost;
+            prev_num_nodes = num_nodes;
+        }
+    }
+    if (auto_builder && _spatial_splits_allowed) {
+        int num_nodes;
+        try_candidate(RTXBVHBuilderSBVH, best_binned_sah_leaf_size, num_nodes);
+    }
+
+    _node_array.swap(best_node_array);
+    _face_index_array.swap(best_face_index_array);
+    _wide_node_array.swap(best_wide_node_array);
+    _builder = best_builder;
+    _max_triangles_per_node = best_leaf_size;
+    _sah_cost_at_build = best_sah_cost;
+    _build_time_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+void BVH::build(const std::shared_ptr<StandardGeometry>& standard, int builder, int max_triangles_per_node)
+{
+    auto start = std::chrono::steady_clock::now();
+    _builder = builder;
+    _max_triangles_per_node = max_triangles_per_node;
+    assert(_max_triangles_per_node > 0);
+    const int num_faces = standard->_face_vertex_indices_array.size();
+    assert(num_faces > 0);
+    const bool use_spatial_splits = _builder == RTXBVHBuilderSBVH && _spatial_splits_allowed;
+    bool restructured = false;
+    const int max_spatial_split_references = use_spatial_splits ? int(num_faces * standard->bvh_spatial_split_budget()) : 0;
+    const int max_face_references = num_faces + max_spatial_split_references;
+    _face_index_array.resize(max_face_references);
+    std::iota(_face_index_array.begin(), _face_index_array.begin() + num_faces, 0);
+    _scratch_face_index_array.resize(num_faces);
+    _face_aabb_max_array.resize(num_faces);
+    _face_aabb_min_array.resize(num_faces);
+    _face_center_array.resize(num_faces);
+    _num_face_references = 0;
+    _num_remaining_spatial_split_references = max_spatial_split_references;
+
+    // 葉が1面以上を持つ二分木のノード数は高々2N-1（Nは参照の数）
+    _build_node_array.resize(2 * max_face_references - 1);
+    _num_build_nodes = 1;
+
+    auto construct = [&]() {
+        parallel_for_chunks(0, num_faces, [&](int, int chunk_begin, int chunk_end) {
+            for (int face_index = chunk_begin; face_index < chunk_end; face_index++) {
+                auto& face = standard->_face_vertex_indices_array[face_index];
+                auto& va = standard->_vertex_array[face[0]];
+                auto& vb = standard->_vertex_array[face[1]];
+                auto& vc = standard->_vertex_array[face[2]];
+                glm::vec3f max(-FLT_MAX);
+                glm::vec3f min(FLT_MAX);
+                merge_aabb_max(max, va, max);
+                merge_aabb_min(min, va, min);
+                merge_aabb_max(max, vb, max);
+                merge_aabb_min(min, vb, min);
+                merge_aabb_max(max, vc, max);
+                merge_aabb_min(min, vc, min);
+                _face_aabb_max_array[face_index] = max;
+                _face_aabb_min_array[face_index] = min;
+                _face_center_array[face_index] = glm::vec3f(va + vb + vc) / 3.0f;
+            }
+        });
+        if (use_spatial_splits) {
+            std::vector<Reference> references(num_faces);
+            for (int face_index = 0; face_index < num_faces; face_index++) {
+                references[face_index] = { _face_aabb_min_array[face_index], _face_aabb_max_array[face_index], face_index };
+            }
+            glm::vec3f root_aabb_max(-FLT_MAX);
+            glm::vec3f root_aabb_min(FLT_MAX);
+            for (int face_index = 0; face_index < num_faces; face_index++) {
+                merge_aabb_max(root_aabb_max, _face_aabb_max_array[face_index], root_aabb_max);
+                merge_aabb_min(root_aabb_min, _face_aabb_min_array[face_index], root_aabb_min);
+            }
+            _root_surface_area = compute_surface_area(root_aabb_max, root_aabb_min);
+            build_sbvh_node(0, references, standard);
         } else {
-            _right->collect_leaves(leaves);
+            build_node(0, 0, num_faces, standard);
         }
+        if (_treelet_iterations > 0) {
+            restructured = restructure_treelets(standard->bvh_sah_traversal_cost());
+        }
+    };
+    // 既に並列領域内(Renderer::construct_bvh)ならそのチームでタスクを実行する
+    if (omp_in_parallel()) {
+        construct();
+    } else {
+#pragma omp parallel
+#pragma omp single
+        construct();
+    }
+    if (use_spatial_splits) {
+        compact_sbvh_leaves(_num_face_references);
+    } else if (restructured) {
+        compact_sbvh_leaves(num_faces);
     }
+    finalize_nodes();
+    layout_nodes();
+    collapse_to_wide_nodes();
+
+    // 作業領域を解放
+    std::vector<Node>().swap(_build_node_array);
+    std::vector<int>().swap(_scratch_face_index_array);
+    std::vector<glm::vec3f>().swap(_face_aabb_max_array);
+    std::vector<glm::vec3f>().swap(_face_aabb_min_array);
+    std::vector<glm::vec3f>().swap(_face_center_array);
+
+    _sah_cost_at_build = compute_sah_cost();
+    _build_time_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
-BVH::BVH(std::shared_ptr<Geometry>& geometry)
+BVH::BVH(std::shared_ptr<Geometry>& geometry, bool spatial_splits_allowed, BVHCache* cache)
 {
     _geometry = geometry;
-    std::vector<int> assigned_face_indices;
+    _sah_cost_at_build = 0.0f;
+    _build_time_ms = 0.0f;
+    _builder = geometry->bvh_builder();
+    _max_triangles_per_node = geometry->bvh_max_triangles_per_node();
+    _spatial_splits_allowed = spatial_splits_allowed;
+    _node_layout = geometry->bvh_node_layout();
+    _node_cluster_bytes = geometry->bvh_node_cluster_bytes();
+    _treelet_iterations = geometry->bvh_treelet_iterations();
+    _treelet_time_budget_ms = geometry->bvh_treelet_time_budget_ms();
+    _coarse_leaf = false;
     if (geometry->type() == RTXGeometryTypeStandard) {
         std::shared_ptr<StandardGeometry> standard = std::static_pointer_cast<StandardGeometry>(geometry);
-        for (int face_index = 0; face_index < (int)standard->_face_vertex_indices_array.size(); face_index++) {
-            assigned_face_indices.push_back(face_index);
+        if (cache != NULL && cache->enabled()) {
+            const uint64_t key = cache->compute_key(*standard, spatial_splits_allowed);
+            if (cache->load(key, *standard, *this) == false) {
+                build(standard);
+                cache->store(key, *standard, *this);
+            }
+        } else {
+            build(standard);
         }
-        _current_node_index = 0;
-        _current_assigned_face_index_offset = 0;
-        _root = std::make_shared<Node>(assigned_face_indices, standard, _current_node_index, _current_assigned_face_index_offset);
-        _root->set_hit_and_miss_links();
-
-        _num_nodes = _root->num_children() + 1;
+        reorder_vertices(standard);
         return;
     }
-    if (geometry->type() == RTXGeometryTypeSphere) {
-        std::shared_ptr<SphereGeometry> sphere = std::static_pointer_cast<SphereGeometry>(geometry);
-        std::vector<int> assigned_face_indices;
-        for (int face_index = 0; face_index < geometry->num_faces(); face_index++) {
-            assigned_face_indices.push_back(face_index);
+
+    // 球・円柱・円錐はAABBだけを持つ根と1つの葉ノードからなる
+    // Every kernel tests the root's box first, so a ray that misses it skips the quadric test.
+    Node root;
+    geometry->compute_aabb(root.aabb_min, root.aabb_max);
+    root.left = 1;
+    root.right = -1;
+    root.hit = 1;
+    root.miss = -1;
+    root.assigned_face_index_start = -1;
+    root.assigned_face_index_end = -1;
+    Node leaf = root;
+    leaf.left = -1;
+    leaf.hit = -1;
+    leaf.assigned_face_index_start = 0;
+    leaf.assigned_face_index_end = 0;
+    _node_array = { root, leaf };
+    collapse_to_wide_nodes();
+}
+BVH::BVH()
+{
+}
+std::shared_ptr<BVH> BVH::coarse_leaf(std::shared_ptr<Geometry>& geometry)
+{
+    assert(geometry->type() == RTXGeometryTypeStandard);
+    std::shared_ptr<StandardGeometry> standard = std::static_pointer_cast<StandardGeometry>(geometry);
+    std::shared_ptr<BVH> bvh(new BVH());
+    bvh->_geometry = geometry;
+    bvh->_build_time_ms = 0.0f;
+    bvh->_builder = geometry->bvh_builder();
+    bvh->_max_triangles_per_node = geometry->bvh_max_triangles_per_node();
+    bvh->_spatial_splits_allowed = false;
+    bvh->_node_layout = geometry->bvh_node_layout();
+    bvh->_node_cluster_bytes = geometry->bvh_node_cluster_bytes();
+    bvh->_treelet_iterations = geometry->bvh_treelet_iterations();
+    bvh->_treelet_time_budget_ms = geometry->bvh_treelet_time_budget_ms();
+    bvh->_coarse_leaf = true;
+
+    const int num_faces = standard->_face_vertex_indices_array.size();
+    assert(num_faces > 0);
+    bvh->_face_index_array.resize(num_faces);
+    std::iota(bvh->_face_index_array.begin(), bvh->_face_index_array.end(), 0);
+    // 根のAABBは構築した木と同じく面の頂点から求める
+    Node root;
+    root.aabb_max = glm::vec3f(-FLT_MAX);
+    root.aabb_min = glm::vec3f(FLT_MAX);
+    for (auto& face : standard->_face_vertex_indices_array) {
+        for (int k = 0; k < 3; k++) {
+            auto& vertex = standard->_vertex_array[face[k]];
+            merge_aabb_max(root.aabb_max, vertex, root.aabb_max);
+            merge_aabb_min(root.aabb_min, vertex, root.aabb_min);
         }
-        _current_node_index = 0;
-        _current_assigned_face_index_offset = 0;
-        _root = std::make_shared<Node>(assigned_face_indices, sphere);
-        _root->set_hit_and_miss_links();
+    }
+    root.left = -1;
+    root.right = -1;
+    root.assigned_face_index_start = 0;
+    root.assigned_face_index_end = num_faces - 1;
+    bvh->_node_array = { root };
+    link_threaded_nodes(bvh->_node_array);
+    bvh->collapse_to_wide_nodes();
+    bvh->_sah_cost_at_build = bvh->compute_sah_cost();
+    return bvh;
+}
+bool BVH::is_coarse_leaf() const
+{
+    return _coarse_leaf;
+}
+int BVH::num_nodes()
+{
+    return _node_array.size();
+}
+int BVH::num_face_references()
+{
+    auto geometry = _geometry.lock();
+    assert(geometry);
+    if (geometry->type() == RTXGeometryTypeStandard) {
+        return _face_index_array.size();
+    }
+    return geometry->num_faces();
+}
+bool BVH::refit()
+{
+    assert(_geometry.expired() == false);
+    auto geometry = _geometry.lock();
+    if (geometry->type() != RTXGeometryTypeStandard) {
+        return true;
+    }
+    std::shared_ptr<StandardGeometry> standard = std::static_pointer_cast<StandardGeometry>(geometry);
 
-        _num_nodes = _root->num_children() + 1;
-        return;
+    // 葉のAABBを面から計算する
+    const int num_nodes = _node_array.size();
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int node_index = 0; node_index < num_nodes; node_index++) {
+        Node& node = _node_array[node_index];
+        if (node.is_leaf() == false) {
+            continue;
+        }
+        node.aabb_max = glm::vec3f(-FLT_MAX);
+        node.aabb_min = glm::vec3f(FLT_MAX);
+        for (int n = node.assigned_face_index_start; n <= node.assigned_face_index_end; n++) {
+            auto& face = standard->_face_vertex_indices_array[_face_index_array[n]];
+            for (int k = 0; k < 3; k++) {
+                auto& vertex = standard->_vertex_array[face[k]];
+                merge_aabb_max(node.aabb_max, vertex, node.aabb_max);
+                merge_aabb_min(node.aabb_min, vertex, node.aabb_min);
+            }
+        }
     }
-    if (geometry->type() == RTXGeometryTypeCylinder) {
-        std::shared_ptr<CylinderGeometry> cylinder = std::static_pointer_cast<CylinderGeometry>(geometry);
-        std::vector<int> assigned_face_indices;
-        for (int face_index = 0; face_index < geometry->num_faces(); face_index++) {
-            assigned_face_indices.push_back(face_index);
+    // どの並べ方でも子は必ず親より後ろにある
+    // Walking the array backwards visits both children before their parent.
+    for (int node_index = num_nodes - 1; node_index >= 0; node_index--) {
+        Node& node = _node_array[node_index];
+        if (node.is_leaf()) {
+            continue;
         }
-        _current_node_index = 0;
-        _current_assigned_face_index_offset = 0;
-        _root = std::make_shared<Node>(assigned_face_indices, cylinder);
-        _root->set_hit_and_miss_links();
+        const Node& left = _node_array[node.left];
+        const Node& right = _node_array[node.right];
+        merge_aabb_max(left.aabb_max, right.aabb_max, node.aabb_max);
+        merge_aabb_min(left.aabb_min, right.aabb_min, node.aabb_min);
+    }
 
-        _num_nodes = _root->num_children() + 1;
-        return;
+    // 粗い葉は作り直さない（遅延構築に任せる）
+    const float threshold = standard->bvh_refit_rebuild_threshold();
+    if (_coarse_leaf == false && threshold > 0.0f && compute_sah_cost() > threshold * _sah_cost_at_build) {
+        build(standard, _builder, _max_triangles_per_node);
+        reorder_vertices(standard);
+        return false;
     }
-    if (geometry->type() == RTXGeometryTypeCone) {
-        std::shared_ptr<ConeGeometry> cone = std::static_pointer_cast<ConeGeometry>(geometry);
-        std::vector<int> assigned_face_indices;
-        for (int face_index = 0; face_index < geometry->num_faces(); face_index++) {
-            assigned_face_indices.push_back(face_index);
+    return true;
+}
+void BVH::object_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max)
+{
+    aabb_min = _node_array[0].aabb_min;
+    aabb_max = _node_array[0].aabb_max;
+}
+// 根のAABBの表面積で正規化したSAHコスト（三角形1枚との交差判定を1とする）
+// cost = sum_inner(C_t * A(n)) / A(root) + sum_leaf(N(n) * A(n)) / A(root)
+float BVH::compute_sah_cost()
+{
+    auto geometry = _geometry.lock();
+    assert(geometry);
+    const float root_surface_area = compute_surface_area(_node_array[0].aabb_max, _node_array[0].aabb_min);
+    if (root_surface_area <= 0.0f) {
+        return 0.0f;
+    }
+    const float traversal_cost = geometry->bvh_sah_traversal_cost();
+    double cost = 0.0;
+    for (const Node& node : _node_array) {
+        const float surface_area = compute_surface_area(node.aabb_max, node.aabb_min);
+        if (node.is_leaf()) {
+            cost += surface_area * (node.assigned_face_index_end - node.assigned_face_index_start + 1);
+        } else {
+            cost += surface_area * traversal_cost;
         }
-        _current_node_index = 0;
-        _current_assigned_face_index_offset = 0;
-        _root = std::make_shared<Node>(assigned_face_indices, cone);
-        _root->set_hit_and_miss_links();
+    }
+    return cost / root_surface_area;
+}
+float compute_volume(const glm::vec3f& max, const glm::vec3f& min)
+{
+    const glm::vec3f extent = glm::max(max - min, glm::vec3f(0.0f));
+    return extent.x * extent.y * extent.z;
+}
+Stats BVH::stats()
+{
+    auto geometry = _geometry.lock();
+    assert(geometry);
+    Stats stats;
+    stats.builder = _builder;
+    stats.max_triangles_per_node = _max_triangles_per_node;
+    stats.num_faces = geometry->num_faces();
+    stats.num_face_references = num_face_references();
+    stats.num_nodes = _node_array.size();
+    stats.num_wide_nodes = _wide_node_array.size();
+    stats.sah_cost = compute_sah_cost();
+    stats.build_time_ms = _build_time_ms;
+    stats.threaded_node_bytes = _node_array.size() * sizeof(rtxThreadedBVHNode);
+    stats.wide_node_bytes = _wide_node_array.size() * sizeof(rtxCPUWideBVHNode);
+    stats.quantized_wide_node_bytes = _wide_node_array.size() * sizeof(rtxCPUQuantizedWideBVHNode);
+    stats.face_bytes = stats.num_face_references * sizeof(rtxFaceVertexIndex);
 
-        _num_nodes = _root->num_children() + 1;
-        return;
+    const float root_surface_area = compute_surface_area(_node_array[0].aabb_max, _node_array[0].aabb_min);
+    double total_leaf_depth = 0.0;
+    double total_leaf_size = 0.0;
+    double total_overlap = 0.0;
+    double total_empty_space = 0.0;
+    int num_empty_space_nodes = 0;
+    std::vector<std::pair<int, int>> stack = { { 0, 0 } };
+    while (stack.empty() == false) {
+        const int node_index = stack.back().first;
+        const int depth = stack.back().second;
+        stack.pop_back();
+        const Node& node = _node_array[node_index];
+        stats.max_depth = std::max(stats.max_depth, depth);
+        if (node.is_leaf()) {
+            const int num_faces = node.assigned_face_index_end - node.assigned_face_index_start + 1;
+            if ((int)stats.leaf_size_histogram.size() <= num_faces) {
+                stats.leaf_size_histogram.resize(num_faces + 1, 0);
+            }
+            stats.leaf_size_histogram[num_faces]++;
+            stats.num_leaves++;
+            total_leaf_depth += depth;
+            total_leaf_size += num_faces;
+            continue;
+        }
+        // 球などの根は子を1つだけ持つ
+        if (node.right == -1) {
+            stack.push_back({ node.left, depth + 1 });
+            continue;
+        }
+        const Node& left = _node_array[node.left];
+        const Node& right = _node_array[node.right];
+        glm::vec3f overlap_max, overlap_min;
+        merge_aabb_min(left.aabb_max, right.aabb_max, overlap_max);
+        merge_aabb_max(left.aabb_min, right.aabb_min, overlap_min);
+        const bool overlapped = overlap_min.x <= overlap_max.x && overlap_min.y <= overlap_max.y && overlap_min.z <= overlap_max.z;
+        if (overlapped && root_surface_area > 0.0f) {
+            total_overlap += compute_surface_area(overlap_max, overlap_min) / root_surface_area;
+        }
+        const float volume = compute_volume(node.aabb_max, node.aabb_min);
+        if (volume > 0.0f) {
+            const float overlap_volume = overlapped ? compute_volume(overlap_max, overlap_min) : 0.0f;
+            const float covered_volume = compute_volume(left.aabb_max, left.aabb_min) + compute_volume(right.aabb_max, right.aabb_min) - overlap_volume;
+            total_empty_space += std::max(0.0f, 1.0f - covered_volume / volume);
+            num_empty_space_nodes++;
+        }
+        stack.push_back({ node.right, depth + 1 });
+        stack.push_back({ node.left, depth + 1 });
     }
+    stats.average_leaf_depth = total_leaf_depth / stats.num_leaves;
+    stats.average_leaf_size = total_leaf_size / stats.num_leaves;
+    stats.overlap = total_overlap;
+    stats.empty_space = num_empty_space_nodes > 0 ? total_empty_space / num_empty_space_nodes : 0.0f;
+    return stats;
 }
-int BVH::num_nodes()
+void BVH::serialize_links(rtx::array<rtxThreadedBVHLink>& link_array, int serialization_offset)
 {
-    return _num_nodes;
+    serialize_octant_links(_node_array, link_array, serialization_offset);
 }
 void BVH::serialize_nodes(rtx::array<rtxThreadedBVHNode>& node_array, int serialization_offset)
 {
-    std::vector<std::shared_ptr<Node>> children = { _root };
-    _root->collect_children(children);
-    for (auto& node : children) {
-        int pos = node->_index + serialization_offset;
-
-        rtxThreadedBVHNode cuda_node;
-        cuda_node.hit_node_index = node->_hit ? node->_hit->_index : -1;
-        cuda_node.miss_node_index = node->_miss ? node->_miss->_index : -1;
-        cuda_node.assigned_face_index_start = node->_assigned_face_index_start;
-        cuda_node.assigned_face_index_end = node->_assigned_face_index_end;
-        cuda_node.aabb_max.x = node->_aabb_max.x;
-        cuda_node.aabb_max.y = node->_aabb_max.y;
-        cuda_node.aabb_max.z = node->_aabb_max.z;
-        cuda_node.aabb_min.x = node->_aabb_min.x;
-        cuda_node.aabb_min.y = node->_aabb_min.y;
-        cuda_node.aabb_min.z = node->_aabb_min.z;
-
-        node_array[pos] = cuda_node;
+    for (int node_index = 0; node_index < (int)_node_array.size(); node_index++) {
+        node_array[node_index + serialization_offset] = serialize_node(_node_array[node_index]);
+    }
+}
+int BVH::num_wide_nodes()
+{
+    return _wide_node_array.size();
+}
+// 多分岐ノードのAABBは二分木のノードから写すので、リフィット後もこれを呼ぶだけでよい
+void BVH::serialize_wide_nodes(rtx::array<rtxCPUWideBVHNode>& node_array, int serialization_offset)
+{
+    for (int wide_node_index = 0; wide_node_index < (int)_wide_node_array.size(); wide_node_index++) {
+        const WideNode& wide_node = _wide_node_array[wide_node_index];
+        rtxCPUWideBVHNode cuda_node;
+        for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+            const int node_index = wide_node.node_index[lane];
+            if (node_index == -1) {
+                cuda_node.aabb_min_x[lane] = FLT_MAX;
+                cuda_node.aabb_min_y[lane] = FLT_MAX;
+                cuda_node.aabb_min_z[lane] = FLT_MAX;
+                cuda_node.aabb_max_x[lane] = -FLT_MAX;
+                cuda_node.aabb_max_y[lane] = -FLT_MAX;
+                cuda_node.aabb_max_z[lane] = -FLT_MAX;
+                cuda_node.child_node_index[lane] = -1;
+                cuda_node.assigned_face_index_start[lane] = -1;
+                cuda_node.num_assigned_faces[lane] = 0;
+                continue;
+            }
+            const Node& node = _node_array[node_index];
+            cuda_node.aabb_min_x[lane] = node.aabb_min.x;
+            cuda_node.aabb_min_y[lane] = node.aabb_min.y;
+            cuda_node.aabb_min_z[lane] = node.aabb_min.z;
+            cuda_node.aabb_max_x[lane] = node.aabb_max.x;
+            cuda_node.aabb_max_y[lane] = node.aabb_max.y;
+            cuda_node.aabb_max_z[lane] = node.aabb_max.z;
+            cuda_node.child_node_index[lane] = wide_node.child_node_index[lane];
+            if (node.is_leaf()) {
+                cuda_node.assigned_face_index_start[lane] = node.assigned_face_index_start;
+                cuda_node.num_assigned_faces[lane] = node.assigned_face_index_end - node.assigned_face_index_start + 1;
+            } else {
+                cuda_node.assigned_face_index_start[lane] = -1;
+                cuda_node.num_assigned_faces[lane] = 0;
+            }
+        }
+        node_array[wide_node_index + serialization_offset] = cuda_node;
+    }
+}
+void BVH::serialize_wide_nodes(rtx::array<rtxCPUQuantizedWideBVHNode>& node_array, int serialization_offset)
+{
+    for (int wide_node_index = 0; wide_node_index < (int)_wide_node_array.size(); wide_node_index++) {
+        const WideNode& wide_node = _wide_node_array[wide_node_index];
+        rtxCPUQuantizedWideBVHNode cuda_node;
+        memset(&cuda_node, 0, sizeof(cuda_node));
 
-        // printf("node: %d face_start: %d face_end: %d max: (%f, %f, %f) min: (%f, %f, %f)\n", node->_index, node->_assigned_face_index_start, node->_assigned_face_index_end, node->_aabb_max.x, node->_aabb_max.y, node->_aabb_max.z, node->_aabb_min.x, node->_aabb_min.y, node->_aabb_min.z);
-        // printf("    hit: %d miss: %d left: %d right: %d\n", (node->_hit ? node->_hit->_index : -1), (node->_miss ? node->_miss->_index : -1), (node->_left ? node->_left->_index : -1), (node->_right ? node->_right->_index : -1));
+        // レーンは先頭から詰めて使われている
+        int num_lanes = 0;
+        float lane_aabb_min[3][RTX_CPU_WIDE_BVH_WIDTH];
+        float lane_aabb_max[3][RTX_CPU_WIDE_BVH_WIDTH];
+        glm::vec3f origin(FLT_MAX);
+        for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+            const int node_index = wide_node.node_index[lane];
+            if (node_index == -1) {
+                break;
+            }
+            const Node& node = _node_array[node_index];
+            for (int axis = 0; axis < 3; axis++) {
+                lane_aabb_min[axis][lane] = node.aabb_min[axis];
+                lane_aabb_max[axis][lane] = node.aabb_max[axis];
+            }
+            merge_aabb_min(origin, node.aabb_min, origin);
+            if (node.is_leaf()) {
+                // 粗い葉はカーネルが箱の判定にしか使わないので面の数を書かない
+                const int num_assigned_faces = _coarse_leaf ? 0 : node.assigned_face_index_end - node.assigned_face_index_start + 1;
+                if (num_assigned_faces > UINT16_MAX) {
+                    throw std::runtime_error("Error: bvh_max_triangles_per_node is too large for the quantized BVH node format");
+                }
+                cuda_node.child_node_index[lane] = -1 - node.assigned_face_index_start;
+                cuda_node.num_assigned_faces[lane] = num_assigned_faces;
+            } else {
+                cuda_node.child_node_index[lane] = wide_node.child_node_index[lane];
+            }
+            num_lanes++;
+        }
+        cuda_node.num_lanes = num_lanes;
+        cuda_node.origin_x = origin.x;
+        cuda_node.origin_y = origin.y;
+        cuda_node.origin_z = origin.z;
+        quantize_lane_aabbs(origin.x, lane_aabb_min[0], lane_aabb_max[0], num_lanes, cuda_node.scale_x, cuda_node.aabb_min_x, cuda_node.aabb_max_x);
+        quantize_lane_aabbs(origin.y, lane_aabb_min[1], lane_aabb_max[1], num_lanes, cuda_node.scale_y, cuda_node.aabb_min_y, cuda_node.aabb_max_y);
+        quantize_lane_aabbs(origin.z, lane_aabb_min[2], lane_aabb_max[2], num_lanes, cuda_node.scale_z, cuda_node.aabb_min_z, cuda_node.aabb_max_z);
+        node_array[wide_node_index + serialization_offset] = cuda_node;
     }
 }
 void BVH::serialize_faces(rtx::array<rtxFaceVertexIndex>& buffer, int serialization_offset)
 {
-    std::vector<std::shared_ptr<bvh::Node>> leaves;
-    collect_leaves(leaves);
     assert(_geometry.expired() == false);
 
     auto geometry = _geometry.lock();
     assert(geometry);
 
+    if (_coarse_leaf) {
+        geometry->serialize_faces(buffer, serialization_offset);
+        return;
+    }
     if (geometry->type() == RTXGeometryTypeStandard) {
         std::shared_ptr<StandardGeometry> standard = std::static_pointer_cast<StandardGeometry>(geometry);
         auto& face_vertex_indices_array = standard->_face_vertex_indices_array;
-        // printf("============================================================\n");
-        // for (int face_index = 0; face_index < face_vertex_indices_array.size(); face_index++) {
-        //     auto& face = face_vertex_indices_array[face_index];
-        //     // printf("[%d] (%d, %d, %d)\n", face_index, face[0], face[1], face[2]);
-        // }
-        for (auto& node : leaves) {
-            int pos = node->_assigned_face_index_start + serialization_offset;
-            for (int face_index : node->_assigned_face_indices) {
-                glm::vec3i face = face_vertex_indices_array[face_index];
-                buffer[pos] = { face[0], face[1], face[2], -1 };
-                pos++;
-                // printf("[%d] (%d, %d, %d)\n", face_index, face[0], face[1], face[2]);
-            }
+        for (int n = 0; n < (int)_face_index_array.size(); n++) {
+            glm::vec3i face = face_vertex_indices_array[_face_index_array[n]];
+            buffer[n + serialization_offset] = {
+                _serial_vertex_index_array[face[0]],
+                _serial_vertex_index_array[face[1]],
+                _serial_vertex_index_array[face[2]],
+                -1,
+            };
         }
         return;
     }
@@ -474,12 +2113,137 @@ void BVH::serialize_faces(rtx::array<rtxFaceVertexIndex>& buffer, int serializat
         return;
     }
 }
-void BVH::collect_leaves(std::vector<std::shared_ptr<bvh::Node>>& leaves)
+void BVH::serialize_vertices(rtx::array<rtxVertex>& buffer, int serialization_offset)
 {
-    if (_root->_is_leaf) {
-        leaves.push_back(_root);
+    assert(_geometry.expired() == false);
+
+    auto geometry = _geometry.lock();
+    assert(geometry);
+
+    if (geometry->type() == RTXGeometryTypeStandard && _coarse_leaf == false) {
+        std::shared_ptr<StandardGeometry> standard = std::static_pointer_cast<StandardGeometry>(geometry);
+        auto& vertex_array = standard->_vertex_array;
+        for (int n = 0; n < (int)_vertex_index_array.size(); n++) {
+            auto& vertex = vertex_array[_vertex_index_array[n]];
+            buffer[n + serialization_offset] = { vertex.x, vertex.y, vertex.z, vertex.w };
+        }
         return;
     }
-    _root->collect_leaves(leaves);
+    geometry->serialize_vertices(buffer, serialization_offset);
+}
+const std::vector<int>& BVH::vertex_index_array() const
+{
+    return _vertex_index_array;
+}
+void TopLevelBVH::set_object_aabbs(const std::vector<std::shared_ptr<BVH>>& bvh_array)
+{
+    const int num_objects = bvh_array.size();
+    _object_aabb_max_array.resize(num_objects);
+    _object_aabb_min_array.resize(num_objects);
+    for (int object_index = 0; object_index < num_objects; object_index++) {
+        bvh_array[object_index]->object_aabb(_object_aabb_min_array[object_index], _object_aabb_max_array[object_index]);
+    }
+}
+int TopLevelBVH::build_node(int begin, int end)
+{
+    const int node_index = _node_array.size();
+    Node node;
+    node.aabb_max = glm::vec3f(-FLT_MAX);
+    node.aabb_min = glm::vec3f(FLT_MAX);
+    node.left = -1;
+    node.right = -1;
+    node.hit = -1;
+    node.miss = -1;
+    node.assigned_face_index_start = -1;
+    node.assigned_face_index_end = -1;
+    for (int n = begin; n < end; n++) {
+        int object_index = _object_index_array[n];
+        merge_aabb_max(node.aabb_max, _object_aabb_max_array[object_index], node.aabb_max);
+        merge_aabb_min(node.aabb_min, _object_aabb_min_array[object_index], node.aabb_min);
+    }
+    if (end - begin == 1) {
+        int object_index = _object_index_array[begin];
+        node.assigned_face_index_start = object_index;
+        node.assigned_face_index_end = object_index;
+        _leaf_node_index_array[object_index] = node_index;
+        _node_array.push_back(node);
+        return node_index;
+    }
+    _node_array.push_back(node);
+
+    // 中心が最も散らばっている軸で中央値分割
+    glm::vec3f center_max(-FLT_MAX);
+    glm::vec3f center_min(FLT_MAX);
+    for (int n = begin; n < end; n++) {
+        int object_index = _object_index_array[n];
+        glm::vec3f center = (_object_aabb_max_array[object_index] + _object_aabb_min_array[object_index]) * 0.5f;
+        merge_aabb_max(center_max, center, center_max);
+        merge_aabb_min(center_min, center, center_min);
+    }
+    const int axis = detect_longest_axis(center_max - center_min) - RTXAxisX;
+    const int split = (begin + end) / 2;
+    auto first = _object_index_array.begin();
+    std::nth_element(first + begin, first + split, first + end, [this, axis](int a, int b) {
+        float center_a = _object_aabb_max_array[a][axis] + _object_aabb_min_array[a][axis];
+        float center_b = _object_aabb_max_array[b][axis] + _object_aabb_min_array[b][axis];
+        if (center_a == center_b) {
+            return a < b;
+        }
+        return center_a < center_b;
+    });
+
+    // 前順に並ぶよう左の部分木を先に作る
+    const int left = build_node(begin, split);
+    const int right = build_node(split, end);
+    _node_array[node_index].left = left;
+    _node_array[node_index].right = right;
+    return node_index;
+}
+void TopLevelBVH::build(const std::vector<std::shared_ptr<BVH>>& bvh_array)
+{
+    const int num_objects = bvh_array.size();
+    assert(num_objects > 0);
+    set_object_aabbs(bvh_array);
+    _object_index_array.resize(num_objects);
+    std::iota(_object_index_array.begin(), _object_index_array.end(), 0);
+    _leaf_node_index_array.resize(num_objects);
+    _node_array.clear();
+    _node_array.reserve(2 * num_objects - 1);
+    build_node(0, num_objects);
+    link_threaded_nodes(_node_array);
+}
+void TopLevelBVH::refit(const std::vector<std::shared_ptr<BVH>>& bvh_array)
+{
+    assert(bvh_array.size() == _leaf_node_index_array.size());
+    set_object_aabbs(bvh_array);
+    for (int object_index = 0; object_index < (int)bvh_array.size(); object_index++) {
+        Node& node = _node_array[_leaf_node_index_array[object_index]];
+        node.aabb_max = _object_aabb_max_array[object_index];
+        node.aabb_min = _object_aabb_min_array[object_index];
+    }
+    for (int node_index = _node_array.size() - 1; node_index >= 0; node_index--) {
+        Node& node = _node_array[node_index];
+        if (node.is_leaf()) {
+            continue;
+        }
+        const Node& left = _node_array[node.left];
+        const Node& right = _node_array[node.right];
+        merge_aabb_max(left.aabb_max, right.aabb_max, node.aabb_max);
+        merge_aabb_min(left.aabb_min, right.aabb_min, node.aabb_min);
+    }
+}
+int TopLevelBVH::num_nodes()
+{
+    return _node_array.size();
+}
+void TopLevelBVH::serialize_links(rtx::array<rtxThreadedBVHLink>& link_array, int serialization_offset)
+{
+    serialize_octant_links(_node_array, link_array, serialization_offset);
+}
+void TopLevelBVH::serialize_nodes(rtx::array<rtxThreadedBVHNode>& node_array, int serialization_offset)
+{
+    for (int node_index = 0; node_index < (int)_node_array.size(); node_index++) {
+        node_array[node_index + serialization_offset] = serialize_node(_node_array[node_index]);
+    }
+}
 }
-}
\ No newline at end of file
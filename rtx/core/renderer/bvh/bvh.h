@@ -5,53 +5,212 @@
 #include "../../geometry/standard.h"
 #include "../../header/array.h"
 #include "../../header/glm.h"
+#include "../header/cpu_bridge.h"
+#include <atomic>
 #include <memory>
 #include <vector>
 
 namespace rtx {
 namespace bvh {
-    class Node {
-    public:
-        bool _is_leaf;
-        unsigned int _index;
-        std::vector<int> _assigned_face_indices;
-        glm::vec3f _aabb_min;
-        glm::vec3f _aabb_max;
-        int _assigned_face_index_start;
-        int _assigned_face_index_end;
-        Node(std::vector<int> assigned_face_indices,
-            std::shared_ptr<StandardGeometry>& geometry,
-            int& current_node_index,
-            int& current_assigned_face_index_offset);
-        Node(std::vector<int> assigned_face_indices,
-            std::shared_ptr<SphereGeometry>& geometry);
-        Node(std::vector<int> assigned_face_indices,
-            std::shared_ptr<CylinderGeometry>& geometry);
-        Node(std::vector<int> assigned_face_indices,
-            std::shared_ptr<ConeGeometry>& geometry);
-        std::shared_ptr<Node> _left;
-        std::shared_ptr<Node> _right;
-        std::shared_ptr<Node> _miss;
-        std::shared_ptr<Node> _hit;
-        int num_children();
-        void set_hit_and_miss_links();
-        void collect_children(std::vector<std::shared_ptr<Node>>& children);
-        void collect_leaves(std::vector<std::shared_ptr<bvh::Node>>& leaves);
+    // ノードは配列に連続して格納し、子やリンクは配列のインデックスで参照する
+    // Nodes live in one contiguous array and refer to each other by index.
+    struct Node {
+        glm::vec3f aabb_min;
+        glm::vec3f aabb_max;
+        int left;
+        int right;
+        int hit;
+        int miss;
+        // 葉ノードが担当する面の範囲（BVH::_face_index_array上）
+        // 中間ノードは-1
+        int assigned_face_index_start;
+        int assigned_face_index_end;
+        bool is_leaf() const
+        {
+            return assigned_face_index_start != -1;
+        }
+    };
+    // SBVHの構築で使う面の参照
+    // A face straddling a spatial split is referenced from both sides, each with its clipped box.
+    struct Reference {
+        glm::vec3f aabb_min;
+        glm::vec3f aabb_max;
+        int face_index;
+    };
+    // 木の質の統計
+    struct Stats {
+        // 実際に使ったビルダーと葉の面数の上限（自動選択の結果）
+        int builder = 0;
+        int max_triangles_per_node = 0;
+        int num_faces = 0;
+        // 空間分割で複製された参照を含む
+        int num_face_references = 0;
+        int num_nodes = 0;
+        int num_leaves = 0;
+        int num_wide_nodes = 0;
+        int max_depth = 0;
+        float average_leaf_depth = 0.0f;
+        float average_leaf_size = 0.0f;
+        // leaf_size_histogram[n]は面をn個持つ葉の数
+        std::vector<int> leaf_size_histogram;
+        // 根のAABBの表面積で正規化したSAHコスト
+        float sah_cost = 0.0f;
+        // 兄弟ノードのAABBの重なりの表面積の総和（根の表面積で正規化）
+        // Rays entering the overlap have to descend into both children.
+        float overlap = 0.0f;
+        // 中間ノードの体積のうち子のAABBで覆われない割合の平均
+        float empty_space = 0.0f;
+        float build_time_ms = 0.0f;
+        size_t threaded_node_bytes = 0;
+        size_t wide_node_bytes = 0;
+        size_t quantized_wide_node_bytes = 0;
+        size_t face_bytes = 0;
+    };
+    // 多分岐BVHのノード
+    // Each lane refers to a node of the binary tree, so a refit only has to re-serialize the boxes.
+    struct WideNode {
+        // レーンが指す二分木のノード（空きは-1）
+        int node_index[RTX_CPU_WIDE_BVH_WIDTH];
+        // 中間ノードのレーンの子の多分岐ノード（それ以外は-1）
+        int child_node_index[RTX_CPU_WIDE_BVH_WIDTH];
     };
 }
+class BVHCache;
 class BVH {
 private:
-    int _current_node_index;
-    int _current_assigned_face_index_offset;
-    int _num_nodes;
+    friend class BVHCache;
+    // _node_layoutの順に並べたノード（根が先頭で、親は子より前）
+    std::vector<bvh::Node> _node_array;
+    // 葉の順に並べ替えた面のインデックス
+    // The builder partitions this permutation in place; each leaf owns one contiguous range.
+    // With spatial splits (RTXBVHBuilderSBVH) a face may appear in several leaves.
+    std::vector<int> _face_index_array;
+    // 葉の順に初めて使われた順で振り直した頂点の番号
+    // _vertex_index_array[serial] is the original index of the serial-th vertex and
+    // _serial_vertex_index_array is its inverse, so a leaf's triangles read nearby vertices.
+    std::vector<int> _vertex_index_array;
+    std::vector<int> _serial_vertex_index_array;
+    // CPUのカーネル用に二分木を畳み込んだ多分岐BVH（_node_layoutの順）
+    std::vector<bvh::WideNode> _wide_node_array;
     std::weak_ptr<Geometry> _geometry;
+    // 構築直後のSAHコスト
+    // リフィットで木の質がどれだけ落ちたかの判定に使う
+    float _sah_cost_at_build;
+    // 最後の構築にかかった時間（キャッシュから読み込んだ場合は0）
+    float _build_time_ms;
+    // 構築に使ったビルダーと葉の面数の上限
+    // With RTXBVHBuilderAuto or BVH_AUTO_TRIANGLES_PER_NODE these hold the selected values, which refit reuses.
+    int _builder;
+    int _max_triangles_per_node;
+    // 空間分割を使うか
+    // Disabled for lights: next event estimation samples a face by its index in [0, num_faces).
+    bool _spatial_splits_allowed;
+    // ノードの並べ方と部分木の塊の大きさ（RTXBVHNodeLayoutSubtreeClustersの場合）
+    int _node_layout;
+    int _node_cluster_bytes;
+    // treeletの組み直しの回数と時間の上限
+    int _treelet_iterations;
+    float _treelet_time_budget_ms;
+    // 全ての面を持つ葉1つだけの木か（coarse_leafで作った場合）
+    // Faces and vertices keep their original order, so the serialized ranges match a full build without spatial splits.
+    bool _coarse_leaf;
+
+    // 構築時に使う作業領域
+    std::vector<bvh::Node> _build_node_array;
+    std::atomic<int> _num_build_nodes;
+    std::vector<int> _scratch_face_index_array;
+    std::vector<glm::vec3f> _face_aabb_max_array;
+    std::vector<glm::vec3f> _face_aabb_min_array;
+    std::vector<glm::vec3f> _face_center_array;
+    // SBVHの構築で使う作業領域
+    std::atomic<int> _num_face_references;
+    std::atomic<int> _num_remaining_spatial_split_references;
+    float _root_surface_area;
+
+    BVH();
+    int allocate_build_nodes(int num_nodes);
+    void build(const std::shared_ptr<StandardGeometry>& geometry);
+    void build(const std::shared_ptr<StandardGeometry>& geometry, int builder, int max_triangles_per_node);
+    void select_and_build(const std::shared_ptr<StandardGeometry>& geometry);
+    void build_node(int node_index, int begin, int end, const std::shared_ptr<StandardGeometry>& geometry);
+    bool split_by_binned_sah(int begin, int end, const bvh::Node& node, bool can_be_leaf, const std::shared_ptr<StandardGeometry>& geometry, int& split);
+    void split_by_median(int begin, int end, const bvh::Node& node, int& split);
+    void compute_aabb(int begin, int end, bvh::Node& node);
+    void build_sbvh_node(int node_index, std::vector<bvh::Reference>& references, const std::shared_ptr<StandardGeometry>& geometry);
+    bool split_sbvh_references(std::vector<bvh::Reference>& references, const bvh::Node& node, bool can_be_leaf, const std::shared_ptr<StandardGeometry>& geometry,
+        std::vector<bvh::Reference>& left_references, std::vector<bvh::Reference>& right_references);
+    void compact_sbvh_leaves(int num_face_references);
+    bool restructure_treelets(float traversal_cost);
+    bool restructure_treelet(int root_index, std::vector<float>& cost_array, float traversal_cost);
+    void finalize_nodes();
+    void layout_nodes();
+    int collapse_node(int node_index);
+    void collapse_to_wide_nodes();
+    void reorder_vertices(const std::shared_ptr<StandardGeometry>& geometry);
 
 public:
-    BVH(std::shared_ptr<Geometry>& geometry);
-    std::shared_ptr<bvh::Node> _root;
+    // cacheを渡すとメッシュのBVHをディスクから読み込み、無ければ構築して書き込む
+    BVH(std::shared_ptr<Geometry>& geometry, bool spatial_splits_allowed = true, BVHCache* cache = NULL);
+    // 構築を後回しにするメッシュの仮のBVH（根のAABBだけが意味を持つ）
+    // Used by the lazy construction of the CPU backend; the real tree replaces it when a ray first reaches the object.
+    static std::shared_ptr<BVH> coarse_leaf(std::shared_ptr<Geometry>& geometry);
+    // メッシュが自動選択（RTXBVHBuilderAutoかBVH_AUTO_TRIANGLES_PER_NODE）を使うなら、そのコストモデルを測っておく
+    // The model is timed once per process; call this while no other work is running.
+    static void prepare_cost_model(const std::shared_ptr<Geometry>& geometry);
+    bool is_coarse_leaf() const;
     int num_nodes();
+    // 直列化した時の面の数（空間分割で複製された参照を含む）
+    int num_face_references();
+    // 頂点が動いた後に木の構造を保ったままAABBだけを更新する
+    // Returns false if the tree degraded past bvh_refit_rebuild_threshold and was rebuilt instead;
+    // the node count and face order may then have changed.
+    bool refit();
+    float compute_sah_cost();
+    // 多分岐BVHを辿るコストの2つの項（根のAABBの表面積で正規化）
+    // node_term = sum_wide(A(n)) / A(root), triangle_term = sum_leaf(N(n) * A(n)) / A(root)
+    void compute_traversal_cost_terms(float& node_term, float& triangle_term);
+    bvh::Stats stats();
+    // オブジェクト全体のAABB（根ノードのAABB）
+    void object_aabb(glm::vec3f& aabb_min, glm::vec3f& aabb_max);
     void serialize_nodes(rtx::array<rtxThreadedBVHNode>& node_array, int serialization_offset);
+    // 象限ごとのリンクはノードの番号がserialize_nodesと同じになるように書き込む
+    void serialize_links(rtx::array<rtxThreadedBVHLink>& link_array, int serialization_offset);
+    int num_wide_nodes();
+    void serialize_wide_nodes(rtx::array<rtxCPUWideBVHNode>& node_array, int serialization_offset);
+    void serialize_wide_nodes(rtx::array<rtxCPUQuantizedWideBVHNode>& node_array, int serialization_offset);
+    // 面の頂点の番号は振り直した番号で書き込むので、頂点もserialize_verticesで直列化する
     void serialize_faces(rtx::array<rtxFaceVertexIndex>& buffer, int serialization_offset);
-    void collect_leaves(std::vector<std::shared_ptr<bvh::Node>>& leaves);
+    void serialize_vertices(rtx::array<rtxVertex>& buffer, int serialization_offset);
+    // 直列化した頂点の元の番号（メッシュ以外は空）
+    // UV coordinates are indexed per vertex and have to be permuted the same way.
+    const std::vector<int>& vertex_index_array() const;
 };
-}
\ No newline at end of file
+// オブジェクトのAABBを葉とする上位のBVH（TLAS）
+// Each leaf holds exactly one object; its index is stored in assigned_face_index_start/end
+// and the ray then continues into that object's own BVH.
+// CUDAのカーネルはTLASを使わずに全オブジェクトを順に辿る
+// Only the CPU backend traverses it; the CUDA kernels still test every object's BVH in turn.
+class TopLevelBVH {
+private:
+    // 深さ優先（前順）で並べたノード
+    std::vector<bvh::Node> _node_array;
+    // オブジェクトの番号から葉ノードの番号を引く
+    std::vector<int> _leaf_node_index_array;
+    std::vector<int> _object_index_array;
+    std::vector<glm::vec3f> _object_aabb_max_array;
+    std::vector<glm::vec3f> _object_aabb_min_array;
+
+    void set_object_aabbs(const std::vector<std::shared_ptr<BVH>>& bvh_array);
+    int build_node(int begin, int end);
+
+public:
+    // 各オブジェクトのBVHの根からTLASを作り直す
+    void build(const std::vector<std::shared_ptr<BVH>>& bvh_array);
+    // 木の構造はそのままでAABBだけを更新する
+    // Cheap enough to run every frame when only some objects moved or deformed.
+    void refit(const std::vector<std::shared_ptr<BVH>>& bvh_array);
+    int num_nodes();
+    void serialize_nodes(rtx::array<rtxThreadedBVHNode>& node_array, int serialization_offset);
+    void serialize_links(rtx::array<rtxThreadedBVHLink>& link_array, int serialization_offset);
+};
+}
@@ -0,0 +1,269 @@
+#include "cache.h"
+#include "../../header/enum.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rtx {
+using namespace bvh;
+namespace {
+    // ファイルの形式を変えたら上げる
+    const uint32_t BVH_CACHE_FORMAT_VERSION = 3;
+    const char BVH_CACHE_MAGIC[8] = { 'R', 'T', 'X', 'B', 'V', 'H', '\0', '\0' };
+    struct BVHCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t node_bytes;
+        uint64_t key;
+        int32_t num_faces;
+        int32_t num_vertices;
+        int32_t num_nodes;
+        int32_t num_face_references;
+        float sah_cost_at_build;
+        // 自動選択の結果（リフィットで作り直す時に使う）
+        int32_t builder;
+        int32_t max_triangles_per_node;
+        int32_t padding;
+        // ノードと面の番号のハッシュ
+        // Catches payloads damaged on disk, which the sizes in the header cannot detect.
+        uint64_t payload_hash;
+    };
+    inline uint64_t rotate_left(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+    inline uint64_t finalize_hash(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+    // 8バイトずつ混ぜるハッシュ（MurmurHash3の64bit版のブロック処理）
+    // Not cryptographic; the header also stores the face and vertex counts to reject collisions cheaply.
+    uint64_t hash_bytes(const void* data, size_t bytes, uint64_t h)
+    {
+        const unsigned char* ptr = static_cast<const unsigned char*>(data);
+        const size_t num_blocks = bytes / 8;
+        for (size_t n = 0; n < num_blocks; n++) {
+            uint64_t block;
+            memcpy(&block, ptr + n * 8, 8);
+            block *= 0x87c37b91114253d5ULL;
+            block = rotate_left(block, 31);
+            block *= 0x4cf5ad432745937fULL;
+            h ^= block;
+            h = rotate_left(h, 27) * 5 + 0x52dce729;
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, ptr + num_blocks * 8, bytes - num_blocks * 8);
+        h ^= tail * 0x87c37b91114253d5ULL;
+        return finalize_hash(h ^ bytes);
+    }
+    template <typename T>
+    uint64_t hash_value(const T& value, uint64_t h)
+    {
+        return hash_bytes(&value, sizeof(T), h);
+    }
+    uint64_t hash_payload(const Node* node_array, int num_nodes, const int* face_index_array, int num_face_references, uint64_t key)
+    {
+        uint64_t h = hash_bytes(node_array, (size_t)num_nodes * sizeof(Node), key);
+        return hash_bytes(face_index_array, (size_t)num_face_references * sizeof(int), h);
+    }
+    // 読み込んだノードと面の番号が範囲内にあるか
+    // The traversal and the wide-node collapse index with these without checks,
+    // so a blob that passes the hash but was written by a broken build must not get through either.
+    bool payload_is_in_range(const std::vector<Node>& node_array, const std::vector<int>& face_index_array, int num_faces)
+    {
+        const int num_nodes = node_array.size();
+        const int num_face_references = face_index_array.size();
+        for (const Node& node : node_array) {
+            if (node.hit < -1 || node.hit >= num_nodes || node.miss < -1 || node.miss >= num_nodes) {
+                return false;
+            }
+            if (node.is_leaf()) {
+                if (node.assigned_face_index_start < 0 || node.assigned_face_index_end < node.assigned_face_index_start || node.assigned_face_index_end >= num_face_references) {
+                    return false;
+                }
+            } else if (node.left <= 0 || node.left >= num_nodes || node.right <= 0 || node.right >= num_nodes) {
+                return false;
+            }
+        }
+        for (int face_index : face_index_array) {
+            if (face_index < 0 || face_index >= num_faces) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+BVHCache::BVHCache()
+{
+    _num_hits = 0;
+    _num_misses = 0;
+    _num_temporary_files = 0;
+}
+void BVHCache::set_directory(const std::string& directory)
+{
+    if (directory.empty() == false) {
+        struct stat st;
+        if (stat(directory.c_str(), &st) != 0 || S_ISDIR(st.st_mode) == false) {
+            throw std::runtime_error("BVH cache directory does not exist: " + directory);
+        }
+    }
+    _directory = directory;
+}
+const std::string& BVHCache::directory() const
+{
+    return _directory;
+}
+bool BVHCache::enabled() const
+{
+    return _directory.empty() == false;
+}
+std::string BVHCache::path_of(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)key);
+    return _directory + "/" + name;
+}
+uint64_t BVHCache::compute_key(const StandardGeometry& geometry, bool spatial_splits_allowed) const
+{
+    uint64_t h = BVH_CACHE_FORMAT_VERSION;
+    h = hash_value((uint32_t)sizeof(Node), h);
+    h = hash_bytes(geometry._vertex_array.data(), geometry._vertex_array.size() * sizeof(glm::vec4f), h);
+    h = hash_bytes(geometry._face_vertex_indices_array.data(), geometry._face_vertex_indices_array.size() * sizeof(glm::vec3i), h);
+    h = hash_value(geometry.bvh_max_triangles_per_node(), h);
+    h = hash_value(geometry.bvh_builder(), h);
+    h = hash_value(geometry.bvh_sah_traversal_cost(), h);
+    if (geometry.bvh_builder() == RTXBVHBuilderSBVH || geometry.bvh_builder() == RTXBVHBuilderAuto) {
+        h = hash_value(geometry.bvh_spatial_split_budget(), h);
+        h = hash_value(spatial_splits_allowed, h);
+    }
+    // 時間の上限で打ち切った組み直しの結果は計算機の速さに依るが、同じ設定なら再利用してよい
+    h = hash_value(geometry.bvh_treelet_iterations(), h);
+    if (geometry.bvh_treelet_iterations() > 0) {
+        h = hash_value(geometry.bvh_treelet_time_budget_ms(), h);
+    }
+    // ノードは並べ替えた後の順で保存する
+    h = hash_value(geometry.bvh_node_layout(), h);
+    if (geometry.bvh_node_layout() == RTXBVHNodeLayoutSubtreeClusters) {
+        h = hash_value(geometry.bvh_node_cluster_bytes(), h);
+    }
+    return h;
+}
+bool BVHCache::load(uint64_t key, const StandardGeometry& geometry, BVH& bvh)
+{
+    const std::string path = path_of(key);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        _num_misses++;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(BVHCacheHeader)) {
+        close(fd);
+        _num_misses++;
+        return false;
+    }
+    const size_t bytes = st.st_size;
+    void* mapped = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        _num_misses++;
+        return false;
+    }
+
+    const char* ptr = static_cast<const char*>(mapped);
+    BVHCacheHeader header;
+    memcpy(&header, ptr, sizeof(header));
+    const size_t expected_bytes = sizeof(BVHCacheHeader) + (size_t)header.num_nodes * sizeof(Node) + (size_t)header.num_face_references * sizeof(int);
+    const bool valid = memcmp(header.magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC)) == 0
+        && header.version == BVH_CACHE_FORMAT_VERSION
+        && header.node_bytes == sizeof(Node)
+        && header.key == key
+        && header.num_faces == (int32_t)geometry._face_vertex_indices_array.size()
+        && header.num_vertices == (int32_t)geometry._vertex_array.size()
+        && header.num_nodes > 0
+        && header.num_face_references >= header.num_faces
+        && expected_bytes == bytes;
+    if (valid == false) {
+        munmap(mapped, bytes);
+        _num_misses++;
+        return false;
+    }
+    const char* node_ptr = ptr + sizeof(BVHCacheHeader);
+    const char* face_index_ptr = node_ptr + (size_t)header.num_nodes * sizeof(Node);
+    bvh._node_array.resize(header.num_nodes);
+    memcpy(bvh._node_array.data(), node_ptr, (size_t)header.num_nodes * sizeof(Node));
+    bvh._face_index_array.resize(header.num_face_references);
+    memcpy(bvh._face_index_array.data(), face_index_ptr, (size_t)header.num_face_references * sizeof(int));
+    munmap(mapped, bytes);
+
+    // 壊れたファイルは読まなかったことにして構築し直す
+    const uint64_t payload_hash = hash_payload(bvh._node_array.data(), header.num_nodes, bvh._face_index_array.data(), header.num_face_references, key);
+    if (payload_hash != header.payload_hash || payload_is_in_range(bvh._node_array, bvh._face_index_array, header.num_faces) == false) {
+        std::vector<Node>().swap(bvh._node_array);
+        std::vector<int>().swap(bvh._face_index_array);
+        _num_misses++;
+        return false;
+    }
+
+    bvh._sah_cost_at_build = header.sah_cost_at_build;
+    bvh._builder = header.builder;
+    bvh._max_triangles_per_node = header.max_triangles_per_node;
+    bvh.collapse_to_wide_nodes();
+    _num_hits++;
+    return true;
+}
+// 一時ファイルに書いてから名前を変えるので、並行して動く他のプロセスが書きかけのファイルを読むことはない
+void BVHCache::store(uint64_t key, const StandardGeometry& geometry, const BVH& bvh)
+{
+    BVHCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC));
+    header.version = BVH_CACHE_FORMAT_VERSION;
+    header.node_bytes = sizeof(Node);
+    header.key = key;
+    header.num_faces = geometry._face_vertex_indices_array.size();
+    header.num_vertices = geometry._vertex_array.size();
+    header.num_nodes = bvh._node_array.size();
+    header.num_face_references = bvh._face_index_array.size();
+    header.sah_cost_at_build = bvh._sah_cost_at_build;
+    header.builder = bvh._builder;
+    header.max_triangles_per_node = bvh._max_triangles_per_node;
+    header.payload_hash = hash_payload(bvh._node_array.data(), bvh._node_array.size(), bvh._face_index_array.data(), bvh._face_index_array.size(), key);
+
+    const std::string path = path_of(key);
+    const std::string temporary_path = path + "." + std::to_string(getpid()) + "." + std::to_string(_num_temporary_files++) + ".tmp";
+    FILE* fp = fopen(temporary_path.c_str(), "wb");
+    if (fp == NULL) {
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(bvh._node_array.data(), sizeof(Node), bvh._node_array.size(), fp) == bvh._node_array.size()
+        && fwrite(bvh._face_index_array.data(), sizeof(int), bvh._face_index_array.size(), fp) == bvh._face_index_array.size();
+    written = fclose(fp) == 0 && written;
+    if (written == false || rename(temporary_path.c_str(), path.c_str()) != 0) {
+        remove(temporary_path.c_str());
+    }
+}
+int BVHCache::num_hits() const
+{
+    return _num_hits;
+}
+int BVHCache::num_misses() const
+{
+    return _num_misses;
+}
+void BVHCache::reset_stats()
+{
+    _num_hits = 0;
+    _num_misses = 0;
+}
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "../../geometry/standard.h"
+#include "bvh.h"
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+namespace rtx {
+// 構築済みのBVHをディスクに保存し、同じメッシュでは読み込んで構築を省く
+// Blobs are keyed by a hash of the world-space vertices, the faces and the BVH settings,
+// so they stay valid across processes as long as the mesh and its placement do not change.
+class BVHCache {
+private:
+    std::string _directory;
+    std::atomic<int> _num_hits;
+    std::atomic<int> _num_misses;
+    std::atomic<int> _num_temporary_files;
+    std::string path_of(uint64_t key) const;
+
+public:
+    BVHCache();
+    // 空文字列でキャッシュを無効にする
+    void set_directory(const std::string& directory);
+    const std::string& directory() const;
+    bool enabled() const;
+    uint64_t compute_key(const StandardGeometry& geometry, bool spatial_splits_allowed) const;
+    // ファイルをメモリマップして読み込む
+    // Returns false (a miss) if there is no blob for the key, it does not match the geometry,
+    // or its payload fails the hash or index range checks; the caller then builds the BVH.
+    bool load(uint64_t key, const StandardGeometry& geometry, BVH& bvh);
+    void store(uint64_t key, const StandardGeometry& geometry, const BVH& bvh);
+    int num_hits() const;
+    int num_misses() const;
+    void reset_stats();
+};
+}
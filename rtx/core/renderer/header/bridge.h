@@ -4,6 +4,8 @@
 
 #define THREADED_BVH_TERMINAL_NODE -1
 #define THREADED_BVH_INNER_NODE -1
+// 象限は負の向きの軸のビット（x: 1, y: 2, z: 4）
+#define RTX_THREADED_BVH_NUM_OCTANTS 8
 #define RTX_CUDA_MAX_TEXTURE_UNITS 50
 
 void rtx_cuda_malloc(void** gpu_array, size_t size);
@@ -37,6 +39,7 @@ void rtx_print_device_properties(int device);
         rtxMaterialAttributeByte* gpu_material_attribute_byte_array, \
         rtxThreadedBVH* gpu_threaded_bvh_array,                      \
         rtxThreadedBVHNode* gpu_threaded_bvh_node_array,             \
+        rtxThreadedBVHLink* gpu_threaded_bvh_link_array,             \
         rtxRGBAColor* gpu_color_mapping_array,                       \
         rtxUVCoordinate* gpu_serialized_uv_coordinate_array,         \
         rtxRGBAPixel* gpu_render_array,                              \
@@ -55,6 +58,7 @@ rtx_define_cuda_mcrt_kernel_launcher_function(global_memory)
         rtxMaterialAttributeByte* gpu_material_attribute_byte_array, \
         rtxThreadedBVH* gpu_threaded_bvh_array,                      \
         rtxThreadedBVHNode* gpu_threaded_bvh_node_array,             \
+        rtxThreadedBVHLink* gpu_threaded_bvh_link_array,             \
         rtxRGBAColor* gpu_color_mapping_array,                       \
         rtxUVCoordinate* gpu_serialized_uv_coordinate_array,         \
         int* gpu_light_sampling_table,                               \
@@ -0,0 +1,155 @@
+#pragma once
+#include "../../header/struct.h"
+#include <atomic>
+#include <stdint.h>
+
+// CUDAのテクスチャオブジェクトに相当するもの
+// Equivalent of cudaTextureObject_t for the CPU kernels.
+typedef struct rtxCPUTextureObject {
+    rtxRGBAPixel* data;
+    int width;
+    int height;
+} rtxCPUTextureObject;
+
+// CPUのカーネルで使う多分岐BVHの分岐数
+// Fixed so that the node layout (and the BVH cache) does not depend on the machine: one AVX2 register,
+// or two SSE2 registers when the kernel selected at run time has no AVX2.
+#define RTX_CPU_WIDE_BVH_WIDTH 8
+
+// 二分木のBVHを畳み込んだ多分岐BVHのノード
+// 子のAABBはレーンごとの配列（SoA）で持ち、1回のSIMDのスラブ判定で全ての子を調べる
+// 中間ノードの子: child_node_index >= 0
+// 葉: child_node_index == -1 かつ num_assigned_faces > 0
+// 空きレーン: AABBはaabb_min > aabb_maxの空集合なので必ず外れる
+typedef struct rtxCPUWideBVHNode {
+    float aabb_min_x[RTX_CPU_WIDE_BVH_WIDTH];
+    float aabb_min_y[RTX_CPU_WIDE_BVH_WIDTH];
+    float aabb_min_z[RTX_CPU_WIDE_BVH_WIDTH];
+    float aabb_max_x[RTX_CPU_WIDE_BVH_WIDTH];
+    float aabb_max_y[RTX_CPU_WIDE_BVH_WIDTH];
+    float aabb_max_z[RTX_CPU_WIDE_BVH_WIDTH];
+    int child_node_index[RTX_CPU_WIDE_BVH_WIDTH];
+    int assigned_face_index_start[RTX_CPU_WIDE_BVH_WIDTH];
+    int num_assigned_faces[RTX_CPU_WIDE_BVH_WIDTH];
+} rtxCPUWideBVHNode;
+
+// 子のAABBを親の枠（全ての子を囲む箱）に対して8bitで量子化したノード
+// 箱は origin + q * scale に復元し、量子化は必ず元の箱を含む向きに丸める
+// scaleは2のべきなので q * scale は誤差なく計算できる
+// child_node_index: 中間ノードの子なら子ノードの番号、葉なら -1 - 面の開始位置
+// Lanes [0, num_lanes) are occupied; the rest are masked out by the kernel.
+typedef struct rtxCPUQuantizedWideBVHNode {
+    float origin_x;
+    float origin_y;
+    float origin_z;
+    float scale_x;
+    float scale_y;
+    float scale_z;
+    uint8_t aabb_min_x[RTX_CPU_WIDE_BVH_WIDTH];
+    uint8_t aabb_min_y[RTX_CPU_WIDE_BVH_WIDTH];
+    uint8_t aabb_min_z[RTX_CPU_WIDE_BVH_WIDTH];
+    uint8_t aabb_max_x[RTX_CPU_WIDE_BVH_WIDTH];
+    uint8_t aabb_max_y[RTX_CPU_WIDE_BVH_WIDTH];
+    uint8_t aabb_max_z[RTX_CPU_WIDE_BVH_WIDTH];
+    int child_node_index[RTX_CPU_WIDE_BVH_WIDTH];
+    uint16_t num_assigned_faces[RTX_CPU_WIDE_BVH_WIDTH];
+    int num_lanes;
+} rtxCPUQuantizedWideBVHNode;
+
+typedef struct rtxCPUWideBVH {
+    int num_nodes;
+    int serial_node_index_offset;
+} rtxCPUWideBVH;
+
+// オブジェクトのBVHを遅延構築する場合の引数
+// node_array_array[object_index] is the object's wide node array in bvh_node_format, or NULL while its BVH
+// is still the coarse leaf; the first ray that enters the object's box calls build, which publishes the array.
+typedef struct rtxCPULazyBVHArguments {
+    std::atomic<const void*>* node_array_array;
+    const void* (*build)(void* context, int object_index);
+    void* context;
+} rtxCPULazyBVHArguments;
+
+// 交差判定に使う値を前もって計算した三角形
+// 面の配列と同じ番号（葉の順）で並べるので、葉の三角形は連続した領域にある
+// Edges and the unit normal are computed with the same operations as the indexed test, so the hits are
+// bit-identical (see triangle_group.cpp for why this needs -ffp-contract=off).
+typedef struct rtxCPUTriangle {
+    float va_x;
+    float va_y;
+    float va_z;
+    float edge_ba_x;
+    float edge_ba_y;
+    float edge_ba_z;
+    float edge_ca_x;
+    float edge_ca_y;
+    float edge_ca_z;
+    float unit_normal_x;
+    float unit_normal_y;
+    float unit_normal_z;
+} rtxCPUTriangle;
+
+void rtx_cpu_launch_mcrt_kernel(
+    rtxFaceVertexIndex* cpu_face_vertex_index_array,
+    rtxVertex* cpu_vertex_array,
+    rtxObject* cpu_object_array,
+    rtxMaterialAttributeByte* cpu_material_attribute_byte_array,
+    rtxThreadedBVH* cpu_threaded_bvh_array,
+    rtxThreadedBVHNode* cpu_threaded_bvh_node_array,
+    rtxThreadedBVHLink* cpu_threaded_bvh_link_array,
+    rtxCPUWideBVH* cpu_wide_bvh_array,
+    rtxCPUWideBVHNode* cpu_wide_bvh_node_array,
+    rtxCPUQuantizedWideBVHNode* cpu_quantized_wide_bvh_node_array,
+    int bvh_node_format,
+    rtxCPUTriangle* cpu_triangle_array,
+    float* cpu_triangle_group_array,
+    int triangle_format,
+    rtxRGBAColor* cpu_color_mapping_array,
+    rtxUVCoordinate* cpu_serialized_uv_coordinate_array,
+    rtxCPUTextureObject* cpu_texture_object_array,
+    rtxCPULazyBVHArguments* cpu_lazy_bvh_args,
+    bool ray_packets_enabled,
+    bool wavefront_enabled,
+    int tile_size,
+    int tile_order,
+    rtxRGBAPixel* cpu_render_array,
+    rtxMCRTKernelArguments& args,
+    int num_threads);
+
+void rtx_cpu_launch_nee_kernel(
+    rtxFaceVertexIndex* cpu_face_vertex_index_array,
+    rtxVertex* cpu_vertex_array,
+    rtxObject* cpu_object_array,
+    rtxMaterialAttributeByte* cpu_material_attribute_byte_array,
+    rtxThreadedBVH* cpu_threaded_bvh_array,
+    rtxThreadedBVHNode* cpu_threaded_bvh_node_array,
+    rtxThreadedBVHLink* cpu_threaded_bvh_link_array,
+    rtxCPUWideBVH* cpu_wide_bvh_array,
+    rtxCPUWideBVHNode* cpu_wide_bvh_node_array,
+    rtxCPUQuantizedWideBVHNode* cpu_quantized_wide_bvh_node_array,
+    int bvh_node_format,
+    rtxCPUTriangle* cpu_triangle_array,
+    float* cpu_triangle_group_array,
+    int triangle_format,
+    rtxRGBAColor* cpu_color_mapping_array,
+    rtxUVCoordinate* cpu_serialized_uv_coordinate_array,
+    rtxCPUTextureObject* cpu_texture_object_array,
+    int* cpu_light_sampling_table,
+    rtxCPULazyBVHArguments* cpu_lazy_bvh_args,
+    bool ray_packets_enabled,
+    bool wavefront_enabled,
+    int tile_size,
+    int tile_order,
+    rtxRGBAPixel* cpu_render_array,
+    rtxNEEKernelArguments& args,
+    int num_threads);
+
+// 多分岐BVHを辿る時間を測る（レイ1本あたり、ns）
+// Used once per process to fit the constants of the BVH cost model to this CPU.
+float rtx_cpu_measure_wide_bvh_traversal(
+    rtxFaceVertexIndex* cpu_face_vertex_index_array,
+    rtxVertex* cpu_vertex_array,
+    int num_faces,
+    int num_vertices,
+    rtxCPUWideBVHNode* cpu_wide_bvh_node_array,
+    int num_rays);
@@ -0,0 +1,136 @@
+#pragma once
+#include "../../header/struct.h"
+#include "cpu_bridge.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// cuda_functions.hのマクロをCPUのカーネルでもそのまま使うため
+// CUDAのベクトル型とcuRANDの関数をここで定義する
+// The macros in cuda_functions.h are shared with the CPU kernels,
+// so the CUDA vector types and the cuRAND functions they use are defined here.
+
+using std::max;
+using std::min;
+
+typedef struct float2 {
+    float x;
+    float y;
+} float2;
+
+typedef struct float3 {
+    float x;
+    float y;
+    float z;
+} float3;
+
+typedef struct float4 {
+    float x;
+    float y;
+    float z;
+    float w;
+} float4;
+
+typedef struct rtxCPURay {
+    float4 direction;
+    float4 origin;
+} rtxCPURay;
+
+// xoroshiro128+
+typedef struct rtxCPURandomState {
+    uint64_t s0;
+    uint64_t s1;
+} rtxCPURandomState;
+
+static inline uint64_t __rtx_cpu_splitmix64(uint64_t& x)
+{
+    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+static inline uint64_t __rtx_cpu_random_next(rtxCPURandomState* state)
+{
+    const uint64_t s0 = state->s0;
+    uint64_t s1 = state->s1;
+    const uint64_t result = s0 + s1;
+    s1 ^= s0;
+    state->s0 = ((s0 << 24) | (s0 >> 40)) ^ s1 ^ (s1 << 16);
+    state->s1 = (s1 << 37) | (s1 >> 27);
+    return result;
+}
+// curand_uniformと同じく(0, 1]の一様乱数
+// Uniform in (0, 1] like curand_uniform.
+static inline float __rtx_cpu_random_uniform(rtxCPURandomState* state)
+{
+    return float((__rtx_cpu_random_next(state) >> 40) + 1) * (1.0f / 16777216.0f);
+}
+// 同じseedとsubsequenceからは常に同じ乱数列が得られる
+// The same (seed, subsequence) pair always yields the same sequence, regardless of the thread running it.
+static inline void curand_init(unsigned long long seed, unsigned long long subsequence, unsigned long long offset, rtxCPURandomState* state)
+{
+    uint64_t x = seed ^ (subsequence * 0xD1B54A32D192ED03ULL);
+    state->s0 = __rtx_cpu_splitmix64(x);
+    state->s1 = __rtx_cpu_splitmix64(x);
+    for (unsigned long long n = 0; n < offset; n++) {
+        __rtx_cpu_random_next(state);
+    }
+}
+static inline float4 curand_uniform4(rtxCPURandomState* state)
+{
+    float4 ret;
+    ret.x = __rtx_cpu_random_uniform(state);
+    ret.y = __rtx_cpu_random_uniform(state);
+    ret.z = __rtx_cpu_random_uniform(state);
+    ret.w = __rtx_cpu_random_uniform(state);
+    return ret;
+}
+// Box-Muller
+static inline float4 curand_normal4(rtxCPURandomState* state)
+{
+    const float4 u = curand_uniform4(state);
+    const float r0 = sqrtf(-2.0f * logf(u.x));
+    const float r1 = sqrtf(-2.0f * logf(u.z));
+    float4 ret;
+    ret.x = r0 * cosf(2.0f * float(M_PI) * u.y);
+    ret.y = r0 * sinf(2.0f * float(M_PI) * u.y);
+    ret.z = r1 * cosf(2.0f * float(M_PI) * u.w);
+    ret.w = r1 * sinf(2.0f * float(M_PI) * u.w);
+    return ret;
+}
+
+// cudaFilterModeLinear, cudaAddressModeWrap, normalizedCoords = trueで作ったテクスチャと同じ挙動
+// Same lookup as the CUDA texture objects: normalized coordinates, bilinear filtering and wrap addressing.
+template <typename T>
+T tex2D(const rtxCPUTextureObject& texture, float x, float y);
+
+template <>
+inline float4 tex2D<float4>(const rtxCPUTextureObject& texture, float x, float y)
+{
+    const float xb = x * texture.width - 0.5f;
+    const float yb = y * texture.height - 0.5f;
+    const float fx = floorf(xb);
+    const float fy = floorf(yb);
+    const float ax = xb - fx;
+    const float ay = yb - fy;
+    int x0 = int(fx) % texture.width;
+    int y0 = int(fy) % texture.height;
+    if (x0 < 0) {
+        x0 += texture.width;
+    }
+    if (y0 < 0) {
+        y0 += texture.height;
+    }
+    const int x1 = (x0 + 1) % texture.width;
+    const int y1 = (y0 + 1) % texture.height;
+    const rtxRGBAPixel& p00 = texture.data[y0 * texture.width + x0];
+    const rtxRGBAPixel& p10 = texture.data[y0 * texture.width + x1];
+    const rtxRGBAPixel& p01 = texture.data[y1 * texture.width + x0];
+    const rtxRGBAPixel& p11 = texture.data[y1 * texture.width + x1];
+    float4 ret;
+    ret.x = (1.0f - ay) * ((1.0f - ax) * p00.r + ax * p10.r) + ay * ((1.0f - ax) * p01.r + ax * p11.r);
+    ret.y = (1.0f - ay) * ((1.0f - ax) * p00.g + ax * p10.g) + ay * ((1.0f - ax) * p01.g + ax * p11.g);
+    ret.z = (1.0f - ay) * ((1.0f - ax) * p00.b + ax * p10.b) + ay * ((1.0f - ax) * p01.b + ax * p11.b);
+    ret.w = (1.0f - ay) * ((1.0f - ax) * p00.a + ax * p10.a) + ay * ((1.0f - ax) * p01.a + ax * p11.a);
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,851 @@
+#pragma once
+#include "../../header/enum.h"
+#include "../../header/struct.h"
+#include "bridge.h"
+#include "cpu_common.h"
+#include "cpu_triangle_group.h"
+#include "cuda_functions.h"
+#include <cassert>
+#include <float.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RTX_CPU_X86
+#endif
+
+// 走査のSIMDの命令セット
+// The kernels are built for the baseline of the target (SSE2 on x86-64) and the traversal is instantiated once
+// per instruction set below; rtx_cpu_traversal_kernel picks one from the CPU features at run time.
+typedef struct rtxCPUInstructionSetBaseline {
+} rtxCPUInstructionSetBaseline;
+typedef struct rtxCPUInstructionSetAVX2 {
+} rtxCPUInstructionSetAVX2;
+#if defined(RTX_CPU_X86)
+// FMAは付けないので、どの命令セットでも丸めはベースラインと同じ
+#define RTX_CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+// 命令セットの型を取る走査は呼び出し元に必ず展開する
+// A template cannot carry a target attribute that depends on its argument, so the traversal is inlined into
+// the entry points of kernel/cpu/traversal.cpp and compiled with their target; otherwise every node test
+// would be an out-of-line call.
+#define RTX_CPU_FORCE_INLINE __attribute__((always_inline)) inline
+
+// 多分岐BVHの走査スタックの大きさ
+// A wide node pushes at most RTX_CPU_WIDE_BVH_WIDTH - 1 more entries than it pops.
+#define RTX_CPU_WIDE_BVH_STACK_SIZE 1024
+
+// CPUのカーネルから参照する直列データ
+typedef struct rtxCPUSerializedScene {
+    rtxFaceVertexIndex* face_vertex_index_array;
+    rtxVertex* vertex_array;
+    rtxObject* object_array;
+    rtxMaterialAttributeByte* material_attribute_byte_array;
+    rtxThreadedBVH* threaded_bvh_array;
+    rtxThreadedBVHNode* threaded_bvh_node_array;
+    rtxThreadedBVHLink* threaded_bvh_link_array;
+    rtxCPUWideBVH* wide_bvh_array;
+    rtxCPUWideBVHNode* wide_bvh_node_array;
+    rtxCPUQuantizedWideBVHNode* quantized_wide_bvh_node_array;
+    // RTXBVHNodeFormat
+    int bvh_node_format;
+    rtxCPUTriangle* triangle_array;
+    // RTXTriangleFormatGroupedの時だけ使う
+    float* triangle_group_array;
+    rtxCPUTriangleGroupKernel triangle_group_kernel;
+    // RTXTriangleFormat
+    int triangle_format;
+    rtxRGBAColor* color_mapping_array;
+    rtxUVCoordinate* uv_coordinate_array;
+    rtxCPUTextureObject* texture_object_array;
+    // 遅延構築しない場合はNULL
+    rtxCPULazyBVHArguments* lazy_bvh;
+    int* light_sampling_table;
+    int object_array_size;
+    // threaded_bvh_array[object_array_size]に置かれたオブジェクト単位のBVH
+    rtxThreadedBVH top_level_bvh;
+} rtxCPUSerializedScene;
+
+typedef struct rtxCPUHit {
+    float3 point;
+    float3 unit_face_normal;
+    rtxVertex va;
+    rtxVertex vb;
+    rtxVertex vc;
+    rtxFaceVertexIndex face;
+    rtxObject object;
+} rtxCPUHit;
+
+// 以下の関数ではcuda_functions.hのマクロを使う
+// マクロ内のcontinueはdo { } while (false)を抜けるために使われる
+// The shared macros bail out with `continue`; inside do { } while (false) that simply exits the block.
+
+static inline bool rtx_cpu_intersect_standard(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    int assigned_face_index_start,
+    int num_assigned_faces,
+    const rtxCPURay& ray,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    bool did_hit = false;
+    for (int m = 0; m < num_assigned_faces; m++) {
+        int serialized_face_index = assigned_face_index_start + m + object.serialized_face_index_offset;
+        const rtxFaceVertexIndex face = scene.face_vertex_index_array[serialized_face_index];
+
+        const rtxVertex va = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+        const rtxVertex vb = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+        const rtxVertex vc = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+
+        float3 face_normal;
+        float distance;
+        __rtx_intersect_triangle_or_continue(ray, va, vb, vc, face_normal, distance, min_distance);
+
+        min_distance = distance;
+        hit.point.x = ray.origin.x + distance * ray.direction.x;
+        hit.point.y = ray.origin.y + distance * ray.direction.y;
+        hit.point.z = ray.origin.z + distance * ray.direction.z;
+
+        hit.unit_face_normal = face_normal;
+
+        hit.va = va;
+        hit.vb = vb;
+        hit.vc = vc;
+        hit.face = face;
+        hit.object = object;
+        did_hit = true;
+    }
+    return did_hit;
+}
+
+// 前もって計算した三角形との交差判定
+// The arithmetic matches __rtx_intersect_triangle_or_continue, but the edges and the unit normal are loaded
+// instead of recomputed, and back faces are rejected before any other work.
+// The face indices and vertices the shading needs are read once, for the nearest hit in the leaf.
+static inline bool rtx_cpu_intersect_standard_precomputed(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    int assigned_face_index_start,
+    int num_assigned_faces,
+    const rtxCPURay& ray,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    const float eps = 0.000001;
+    const int serialized_face_index_start = assigned_face_index_start + object.serialized_face_index_offset;
+    const rtxCPUTriangle* triangle_array = scene.triangle_array + serialized_face_index_start;
+    int hit_face_index = -1;
+    for (int m = 0; m < num_assigned_faces; m++) {
+        const rtxCPUTriangle& triangle = triangle_array[m];
+        float dot = triangle.unit_normal_x * ray.direction.x + triangle.unit_normal_y * ray.direction.y + triangle.unit_normal_z * ray.direction.z;
+        if (dot > 0.0f) {
+            continue;
+        }
+        float3 h = {
+            ray.direction.y * triangle.edge_ca_z - ray.direction.z * triangle.edge_ca_y,
+            ray.direction.z * triangle.edge_ca_x - ray.direction.x * triangle.edge_ca_z,
+            ray.direction.x * triangle.edge_ca_y - ray.direction.y * triangle.edge_ca_x,
+        };
+        float f = triangle.edge_ba_x * h.x + triangle.edge_ba_y * h.y + triangle.edge_ba_z * h.z;
+        if (f > -eps && f < eps) {
+            continue;
+        }
+        f = 1.0f / f;
+        const float3 s = {
+            ray.origin.x - triangle.va_x,
+            ray.origin.y - triangle.va_y,
+            ray.origin.z - triangle.va_z,
+        };
+        dot = s.x * h.x + s.y * h.y + s.z * h.z;
+        const float u = f * dot;
+        if (u < 0.0f || u > 1.0f) {
+            continue;
+        }
+        h.x = s.y * triangle.edge_ba_z - s.z * triangle.edge_ba_y;
+        h.y = s.z * triangle.edge_ba_x - s.x * triangle.edge_ba_z;
+        h.z = s.x * triangle.edge_ba_y - s.y * triangle.edge_ba_x;
+        dot = h.x * ray.direction.x + h.y * ray.direction.y + h.z * ray.direction.z;
+        const float v = f * dot;
+        if (v < 0.0f || u + v > 1.0f) {
+            continue;
+        }
+        dot = triangle.edge_ca_x * h.x + triangle.edge_ca_y * h.y + triangle.edge_ca_z * h.z;
+        const float t = f * dot;
+        if (t <= 0.001f) {
+            continue;
+        }
+        if (min_distance <= t) {
+            continue;
+        }
+        min_distance = t;
+        hit_face_index = m;
+    }
+    if (hit_face_index == -1) {
+        return false;
+    }
+    const rtxCPUTriangle& triangle = triangle_array[hit_face_index];
+    hit.point.x = ray.origin.x + min_distance * ray.direction.x;
+    hit.point.y = ray.origin.y + min_distance * ray.direction.y;
+    hit.point.z = ray.origin.z + min_distance * ray.direction.z;
+    hit.unit_face_normal = { triangle.unit_normal_x, triangle.unit_normal_y, triangle.unit_normal_z };
+
+    const rtxFaceVertexIndex face = scene.face_vertex_index_array[serialized_face_index_start + hit_face_index];
+    hit.va = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+    hit.vb = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+    hit.vc = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+    hit.face = face;
+    hit.object = object;
+    return true;
+}
+
+// 成分ごとにまとめた三角形との交差判定
+// The SIMD kernel finds the nearest face of the leaf; the hit is then filled in as the precomputed test does.
+static inline bool rtx_cpu_intersect_standard_grouped(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    int assigned_face_index_start,
+    int num_assigned_faces,
+    const rtxCPURay& ray,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    const int serialized_face_index_start = assigned_face_index_start + object.serialized_face_index_offset;
+    const rtxCPUTriangleGroupKernel& kernel = scene.triangle_group_kernel;
+    const int hit_face_index = kernel.intersect(scene.triangle_group_array, serialized_face_index_start, num_assigned_faces, ray, min_distance);
+    if (hit_face_index == -1) {
+        return false;
+    }
+    const rtxCPUTriangle triangle = rtx_cpu_load_triangle_from_group(scene.triangle_group_array, kernel.width, hit_face_index);
+    hit.point.x = ray.origin.x + min_distance * ray.direction.x;
+    hit.point.y = ray.origin.y + min_distance * ray.direction.y;
+    hit.point.z = ray.origin.z + min_distance * ray.direction.z;
+    hit.unit_face_normal = { triangle.unit_normal_x, triangle.unit_normal_y, triangle.unit_normal_z };
+
+    const rtxFaceVertexIndex face = scene.face_vertex_index_array[hit_face_index];
+    hit.va = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+    hit.vb = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+    hit.vc = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+    hit.face = face;
+    hit.object = object;
+    return true;
+}
+
+static inline bool rtx_cpu_intersect_sphere(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    int assigned_face_index_start,
+    int num_assigned_faces,
+    const rtxCPURay& ray,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    do {
+        int serialized_array_index = assigned_face_index_start + object.serialized_face_index_offset;
+        const rtxFaceVertexIndex face = scene.face_vertex_index_array[serialized_array_index];
+
+        const rtxVertex center = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+        const rtxVertex radius = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+
+        float distance;
+        __rtx_intersect_sphere_or_continue(ray, center, radius, distance, min_distance);
+
+        min_distance = distance;
+        hit.point.x = ray.origin.x + distance * ray.direction.x;
+        hit.point.y = ray.origin.y + distance * ray.direction.y;
+        hit.point.z = ray.origin.z + distance * ray.direction.z;
+
+        float3 normal = {
+            hit.point.x - center.x,
+            hit.point.y - center.y,
+            hit.point.z - center.z,
+        };
+        __rtx_normalize_vector(normal);
+        hit.unit_face_normal = normal;
+
+        hit.object = object;
+        return true;
+    } while (false);
+    return false;
+}
+
+static inline bool rtx_cpu_intersect_cylinder(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    int assigned_face_index_start,
+    int num_assigned_faces,
+    const rtxCPURay& ray,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    do {
+        rtxFaceVertexIndex face;
+        int offset = assigned_face_index_start + object.serialized_face_index_offset;
+
+        // Load cylinder parameters
+        face = scene.face_vertex_index_array[offset + 0];
+        const rtxVertex params = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+        const float radius = params.x;
+        const float y_max = params.y;
+        const float y_min = params.z;
+
+        // Load transformation matrix
+        face = scene.face_vertex_index_array[offset + 1];
+        const rtxVertex trans_a = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+        const rtxVertex trans_b = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+        const rtxVertex trans_c = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+
+        // Load inverse transformation matrix
+        face = scene.face_vertex_index_array[offset + 2];
+        const rtxVertex inv_trans_a = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+        const rtxVertex inv_trans_b = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+        const rtxVertex inv_trans_c = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+
+        float distance;
+        float3 unit_hit_face_normal;
+        __rtx_intersect_cylinder_or_continue(
+            ray,
+            trans_a, trans_b, trans_c,
+            inv_trans_a, inv_trans_b, inv_trans_c,
+            unit_hit_face_normal,
+            distance,
+            min_distance);
+        min_distance = distance;
+
+        // hit point in view space
+        hit.point.x = ray.origin.x + distance * ray.direction.x;
+        hit.point.y = ray.origin.y + distance * ray.direction.y;
+        hit.point.z = ray.origin.z + distance * ray.direction.z;
+        hit.unit_face_normal = unit_hit_face_normal;
+
+        hit.object = object;
+        return true;
+    } while (false);
+    return false;
+}
+
+static inline bool rtx_cpu_intersect_cone(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    int assigned_face_index_start,
+    int num_assigned_faces,
+    const rtxCPURay& ray,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    do {
+        rtxFaceVertexIndex face;
+        int offset = assigned_face_index_start + object.serialized_face_index_offset;
+
+        // Load cone parameters
+        face = scene.face_vertex_index_array[offset + 0];
+        const rtxVertex params = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+        const float radius = params.x;
+        const float height = params.y;
+
+        // Load transformation matrix
+        face = scene.face_vertex_index_array[offset + 1];
+        const rtxVertex trans_a = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+        const rtxVertex trans_b = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+        const rtxVertex trans_c = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+
+        // Load inverse transformation matrix
+        face = scene.face_vertex_index_array[offset + 2];
+        const rtxVertex inv_trans_a = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+        const rtxVertex inv_trans_b = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+        const rtxVertex inv_trans_c = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+
+        float distance;
+        float3 unit_hit_face_normal;
+        __rtx_intersect_cone_or_continue(
+            ray,
+            trans_a, trans_b, trans_c,
+            inv_trans_a, inv_trans_b, inv_trans_c,
+            unit_hit_face_normal,
+            distance,
+            min_distance);
+        min_distance = distance;
+
+        // hit point in view space
+        hit.point.x = ray.origin.x + distance * ray.direction.x;
+        hit.point.y = ray.origin.y + distance * ray.direction.y;
+        hit.point.z = ray.origin.z + distance * ray.direction.z;
+        hit.unit_face_normal = unit_hit_face_normal;
+
+        hit.object = object;
+        return true;
+    } while (false);
+    return false;
+}
+
+// 1つのオブジェクトのThreaded BVHを辿る
+// 多分岐BVHのノードの全レーンのAABBとの衝突判定をまとめて行う
+// 各軸で近い面と遠い面をレイの向きで選ぶのは__rtx_bvh_traversal_one_step_or_continueと同じ
+// Returns a bit mask of the lanes whose box the ray enters within [0.001, min_distance];
+// the entry distance of every lane is written to distance.
+static inline int rtx_cpu_intersect_wide_bvh_node_aabbs(
+    rtxCPUInstructionSetBaseline,
+    const rtxCPUWideBVHNode& node,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    float min_distance,
+    float* distance)
+{
+    const float* near_x = ray_direction_inv.x < 0 ? node.aabb_max_x : node.aabb_min_x;
+    const float* far_x = ray_direction_inv.x < 0 ? node.aabb_min_x : node.aabb_max_x;
+    const float* near_y = ray_direction_inv.y < 0 ? node.aabb_max_y : node.aabb_min_y;
+    const float* far_y = ray_direction_inv.y < 0 ? node.aabb_min_y : node.aabb_max_y;
+    const float* near_z = ray_direction_inv.z < 0 ? node.aabb_max_z : node.aabb_min_z;
+    const float* far_z = ray_direction_inv.z < 0 ? node.aabb_min_z : node.aabb_max_z;
+#if defined(__SSE2__)
+    const __m128 origin_x = _mm_set1_ps(ray.origin.x);
+    const __m128 origin_y = _mm_set1_ps(ray.origin.y);
+    const __m128 origin_z = _mm_set1_ps(ray.origin.z);
+    const __m128 inv_x = _mm_set1_ps(ray_direction_inv.x);
+    const __m128 inv_y = _mm_set1_ps(ray_direction_inv.y);
+    const __m128 inv_z = _mm_set1_ps(ray_direction_inv.z);
+    int mask = 0;
+    // 4レーンずつ2回に分けて調べる
+    for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane += 4) {
+        // 計算誤差を防ぐため0.001より手前は見ない
+        // The new term comes first so that a NaN slab (0 * inf) leaves the interval unchanged.
+        __m128 t_near = _mm_set1_ps(0.001f);
+        __m128 t_far = _mm_set1_ps(min_distance);
+        t_near = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_x + lane), origin_x), inv_x), t_near);
+        t_far = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_x + lane), origin_x), inv_x), t_far);
+        t_near = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_y + lane), origin_y), inv_y), t_near);
+        t_far = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_y + lane), origin_y), inv_y), t_far);
+        t_near = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_z + lane), origin_z), inv_z), t_near);
+        t_far = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_z + lane), origin_z), inv_z), t_far);
+        _mm_storeu_ps(distance + lane, t_near);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(t_near, t_far)) << lane;
+    }
+    return mask;
+#else
+    int mask = 0;
+    for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+        float t_near = 0.001f;
+        float t_far = min_distance;
+        t_near = max((near_x[lane] - ray.origin.x) * ray_direction_inv.x, t_near);
+        t_far = min((far_x[lane] - ray.origin.x) * ray_direction_inv.x, t_far);
+        t_near = max((near_y[lane] - ray.origin.y) * ray_direction_inv.y, t_near);
+        t_far = min((far_y[lane] - ray.origin.y) * ray_direction_inv.y, t_far);
+        t_near = max((near_z[lane] - ray.origin.z) * ray_direction_inv.z, t_near);
+        t_far = min((far_z[lane] - ray.origin.z) * ray_direction_inv.z, t_far);
+        distance[lane] = t_near;
+        if (t_near <= t_far) {
+            mask |= 1 << lane;
+        }
+    }
+    return mask;
+#endif
+}
+#if defined(RTX_CPU_X86)
+RTX_CPU_TARGET_AVX2 static inline int rtx_cpu_intersect_wide_bvh_node_aabbs(
+    rtxCPUInstructionSetAVX2,
+    const rtxCPUWideBVHNode& node,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    float min_distance,
+    float* distance)
+{
+    const float* near_x = ray_direction_inv.x < 0 ? node.aabb_max_x : node.aabb_min_x;
+    const float* far_x = ray_direction_inv.x < 0 ? node.aabb_min_x : node.aabb_max_x;
+    const float* near_y = ray_direction_inv.y < 0 ? node.aabb_max_y : node.aabb_min_y;
+    const float* far_y = ray_direction_inv.y < 0 ? node.aabb_min_y : node.aabb_max_y;
+    const float* near_z = ray_direction_inv.z < 0 ? node.aabb_max_z : node.aabb_min_z;
+    const float* far_z = ray_direction_inv.z < 0 ? node.aabb_min_z : node.aabb_max_z;
+    const __m256 origin_x = _mm256_set1_ps(ray.origin.x);
+    const __m256 origin_y = _mm256_set1_ps(ray.origin.y);
+    const __m256 origin_z = _mm256_set1_ps(ray.origin.z);
+    const __m256 inv_x = _mm256_set1_ps(ray_direction_inv.x);
+    const __m256 inv_y = _mm256_set1_ps(ray_direction_inv.y);
+    const __m256 inv_z = _mm256_set1_ps(ray_direction_inv.z);
+    __m256 t_near = _mm256_set1_ps(0.001f);
+    __m256 t_far = _mm256_set1_ps(min_distance);
+    t_near = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_x), origin_x), inv_x), t_near);
+    t_far = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_x), origin_x), inv_x), t_far);
+    t_near = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_y), origin_y), inv_y), t_near);
+    t_far = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_y), origin_y), inv_y), t_far);
+    t_near = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_z), origin_z), inv_z), t_near);
+    t_far = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_z), origin_z), inv_z), t_far);
+    _mm256_storeu_ps(distance, t_near);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+}
+#endif
+// 量子化したノードの全レーンのAABBとの衝突判定
+// (origin + q * scale - ray.origin) * inv = q * (scale * inv) + (origin - ray.origin) * inv
+// so each plane costs one multiply-add on the quantized coordinates.
+typedef struct rtxCPUQuantizedWideBVHNodePlanes {
+    const uint8_t* near_x;
+    const uint8_t* far_x;
+    const uint8_t* near_y;
+    const uint8_t* far_y;
+    const uint8_t* near_z;
+    const uint8_t* far_z;
+    float scale_x;
+    float scale_y;
+    float scale_z;
+    float offset_x;
+    float offset_y;
+    float offset_z;
+} rtxCPUQuantizedWideBVHNodePlanes;
+
+static inline rtxCPUQuantizedWideBVHNodePlanes rtx_cpu_quantized_wide_bvh_node_planes(
+    const rtxCPUQuantizedWideBVHNode& node,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv)
+{
+    rtxCPUQuantizedWideBVHNodePlanes planes;
+    planes.near_x = ray_direction_inv.x < 0 ? node.aabb_max_x : node.aabb_min_x;
+    planes.far_x = ray_direction_inv.x < 0 ? node.aabb_min_x : node.aabb_max_x;
+    planes.near_y = ray_direction_inv.y < 0 ? node.aabb_max_y : node.aabb_min_y;
+    planes.far_y = ray_direction_inv.y < 0 ? node.aabb_min_y : node.aabb_max_y;
+    planes.near_z = ray_direction_inv.z < 0 ? node.aabb_max_z : node.aabb_min_z;
+    planes.far_z = ray_direction_inv.z < 0 ? node.aabb_min_z : node.aabb_max_z;
+    planes.scale_x = node.scale_x * ray_direction_inv.x;
+    planes.scale_y = node.scale_y * ray_direction_inv.y;
+    planes.scale_z = node.scale_z * ray_direction_inv.z;
+    planes.offset_x = (node.origin_x - ray.origin.x) * ray_direction_inv.x;
+    planes.offset_y = (node.origin_y - ray.origin.y) * ray_direction_inv.y;
+    planes.offset_z = (node.origin_z - ray.origin.z) * ray_direction_inv.z;
+    return planes;
+}
+#if defined(__SSE2__)
+// 8bitの量子化座標を4レーン分floatに変換して読み込む
+static inline __m128 rtx_cpu_load_quantized_lanes(const uint8_t* quantized)
+{
+    int packed;
+    memcpy(&packed, quantized, sizeof(int));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+#endif
+static inline int rtx_cpu_intersect_wide_bvh_node_aabbs(
+    rtxCPUInstructionSetBaseline,
+    const rtxCPUQuantizedWideBVHNode& node,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    float min_distance,
+    float* distance)
+{
+    const rtxCPUQuantizedWideBVHNodePlanes planes = rtx_cpu_quantized_wide_bvh_node_planes(node, ray, ray_direction_inv);
+    const int lane_mask = (1 << node.num_lanes) - 1;
+#if defined(__SSE2__)
+    const __m128 lane_scale_x = _mm_set1_ps(planes.scale_x);
+    const __m128 lane_scale_y = _mm_set1_ps(planes.scale_y);
+    const __m128 lane_scale_z = _mm_set1_ps(planes.scale_z);
+    const __m128 lane_offset_x = _mm_set1_ps(planes.offset_x);
+    const __m128 lane_offset_y = _mm_set1_ps(planes.offset_y);
+    const __m128 lane_offset_z = _mm_set1_ps(planes.offset_z);
+    int mask = 0;
+    for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane += 4) {
+        __m128 t_near = _mm_set1_ps(0.001f);
+        __m128 t_far = _mm_set1_ps(min_distance);
+        t_near = _mm_max_ps(_mm_add_ps(_mm_mul_ps(rtx_cpu_load_quantized_lanes(planes.near_x + lane), lane_scale_x), lane_offset_x), t_near);
+        t_far = _mm_min_ps(_mm_add_ps(_mm_mul_ps(rtx_cpu_load_quantized_lanes(planes.far_x + lane), lane_scale_x), lane_offset_x), t_far);
+        t_near = _mm_max_ps(_mm_add_ps(_mm_mul_ps(rtx_cpu_load_quantized_lanes(planes.near_y + lane), lane_scale_y), lane_offset_y), t_near);
+        t_far = _mm_min_ps(_mm_add_ps(_mm_mul_ps(rtx_cpu_load_quantized_lanes(planes.far_y + lane), lane_scale_y), lane_offset_y), t_far);
+        t_near = _mm_max_ps(_mm_add_ps(_mm_mul_ps(rtx_cpu_load_quantized_lanes(planes.near_z + lane), lane_scale_z), lane_offset_z), t_near);
+        t_far = _mm_min_ps(_mm_add_ps(_mm_mul_ps(rtx_cpu_load_quantized_lanes(planes.far_z + lane), lane_scale_z), lane_offset_z), t_far);
+        _mm_storeu_ps(distance + lane, t_near);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(t_near, t_far)) << lane;
+    }
+    return mask & lane_mask;
+#else
+    int mask = 0;
+    for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+        float t_near = 0.001f;
+        float t_far = min_distance;
+        t_near = max(planes.near_x[lane] * planes.scale_x + planes.offset_x, t_near);
+        t_far = min(planes.far_x[lane] * planes.scale_x + planes.offset_x, t_far);
+        t_near = max(planes.near_y[lane] * planes.scale_y + planes.offset_y, t_near);
+        t_far = min(planes.far_y[lane] * planes.scale_y + planes.offset_y, t_far);
+        t_near = max(planes.near_z[lane] * planes.scale_z + planes.offset_z, t_near);
+        t_far = min(planes.far_z[lane] * planes.scale_z + planes.offset_z, t_far);
+        distance[lane] = t_near;
+        if (t_near <= t_far) {
+            mask |= 1 << lane;
+        }
+    }
+    return mask & lane_mask;
+#endif
+}
+#if defined(RTX_CPU_X86)
+// 8bitの量子化座標を8レーン分floatに変換して読み込む
+RTX_CPU_TARGET_AVX2 static inline __m256 rtx_cpu_load_quantized_lanes_avx2(const uint8_t* quantized)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)quantized)));
+}
+RTX_CPU_TARGET_AVX2 static inline int rtx_cpu_intersect_wide_bvh_node_aabbs(
+    rtxCPUInstructionSetAVX2,
+    const rtxCPUQuantizedWideBVHNode& node,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    float min_distance,
+    float* distance)
+{
+    const rtxCPUQuantizedWideBVHNodePlanes planes = rtx_cpu_quantized_wide_bvh_node_planes(node, ray, ray_direction_inv);
+    const int lane_mask = (1 << node.num_lanes) - 1;
+    const __m256 lane_scale_x = _mm256_set1_ps(planes.scale_x);
+    const __m256 lane_scale_y = _mm256_set1_ps(planes.scale_y);
+    const __m256 lane_scale_z = _mm256_set1_ps(planes.scale_z);
+    const __m256 lane_offset_x = _mm256_set1_ps(planes.offset_x);
+    const __m256 lane_offset_y = _mm256_set1_ps(planes.offset_y);
+    const __m256 lane_offset_z = _mm256_set1_ps(planes.offset_z);
+    __m256 t_near = _mm256_set1_ps(0.001f);
+    __m256 t_far = _mm256_set1_ps(min_distance);
+    t_near = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(rtx_cpu_load_quantized_lanes_avx2(planes.near_x), lane_scale_x), lane_offset_x), t_near);
+    t_far = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(rtx_cpu_load_quantized_lanes_avx2(planes.far_x), lane_scale_x), lane_offset_x), t_far);
+    t_near = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(rtx_cpu_load_quantized_lanes_avx2(planes.near_y), lane_scale_y), lane_offset_y), t_near);
+    t_far = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(rtx_cpu_load_quantized_lanes_avx2(planes.far_y), lane_scale_y), lane_offset_y), t_far);
+    t_near = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(rtx_cpu_load_quantized_lanes_avx2(planes.near_z), lane_scale_z), lane_offset_z), t_near);
+    t_far = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(rtx_cpu_load_quantized_lanes_avx2(planes.far_z), lane_scale_z), lane_offset_z), t_far);
+    _mm256_storeu_ps(distance, t_near);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ)) & lane_mask;
+}
+#endif
+typedef struct rtxCPUWideBVHStackEntry {
+    float distance;
+    // 中間ノードならノード番号、葉なら-1
+    int node_index;
+    int assigned_face_index_start;
+    int num_assigned_faces;
+} rtxCPUWideBVHStackEntry;
+
+static inline rtxCPUWideBVHStackEntry rtx_cpu_wide_bvh_stack_entry(const rtxCPUWideBVHNode& node, int lane, float distance)
+{
+    return { distance, node.child_node_index[lane], node.assigned_face_index_start[lane], node.num_assigned_faces[lane] };
+}
+static inline rtxCPUWideBVHStackEntry rtx_cpu_wide_bvh_stack_entry(const rtxCPUQuantizedWideBVHNode& node, int lane, float distance)
+{
+    const int child_node_index = node.child_node_index[lane];
+    if (child_node_index >= 0) {
+        return { distance, child_node_index, -1, 0 };
+    }
+    return { distance, -1, -1 - child_node_index, node.num_assigned_faces[lane] };
+}
+static inline bool rtx_cpu_intersect_leaf(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    const rtxCPUWideBVHStackEntry& leaf,
+    const rtxCPURay& ray,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    if (object.geometry_type == RTXGeometryTypeStandard) {
+        if (scene.triangle_format == RTXTriangleFormatPrecomputed) {
+            return rtx_cpu_intersect_standard_precomputed(scene, object, leaf.assigned_face_index_start, leaf.num_assigned_faces, ray, hit, min_distance);
+        }
+        if (scene.triangle_format == RTXTriangleFormatGrouped) {
+            return rtx_cpu_intersect_standard_grouped(scene, object, leaf.assigned_face_index_start, leaf.num_assigned_faces, ray, hit, min_distance);
+        }
+        return rtx_cpu_intersect_standard(scene, object, leaf.assigned_face_index_start, leaf.num_assigned_faces, ray, hit, min_distance);
+    }
+    if (object.geometry_type == RTXGeometryTypeSphere) {
+        return rtx_cpu_intersect_sphere(scene, object, leaf.assigned_face_index_start, leaf.num_assigned_faces, ray, hit, min_distance);
+    }
+    if (object.geometry_type == RTXGeometryTypeCylinder) {
+        return rtx_cpu_intersect_cylinder(scene, object, leaf.assigned_face_index_start, leaf.num_assigned_faces, ray, hit, min_distance);
+    }
+    if (object.geometry_type == RTXGeometryTypeCone) {
+        return rtx_cpu_intersect_cone(scene, object, leaf.assigned_face_index_start, leaf.num_assigned_faces, ray, hit, min_distance);
+    }
+    return false;
+}
+// 近い子から順に調べ、見つかった交点より遠い子は取り出した時点で捨てる
+// Children are pushed farthest first so the nearest one is popped next.
+template <typename InstructionSet, typename WideBVHNode>
+static RTX_CPU_FORCE_INLINE bool rtx_cpu_intersect_wide_bvh(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    const WideBVHNode* node_array,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    bool did_hit_object = false;
+    rtxCPUWideBVHStackEntry stack[RTX_CPU_WIDE_BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = { 0.0f, 0, -1, 0 };
+    while (stack_size > 0) {
+        const rtxCPUWideBVHStackEntry entry = stack[--stack_size];
+        if (entry.distance > min_distance) {
+            continue;
+        }
+        if (entry.node_index == -1) {
+            did_hit_object |= rtx_cpu_intersect_leaf(scene, object, entry, ray, hit, min_distance);
+            continue;
+        }
+
+        const WideBVHNode& node = node_array[entry.node_index];
+        float distance[RTX_CPU_WIDE_BVH_WIDTH];
+        const int hit_mask = rtx_cpu_intersect_wide_bvh_node_aabbs(InstructionSet(), node, ray, ray_direction_inv, min_distance, distance);
+        if (hit_mask == 0) {
+            continue;
+        }
+
+        // 当たった子を遠い順に並べる
+        int order[RTX_CPU_WIDE_BVH_WIDTH];
+        int num_hit_lanes = 0;
+        for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+            if ((hit_mask & (1 << lane)) == 0) {
+                continue;
+            }
+            int k = num_hit_lanes++;
+            while (k > 0 && distance[order[k - 1]] < distance[lane]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = lane;
+        }
+        assert(stack_size + num_hit_lanes <= RTX_CPU_WIDE_BVH_STACK_SIZE);
+        for (int k = 0; k < num_hit_lanes; k++) {
+            const int lane = order[k];
+            stack[stack_size++] = rtx_cpu_wide_bvh_stack_entry(node, lane, distance[lane]);
+        }
+    }
+    return did_hit_object;
+}
+// オブジェクトの多分岐BVHのノードの配列（bvh_node_formatの型）
+// With lazy construction an object that is still a coarse leaf is built here if the ray enters its box;
+// NULL means the ray misses the object.
+template <typename InstructionSet>
+static RTX_CPU_FORCE_INLINE const void* rtx_cpu_object_wide_bvh_nodes(
+    const rtxCPUSerializedScene& scene,
+    int object_index,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    float min_distance)
+{
+    const rtxCPUWideBVH& bvh = scene.wide_bvh_array[object_index];
+    if (scene.lazy_bvh == NULL) {
+        if (scene.bvh_node_format == RTXBVHNodeFormatQuantized) {
+            return scene.quantized_wide_bvh_node_array + bvh.serial_node_index_offset;
+        }
+        return scene.wide_bvh_node_array + bvh.serial_node_index_offset;
+    }
+    const void* node_array = scene.lazy_bvh->node_array_array[object_index].load(std::memory_order_acquire);
+    if (node_array != NULL) {
+        return node_array;
+    }
+    // まだ粗い葉のままなので、その箱に当たった場合だけ構築する
+    // The coarse leaf is the only lane of the object's serialized root; a ray that misses it, or enters it
+    // beyond the nearest hit so far, does not pay for the build.
+    float distance[RTX_CPU_WIDE_BVH_WIDTH];
+    int hit_mask;
+    if (scene.bvh_node_format == RTXBVHNodeFormatQuantized) {
+        hit_mask = rtx_cpu_intersect_wide_bvh_node_aabbs(InstructionSet(), scene.quantized_wide_bvh_node_array[bvh.serial_node_index_offset], ray, ray_direction_inv, min_distance, distance);
+    } else {
+        hit_mask = rtx_cpu_intersect_wide_bvh_node_aabbs(InstructionSet(), scene.wide_bvh_node_array[bvh.serial_node_index_offset], ray, ray_direction_inv, min_distance, distance);
+    }
+    if ((hit_mask & 1) == 0) {
+        return NULL;
+    }
+    return scene.lazy_bvh->build(scene.lazy_bvh->context, object_index);
+}
+template <typename InstructionSet>
+static RTX_CPU_FORCE_INLINE bool rtx_cpu_intersect_object(
+    const rtxCPUSerializedScene& scene,
+    int object_index,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    const rtxObject& object = scene.object_array[object_index];
+
+    // 各ジオメトリの多分岐BVH
+    const void* node_array = rtx_cpu_object_wide_bvh_nodes<InstructionSet>(scene, object_index, ray, ray_direction_inv, min_distance);
+    if (node_array == NULL) {
+        return false;
+    }
+    if (scene.bvh_node_format == RTXBVHNodeFormatQuantized) {
+        return rtx_cpu_intersect_wide_bvh<InstructionSet>(scene, object, (const rtxCPUQuantizedWideBVHNode*)node_array, ray, ray_direction_inv, hit, min_distance);
+    }
+    return rtx_cpu_intersect_wide_bvh<InstructionSet>(scene, object, (const rtxCPUWideBVHNode*)node_array, ray, ray_direction_inv, hit, min_distance);
+}
+template <typename InstructionSet>
+static RTX_CPU_FORCE_INLINE bool rtx_cpu_intersect_scene(
+    const rtxCPUSerializedScene& scene,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    rtxCPUHit& hit)
+{
+    float min_distance = FLT_MAX;
+    bool did_hit_object = false;
+
+    const rtxThreadedBVH& top_level_bvh = scene.top_level_bvh;
+    const int octant = __rtx_ray_octant(ray_direction_inv);
+    int tlas_current_node_index = 0;
+    for (int traversal = 0; traversal < top_level_bvh.num_nodes; traversal++) {
+        if (tlas_current_node_index == THREADED_BVH_TERMINAL_NODE) {
+            break;
+        }
+        const int serialized_node_index = top_level_bvh.serial_node_index_offset + tlas_current_node_index;
+        rtxThreadedBVHNode node = scene.threaded_bvh_node_array[serialized_node_index];
+        __rtx_load_octant_links(node, scene.threaded_bvh_link_array, serialized_node_index, octant);
+
+        bool is_inner_node = node.assigned_face_index_start == -1;
+        if (is_inner_node) {
+            __rtx_bvh_traversal_one_step_or_continue(ray, node, ray_direction_inv, min_distance, tlas_current_node_index);
+        } else {
+            did_hit_object |= rtx_cpu_intersect_object<InstructionSet>(scene, node.assigned_face_index_start, ray, ray_direction_inv, hit, min_distance);
+        }
+
+        if (node.hit_node_index == THREADED_BVH_TERMINAL_NODE) {
+            tlas_current_node_index = node.miss_node_index;
+        } else {
+            tlas_current_node_index = node.hit_node_index;
+        }
+    }
+    return did_hit_object;
+}
+
+static inline void rtx_cpu_fetch_color(
+    const rtxCPUSerializedScene& scene,
+    const rtxCPUHit& hit,
+    rtxRGBAColor& hit_color)
+{
+    // __rtx_fetch_colorはhit_va, hit_vb, hit_vcを参照する
+    const rtxVertex& hit_va = hit.va;
+    const rtxVertex& hit_vb = hit.vb;
+    const rtxVertex& hit_vc = hit.vc;
+    hit_color = { 0.0f, 0.0f, 0.0f, 0.0f };
+    __rtx_fetch_color_in_linear_memory(
+        hit.point,
+        hit.object,
+        hit.face,
+        hit_color,
+        scene.material_attribute_byte_array,
+        scene.color_mapping_array,
+        scene.texture_object_array,
+        scene.uv_coordinate_array);
+}
+
+template <typename CurrentDirection, typename NextDirection>
+static inline float rtx_cpu_compute_brdf(
+    const rtxCPUSerializedScene& scene,
+    const rtxCPUHit& hit,
+    const CurrentDirection& unit_current_ray_direction,
+    const NextDirection& unit_next_path_direction)
+{
+    float brdf = 0.0f;
+    __rtx_compute_brdf(
+        hit.unit_face_normal,
+        hit.object,
+        hit.face,
+        unit_current_ray_direction,
+        unit_next_path_direction,
+        scene.material_attribute_byte_array,
+        brdf);
+    return brdf;
+}
+
+static inline rtxEmissiveMaterialAttribute rtx_cpu_emissive_attribute(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object)
+{
+    return ((rtxEmissiveMaterialAttribute*)&scene.material_attribute_byte_array[object.material_attribute_byte_array_offset])[0];
+}
\ No newline at end of file
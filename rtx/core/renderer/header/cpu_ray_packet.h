@@ -0,0 +1,460 @@
+#pragma once
+#include "cpu_functions.h"
+#include "cpu_traversal.h"
+
+// タイルの4x2画素のブロックの一次レイをまとめて辿る
+// The rays of a block pass through neighbouring pixels of the screen, so they start within a few pixel widths of
+// each other (orthographic) or diverge from one origin by a few pixel widths (perspective) and visit nearly the
+// same nodes and triangles; a packet shares each node fetch and tests every triangle against all of its rays at once.
+// The packet code is AVX2 only and is compiled with a target attribute; the baseline kernel traces the rays
+// of a packet one at a time.
+#if defined(RTX_CPU_X86)
+typedef struct rtxCPURayPacket {
+    int num_rays;
+    // 全てのレイに共通の象限
+    int octant;
+    // 使わないレーンは0番目のレイの複製
+    rtxCPURay ray[RTX_CPU_RAY_PACKET_SIZE];
+    float3 ray_direction_inv[RTX_CPU_RAY_PACKET_SIZE];
+    alignas(32) float origin_x[RTX_CPU_RAY_PACKET_SIZE];
+    alignas(32) float origin_y[RTX_CPU_RAY_PACKET_SIZE];
+    alignas(32) float origin_z[RTX_CPU_RAY_PACKET_SIZE];
+    alignas(32) float direction_x[RTX_CPU_RAY_PACKET_SIZE];
+    alignas(32) float direction_y[RTX_CPU_RAY_PACKET_SIZE];
+    alignas(32) float direction_z[RTX_CPU_RAY_PACKET_SIZE];
+    alignas(32) float inv_x[RTX_CPU_RAY_PACKET_SIZE];
+    alignas(32) float inv_y[RTX_CPU_RAY_PACKET_SIZE];
+    alignas(32) float inv_z[RTX_CPU_RAY_PACKET_SIZE];
+} rtxCPURayPacket;
+
+// レイごとの最も近い交点
+// face_index is the face of the nearest mesh hit within its object (-1 if the nearest hit is a sphere,
+// cylinder or cone, which is already written to the hit array by the single-ray test).
+typedef struct rtxCPURayPacketHit {
+    alignas(32) float min_distance[RTX_CPU_RAY_PACKET_SIZE];
+    int object_index[RTX_CPU_RAY_PACKET_SIZE];
+    int face_index[RTX_CPU_RAY_PACKET_SIZE];
+} rtxCPURayPacketHit;
+
+typedef struct rtxCPURayPacketStackEntry {
+    // 当たったレイの中で最も近い距離
+    rtxCPUWideBVHStackEntry entry;
+    int ray_mask;
+} rtxCPURayPacketStackEntry;
+
+// マスクの最も下の立っているビットの番号
+static inline int rtx_cpu_lowest_bit_index(int mask)
+{
+    int index = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+}
+// min_distanceがdistanceより小さいレイのビットマスク
+RTX_CPU_TARGET_AVX2 static inline int rtx_cpu_ray_packet_closer_mask(const rtxCPURayPacketHit& packet_hit, float distance)
+{
+    return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(packet_hit.min_distance), _mm256_set1_ps(distance), _CMP_LT_OQ));
+}
+// オブジェクト単位のBVHのノードとの衝突判定
+// The single-ray test rejects only on ordered comparisons, so a NaN slab never culls the node here either.
+RTX_CPU_TARGET_AVX2 static inline int rtx_cpu_intersect_threaded_bvh_node_packet(
+    const rtxThreadedBVHNode& node,
+    const rtxCPURayPacket& packet,
+    const rtxCPURayPacketHit& packet_hit,
+    int ray_mask)
+{
+    const float near_x = (packet.octant & 1) ? node.aabb_max.x : node.aabb_min.x;
+    const float far_x = (packet.octant & 1) ? node.aabb_min.x : node.aabb_max.x;
+    const float near_y = (packet.octant & 2) ? node.aabb_max.y : node.aabb_min.y;
+    const float far_y = (packet.octant & 2) ? node.aabb_min.y : node.aabb_max.y;
+    const float near_z = (packet.octant & 4) ? node.aabb_max.z : node.aabb_min.z;
+    const float far_z = (packet.octant & 4) ? node.aabb_min.z : node.aabb_max.z;
+    const __m256 origin_x = _mm256_load_ps(packet.origin_x);
+    const __m256 origin_y = _mm256_load_ps(packet.origin_y);
+    const __m256 origin_z = _mm256_load_ps(packet.origin_z);
+    const __m256 inv_x = _mm256_load_ps(packet.inv_x);
+    const __m256 inv_y = _mm256_load_ps(packet.inv_y);
+    const __m256 inv_z = _mm256_load_ps(packet.inv_z);
+    const __m256 t_near_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(near_x), origin_x), inv_x);
+    const __m256 t_far_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(far_x), origin_x), inv_x);
+    const __m256 t_near_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(near_y), origin_y), inv_y);
+    const __m256 t_far_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(far_y), origin_y), inv_y);
+    const __m256 t_near_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(near_z), origin_z), inv_z);
+    const __m256 t_far_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(far_z), origin_z), inv_z);
+    const __m256 t_near = _mm256_max_ps(_mm256_max_ps(t_near_x, t_near_y), t_near_z);
+    const __m256 t_far = _mm256_min_ps(_mm256_min_ps(t_far_x, t_far_y), t_far_z);
+    __m256 miss = _mm256_cmp_ps(t_near, t_far, _CMP_GT_OQ);
+    miss = _mm256_or_ps(miss, _mm256_cmp_ps(t_far, _mm256_set1_ps(0.001f), _CMP_LT_OQ));
+    miss = _mm256_or_ps(miss, _mm256_cmp_ps(t_near, _mm256_load_ps(packet_hit.min_distance), _CMP_GT_OQ));
+    return ray_mask & ~_mm256_movemask_ps(miss);
+}
+// 1つの三角形と全てのレイの交差判定
+// The same reject conditions as rtx_cpu_intersect_standard_precomputed, evaluated for 8 rays in the order the
+// single-ray test computes them. Lanes that hit closer than their min_distance take the face.
+RTX_CPU_TARGET_AVX2 static inline void rtx_cpu_intersect_triangle_packet(
+    const rtxCPUTriangle& triangle,
+    const rtxCPURayPacket& packet,
+    int ray_mask,
+    int object_index,
+    int face_index,
+    rtxCPURayPacketHit& packet_hit)
+{
+    const __m256 direction_x = _mm256_load_ps(packet.direction_x);
+    const __m256 direction_y = _mm256_load_ps(packet.direction_y);
+    const __m256 direction_z = _mm256_load_ps(packet.direction_z);
+    const __m256 edge_ba_x = _mm256_set1_ps(triangle.edge_ba_x);
+    const __m256 edge_ba_y = _mm256_set1_ps(triangle.edge_ba_y);
+    const __m256 edge_ba_z = _mm256_set1_ps(triangle.edge_ba_z);
+    const __m256 edge_ca_x = _mm256_set1_ps(triangle.edge_ca_x);
+    const __m256 edge_ca_y = _mm256_set1_ps(triangle.edge_ca_y);
+    const __m256 edge_ca_z = _mm256_set1_ps(triangle.edge_ca_z);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    __m256 dot = _mm256_add_ps(_mm256_add_ps(
+                                   _mm256_mul_ps(_mm256_set1_ps(triangle.unit_normal_x), direction_x),
+                                   _mm256_mul_ps(_mm256_set1_ps(triangle.unit_normal_y), direction_y)),
+        _mm256_mul_ps(_mm256_set1_ps(triangle.unit_normal_z), direction_z));
+    __m256 reject = _mm256_cmp_ps(dot, zero, _CMP_GT_OQ);
+
+    __m256 h_x = _mm256_sub_ps(_mm256_mul_ps(direction_y, edge_ca_z), _mm256_mul_ps(direction_z, edge_ca_y));
+    __m256 h_y = _mm256_sub_ps(_mm256_mul_ps(direction_z, edge_ca_x), _mm256_mul_ps(direction_x, edge_ca_z));
+    __m256 h_z = _mm256_sub_ps(_mm256_mul_ps(direction_x, edge_ca_y), _mm256_mul_ps(direction_y, edge_ca_x));
+    __m256 f = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge_ba_x, h_x), _mm256_mul_ps(edge_ba_y, h_y)), _mm256_mul_ps(edge_ba_z, h_z));
+    reject = _mm256_or_ps(reject, _mm256_and_ps(
+                                      _mm256_cmp_ps(f, _mm256_set1_ps(-0.000001f), _CMP_GT_OQ),
+                                      _mm256_cmp_ps(f, _mm256_set1_ps(0.000001f), _CMP_LT_OQ)));
+    if ((ray_mask & ~_mm256_movemask_ps(reject)) == 0) {
+        return;
+    }
+    f = _mm256_div_ps(one, f);
+
+    const __m256 s_x = _mm256_sub_ps(_mm256_load_ps(packet.origin_x), _mm256_set1_ps(triangle.va_x));
+    const __m256 s_y = _mm256_sub_ps(_mm256_load_ps(packet.origin_y), _mm256_set1_ps(triangle.va_y));
+    const __m256 s_z = _mm256_sub_ps(_mm256_load_ps(packet.origin_z), _mm256_set1_ps(triangle.va_z));
+    dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(s_x, h_x), _mm256_mul_ps(s_y, h_y)), _mm256_mul_ps(s_z, h_z));
+    const __m256 u = _mm256_mul_ps(f, dot);
+    reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ)));
+
+    h_x = _mm256_sub_ps(_mm256_mul_ps(s_y, edge_ba_z), _mm256_mul_ps(s_z, edge_ba_y));
+    h_y = _mm256_sub_ps(_mm256_mul_ps(s_z, edge_ba_x), _mm256_mul_ps(s_x, edge_ba_z));
+    h_z = _mm256_sub_ps(_mm256_mul_ps(s_x, edge_ba_y), _mm256_mul_ps(s_y, edge_ba_x));
+    dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(h_x, direction_x), _mm256_mul_ps(h_y, direction_y)), _mm256_mul_ps(h_z, direction_z));
+    const __m256 v = _mm256_mul_ps(f, dot);
+    reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ)));
+
+    dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge_ca_x, h_x), _mm256_mul_ps(edge_ca_y, h_y)), _mm256_mul_ps(edge_ca_z, h_z));
+    const __m256 t = _mm256_mul_ps(f, dot);
+    const __m256 min_distance = _mm256_load_ps(packet_hit.min_distance);
+    reject = _mm256_or_ps(reject, _mm256_cmp_ps(t, _mm256_set1_ps(0.001f), _CMP_LE_OQ));
+    reject = _mm256_or_ps(reject, _mm256_cmp_ps(min_distance, t, _CMP_LE_OQ));
+
+    int hit_mask = ray_mask & ~_mm256_movemask_ps(reject);
+    if (hit_mask == 0) {
+        return;
+    }
+    const __m256 accept = _mm256_castsi256_ps(_mm256_setr_epi32(
+        -(hit_mask & 1), -((hit_mask >> 1) & 1), -((hit_mask >> 2) & 1), -((hit_mask >> 3) & 1),
+        -((hit_mask >> 4) & 1), -((hit_mask >> 5) & 1), -((hit_mask >> 6) & 1), -((hit_mask >> 7) & 1)));
+    _mm256_store_ps(packet_hit.min_distance, _mm256_blendv_ps(min_distance, t, accept));
+    while (hit_mask != 0) {
+        const int lane = rtx_cpu_lowest_bit_index(hit_mask);
+        hit_mask &= hit_mask - 1;
+        packet_hit.object_index[lane] = object_index;
+        packet_hit.face_index[lane] = face_index;
+    }
+}
+// 面の番号で並べた三角形をパケットで判定する
+RTX_CPU_TARGET_AVX2 static inline void rtx_cpu_intersect_standard_packet(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    int object_index,
+    const rtxCPUWideBVHStackEntry& leaf,
+    const rtxCPURayPacket& packet,
+    int ray_mask,
+    rtxCPURayPacketHit& packet_hit)
+{
+    for (int m = 0; m < leaf.num_assigned_faces; m++) {
+        const int face_index = leaf.assigned_face_index_start + m;
+        const int serialized_face_index = face_index + object.serialized_face_index_offset;
+        if (scene.triangle_format == RTXTriangleFormatPrecomputed) {
+            rtx_cpu_intersect_triangle_packet(scene.triangle_array[serialized_face_index], packet, ray_mask, object_index, face_index, packet_hit);
+            continue;
+        }
+        if (scene.triangle_format == RTXTriangleFormatGrouped) {
+            const rtxCPUTriangle triangle = rtx_cpu_load_triangle_from_group(scene.triangle_group_array, scene.triangle_group_kernel.width, serialized_face_index);
+            rtx_cpu_intersect_triangle_packet(triangle, packet, ray_mask, object_index, face_index, packet_hit);
+            continue;
+        }
+        // 辺と法線は__rtx_intersect_triangle_or_continueと同じ式で求める
+        const rtxFaceVertexIndex face = scene.face_vertex_index_array[serialized_face_index];
+        const rtxVertex va = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+        const rtxVertex vb = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+        const rtxVertex vc = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+        rtxCPUTriangle triangle;
+        triangle.va_x = va.x;
+        triangle.va_y = va.y;
+        triangle.va_z = va.z;
+        triangle.edge_ba_x = vb.x - va.x;
+        triangle.edge_ba_y = vb.y - va.y;
+        triangle.edge_ba_z = vb.z - va.z;
+        triangle.edge_ca_x = vc.x - va.x;
+        triangle.edge_ca_y = vc.y - va.y;
+        triangle.edge_ca_z = vc.z - va.z;
+        float3 normal = {
+            triangle.edge_ba_y * triangle.edge_ca_z - triangle.edge_ba_z * triangle.edge_ca_y,
+            triangle.edge_ba_z * triangle.edge_ca_x - triangle.edge_ba_x * triangle.edge_ca_z,
+            triangle.edge_ba_x * triangle.edge_ca_y - triangle.edge_ba_y * triangle.edge_ca_x,
+        };
+        const float norm = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+        triangle.unit_normal_x = normal.x / norm;
+        triangle.unit_normal_y = normal.y / norm;
+        triangle.unit_normal_z = normal.z / norm;
+        rtx_cpu_intersect_triangle_packet(triangle, packet, ray_mask, object_index, face_index, packet_hit);
+    }
+}
+// メッシュの多分岐BVHをパケットで辿る
+// Every ray tests a node with the single-ray SIMD test over its children, so a child is entered by exactly the
+// rays that would enter it alone; children are pushed farthest first by the nearest entry among their rays.
+template <typename WideBVHNode>
+RTX_CPU_TARGET_AVX2 static inline void rtx_cpu_intersect_wide_bvh_packet(
+    const rtxCPUSerializedScene& scene,
+    const rtxObject& object,
+    int object_index,
+    const WideBVHNode* node_array,
+    const rtxCPURayPacket& packet,
+    int ray_mask,
+    rtxCPURayPacketHit& packet_hit)
+{
+    rtxCPURayPacketStackEntry stack[RTX_CPU_WIDE_BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = { { 0.0f, 0, -1, 0 }, ray_mask };
+    while (stack_size > 0) {
+        const rtxCPURayPacketStackEntry packet_entry = stack[--stack_size];
+        const rtxCPUWideBVHStackEntry& entry = packet_entry.entry;
+        // 見つけた交点より奥にある子はそのレイでは辿らない
+        const int entry_ray_mask = packet_entry.ray_mask & ~rtx_cpu_ray_packet_closer_mask(packet_hit, entry.distance);
+        if (entry_ray_mask == 0) {
+            continue;
+        }
+        if (entry.node_index == -1) {
+            rtx_cpu_intersect_standard_packet(scene, object, object_index, entry, packet, entry_ray_mask, packet_hit);
+            continue;
+        }
+
+        const WideBVHNode& node = node_array[entry.node_index];
+        int lane_ray_mask[RTX_CPU_WIDE_BVH_WIDTH] = {};
+        float lane_distance[RTX_CPU_WIDE_BVH_WIDTH];
+        for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+            lane_distance[lane] = FLT_MAX;
+        }
+        int remaining_ray_mask = entry_ray_mask;
+        while (remaining_ray_mask != 0) {
+            const int ray_index = rtx_cpu_lowest_bit_index(remaining_ray_mask);
+            remaining_ray_mask &= remaining_ray_mask - 1;
+            float distance[RTX_CPU_WIDE_BVH_WIDTH];
+            int hit_mask = rtx_cpu_intersect_wide_bvh_node_aabbs(rtxCPUInstructionSetAVX2(), node, packet.ray[ray_index], packet.ray_direction_inv[ray_index], packet_hit.min_distance[ray_index], distance);
+            while (hit_mask != 0) {
+                const int lane = rtx_cpu_lowest_bit_index(hit_mask);
+                hit_mask &= hit_mask - 1;
+                lane_ray_mask[lane] |= 1 << ray_index;
+                lane_distance[lane] = min(lane_distance[lane], distance[lane]);
+            }
+        }
+
+        // 当たった子を遠い順に並べる
+        int order[RTX_CPU_WIDE_BVH_WIDTH];
+        int num_hit_lanes = 0;
+        for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+            if (lane_ray_mask[lane] == 0) {
+                continue;
+            }
+            int k = num_hit_lanes++;
+            while (k > 0 && lane_distance[order[k - 1]] < lane_distance[lane]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = lane;
+        }
+        assert(stack_size + num_hit_lanes <= RTX_CPU_WIDE_BVH_STACK_SIZE);
+        for (int k = 0; k < num_hit_lanes; k++) {
+            const int lane = order[k];
+            stack[stack_size++] = { rtx_cpu_wide_bvh_stack_entry(node, lane, lane_distance[lane]), lane_ray_mask[lane] };
+        }
+    }
+}
+RTX_CPU_TARGET_AVX2 static inline void rtx_cpu_intersect_object_packet(
+    const rtxCPUSerializedScene& scene,
+    int object_index,
+    const rtxCPURayPacket& packet,
+    int ray_mask,
+    rtxCPURayPacketHit& packet_hit,
+    rtxCPUHit* hit_array)
+{
+    const rtxObject& object = scene.object_array[object_index];
+
+    // 球などは葉が1つしかないのでレイごとに判定する
+    if (object.geometry_type != RTXGeometryTypeStandard) {
+        while (ray_mask != 0) {
+            const int ray_index = rtx_cpu_lowest_bit_index(ray_mask);
+            ray_mask &= ray_mask - 1;
+            if (rtx_cpu_intersect_object<rtxCPUInstructionSetAVX2>(scene, object_index, packet.ray[ray_index], packet.ray_direction_inv[ray_index], hit_array[ray_index], packet_hit.min_distance[ray_index])) {
+                packet_hit.object_index[ray_index] = object_index;
+                packet_hit.face_index[ray_index] = -1;
+            }
+        }
+        return;
+    }
+
+    // 遅延構築ではオブジェクトの箱に当たったレイがあれば構築される
+    const void* node_array = NULL;
+    for (int ray_index = 0; ray_index < packet.num_rays && node_array == NULL; ray_index++) {
+        if ((ray_mask & (1 << ray_index)) == 0) {
+            continue;
+        }
+        node_array = rtx_cpu_object_wide_bvh_nodes<rtxCPUInstructionSetAVX2>(scene, object_index, packet.ray[ray_index], packet.ray_direction_inv[ray_index], packet_hit.min_distance[ray_index]);
+    }
+    if (node_array == NULL) {
+        return;
+    }
+    if (scene.bvh_node_format == RTXBVHNodeFormatQuantized) {
+        rtx_cpu_intersect_wide_bvh_packet(scene, object, object_index, (const rtxCPUQuantizedWideBVHNode*)node_array, packet, ray_mask, packet_hit);
+        return;
+    }
+    rtx_cpu_intersect_wide_bvh_packet(scene, object, object_index, (const rtxCPUWideBVHNode*)node_array, packet, ray_mask, packet_hit);
+}
+#endif
+// パケットの逆数を求め、全てのレイが同じ象限を向いているか調べる
+static inline bool rtx_cpu_ray_packet_is_coherent(
+    const rtxCPURay* ray_array,
+    int num_rays,
+    float3* ray_direction_inv_array)
+{
+    for (int ray_index = 0; ray_index < num_rays; ray_index++) {
+        const rtxCPURay& ray = ray_array[ray_index];
+        ray_direction_inv_array[ray_index] = { 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
+    }
+    bool coherent = num_rays > 1;
+    for (int ray_index = 1; ray_index < num_rays && coherent; ray_index++) {
+        coherent = __rtx_ray_octant(ray_direction_inv_array[ray_index]) == __rtx_ray_octant(ray_direction_inv_array[0]);
+    }
+    return coherent;
+}
+// AVX2のない環境ではレイを1本ずつ辿る
+static inline void rtx_cpu_intersect_scene_packet(
+    rtxCPUInstructionSetBaseline,
+    const rtxCPUSerializedScene& scene,
+    const rtxCPURay* ray_array,
+    int num_rays,
+    rtxCPUHit* hit_array,
+    bool* did_hit_array)
+{
+    float3 ray_direction_inv_array[RTX_CPU_RAY_PACKET_SIZE];
+    rtx_cpu_ray_packet_is_coherent(ray_array, num_rays, ray_direction_inv_array);
+    for (int ray_index = 0; ray_index < num_rays; ray_index++) {
+        did_hit_array[ray_index] = rtx_cpu_intersect_scene<rtxCPUInstructionSetBaseline>(scene, ray_array[ray_index], ray_direction_inv_array[ray_index], hit_array[ray_index]);
+    }
+}
+#if defined(RTX_CPU_X86)
+// 一次レイをまとめて交差判定する
+// Falls back to one ray at a time when the packet holds a single ray or its rays do not share an octant
+// (the top-level links are ordered per octant). A mesh hit is finished by re-running the single-ray test on
+// the nearest face, so the hit point and normal are bit-identical to rtx_cpu_intersect_scene.
+RTX_CPU_TARGET_AVX2 static inline void rtx_cpu_intersect_scene_packet(
+    rtxCPUInstructionSetAVX2,
+    const rtxCPUSerializedScene& scene,
+    const rtxCPURay* ray_array,
+    int num_rays,
+    rtxCPUHit* hit_array,
+    bool* did_hit_array)
+{
+    float3 ray_direction_inv_array[RTX_CPU_RAY_PACKET_SIZE];
+    if (rtx_cpu_ray_packet_is_coherent(ray_array, num_rays, ray_direction_inv_array)) {
+        rtxCPURayPacket packet;
+        packet.num_rays = num_rays;
+        packet.octant = __rtx_ray_octant(ray_direction_inv_array[0]);
+        rtxCPURayPacketHit packet_hit;
+        for (int ray_index = 0; ray_index < RTX_CPU_RAY_PACKET_SIZE; ray_index++) {
+            const int source_index = ray_index < num_rays ? ray_index : 0;
+            const rtxCPURay& ray = ray_array[source_index];
+            const float3& ray_direction_inv = ray_direction_inv_array[source_index];
+            packet.ray[ray_index] = ray;
+            packet.ray_direction_inv[ray_index] = ray_direction_inv;
+            packet.origin_x[ray_index] = ray.origin.x;
+            packet.origin_y[ray_index] = ray.origin.y;
+            packet.origin_z[ray_index] = ray.origin.z;
+            packet.direction_x[ray_index] = ray.direction.x;
+            packet.direction_y[ray_index] = ray.direction.y;
+            packet.direction_z[ray_index] = ray.direction.z;
+            packet.inv_x[ray_index] = ray_direction_inv.x;
+            packet.inv_y[ray_index] = ray_direction_inv.y;
+            packet.inv_z[ray_index] = ray_direction_inv.z;
+            packet_hit.min_distance[ray_index] = FLT_MAX;
+            packet_hit.object_index[ray_index] = -1;
+            packet_hit.face_index[ray_index] = -1;
+        }
+        const int ray_mask = (1 << num_rays) - 1;
+
+        const rtxThreadedBVH& top_level_bvh = scene.top_level_bvh;
+        int tlas_current_node_index = 0;
+        for (int traversal = 0; traversal < top_level_bvh.num_nodes; traversal++) {
+            if (tlas_current_node_index == THREADED_BVH_TERMINAL_NODE) {
+                break;
+            }
+            const int serialized_node_index = top_level_bvh.serial_node_index_offset + tlas_current_node_index;
+            rtxThreadedBVHNode node = scene.threaded_bvh_node_array[serialized_node_index];
+            __rtx_load_octant_links(node, scene.threaded_bvh_link_array, serialized_node_index, packet.octant);
+
+            bool is_inner_node = node.assigned_face_index_start == -1;
+            if (is_inner_node) {
+                // どのレイも当たらなければ部分木を飛ばす
+                if (rtx_cpu_intersect_threaded_bvh_node_packet(node, packet, packet_hit, ray_mask) == 0) {
+                    tlas_current_node_index = node.miss_node_index;
+                    continue;
+                }
+            } else {
+                rtx_cpu_intersect_object_packet(scene, node.assigned_face_index_start, packet, ray_mask, packet_hit, hit_array);
+            }
+
+            if (node.hit_node_index == THREADED_BVH_TERMINAL_NODE) {
+                tlas_current_node_index = node.miss_node_index;
+            } else {
+                tlas_current_node_index = node.hit_node_index;
+            }
+        }
+
+        for (int ray_index = 0; ray_index < num_rays; ray_index++) {
+            const int object_index = packet_hit.object_index[ray_index];
+            if (object_index == -1) {
+                did_hit_array[ray_index] = false;
+                continue;
+            }
+            did_hit_array[ray_index] = true;
+            const int face_index = packet_hit.face_index[ray_index];
+            if (face_index == -1) {
+                continue;
+            }
+            const rtxObject& object = scene.object_array[object_index];
+            float min_distance = FLT_MAX;
+            bool did_hit_face;
+            if (scene.triangle_format == RTXTriangleFormatPrecomputed) {
+                did_hit_face = rtx_cpu_intersect_standard_precomputed(scene, object, face_index, 1, ray_array[ray_index], hit_array[ray_index], min_distance);
+            } else if (scene.triangle_format == RTXTriangleFormatGrouped) {
+                did_hit_face = rtx_cpu_intersect_standard_grouped(scene, object, face_index, 1, ray_array[ray_index], hit_array[ray_index], min_distance);
+            } else {
+                did_hit_face = rtx_cpu_intersect_standard(scene, object, face_index, 1, ray_array[ray_index], hit_array[ray_index], min_distance);
+            }
+            // 丸め方の違いで単独のテストが外れた場合はそのレイだけ辿り直す
+            if (did_hit_face == false) {
+                did_hit_array[ray_index] = rtx_cpu_intersect_scene<rtxCPUInstructionSetAVX2>(scene, ray_array[ray_index], ray_direction_inv_array[ray_index], hit_array[ray_index]);
+            }
+        }
+        return;
+    }
+    for (int ray_index = 0; ray_index < num_rays; ray_index++) {
+        did_hit_array[ray_index] = rtx_cpu_intersect_scene<rtxCPUInstructionSetAVX2>(scene, ray_array[ray_index], ray_direction_inv_array[ray_index], hit_array[ray_index]);
+    }
+}
+#endif
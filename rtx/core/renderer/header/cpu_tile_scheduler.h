@@ -0,0 +1,182 @@
+#pragma once
+#include "../../header/enum.h"
+#include "../../header/struct.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// 画面の矩形の領域と、その画素のサンプルの範囲
+// With num_rays_per_thread below num_rays_per_pixel every pixel's samples are split into ranges of
+// num_rays_per_thread, and each (tile, range) pair is a separate unit of work.
+typedef struct rtxCPUTile {
+    int x;
+    int y;
+    int width;
+    int height;
+    int sample_range_index;
+} rtxCPUTile;
+
+// スレッドごとのタイルの両端キュー
+// A queue is a range [begin, end) of rtxCPUTileScheduler::tile_array packed into one word: the owner pops from
+// begin and thieves take the back half, both with a compare-and-swap. Tiles are only ever removed, so the range
+// needs no further synchronisation. The padding keeps two queues off the same cache line.
+typedef struct rtxCPUTileQueue {
+    std::atomic<uint64_t> range;
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+} rtxCPUTileQueue;
+
+typedef struct rtxCPUTileScheduler {
+    // サンプルの範囲ごとにtile_orderの順に並べたタイル
+    std::vector<rtxCPUTile> tile_array;
+    std::vector<rtxCPUTileQueue> queue_array;
+} rtxCPUTileScheduler;
+
+// 1画素のサンプルを分けた範囲の数
+static inline int rtx_cpu_num_sample_ranges(int num_rays_per_pixel, int num_rays_per_thread)
+{
+    return (num_rays_per_pixel + num_rays_per_thread - 1) / num_rays_per_thread;
+}
+static inline uint64_t rtx_cpu_tile_range(uint32_t begin, uint32_t end)
+{
+    return (uint64_t(end) << 32) | begin;
+}
+// タイルの座標のビットを交互に並べる
+static inline uint32_t rtx_cpu_tile_morton_code(uint32_t x, uint32_t y)
+{
+    uint32_t code = 0;
+    for (int bit = 0; bit < 16; bit++) {
+        code |= ((x >> bit) & 1) << (2 * bit);
+        code |= ((y >> bit) & 1) << (2 * bit + 1);
+    }
+    return code;
+}
+// 画面をタイルに分け、順に並べてnum_queues個のキューに連続した範囲ずつ配る
+static inline void rtx_cpu_init_tile_scheduler(
+    rtxCPUTileScheduler& scheduler,
+    int screen_width,
+    int screen_height,
+    int tile_size,
+    int tile_order,
+    int num_sample_ranges,
+    int num_queues)
+{
+    const int num_tiles_x = (screen_width + tile_size - 1) / tile_size;
+    const int num_tiles_y = (screen_height + tile_size - 1) / tile_size;
+    const int num_tiles = num_tiles_x * num_tiles_y;
+
+    // 並べ替えの鍵とタイルの番号
+    std::vector<std::pair<uint64_t, int>> key_array(num_tiles);
+    for (int tile_index = 0; tile_index < num_tiles; tile_index++) {
+        const int tile_x = tile_index % num_tiles_x;
+        const int tile_y = tile_index / num_tiles_x;
+        uint64_t key = tile_index;
+        if (tile_order == RTXTileOrderMorton) {
+            key = rtx_cpu_tile_morton_code(tile_x, tile_y);
+        } else if (tile_order == RTXTileOrderSpiral) {
+            // 中心からの距離（タイルの半分を単位とする）の2乗
+            const int64_t dx = 2 * tile_x + 1 - num_tiles_x;
+            const int64_t dy = 2 * tile_y + 1 - num_tiles_y;
+            key = uint64_t(dx * dx + dy * dy);
+        }
+        key_array[tile_index] = { key, tile_index };
+    }
+    std::sort(key_array.begin(), key_array.end());
+
+    scheduler.tile_array.resize(num_tiles * num_sample_ranges);
+    for (int sample_range_index = 0; sample_range_index < num_sample_ranges; sample_range_index++) {
+        for (int k = 0; k < num_tiles; k++) {
+            const int tile_index = key_array[k].second;
+            rtxCPUTile& tile = scheduler.tile_array[sample_range_index * num_tiles + k];
+            tile.x = (tile_index % num_tiles_x) * tile_size;
+            tile.y = (tile_index / num_tiles_x) * tile_size;
+            tile.width = std::min(tile_size, screen_width - tile.x);
+            tile.height = std::min(tile_size, screen_height - tile.y);
+            tile.sample_range_index = sample_range_index;
+        }
+    }
+    const int num_units = scheduler.tile_array.size();
+
+    std::vector<rtxCPUTileQueue>(num_queues).swap(scheduler.queue_array);
+    for (int queue_index = 0; queue_index < num_queues; queue_index++) {
+        const uint32_t begin = uint64_t(num_units) * queue_index / num_queues;
+        const uint32_t end = uint64_t(num_units) * (queue_index + 1) / num_queues;
+        scheduler.queue_array[queue_index].range.store(rtx_cpu_tile_range(begin, end), std::memory_order_relaxed);
+    }
+}
+// 自分のキューの先頭から1つ取り出す
+static inline bool rtx_cpu_pop_tile(rtxCPUTileQueue& queue, int& tile_array_index)
+{
+    uint64_t range = queue.range.load(std::memory_order_relaxed);
+    while (true) {
+        const uint32_t begin = uint32_t(range);
+        const uint32_t end = uint32_t(range >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        if (queue.range.compare_exchange_weak(range, rtx_cpu_tile_range(begin + 1, end), std::memory_order_relaxed)) {
+            tile_array_index = begin;
+            return true;
+        }
+    }
+}
+// 他のキューの後ろ半分を自分のキューに移す
+static inline bool rtx_cpu_steal_tiles(rtxCPUTileQueue& victim, rtxCPUTileQueue& thief)
+{
+    uint64_t range = victim.range.load(std::memory_order_relaxed);
+    while (true) {
+        const uint32_t begin = uint32_t(range);
+        const uint32_t end = uint32_t(range >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        const uint32_t split = end - (end - begin + 1) / 2;
+        if (victim.range.compare_exchange_weak(range, rtx_cpu_tile_range(begin, split), std::memory_order_relaxed)) {
+            // 空のキューは誰も書き換えないので、そのまま置き換えてよい
+            thief.range.store(rtx_cpu_tile_range(split, end), std::memory_order_relaxed);
+            return true;
+        }
+    }
+}
+// 次に描画するタイル
+// Takes the next tile of the caller's own queue; once it is empty, steals from the other queues in turn,
+// starting with the next one. Returns false when every queue is empty.
+static inline bool rtx_cpu_next_tile(rtxCPUTileScheduler& scheduler, int queue_index, rtxCPUTile& tile)
+{
+    const int num_queues = scheduler.queue_array.size();
+    rtxCPUTileQueue& queue = scheduler.queue_array[queue_index];
+    int tile_array_index;
+    while (rtx_cpu_pop_tile(queue, tile_array_index) == false) {
+        bool did_steal = false;
+        for (int k = 1; k < num_queues && did_steal == false; k++) {
+            did_steal = rtx_cpu_steal_tiles(scheduler.queue_array[(queue_index + k) % num_queues], queue);
+        }
+        if (did_steal == false) {
+            return false;
+        }
+    }
+    tile = scheduler.tile_array[tile_array_index];
+    return true;
+}
+// タイルの画素を書き戻す
+// render_array holds num_sample_ranges partial sums per pixel, which the renderer adds up in range order,
+// so the image does not depend on which thread rendered which range.
+static inline void rtx_cpu_store_tile(
+    const rtxCPUTile& tile,
+    const rtxRGBAPixel* tile_pixel_array,
+    int num_sample_ranges,
+    rtxRGBAPixel* render_array,
+    int screen_width)
+{
+    for (int tile_row = 0; tile_row < tile.height; tile_row++) {
+        const rtxRGBAPixel* tile_row_pixels = tile_pixel_array + tile_row * tile.width;
+        const int row_pixel_index = (tile.y + tile_row) * screen_width + tile.x;
+        if (num_sample_ranges == 1) {
+            std::copy(tile_row_pixels, tile_row_pixels + tile.width, render_array + row_pixel_index);
+            continue;
+        }
+        for (int tile_column = 0; tile_column < tile.width; tile_column++) {
+            render_array[(row_pixel_index + tile_column) * num_sample_ranges + tile.sample_range_index] = tile_row_pixels[tile_column];
+        }
+    }
+}
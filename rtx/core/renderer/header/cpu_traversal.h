@@ -0,0 +1,43 @@
+#pragma once
+#include "cpu_functions.h"
+
+// パケットにまとめる一次レイの最大数
+// The AVX2 kernel traces this many rays per packet; the baseline kernel has a packet size of 1.
+#define RTX_CPU_RAY_PACKET_SIZE 8
+// パケットにまとめる画素の区画（幅と高さ）
+// A packet holds the same sample of each pixel in a block, so it is full even at one sample per pixel.
+#define RTX_CPU_RAY_PACKET_BLOCK_WIDTH 4
+#define RTX_CPU_RAY_PACKET_BLOCK_HEIGHT 2
+
+typedef bool (*rtxCPUIntersectSceneFunction)(
+    const rtxCPUSerializedScene& scene,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    rtxCPUHit& hit);
+typedef void (*rtxCPUIntersectScenePacketFunction)(
+    const rtxCPUSerializedScene& scene,
+    const rtxCPURay* ray_array,
+    int num_rays,
+    rtxCPUHit* hit_array,
+    bool* did_hit_array);
+typedef bool (*rtxCPUIntersectObjectFunction)(
+    const rtxCPUSerializedScene& scene,
+    int object_index,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    rtxCPUHit& hit,
+    float& min_distance);
+
+// 多分岐BVHの走査（スラブ判定、量子化したノード、レイのパケット）
+typedef struct rtxCPUTraversalKernel {
+    // 1つのパケットにまとめるレイの数（パケットを使わないなら1）
+    int ray_packet_size;
+    rtxCPUIntersectSceneFunction intersect_scene;
+    rtxCPUIntersectScenePacketFunction intersect_scene_packet;
+    rtxCPUIntersectObjectFunction intersect_object;
+} rtxCPUTraversalKernel;
+
+// 実行中のCPUが対応する命令セットの走査
+// AVX2 when the CPU has it, otherwise the baseline of the build (SSE2 on x86-64, scalar elsewhere).
+// Chosen once at run time like rtx_cpu_triangle_group_kernel, and every instruction set rounds the same way.
+const rtxCPUTraversalKernel& rtx_cpu_traversal_kernel();
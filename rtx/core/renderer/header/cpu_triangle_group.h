@@ -0,0 +1,57 @@
+#pragma once
+#include "cpu_bridge.h"
+#include "cpu_common.h"
+
+// 三角形のまとまりの成分の数（rtxCPUTriangleのfloatの数）
+#define RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS 12
+
+// 面の配列の連続したwidth個の三角形を成分ごとに並べたまとまり
+// Group g holds the serialized faces [g * width, (g + 1) * width) and lane k of component c is stored at
+// group_array[(g * RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS + c) * width + k], with the components in the order of
+// rtxCPUTriangle. Groups follow the face array rather than the leaves, so a leaf may share its first and last
+// group with its neighbours and the kernels mask the lanes outside it.
+
+// 葉の面のうち最も近い交点を持つ面
+// Tests the serialized faces [face_index_start, face_index_start + num_faces) with the arithmetic of
+// rtx_cpu_intersect_standard_precomputed and returns the nearest one closer than min_distance, or -1.
+// min_distance is updated, and ties go to the lower face index as in the scalar loop.
+typedef int (*rtxCPUIntersectTriangleGroupFunction)(
+    const float* group_array,
+    int face_index_start,
+    int num_faces,
+    const rtxCPURay& ray,
+    float& min_distance);
+
+typedef struct rtxCPUTriangleGroupKernel {
+    // まとまりの三角形の数（SIMDのレーン数）
+    int width;
+    rtxCPUIntersectTriangleGroupFunction intersect;
+} rtxCPUTriangleGroupKernel;
+
+// 実行中のCPUが対応する最も広い命令セットのカーネル
+// AVX-512 (16 lanes), AVX2 (8 lanes) or SSE2 (4 lanes), chosen once from the CPU features at run time,
+// so the same build runs on every x86-64 machine. Other architectures get a scalar loop over groups of 4.
+const rtxCPUTriangleGroupKernel& rtx_cpu_triangle_group_kernel();
+
+// 三角形をまとまりのレーンに書き込む
+static inline void rtx_cpu_store_triangle_in_group(float* group_array, int width, int serialized_face_index, const rtxCPUTriangle& triangle)
+{
+    const float* components = &triangle.va_x;
+    float* group = group_array + (serialized_face_index / width) * RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS * width;
+    const int lane = serialized_face_index % width;
+    for (int c = 0; c < RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS; c++) {
+        group[c * width + lane] = components[c];
+    }
+}
+// まとまりのレーンから三角形を読む
+static inline rtxCPUTriangle rtx_cpu_load_triangle_from_group(const float* group_array, int width, int serialized_face_index)
+{
+    rtxCPUTriangle triangle;
+    float* components = &triangle.va_x;
+    const float* group = group_array + (serialized_face_index / width) * RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS * width;
+    const int lane = serialized_face_index % width;
+    for (int c = 0; c < RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS; c++) {
+        components[c] = group[c * width + lane];
+    }
+    return triangle;
+}
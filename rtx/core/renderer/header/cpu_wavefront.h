@@ -0,0 +1,54 @@
+#pragma once
+#include "cpu_functions.h"
+#include <vector>
+
+// 波面法（wavefront）で1度に追跡する経路の数の上限
+// Each pixel of a batch traces one path per wave, so this bounds the path state to a few MB
+// while leaving enough paths per stage to keep every thread busy.
+#define RTX_CPU_WAVEFRONT_MAX_PATHS 16384
+
+// 当たらなかった経路（0）と材質の種類（1〜RTXMaterialTypeEmissive）
+#define RTX_CPU_WAVEFRONT_NUM_SHADING_GROUPS (RTXMaterialTypeEmissive + 1)
+
+// 画素ごとのスーパーサンプリング用の乱数の状態
+// The megakernel keeps it in the locals declared by __xorshift_init; a wave saves it between samples.
+typedef struct rtxCPUXorshiftState {
+    unsigned long x;
+    unsigned long y;
+    unsigned long z;
+    unsigned long w;
+} rtxCPUXorshiftState;
+
+// 経路を衝突した材質の種類ごとにまとめる
+// A stable counting sort, so paths of one group keep their pixel order.
+static inline void rtx_cpu_wavefront_group_by_material(
+    const std::vector<int>& queue,
+    const bool* did_hit_array,
+    const rtxCPUHit* hit_array,
+    std::vector<int>& grouped_queue)
+{
+    int group_offset[RTX_CPU_WAVEFRONT_NUM_SHADING_GROUPS + 1] = {};
+    for (int path_index : queue) {
+        const int group = did_hit_array[path_index] ? hit_array[path_index].object.layerd_material_types.outside : 0;
+        group_offset[group + 1]++;
+    }
+    for (int group = 0; group < RTX_CPU_WAVEFRONT_NUM_SHADING_GROUPS; group++) {
+        group_offset[group + 1] += group_offset[group];
+    }
+    grouped_queue.resize(queue.size());
+    for (int path_index : queue) {
+        const int group = did_hit_array[path_index] ? hit_array[path_index].object.layerd_material_types.outside : 0;
+        grouped_queue[group_offset[group]++] = path_index;
+    }
+}
+// 終了した経路を取り除く
+static inline void rtx_cpu_wavefront_compact(std::vector<int>& queue, const bool* alive_array)
+{
+    int num_alive = 0;
+    for (int path_index : queue) {
+        if (alive_array[path_index]) {
+            queue[num_alive++] = path_index;
+        }
+    }
+    queue.resize(num_alive);
+}
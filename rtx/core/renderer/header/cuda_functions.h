@@ -274,7 +274,20 @@
         t = t0;                                                                                                                                        \
     }
 
-#define __rtx_bvh_traversal_one_step_or_continue(ray, node, ray_direction_inv, bvh_current_node_index)                         \
+// レイの向きの符号から象限を求める
+#define __rtx_ray_octant(ray_direction_inv) \
+    ((ray_direction_inv.x < 0 ? 1 : 0) | (ray_direction_inv.y < 0 ? 2 : 0) | (ray_direction_inv.z < 0 ? 4 : 0))
+
+// ノードのhit/missをレイの象限のリンクで置き換える
+// Each split then visits the child nearer along its axis first, without a stack.
+#define __rtx_load_octant_links(node, link_array, serialized_node_index, octant)                                          \
+    {                                                                                                                  \
+        const rtxThreadedBVHLink link = link_array[(serialized_node_index) * RTX_THREADED_BVH_NUM_OCTANTS + (octant)]; \
+        node.hit_node_index = link.hit_node_index;                                                                     \
+        node.miss_node_index = link.miss_node_index;                                                                   \
+    }
+
+#define __rtx_bvh_traversal_one_step_or_continue(ray, node, ray_direction_inv, min_distance, bvh_current_node_index)           \
     {                                                                                                                          \
         float tmin = ((ray_direction_inv.x < 0 ? node.aabb_max.x : node.aabb_min.x) - ray.origin.x) * ray_direction_inv.x;     \
         float tmax = ((ray_direction_inv.x < 0 ? node.aabb_min.x : node.aabb_max.x) - ray.origin.x) * ray_direction_inv.x;     \
@@ -307,6 +320,11 @@
             bvh_current_node_index = node.miss_node_index;                                                                     \
             continue;                                                                                                          \
         }                                                                                                                      \
+        /* すでに見つけた交点より奥の箱は辿らない */                                                        \
+        if (tmin > min_distance) {                                                                                             \
+            bvh_current_node_index = node.miss_node_index;                                                                     \
+            continue;                                                                                                          \
+        }                                                                                                                      \
     }
 
 #define rtx_cuda_fetch_uv_coordinate_in_linear_memory(                                                              \
@@ -572,36 +590,47 @@
     ret.y = o.y + t * d.y;           \
     ret.z = o.z + t * d.z;
 
-#define __rtx_generate_ray(ray, args, aspect_ratio)                                                                                          \
-    /* スーパーサンプリング */                                                                                                     \
-    float2 noise = { 0.0f, 0.0f };                                                                                                           \
-    if (args.supersampling_enabled) {                                                                                                        \
-        __xorshift_uniform(noise.x, xors_x, xors_y, xors_z, xors_w);                                                                         \
-        __xorshift_uniform(noise.y, xors_x, xors_y, xors_z, xors_w);                                                                         \
-    }                                                                                                                                        \
-    /* 方向 */                                                                                                                             \
-    ray.direction.x = 2.0f * float(target_pixel_x + noise.x) / float(args.screen_width) - 1.0f;                                              \
-    ray.direction.y = -(2.0f * float(target_pixel_y + noise.y) / float(args.screen_height) - 1.0f) / aspect_ratio;                           \
-    ray.direction.z = -args.ray_origin_z;                                                                                                    \
-    /* 始点 */                                                                                                                             \
-    if (args.camera_type == RTXCameraTypePerspective) {                                                                                      \
-        ray.origin.x = 0.0f;                                                                                                                 \
-        ray.origin.y = 0.0f;                                                                                                                 \
-        ray.origin.z = args.ray_origin_z;                                                                                                    \
-        ray.origin.w = 0.0f;                                                                                                                 \
-        /* 正規化 */                                                                                                                      \
-        const float norm = sqrtf(ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z); \
-        ray.direction.x /= norm;                                                                                                             \
-        ray.direction.y /= norm;                                                                                                             \
-        ray.direction.z /= norm;                                                                                                             \
-    } else {                                                                                                                                 \
-        ray.origin.x = ray.direction.x * args.ray_origin_z;                                                                                  \
-        ray.origin.y = ray.direction.y * args.ray_origin_z;                                                                                  \
-        ray.origin.z = args.ray_origin_z;                                                                                                    \
-        ray.origin.w = 0.0f;                                                                                                                 \
-        ray.direction.x = 0.0f;                                                                                                              \
-        ray.direction.y = 0.0f;                                                                                                              \
-        ray.direction.z = -1.0f;                                                                                                             \
+#define __rtx_generate_ray(ray, args, aspect_ratio)                                                                                                                               \
+    /* スーパーサンプリング */                                                                                                                                                              \
+    float2 noise = { 0.0f, 0.0f };                                                                                                                                                \
+    if (args.supersampling_enabled) {                                                                                                                                             \
+        __xorshift_uniform(noise.x, xors_x, xors_y, xors_z, xors_w);                                                                                                              \
+        __xorshift_uniform(noise.y, xors_x, xors_y, xors_z, xors_w);                                                                                                              \
+    }                                                                                                                                                                             \
+    /* 方向 */                                                                                                                                                                      \
+    ray.direction.x = 2.0f * float(target_pixel_x + noise.x) / float(args.screen_width) - 1.0f;                                                                                   \
+    ray.direction.y = -(2.0f * float(target_pixel_y + noise.y) / float(args.screen_height) - 1.0f) / aspect_ratio;                                                                \
+    ray.direction.z = -args.ray_origin_z;                                                                                                                                         \
+    /* 始点 */                                                                                                                                                                      \
+    if (args.camera_type == RTXCameraTypePerspective) {                                                                                                                           \
+        ray.origin.x = 0.0f;                                                                                                                                                      \
+        ray.origin.y = 0.0f;                                                                                                                                                      \
+        ray.origin.z = args.ray_origin_z;                                                                                                                                         \
+        ray.origin.w = 0.0f;                                                                                                                                                      \
+        /* 正規化 */                                                                                                                                                                 \
+        const float norm = sqrtf(ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z);                                      \
+        ray.direction.x /= norm;                                                                                                                                                  \
+        ray.direction.y /= norm;                                                                                                                                                  \
+        ray.direction.z /= norm;                                                                                                                                                  \
+    } else {                                                                                                                                                                      \
+        ray.origin.x = ray.direction.x * args.ray_origin_z;                                                                                                                       \
+        ray.origin.y = ray.direction.y * args.ray_origin_z;                                                                                                                       \
+        ray.origin.z = args.ray_origin_z;                                                                                                                                         \
+        ray.origin.w = 0.0f;                                                                                                                                                      \
+        ray.direction.x = 0.0f;                                                                                                                                                   \
+        ray.direction.y = 0.0f;                                                                                                                                                   \
+        ray.direction.z = -1.0f;                                                                                                                                                  \
+    }                                                                                                                                                                             \
+    /* ジオメトリはワールド座標系にあるのでレイを変換する */                                                                                                                                               \
+    {                                                                                                                                                                             \
+        const float4 view_origin = ray.origin;                                                                                                                                    \
+        const float4 view_direction = ray.direction;                                                                                                                              \
+        ray.origin.x = view_origin.x * args.inv_view_matrix_a.x + view_origin.y * args.inv_view_matrix_a.y + view_origin.z * args.inv_view_matrix_a.z + args.inv_view_matrix_a.w; \
+        ray.origin.y = view_origin.x * args.inv_view_matrix_b.x + view_origin.y * args.inv_view_matrix_b.y + view_origin.z * args.inv_view_matrix_b.z + args.inv_view_matrix_b.w; \
+        ray.origin.z = view_origin.x * args.inv_view_matrix_c.x + view_origin.y * args.inv_view_matrix_c.y + view_origin.z * args.inv_view_matrix_c.z + args.inv_view_matrix_c.w; \
+        ray.direction.x = view_direction.x * args.inv_view_matrix_a.x + view_direction.y * args.inv_view_matrix_a.y + view_direction.z * args.inv_view_matrix_a.z;                \
+        ray.direction.y = view_direction.x * args.inv_view_matrix_b.x + view_direction.y * args.inv_view_matrix_b.y + view_direction.z * args.inv_view_matrix_b.z;                \
+        ray.direction.z = view_direction.x * args.inv_view_matrix_c.x + view_direction.y * args.inv_view_matrix_c.y + view_direction.z * args.inv_view_matrix_c.z;                \
     }
 
 #define __rtx_normalize_vector(vec)                                        \
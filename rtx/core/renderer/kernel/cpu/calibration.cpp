@@ -0,0 +1,98 @@
+#include "../../../header/enum.h"
+#include "../../../header/struct.h"
+#include "../../header/cpu_bridge.h"
+#include "../../header/cpu_common.h"
+#include "../../header/cpu_functions.h"
+#include "../../header/cpu_traversal.h"
+#include <chrono>
+#include <vector>
+
+// BVHのコストモデルを合わせるための計測
+// Traces random rays through one object's wide BVH with the same traversal the CPU kernels use.
+// The rays start outside the bounding sphere of the mesh and aim at a random point of its AABB,
+// which is the ray distribution the surface area heuristic assumes.
+namespace {
+const int NUM_CALIBRATION_TRIALS = 3;
+
+float random_uniform(rtxCPURandomState& state)
+{
+    return (__rtx_cpu_random_next(&state) >> 40) * (1.0f / 16777216.0f);
+}
+}
+
+float rtx_cpu_measure_wide_bvh_traversal(
+    rtxFaceVertexIndex* cpu_face_vertex_index_array,
+    rtxVertex* cpu_vertex_array,
+    int num_faces,
+    int num_vertices,
+    rtxCPUWideBVHNode* cpu_wide_bvh_node_array,
+    int num_rays)
+{
+    float3 aabb_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float3 aabb_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int n = 0; n < num_vertices; n++) {
+        const rtxVertex& v = cpu_vertex_array[n];
+        aabb_min = { std::min(aabb_min.x, v.x), std::min(aabb_min.y, v.y), std::min(aabb_min.z, v.z) };
+        aabb_max = { std::max(aabb_max.x, v.x), std::max(aabb_max.y, v.y), std::max(aabb_max.z, v.z) };
+    }
+    const float3 center = { (aabb_min.x + aabb_max.x) * 0.5f, (aabb_min.y + aabb_max.y) * 0.5f, (aabb_min.z + aabb_max.z) * 0.5f };
+    const float3 extent = { aabb_max.x - aabb_min.x, aabb_max.y - aabb_min.y, aabb_max.z - aabb_min.z };
+    const float radius = sqrtf(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z);
+
+    rtxCPURandomState state = { 0x9E3779B97F4A7C15ULL, 0xBF58476D1CE4E5B9ULL };
+    std::vector<rtxCPURay> ray_array(num_rays);
+    std::vector<float3> ray_direction_inv_array(num_rays);
+    for (int n = 0; n < num_rays; n++) {
+        // 球面上の一様な点
+        const float z = 2.0f * random_uniform(state) - 1.0f;
+        const float phi = 2.0f * M_PI * random_uniform(state);
+        const float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+        const float3 origin = { center.x + radius * r * cosf(phi), center.y + radius * r * sinf(phi), center.z + radius * z };
+        const float3 target = {
+            aabb_min.x + extent.x * random_uniform(state),
+            aabb_min.y + extent.y * random_uniform(state),
+            aabb_min.z + extent.z * random_uniform(state),
+        };
+        float3 direction = { target.x - origin.x, target.y - origin.y, target.z - origin.z };
+        const float norm = sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+        direction = { direction.x / norm, direction.y / norm, direction.z / norm };
+        ray_array[n].origin = { origin.x, origin.y, origin.z, 1.0f };
+        ray_array[n].direction = { direction.x, direction.y, direction.z, 1.0f };
+        ray_direction_inv_array[n] = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    }
+
+    rtxObject object;
+    memset(&object, 0, sizeof(object));
+    object.num_faces = num_faces;
+    object.num_vertices = num_vertices;
+    object.geometry_type = RTXGeometryTypeStandard;
+    rtxCPUWideBVH wide_bvh = { 0, 0 };
+    rtxCPUSerializedScene scene;
+    memset(&scene, 0, sizeof(scene));
+    scene.face_vertex_index_array = cpu_face_vertex_index_array;
+    scene.vertex_array = cpu_vertex_array;
+    scene.object_array = &object;
+    scene.wide_bvh_array = &wide_bvh;
+    scene.wide_bvh_node_array = cpu_wide_bvh_node_array;
+    scene.bvh_node_format = RTXBVHNodeFormatFull;
+    scene.triangle_format = RTXTriangleFormatIndexed;
+    scene.object_array_size = 1;
+
+    const rtxCPUTraversalKernel& traversal_kernel = rtx_cpu_traversal_kernel();
+    // 結果を使わないと最適化で消されるので集計する
+    volatile int sink = 0;
+    double best = 1e30;
+    for (int trial = 0; trial < NUM_CALIBRATION_TRIALS; trial++) {
+        auto start = std::chrono::steady_clock::now();
+        int num_hits = 0;
+        for (int n = 0; n < num_rays; n++) {
+            rtxCPUHit hit;
+            float min_distance = FLT_MAX;
+            num_hits += traversal_kernel.intersect_object(scene, 0, ray_array[n], ray_direction_inv_array[n], hit, min_distance);
+        }
+        auto end = std::chrono::steady_clock::now();
+        sink = sink + num_hits;
+        best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    return best / num_rays;
+}
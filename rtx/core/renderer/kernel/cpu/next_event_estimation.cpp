@@ -0,0 +1,631 @@
+#include "../../../header/enum.h"
+#include "../../../header/struct.h"
+#include "../../header/cpu_bridge.h"
+#include "../../header/cpu_common.h"
+#include "../../header/cpu_functions.h"
+#include "../../header/cpu_tile_scheduler.h"
+#include "../../header/cpu_traversal.h"
+#include "../../header/cpu_wavefront.h"
+#include <memory>
+#include <omp.h>
+
+// 波面法による次イベント推定
+// The stages of a bounce are generate, extend (closest hit), shade grouped by material, which also samples a
+// light and builds the shadow ray, shadow, which adds the light's contribution, and compaction.
+// Like the megakernel, the shadow ray looks for the closest hit and a path whose shadow ray escapes ends there.
+static void rtx_cpu_render_nee_wavefront(
+    const rtxCPUSerializedScene& scene,
+    bool ray_packets_enabled,
+    rtxRGBAPixel* cpu_render_array,
+    rtxNEEKernelArguments& args,
+    int num_threads)
+{
+    const int num_pixels = args.screen_width * args.screen_height;
+    const float aspect_ratio = float(args.screen_width) / float(args.screen_height);
+    const rtxCPUTraversalKernel& traversal_kernel = rtx_cpu_traversal_kernel();
+    const int ray_packet_size = ray_packets_enabled ? traversal_kernel.ray_packet_size : 1;
+    const int num_sample_ranges = rtx_cpu_num_sample_ranges(args.num_rays_per_pixel, args.num_rays_per_thread);
+    const int num_units = num_pixels * num_sample_ranges;
+    const int max_paths = min(num_units, RTX_CPU_WAVEFRONT_MAX_PATHS);
+
+    // 経路ごとの状態
+    std::vector<rtxCPURandomState> curand_state_array(max_paths);
+    std::vector<rtxCPUXorshiftState> xorshift_state_array(max_paths);
+    std::vector<rtxCPURay> ray_array(max_paths);
+    std::vector<rtxCPURay> shadow_ray_array(max_paths);
+    std::vector<rtxCPUHit> hit_array(max_paths);
+    std::vector<rtxRGBAColor> hit_object_color_array(max_paths);
+    std::vector<rtxRGBAColor> path_weight_array(max_paths);
+    std::vector<rtxRGBAColor> next_path_weight_array(max_paths);
+    std::vector<float> g_term_array(max_paths);
+    std::vector<float> shadow_ray_brdf_array(max_paths);
+    std::vector<rtxRGBAPixel> pixel_array(max_paths);
+    std::unique_ptr<bool[]> did_hit_array(new bool[max_paths]);
+    std::unique_ptr<bool[]> alive_array(new bool[max_paths]);
+    std::unique_ptr<bool[]> has_shadow_ray_array(new bool[max_paths]);
+    std::vector<int> queue;
+    std::vector<int> grouped_queue;
+    std::vector<int> shadow_queue;
+
+    // 単位（画素とサンプルの範囲の組）は範囲ごとに画素の順に並べる
+    for (int unit_index_offset = 0; unit_index_offset < num_units; unit_index_offset += max_paths) {
+        const int num_paths = min(max_paths, num_units - unit_index_offset);
+
+#pragma omp parallel for schedule(static) num_threads(num_threads)
+        for (int path_index = 0; path_index < num_paths; path_index++) {
+            const int unit_index = unit_index_offset + path_index;
+            const int target_pixel_index = unit_index % num_pixels;
+            const int target_pixel_x = target_pixel_index % args.screen_width;
+            const int target_pixel_y = target_pixel_index / args.screen_width;
+            curand_init(args.curand_seed, unit_index, 0, &curand_state_array[path_index]);
+            __xorshift_init(args.curand_seed);
+            // 前の範囲のサンプルが使うジッターを読み飛ばす
+            const int sample_begin = (unit_index / num_pixels) * args.num_rays_per_thread;
+            for (int n = 0; n < sample_begin; n++) {
+                rtxCPURay skipped_ray;
+                __rtx_generate_ray(skipped_ray, args, aspect_ratio);
+            }
+            xorshift_state_array[path_index] = { xors_x, xors_y, xors_z, xors_w };
+            pixel_array[path_index] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        }
+
+        for (int n = 0; n < args.num_rays_per_thread; n++) {
+            // このサンプルを持つ単位の数（短くなり得るのは最後の範囲だけ）
+            const int last_range_begin = (num_sample_ranges - 1) * args.num_rays_per_thread;
+            const int num_active_units = (last_range_begin + n < args.num_rays_per_pixel) ? num_units : (num_sample_ranges - 1) * num_pixels;
+            const int num_active_paths = min(num_paths, num_active_units - unit_index_offset);
+            if (num_active_paths <= 0) {
+                break;
+            }
+
+            // レイの生成
+#pragma omp parallel for schedule(static) num_threads(num_threads)
+            for (int path_index = 0; path_index < num_active_paths; path_index++) {
+                const int target_pixel_index = (unit_index_offset + path_index) % num_pixels;
+                const int target_pixel_x = target_pixel_index % args.screen_width;
+                const int target_pixel_y = target_pixel_index / args.screen_width;
+                rtxCPUXorshiftState& xorshift_state = xorshift_state_array[path_index];
+                unsigned long xors_x = xorshift_state.x;
+                unsigned long xors_y = xorshift_state.y;
+                unsigned long xors_z = xorshift_state.z;
+                unsigned long xors_w = xorshift_state.w;
+                __rtx_generate_ray(ray_array[path_index], args, aspect_ratio);
+                xorshift_state = { xors_x, xors_y, xors_z, xors_w };
+                path_weight_array[path_index] = { 1.0f, 1.0f, 1.0f };
+            }
+            queue.resize(num_active_paths);
+            for (int path_index = 0; path_index < num_active_paths; path_index++) {
+                queue[path_index] = path_index;
+            }
+
+            // 1回の反射ごとに経路のレイとシャドウレイを1本ずつ飛ばす
+            for (int bounce = 0; bounce < args.max_bounce && queue.empty() == false; bounce++) {
+                // 衝突判定
+                // 一次レイは隣り合う画素をまとめてパケットで辿る
+                if (bounce == 0 && ray_packet_size > 1) {
+                    const int num_packets = (num_active_paths + ray_packet_size - 1) / ray_packet_size;
+#pragma omp parallel for schedule(dynamic, 16) num_threads(num_threads)
+                    for (int packet_index = 0; packet_index < num_packets; packet_index++) {
+                        const int path_index = packet_index * ray_packet_size;
+                        const int num_packet_rays = min(ray_packet_size, num_active_paths - path_index);
+                        traversal_kernel.intersect_scene_packet(scene, &ray_array[path_index], num_packet_rays, &hit_array[path_index], &did_hit_array[path_index]);
+                    }
+                } else {
+                    const int num_queued_paths = queue.size();
+#pragma omp parallel for schedule(dynamic, 16) num_threads(num_threads)
+                    for (int k = 0; k < num_queued_paths; k++) {
+                        const int path_index = queue[k];
+                        const rtxCPURay& ray = ray_array[path_index];
+                        const float3 ray_direction_inv = {
+                            1.0f / ray.direction.x,
+                            1.0f / ray.direction.y,
+                            1.0f / ray.direction.z,
+                        };
+                        did_hit_array[path_index] = traversal_kernel.intersect_scene(scene, ray, ray_direction_inv, hit_array[path_index]);
+                    }
+                }
+
+                // 材質ごとにまとめてシェーディングし、光源をサンプリングする
+                rtx_cpu_wavefront_group_by_material(queue, did_hit_array.get(), hit_array.data(), grouped_queue);
+                const int num_grouped_paths = grouped_queue.size();
+#pragma omp parallel for schedule(dynamic, 64) num_threads(num_threads)
+                for (int k = 0; k < num_grouped_paths; k++) {
+                    const int path_index = grouped_queue[k];
+                    const rtxCPUHit& hit = hit_array[path_index];
+                    rtxRGBAPixel& pixel = pixel_array[path_index];
+                    rtxRGBAColor& path_weight = path_weight_array[path_index];
+                    rtxRGBAColor& next_path_weight = next_path_weight_array[path_index];
+                    rtxRGBAColor& hit_object_color = hit_object_color_array[path_index];
+                    rtxCPURay& primary_ray = ray_array[path_index];
+                    rtxCPURay& shadow_ray = shadow_ray_array[path_index];
+                    rtxCPURandomState& curand_state = curand_state_array[path_index];
+                    alive_array[path_index] = false;
+                    has_shadow_ray_array[path_index] = false;
+
+                    if (did_hit_array[path_index] == false) {
+                        if (bounce == 0) {
+                            pixel.r += args.ambient_color.r;
+                            pixel.g += args.ambient_color.g;
+                            pixel.b += args.ambient_color.b;
+                        }
+                        continue;
+                    }
+
+                    int material_type = hit.object.layerd_material_types.outside;
+                    bool did_hit_light = material_type == RTXMaterialTypeEmissive;
+
+                    rtx_cpu_fetch_color(scene, hit, hit_object_color);
+
+                    // 光源に当たった場合トレースを打ち切り
+                    if (did_hit_light) {
+                        if (bounce > 0) {
+                            continue;
+                        }
+                        // 最初のパスで光源に当たった場合のみ寄与を加算
+                        rtxEmissiveMaterialAttribute attr = rtx_cpu_emissive_attribute(scene, hit.object);
+                        if (attr.visible) {
+                            pixel.r += hit_object_color.r * path_weight.r * attr.intensity;
+                            pixel.g += hit_object_color.g * path_weight.g * attr.intensity;
+                            pixel.b += hit_object_color.b * path_weight.b * attr.intensity;
+                        } else {
+                            pixel.r += args.ambient_color.r;
+                            pixel.g += args.ambient_color.g;
+                            pixel.b += args.ambient_color.b;
+                        }
+                        continue;
+                    }
+
+                    const float3 unit_hit_face_normal = hit.unit_face_normal;
+                    const float3 hit_point = hit.point;
+
+                    // 反射方向のサンプリング
+                    float3 unit_next_path_direction;
+                    float cosine_term;
+                    __rtx_sample_ray_direction(
+                        unit_hit_face_normal,
+                        unit_next_path_direction,
+                        cosine_term,
+                        curand_state);
+
+                    float input_ray_brdf = rtx_cpu_compute_brdf(scene, hit, primary_ray.direction, unit_next_path_direction);
+
+                    // 入射方向のサンプリング
+                    primary_ray.origin.x = hit_point.x;
+                    primary_ray.origin.y = hit_point.y;
+                    primary_ray.origin.z = hit_point.z;
+                    primary_ray.direction.x = unit_next_path_direction.x;
+                    primary_ray.direction.y = unit_next_path_direction.y;
+                    primary_ray.direction.z = unit_next_path_direction.z;
+
+                    float inv_pdf = 2.0f * M_PI;
+                    next_path_weight.r = path_weight.r * input_ray_brdf * hit_object_color.r * cosine_term * inv_pdf;
+                    next_path_weight.g = path_weight.g * input_ray_brdf * hit_object_color.g * cosine_term * inv_pdf;
+                    next_path_weight.b = path_weight.b * input_ray_brdf * hit_object_color.b * cosine_term * inv_pdf;
+                    alive_array[path_index] = true;
+
+                    float4 random_uniform4 = curand_uniform4(&curand_state);
+
+                    // 光源のサンプリング
+                    const int table_index = min(int(floorf(random_uniform4.x * float(args.light_sampling_table_size))), args.light_sampling_table_size - 1);
+                    const int object_index = scene.light_sampling_table[table_index];
+                    const rtxObject& object = scene.object_array[object_index];
+
+                    float light_distance = 0.0f;
+                    float3 unit_light_normal = { 0.0f, 0.0f, 0.0f };
+                    if (object.geometry_type == RTXGeometryTypeStandard) {
+                        const int face_index = min(int(floorf(random_uniform4.y * float(object.num_faces))), object.num_faces - 1);
+                        const int serialized_face_index = face_index + object.serialized_face_index_offset;
+                        const rtxFaceVertexIndex face = scene.face_vertex_index_array[serialized_face_index];
+                        const rtxVertex va = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+                        const rtxVertex vb = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+                        const rtxVertex vc = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+                        __rtx_nee_sample_point_in_triangle(random_uniform4, va, vb, vc, shadow_ray, light_distance, unit_light_normal);
+                    } else if (object.geometry_type == RTXGeometryTypeSphere) {
+                        const int serialized_array_index = object.serialized_face_index_offset;
+                        const rtxFaceVertexIndex face = scene.face_vertex_index_array[serialized_array_index];
+                        const rtxVertex center = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+                        const rtxVertex radius = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+                        __rtx_nee_sample_point_in_sphere(curand_state, unit_light_normal, shadow_ray, light_distance);
+                    }
+
+                    const float dot_ray_face = shadow_ray.direction.x * unit_hit_face_normal.x
+                        + shadow_ray.direction.y * unit_hit_face_normal.y
+                        + shadow_ray.direction.z * unit_hit_face_normal.z;
+
+                    // 光源が面の裏側にある場合はシャドウレイを飛ばさない
+                    if (dot_ray_face <= 0.0f) {
+                        path_weight.r = next_path_weight.r;
+                        path_weight.g = next_path_weight.g;
+                        path_weight.b = next_path_weight.b;
+                        continue;
+                    }
+
+                    shadow_ray.origin.x = hit_point.x;
+                    shadow_ray.origin.y = hit_point.y;
+                    shadow_ray.origin.z = hit_point.z;
+
+                    shadow_ray_brdf_array[path_index] = rtx_cpu_compute_brdf(scene, hit, primary_ray.direction, shadow_ray.direction);
+
+                    const float dot_ray_light = fabsf(shadow_ray.direction.x * unit_light_normal.x + shadow_ray.direction.y * unit_light_normal.y + shadow_ray.direction.z * unit_light_normal.z);
+
+                    // ハック
+                    const float r = max(light_distance, 0.5f);
+                    g_term_array[path_index] = dot_ray_face * dot_ray_light / (r * r);
+                    has_shadow_ray_array[path_index] = true;
+                }
+
+                // シャドウレイ
+                shadow_queue.clear();
+                for (int path_index : queue) {
+                    if (has_shadow_ray_array[path_index]) {
+                        shadow_queue.push_back(path_index);
+                    }
+                }
+                const int num_shadow_rays = shadow_queue.size();
+#pragma omp parallel for schedule(dynamic, 16) num_threads(num_threads)
+                for (int k = 0; k < num_shadow_rays; k++) {
+                    const int path_index = shadow_queue[k];
+                    const rtxCPURay& shadow_ray = shadow_ray_array[path_index];
+                    const float3 ray_direction_inv = {
+                        1.0f / shadow_ray.direction.x,
+                        1.0f / shadow_ray.direction.y,
+                        1.0f / shadow_ray.direction.z,
+                    };
+                    rtxCPUHit& hit = hit_array[path_index];
+                    rtxRGBAColor& path_weight = path_weight_array[path_index];
+                    const rtxRGBAColor& next_path_weight = next_path_weight_array[path_index];
+
+                    // 何にも当たらなければ経路を打ち切る
+                    if (traversal_kernel.intersect_scene(scene, shadow_ray, ray_direction_inv, hit) == false) {
+                        alive_array[path_index] = false;
+                        continue;
+                    }
+
+                    // 光源に当たった場合寄与を加算
+                    int material_type = hit.object.layerd_material_types.outside;
+                    if (material_type == RTXMaterialTypeEmissive) {
+                        rtxRGBAColor hit_light_color;
+                        rtx_cpu_fetch_color(scene, hit, hit_light_color);
+
+                        const rtxRGBAColor& hit_object_color = hit_object_color_array[path_index];
+                        const float shadow_ray_brdf = shadow_ray_brdf_array[path_index];
+                        const float g_term = g_term_array[path_index];
+                        rtxRGBAPixel& pixel = pixel_array[path_index];
+                        rtxEmissiveMaterialAttribute attr = rtx_cpu_emissive_attribute(scene, hit.object);
+                        float emission = attr.intensity;
+                        float inv_pdf = args.total_light_face_area;
+                        pixel.r += path_weight.r * emission * shadow_ray_brdf * hit_light_color.r * hit_object_color.r * inv_pdf * g_term;
+                        pixel.g += path_weight.g * emission * shadow_ray_brdf * hit_light_color.g * hit_object_color.g * inv_pdf * g_term;
+                        pixel.b += path_weight.b * emission * shadow_ray_brdf * hit_light_color.b * hit_object_color.b * inv_pdf * g_term;
+                    }
+
+                    path_weight.r = next_path_weight.r;
+                    path_weight.g = next_path_weight.g;
+                    path_weight.b = next_path_weight.b;
+                }
+
+                // 終了した経路を取り除く
+                rtx_cpu_wavefront_compact(queue, alive_array.get());
+            }
+        }
+        for (int path_index = 0; path_index < num_paths; path_index++) {
+            const int unit_index = unit_index_offset + path_index;
+            cpu_render_array[(unit_index % num_pixels) * num_sample_ranges + unit_index / num_pixels] = pixel_array[path_index];
+        }
+    }
+}
+
+void rtx_cpu_launch_nee_kernel(
+    rtxFaceVertexIndex* cpu_face_vertex_index_array,
+    rtxVertex* cpu_vertex_array,
+    rtxObject* cpu_object_array,
+    rtxMaterialAttributeByte* cpu_material_attribute_byte_array,
+    rtxThreadedBVH* cpu_threaded_bvh_array,
+    rtxThreadedBVHNode* cpu_threaded_bvh_node_array,
+    rtxThreadedBVHLink* cpu_threaded_bvh_link_array,
+    rtxCPUWideBVH* cpu_wide_bvh_array,
+    rtxCPUWideBVHNode* cpu_wide_bvh_node_array,
+    rtxCPUQuantizedWideBVHNode* cpu_quantized_wide_bvh_node_array,
+    int bvh_node_format,
+    rtxCPUTriangle* cpu_triangle_array,
+    float* cpu_triangle_group_array,
+    int triangle_format,
+    rtxRGBAColor* cpu_color_mapping_array,
+    rtxUVCoordinate* cpu_serialized_uv_coordinate_array,
+    rtxCPUTextureObject* cpu_texture_object_array,
+    int* cpu_light_sampling_table,
+    rtxCPULazyBVHArguments* cpu_lazy_bvh_args,
+    bool ray_packets_enabled,
+    bool wavefront_enabled,
+    int tile_size,
+    int tile_order,
+    rtxRGBAPixel* cpu_render_array,
+    rtxNEEKernelArguments& args,
+    int num_threads)
+{
+    rtxCPUSerializedScene scene;
+    scene.face_vertex_index_array = cpu_face_vertex_index_array;
+    scene.vertex_array = cpu_vertex_array;
+    scene.object_array = cpu_object_array;
+    scene.material_attribute_byte_array = cpu_material_attribute_byte_array;
+    scene.threaded_bvh_array = cpu_threaded_bvh_array;
+    scene.threaded_bvh_node_array = cpu_threaded_bvh_node_array;
+    scene.threaded_bvh_link_array = cpu_threaded_bvh_link_array;
+    scene.wide_bvh_array = cpu_wide_bvh_array;
+    scene.wide_bvh_node_array = cpu_wide_bvh_node_array;
+    scene.quantized_wide_bvh_node_array = cpu_quantized_wide_bvh_node_array;
+    scene.bvh_node_format = bvh_node_format;
+    scene.triangle_array = cpu_triangle_array;
+    scene.triangle_group_array = cpu_triangle_group_array;
+    scene.triangle_group_kernel = rtx_cpu_triangle_group_kernel();
+    scene.triangle_format = triangle_format;
+    scene.color_mapping_array = cpu_color_mapping_array;
+    scene.uv_coordinate_array = cpu_serialized_uv_coordinate_array;
+    scene.texture_object_array = cpu_texture_object_array;
+    scene.lazy_bvh = cpu_lazy_bvh_args;
+    scene.light_sampling_table = cpu_light_sampling_table;
+    scene.object_array_size = args.object_array_size;
+    scene.top_level_bvh = cpu_threaded_bvh_array[args.object_array_size];
+
+    if (wavefront_enabled) {
+        rtx_cpu_render_nee_wavefront(scene, ray_packets_enabled, cpu_render_array, args, num_threads);
+        return;
+    }
+
+    const int num_pixels = args.screen_width * args.screen_height;
+    const float aspect_ratio = float(args.screen_width) / float(args.screen_height);
+    const rtxCPUTraversalKernel& traversal_kernel = rtx_cpu_traversal_kernel();
+    const int ray_packet_size = ray_packets_enabled ? traversal_kernel.ray_packet_size : 1;
+    const int block_width = ray_packet_size > 1 ? RTX_CPU_RAY_PACKET_BLOCK_WIDTH : 1;
+    const int block_height = ray_packet_size > 1 ? RTX_CPU_RAY_PACKET_BLOCK_HEIGHT : 1;
+    const int num_sample_ranges = rtx_cpu_num_sample_ranges(args.num_rays_per_pixel, args.num_rays_per_thread);
+
+    // 1画素のnum_rays_per_thread個のサンプルを1スレッドが担当する
+    // 画素ごとにコストが大きく異なるので、画面をタイルに分けてスレッドごとのキューから配り、
+    // 自分のキューが空になったスレッドは他のキューからタイルを奪う
+    rtxCPUTileScheduler scheduler;
+    rtx_cpu_init_tile_scheduler(scheduler, args.screen_width, args.screen_height, tile_size, tile_order, num_sample_ranges, num_threads);
+#pragma omp parallel num_threads(num_threads)
+    {
+        // タイルの画素はスレッドの領域に書き、まとめて書き戻す
+        // Threads never store next to each other's pixels while rendering a tile.
+        std::vector<rtxRGBAPixel> tile_pixel_array(tile_size * tile_size);
+        rtxCPUTile tile;
+        while (rtx_cpu_next_tile(scheduler, omp_get_thread_num(), tile)) {
+            const int num_blocks_x = (tile.width + block_width - 1) / block_width;
+            const int num_blocks_y = (tile.height + block_height - 1) / block_height;
+            for (int block_index = 0; block_index < num_blocks_x * num_blocks_y; block_index++) {
+                const int block_x = tile.x + (block_index % num_blocks_x) * block_width;
+                const int block_y = tile.y + (block_index / num_blocks_x) * block_height;
+                const int block_pixel_width = min(block_width, tile.x + tile.width - block_x);
+                const int block_pixel_height = min(block_height, tile.y + tile.height - block_y);
+                const int num_block_pixels = block_pixel_width * block_pixel_height;
+
+                // 区画の画素ごとの乱数と出力する画素
+                rtxCPURandomState curand_state_array[RTX_CPU_RAY_PACKET_SIZE];
+                rtxRGBAPixel pixel_array[RTX_CPU_RAY_PACKET_SIZE];
+                for (int k = 0; k < num_block_pixels; k++) {
+                    const int target_pixel_index = (block_y + k / block_pixel_width) * args.screen_width + block_x + k % block_pixel_width;
+                    curand_init(args.curand_seed, tile.sample_range_index * num_pixels + target_pixel_index, 0, &curand_state_array[k]);
+                    pixel_array[k] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                }
+                // 揺らぎの乱数はどの画素も同じ種から始まるので区画で1つの状態を使う
+                // Each pixel's rays rewind it to the state at the start of the sample, so every pixel draws
+                // the same jitter as when the pixels were traced one at a time.
+                int target_pixel_x = block_x;
+                int target_pixel_y = block_y;
+                __xorshift_init(args.curand_seed);
+
+                // このスレッドが担当するサンプルの範囲
+                const int sample_begin = tile.sample_range_index * args.num_rays_per_thread;
+                const int sample_end = min(args.num_rays_per_pixel, sample_begin + args.num_rays_per_thread);
+                for (int n = 0; n < sample_begin; n++) {
+                    rtxCPURay skipped_ray;
+                    __rtx_generate_ray(skipped_ray, args, aspect_ratio);
+                }
+
+                // 区画の各画素の同じ番号のサンプルの一次レイはまとめて交差判定する
+                // The jitter only draws from xorshift and the bounces only from each pixel's curand_state,
+                // so generating the rays of a packet up front leaves every random sequence unchanged.
+                rtxCPURay packet_ray_array[RTX_CPU_RAY_PACKET_SIZE];
+                rtxCPUHit packet_hit_array[RTX_CPU_RAY_PACKET_SIZE];
+                bool packet_did_hit_array[RTX_CPU_RAY_PACKET_SIZE];
+
+                for (int n = sample_begin; n < sample_end; n++) {
+                    const unsigned long xors_state[4] = { xors_x, xors_y, xors_z, xors_w };
+                    for (int k = 0; k < num_block_pixels; k++) {
+                        xors_x = xors_state[0];
+                        xors_y = xors_state[1];
+                        xors_z = xors_state[2];
+                        xors_w = xors_state[3];
+                        target_pixel_x = block_x + k % block_pixel_width;
+                        target_pixel_y = block_y + k / block_pixel_width;
+                        // レイの生成
+                        __rtx_generate_ray(packet_ray_array[k], args, aspect_ratio);
+                    }
+                    traversal_kernel.intersect_scene_packet(scene, packet_ray_array, num_block_pixels, packet_hit_array, packet_did_hit_array);
+
+                    for (int packet_ray_index = 0; packet_ray_index < num_block_pixels; packet_ray_index++) {
+                        rtxCPURandomState& curand_state = curand_state_array[packet_ray_index];
+                        rtxRGBAPixel& pixel = pixel_array[packet_ray_index];
+                        rtxCPURay* ray;
+                        rtxCPURay shadow_ray;
+                        rtxCPURay primary_ray;
+                        rtxCPUHit hit;
+                        rtxRGBAColor hit_object_color = { 0.0f, 0.0f, 0.0f, 0.0f };
+                        float g_term = 0.0f;
+                        float shadow_ray_brdf = 0.0f;
+
+                        primary_ray = packet_ray_array[packet_ray_index];
+
+                        float3 ray_direction_inv;
+                        ray = &primary_ray;
+
+                        // 光輸送経路のウェイト
+                        rtxRGBAColor path_weight = { 1.0f, 1.0f, 1.0f };
+                        rtxRGBAColor next_path_weight = { 1.0f, 1.0f, 1.0f };
+
+                        // レイが当たるたびにシャドウレイを飛ばすので2倍ループが必要
+                        int total_rays = args.max_bounce * 2;
+
+                        for (int iter = 0; iter < total_rays; iter++) {
+                            bool is_shadow_ray = (iter & 1) == 1; // iter % 2
+
+                            ray_direction_inv.x = 1.0f / ray->direction.x;
+                            ray_direction_inv.y = 1.0f / ray->direction.y;
+                            ray_direction_inv.z = 1.0f / ray->direction.z;
+
+                            bool did_hit_object;
+                            if (iter == 0) {
+                                did_hit_object = packet_did_hit_array[packet_ray_index];
+                                hit = packet_hit_array[packet_ray_index];
+                            } else {
+                                did_hit_object = traversal_kernel.intersect_scene(scene, *ray, ray_direction_inv, hit);
+                            }
+
+                            if (did_hit_object == false) {
+                                if (iter == 0) {
+                                    pixel.r += args.ambient_color.r;
+                                    pixel.g += args.ambient_color.g;
+                                    pixel.b += args.ambient_color.b;
+                                }
+                                break;
+                            }
+
+                            if (is_shadow_ray) {
+                                // 光源に当たった場合寄与を加算
+                                int material_type = hit.object.layerd_material_types.outside;
+                                if (material_type == RTXMaterialTypeEmissive) {
+                                    rtxRGBAColor hit_light_color;
+                                    rtx_cpu_fetch_color(scene, hit, hit_light_color);
+
+                                    rtxEmissiveMaterialAttribute attr = rtx_cpu_emissive_attribute(scene, hit.object);
+                                    float emission = attr.intensity;
+                                    float inv_pdf = args.total_light_face_area;
+                                    pixel.r += path_weight.r * emission * shadow_ray_brdf * hit_light_color.r * hit_object_color.r * inv_pdf * g_term;
+                                    pixel.g += path_weight.g * emission * shadow_ray_brdf * hit_light_color.g * hit_object_color.g * inv_pdf * g_term;
+                                    pixel.b += path_weight.b * emission * shadow_ray_brdf * hit_light_color.b * hit_object_color.b * inv_pdf * g_term;
+                                }
+
+                                path_weight.r = next_path_weight.r;
+                                path_weight.g = next_path_weight.g;
+                                path_weight.b = next_path_weight.b;
+
+                                ray = &primary_ray;
+                            } else {
+                                int material_type = hit.object.layerd_material_types.outside;
+                                bool did_hit_light = material_type == RTXMaterialTypeEmissive;
+
+                                rtx_cpu_fetch_color(scene, hit, hit_object_color);
+
+                                // 光源に当たった場合トレースを打ち切り
+                                if (did_hit_light) {
+                                    if (iter > 0) {
+                                        break;
+                                    }
+                                    // 最初のパスで光源に当たった場合のみ寄与を加算
+                                    rtxEmissiveMaterialAttribute attr = rtx_cpu_emissive_attribute(scene, hit.object);
+                                    if (attr.visible) {
+                                        pixel.r += hit_object_color.r * path_weight.r * attr.intensity;
+                                        pixel.g += hit_object_color.g * path_weight.g * attr.intensity;
+                                        pixel.b += hit_object_color.b * path_weight.b * attr.intensity;
+                                    } else {
+                                        pixel.r += args.ambient_color.r;
+                                        pixel.g += args.ambient_color.g;
+                                        pixel.b += args.ambient_color.b;
+                                    }
+                                    break;
+                                }
+
+                                // シャドウレイの衝突判定でhitが上書きされるので保存しておく
+                                const float3 unit_hit_face_normal = hit.unit_face_normal;
+                                const float3 hit_point = hit.point;
+
+                                // 反射方向のサンプリング
+                                float3 unit_next_path_direction;
+                                float cosine_term;
+                                __rtx_sample_ray_direction(
+                                    unit_hit_face_normal,
+                                    unit_next_path_direction,
+                                    cosine_term,
+                                    curand_state);
+
+                                float input_ray_brdf = rtx_cpu_compute_brdf(scene, hit, ray->direction, unit_next_path_direction);
+
+                                // 入射方向のサンプリング
+                                ray->origin.x = hit_point.x;
+                                ray->origin.y = hit_point.y;
+                                ray->origin.z = hit_point.z;
+                                ray->direction.x = unit_next_path_direction.x;
+                                ray->direction.y = unit_next_path_direction.y;
+                                ray->direction.z = unit_next_path_direction.z;
+
+                                float inv_pdf = 2.0f * M_PI;
+                                next_path_weight.r = path_weight.r * input_ray_brdf * hit_object_color.r * cosine_term * inv_pdf;
+                                next_path_weight.g = path_weight.g * input_ray_brdf * hit_object_color.g * cosine_term * inv_pdf;
+                                next_path_weight.b = path_weight.b * input_ray_brdf * hit_object_color.b * cosine_term * inv_pdf;
+
+                                float4 random_uniform4 = curand_uniform4(&curand_state);
+
+                                // 光源のサンプリング
+                                const int table_index = min(int(floorf(random_uniform4.x * float(args.light_sampling_table_size))), args.light_sampling_table_size - 1);
+                                const int object_index = scene.light_sampling_table[table_index];
+                                const rtxObject& object = scene.object_array[object_index];
+
+                                float light_distance = 0.0f;
+                                float3 unit_light_normal = { 0.0f, 0.0f, 0.0f };
+                                if (object.geometry_type == RTXGeometryTypeStandard) {
+                                    const int face_index = min(int(floorf(random_uniform4.y * float(object.num_faces))), object.num_faces - 1);
+                                    const int serialized_face_index = face_index + object.serialized_face_index_offset;
+                                    const rtxFaceVertexIndex face = scene.face_vertex_index_array[serialized_face_index];
+                                    const rtxVertex va = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+                                    const rtxVertex vb = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+                                    const rtxVertex vc = scene.vertex_array[face.c + object.serialized_vertex_index_offset];
+                                    __rtx_nee_sample_point_in_triangle(random_uniform4, va, vb, vc, shadow_ray, light_distance, unit_light_normal);
+                                } else if (object.geometry_type == RTXGeometryTypeSphere) {
+                                    const int serialized_array_index = object.serialized_face_index_offset;
+                                    const rtxFaceVertexIndex face = scene.face_vertex_index_array[serialized_array_index];
+                                    const rtxVertex center = scene.vertex_array[face.a + object.serialized_vertex_index_offset];
+                                    const rtxVertex radius = scene.vertex_array[face.b + object.serialized_vertex_index_offset];
+                                    __rtx_nee_sample_point_in_sphere(curand_state, unit_light_normal, shadow_ray, light_distance);
+                                }
+
+                                const float dot_ray_face = shadow_ray.direction.x * unit_hit_face_normal.x
+                                    + shadow_ray.direction.y * unit_hit_face_normal.y
+                                    + shadow_ray.direction.z * unit_hit_face_normal.z;
+
+                                if (dot_ray_face <= 0.0f) {
+                                    ray = &primary_ray;
+                                    iter += 1;
+                                    path_weight.r = next_path_weight.r;
+                                    path_weight.g = next_path_weight.g;
+                                    path_weight.b = next_path_weight.b;
+                                    continue;
+                                }
+
+                                shadow_ray.origin.x = hit_point.x;
+                                shadow_ray.origin.y = hit_point.y;
+                                shadow_ray.origin.z = hit_point.z;
+
+                                shadow_ray_brdf = rtx_cpu_compute_brdf(scene, hit, primary_ray.direction, shadow_ray.direction);
+
+                                const float dot_ray_light = fabsf(shadow_ray.direction.x * unit_light_normal.x + shadow_ray.direction.y * unit_light_normal.y + shadow_ray.direction.z * unit_light_normal.z);
+
+                                // ハック
+                                const float r = max(light_distance, 0.5f);
+                                g_term = dot_ray_face * dot_ray_light / (r * r);
+
+                                ray = &shadow_ray;
+                            }
+                        }
+                    }
+                }
+                for (int k = 0; k < num_block_pixels; k++) {
+                    const int tile_pixel_index = (block_y - tile.y + k / block_pixel_width) * tile.width + block_x - tile.x + k % block_pixel_width;
+                    tile_pixel_array[tile_pixel_index] = pixel_array[k];
+                }
+            }
+            rtx_cpu_store_tile(tile, tile_pixel_array.data(), num_sample_ranges, cpu_render_array, args.screen_width);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "../../header/cpu_ray_packet.h"
+#include "../../header/cpu_traversal.h"
+
+// 命令セットごとの走査
+// Each entry point instantiates the traversal templates of cpu_functions.h and cpu_ray_packet.h for one
+// instruction set. The AVX2 entry points carry the target attribute so that the traversal is inlined into
+// them and compiled for AVX2, while the rest of the CPU kernel stays at the baseline of the build.
+namespace {
+bool rtx_cpu_intersect_scene_baseline(
+    const rtxCPUSerializedScene& scene,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    rtxCPUHit& hit)
+{
+    return rtx_cpu_intersect_scene<rtxCPUInstructionSetBaseline>(scene, ray, ray_direction_inv, hit);
+}
+void rtx_cpu_intersect_scene_packet_baseline(
+    const rtxCPUSerializedScene& scene,
+    const rtxCPURay* ray_array,
+    int num_rays,
+    rtxCPUHit* hit_array,
+    bool* did_hit_array)
+{
+    rtx_cpu_intersect_scene_packet(rtxCPUInstructionSetBaseline(), scene, ray_array, num_rays, hit_array, did_hit_array);
+}
+bool rtx_cpu_intersect_object_baseline(
+    const rtxCPUSerializedScene& scene,
+    int object_index,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    return rtx_cpu_intersect_object<rtxCPUInstructionSetBaseline>(scene, object_index, ray, ray_direction_inv, hit, min_distance);
+}
+#if defined(RTX_CPU_X86)
+RTX_CPU_TARGET_AVX2 bool rtx_cpu_intersect_scene_avx2(
+    const rtxCPUSerializedScene& scene,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    rtxCPUHit& hit)
+{
+    return rtx_cpu_intersect_scene<rtxCPUInstructionSetAVX2>(scene, ray, ray_direction_inv, hit);
+}
+RTX_CPU_TARGET_AVX2 void rtx_cpu_intersect_scene_packet_avx2(
+    const rtxCPUSerializedScene& scene,
+    const rtxCPURay* ray_array,
+    int num_rays,
+    rtxCPUHit* hit_array,
+    bool* did_hit_array)
+{
+    rtx_cpu_intersect_scene_packet(rtxCPUInstructionSetAVX2(), scene, ray_array, num_rays, hit_array, did_hit_array);
+}
+RTX_CPU_TARGET_AVX2 bool rtx_cpu_intersect_object_avx2(
+    const rtxCPUSerializedScene& scene,
+    int object_index,
+    const rtxCPURay& ray,
+    const float3& ray_direction_inv,
+    rtxCPUHit& hit,
+    float& min_distance)
+{
+    return rtx_cpu_intersect_object<rtxCPUInstructionSetAVX2>(scene, object_index, ray, ray_direction_inv, hit, min_distance);
+}
+#endif
+
+rtxCPUTraversalKernel rtx_cpu_select_traversal_kernel()
+{
+#if defined(RTX_CPU_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return { RTX_CPU_RAY_PACKET_SIZE, rtx_cpu_intersect_scene_avx2, rtx_cpu_intersect_scene_packet_avx2, rtx_cpu_intersect_object_avx2 };
+    }
+#endif
+    return { 1, rtx_cpu_intersect_scene_baseline, rtx_cpu_intersect_scene_packet_baseline, rtx_cpu_intersect_object_baseline };
+}
+}
+
+const rtxCPUTraversalKernel& rtx_cpu_traversal_kernel()
+{
+    static const rtxCPUTraversalKernel kernel = rtx_cpu_select_traversal_kernel();
+    return kernel;
+}
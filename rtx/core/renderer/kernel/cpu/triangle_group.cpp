@@ -0,0 +1,347 @@
+#include "../../header/cpu_triangle_group.h"
+#include <float.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RTX_CPU_TRIANGLE_GROUP_X86
+#endif
+
+// 葉の三角形をまとめて判定するカーネル
+// Each kernel is compiled for its own instruction set with a target attribute and picked at run time. This
+// only holds if the file itself is built for the baseline ISA, which is why the makefiles do not pass
+// -march=native. The makefiles also pass -ffp-contract=off: the AVX-512 target would otherwise fuse the
+// products into FMA and its hits would no longer match the precomputed format's. Every comparison is written as
+// the negation of the scalar test's `continue` condition (the unordered predicates), so NaNs are treated alike.
+namespace {
+const float EPS = 0.000001f;
+const float MIN_DISTANCE = 0.001f;
+
+// SIMDのない環境ではまとまりを1つずつ読む
+int rtx_cpu_intersect_triangle_groups_scalar(
+    const float* group_array,
+    int face_index_start,
+    int num_faces,
+    const rtxCPURay& ray,
+    float& min_distance)
+{
+    const int width = 4;
+    int hit_face_index = -1;
+    for (int face_index = face_index_start; face_index < face_index_start + num_faces; face_index++) {
+        const rtxCPUTriangle triangle = rtx_cpu_load_triangle_from_group(group_array, width, face_index);
+        float dot = triangle.unit_normal_x * ray.direction.x + triangle.unit_normal_y * ray.direction.y + triangle.unit_normal_z * ray.direction.z;
+        if (dot > 0.0f) {
+            continue;
+        }
+        float3 h = {
+            ray.direction.y * triangle.edge_ca_z - ray.direction.z * triangle.edge_ca_y,
+            ray.direction.z * triangle.edge_ca_x - ray.direction.x * triangle.edge_ca_z,
+            ray.direction.x * triangle.edge_ca_y - ray.direction.y * triangle.edge_ca_x,
+        };
+        float f = triangle.edge_ba_x * h.x + triangle.edge_ba_y * h.y + triangle.edge_ba_z * h.z;
+        if (f > -EPS && f < EPS) {
+            continue;
+        }
+        f = 1.0f / f;
+        const float3 s = {
+            ray.origin.x - triangle.va_x,
+            ray.origin.y - triangle.va_y,
+            ray.origin.z - triangle.va_z,
+        };
+        dot = s.x * h.x + s.y * h.y + s.z * h.z;
+        const float u = f * dot;
+        if (u < 0.0f || u > 1.0f) {
+            continue;
+        }
+        h.x = s.y * triangle.edge_ba_z - s.z * triangle.edge_ba_y;
+        h.y = s.z * triangle.edge_ba_x - s.x * triangle.edge_ba_z;
+        h.z = s.x * triangle.edge_ba_y - s.y * triangle.edge_ba_x;
+        dot = h.x * ray.direction.x + h.y * ray.direction.y + h.z * ray.direction.z;
+        const float v = f * dot;
+        if (v < 0.0f || u + v > 1.0f) {
+            continue;
+        }
+        dot = triangle.edge_ca_x * h.x + triangle.edge_ca_y * h.y + triangle.edge_ca_z * h.z;
+        const float t = f * dot;
+        if (t <= MIN_DISTANCE) {
+            continue;
+        }
+        if (min_distance <= t) {
+            continue;
+        }
+        min_distance = t;
+        hit_face_index = face_index;
+    }
+    return hit_face_index;
+}
+
+#if defined(RTX_CPU_TRIANGLE_GROUP_X86)
+__attribute__((target("sse2"))) int rtx_cpu_intersect_triangle_groups_sse(
+    const float* group_array,
+    int face_index_start,
+    int num_faces,
+    const rtxCPURay& ray,
+    float& min_distance)
+{
+    const int width = 4;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 eps = _mm_set1_ps(EPS);
+    const __m128 negative_eps = _mm_set1_ps(-EPS);
+    const __m128 no_hit = _mm_set1_ps(FLT_MAX);
+    const __m128 direction_x = _mm_set1_ps(ray.direction.x);
+    const __m128 direction_y = _mm_set1_ps(ray.direction.y);
+    const __m128 direction_z = _mm_set1_ps(ray.direction.z);
+    const __m128 origin_x = _mm_set1_ps(ray.origin.x);
+    const __m128 origin_y = _mm_set1_ps(ray.origin.y);
+    const __m128 origin_z = _mm_set1_ps(ray.origin.z);
+    const __m128i face_index_lower = _mm_set1_epi32(face_index_start - 1);
+    const __m128i face_index_upper = _mm_set1_epi32(face_index_start + num_faces);
+    const int face_index_end = face_index_start + num_faces;
+    int hit_face_index = -1;
+    for (int group_face_index = face_index_start - face_index_start % width; group_face_index < face_index_end; group_face_index += width) {
+        const float* group = group_array + group_face_index * RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS;
+        const __m128 va_x = _mm_loadu_ps(group + 0 * width);
+        const __m128 va_y = _mm_loadu_ps(group + 1 * width);
+        const __m128 va_z = _mm_loadu_ps(group + 2 * width);
+        const __m128 edge_ba_x = _mm_loadu_ps(group + 3 * width);
+        const __m128 edge_ba_y = _mm_loadu_ps(group + 4 * width);
+        const __m128 edge_ba_z = _mm_loadu_ps(group + 5 * width);
+        const __m128 edge_ca_x = _mm_loadu_ps(group + 6 * width);
+        const __m128 edge_ca_y = _mm_loadu_ps(group + 7 * width);
+        const __m128 edge_ca_z = _mm_loadu_ps(group + 8 * width);
+        const __m128 unit_normal_x = _mm_loadu_ps(group + 9 * width);
+        const __m128 unit_normal_y = _mm_loadu_ps(group + 10 * width);
+        const __m128 unit_normal_z = _mm_loadu_ps(group + 11 * width);
+
+        // 葉に含まれるレーン
+        const __m128i face_index = _mm_add_epi32(_mm_set1_epi32(group_face_index), _mm_setr_epi32(0, 1, 2, 3));
+        __m128 keep = _mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(face_index, face_index_lower), _mm_cmpgt_epi32(face_index_upper, face_index)));
+
+        __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(unit_normal_x, direction_x), _mm_mul_ps(unit_normal_y, direction_y)), _mm_mul_ps(unit_normal_z, direction_z));
+        keep = _mm_and_ps(keep, _mm_cmpngt_ps(dot, zero));
+        const __m128 h_x = _mm_sub_ps(_mm_mul_ps(direction_y, edge_ca_z), _mm_mul_ps(direction_z, edge_ca_y));
+        const __m128 h_y = _mm_sub_ps(_mm_mul_ps(direction_z, edge_ca_x), _mm_mul_ps(direction_x, edge_ca_z));
+        const __m128 h_z = _mm_sub_ps(_mm_mul_ps(direction_x, edge_ca_y), _mm_mul_ps(direction_y, edge_ca_x));
+        __m128 f = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge_ba_x, h_x), _mm_mul_ps(edge_ba_y, h_y)), _mm_mul_ps(edge_ba_z, h_z));
+        keep = _mm_and_ps(keep, _mm_or_ps(_mm_cmpngt_ps(f, negative_eps), _mm_cmpnlt_ps(f, eps)));
+        f = _mm_div_ps(one, f);
+        const __m128 s_x = _mm_sub_ps(origin_x, va_x);
+        const __m128 s_y = _mm_sub_ps(origin_y, va_y);
+        const __m128 s_z = _mm_sub_ps(origin_z, va_z);
+        dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s_x, h_x), _mm_mul_ps(s_y, h_y)), _mm_mul_ps(s_z, h_z));
+        const __m128 u = _mm_mul_ps(f, dot);
+        keep = _mm_and_ps(keep, _mm_and_ps(_mm_cmpnlt_ps(u, zero), _mm_cmpngt_ps(u, one)));
+        const __m128 q_x = _mm_sub_ps(_mm_mul_ps(s_y, edge_ba_z), _mm_mul_ps(s_z, edge_ba_y));
+        const __m128 q_y = _mm_sub_ps(_mm_mul_ps(s_z, edge_ba_x), _mm_mul_ps(s_x, edge_ba_z));
+        const __m128 q_z = _mm_sub_ps(_mm_mul_ps(s_x, edge_ba_y), _mm_mul_ps(s_y, edge_ba_x));
+        dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(q_x, direction_x), _mm_mul_ps(q_y, direction_y)), _mm_mul_ps(q_z, direction_z));
+        const __m128 v = _mm_mul_ps(f, dot);
+        keep = _mm_and_ps(keep, _mm_and_ps(_mm_cmpnlt_ps(v, zero), _mm_cmpngt_ps(_mm_add_ps(u, v), one)));
+        dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge_ca_x, q_x), _mm_mul_ps(edge_ca_y, q_y)), _mm_mul_ps(edge_ca_z, q_z));
+        const __m128 t = _mm_mul_ps(f, dot);
+        keep = _mm_and_ps(keep, _mm_and_ps(_mm_cmpnle_ps(t, _mm_set1_ps(MIN_DISTANCE)), _mm_cmpnge_ps(t, _mm_set1_ps(min_distance))));
+        if (_mm_movemask_ps(keep) == 0) {
+            continue;
+        }
+
+        // 最も近い交点（水平方向の最小値）
+        const __m128 masked_t = _mm_or_ps(_mm_and_ps(keep, t), _mm_andnot_ps(keep, no_hit));
+        __m128 nearest = _mm_min_ps(masked_t, _mm_shuffle_ps(masked_t, masked_t, _MM_SHUFFLE(1, 0, 3, 2)));
+        nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+        const int lane_bits = _mm_movemask_ps(_mm_and_ps(keep, _mm_cmpeq_ps(masked_t, nearest)));
+        min_distance = _mm_cvtss_f32(nearest);
+        hit_face_index = group_face_index + __builtin_ctz(lane_bits);
+    }
+    return hit_face_index;
+}
+
+__attribute__((target("avx2"))) int rtx_cpu_intersect_triangle_groups_avx2(
+    const float* group_array,
+    int face_index_start,
+    int num_faces,
+    const rtxCPURay& ray,
+    float& min_distance)
+{
+    const int width = 8;
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 eps = _mm256_set1_ps(EPS);
+    const __m256 negative_eps = _mm256_set1_ps(-EPS);
+    const __m256 no_hit = _mm256_set1_ps(FLT_MAX);
+    const __m256 direction_x = _mm256_set1_ps(ray.direction.x);
+    const __m256 direction_y = _mm256_set1_ps(ray.direction.y);
+    const __m256 direction_z = _mm256_set1_ps(ray.direction.z);
+    const __m256 origin_x = _mm256_set1_ps(ray.origin.x);
+    const __m256 origin_y = _mm256_set1_ps(ray.origin.y);
+    const __m256 origin_z = _mm256_set1_ps(ray.origin.z);
+    const __m256i face_index_lower = _mm256_set1_epi32(face_index_start - 1);
+    const __m256i face_index_upper = _mm256_set1_epi32(face_index_start + num_faces);
+    const int face_index_end = face_index_start + num_faces;
+    int hit_face_index = -1;
+    for (int group_face_index = face_index_start - face_index_start % width; group_face_index < face_index_end; group_face_index += width) {
+        const float* group = group_array + group_face_index * RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS;
+        const __m256 va_x = _mm256_loadu_ps(group + 0 * width);
+        const __m256 va_y = _mm256_loadu_ps(group + 1 * width);
+        const __m256 va_z = _mm256_loadu_ps(group + 2 * width);
+        const __m256 edge_ba_x = _mm256_loadu_ps(group + 3 * width);
+        const __m256 edge_ba_y = _mm256_loadu_ps(group + 4 * width);
+        const __m256 edge_ba_z = _mm256_loadu_ps(group + 5 * width);
+        const __m256 edge_ca_x = _mm256_loadu_ps(group + 6 * width);
+        const __m256 edge_ca_y = _mm256_loadu_ps(group + 7 * width);
+        const __m256 edge_ca_z = _mm256_loadu_ps(group + 8 * width);
+        const __m256 unit_normal_x = _mm256_loadu_ps(group + 9 * width);
+        const __m256 unit_normal_y = _mm256_loadu_ps(group + 10 * width);
+        const __m256 unit_normal_z = _mm256_loadu_ps(group + 11 * width);
+
+        // 葉に含まれるレーン
+        const __m256i face_index = _mm256_add_epi32(_mm256_set1_epi32(group_face_index), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256 keep = _mm256_castsi256_ps(_mm256_and_si256(_mm256_cmpgt_epi32(face_index, face_index_lower), _mm256_cmpgt_epi32(face_index_upper, face_index)));
+
+        __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(unit_normal_x, direction_x), _mm256_mul_ps(unit_normal_y, direction_y)), _mm256_mul_ps(unit_normal_z, direction_z));
+        keep = _mm256_and_ps(keep, _mm256_cmp_ps(dot, zero, _CMP_NGT_UQ));
+        const __m256 h_x = _mm256_sub_ps(_mm256_mul_ps(direction_y, edge_ca_z), _mm256_mul_ps(direction_z, edge_ca_y));
+        const __m256 h_y = _mm256_sub_ps(_mm256_mul_ps(direction_z, edge_ca_x), _mm256_mul_ps(direction_x, edge_ca_z));
+        const __m256 h_z = _mm256_sub_ps(_mm256_mul_ps(direction_x, edge_ca_y), _mm256_mul_ps(direction_y, edge_ca_x));
+        __m256 f = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge_ba_x, h_x), _mm256_mul_ps(edge_ba_y, h_y)), _mm256_mul_ps(edge_ba_z, h_z));
+        keep = _mm256_and_ps(keep, _mm256_or_ps(_mm256_cmp_ps(f, negative_eps, _CMP_NGT_UQ), _mm256_cmp_ps(f, eps, _CMP_NLT_UQ)));
+        f = _mm256_div_ps(one, f);
+        const __m256 s_x = _mm256_sub_ps(origin_x, va_x);
+        const __m256 s_y = _mm256_sub_ps(origin_y, va_y);
+        const __m256 s_z = _mm256_sub_ps(origin_z, va_z);
+        dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(s_x, h_x), _mm256_mul_ps(s_y, h_y)), _mm256_mul_ps(s_z, h_z));
+        const __m256 u = _mm256_mul_ps(f, dot);
+        keep = _mm256_and_ps(keep, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_NLT_UQ), _mm256_cmp_ps(u, one, _CMP_NGT_UQ)));
+        const __m256 q_x = _mm256_sub_ps(_mm256_mul_ps(s_y, edge_ba_z), _mm256_mul_ps(s_z, edge_ba_y));
+        const __m256 q_y = _mm256_sub_ps(_mm256_mul_ps(s_z, edge_ba_x), _mm256_mul_ps(s_x, edge_ba_z));
+        const __m256 q_z = _mm256_sub_ps(_mm256_mul_ps(s_x, edge_ba_y), _mm256_mul_ps(s_y, edge_ba_x));
+        dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(q_x, direction_x), _mm256_mul_ps(q_y, direction_y)), _mm256_mul_ps(q_z, direction_z));
+        const __m256 v = _mm256_mul_ps(f, dot);
+        keep = _mm256_and_ps(keep, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_NLT_UQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_NGT_UQ)));
+        dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge_ca_x, q_x), _mm256_mul_ps(edge_ca_y, q_y)), _mm256_mul_ps(edge_ca_z, q_z));
+        const __m256 t = _mm256_mul_ps(f, dot);
+        keep = _mm256_and_ps(keep, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(MIN_DISTANCE), _CMP_NLE_UQ), _mm256_cmp_ps(t, _mm256_set1_ps(min_distance), _CMP_NGE_UQ)));
+        if (_mm256_movemask_ps(keep) == 0) {
+            continue;
+        }
+
+        // 最も近い交点（水平方向の最小値）
+        const __m256 masked_t = _mm256_blendv_ps(no_hit, t, keep);
+        __m256 nearest = _mm256_min_ps(masked_t, _mm256_permute2f128_ps(masked_t, masked_t, 1));
+        nearest = _mm256_min_ps(nearest, _mm256_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+        nearest = _mm256_min_ps(nearest, _mm256_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+        const int lane_bits = _mm256_movemask_ps(_mm256_and_ps(keep, _mm256_cmp_ps(masked_t, nearest, _CMP_EQ_OQ)));
+        min_distance = _mm_cvtss_f32(_mm256_castps256_ps128(nearest));
+        hit_face_index = group_face_index + __builtin_ctz(lane_bits);
+    }
+    return hit_face_index;
+}
+
+__attribute__((target("avx512f"))) int rtx_cpu_intersect_triangle_groups_avx512(
+    const float* group_array,
+    int face_index_start,
+    int num_faces,
+    const rtxCPURay& ray,
+    float& min_distance)
+{
+    const int width = 16;
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 eps = _mm512_set1_ps(EPS);
+    const __m512 negative_eps = _mm512_set1_ps(-EPS);
+    const __m512 no_hit = _mm512_set1_ps(FLT_MAX);
+    const __m512 direction_x = _mm512_set1_ps(ray.direction.x);
+    const __m512 direction_y = _mm512_set1_ps(ray.direction.y);
+    const __m512 direction_z = _mm512_set1_ps(ray.direction.z);
+    const __m512 origin_x = _mm512_set1_ps(ray.origin.x);
+    const __m512 origin_y = _mm512_set1_ps(ray.origin.y);
+    const __m512 origin_z = _mm512_set1_ps(ray.origin.z);
+    const int face_index_end = face_index_start + num_faces;
+    int hit_face_index = -1;
+    for (int group_face_index = face_index_start - face_index_start % width; group_face_index < face_index_end; group_face_index += width) {
+        const float* group = group_array + group_face_index * RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS;
+        const __m512 va_x = _mm512_loadu_ps(group + 0 * width);
+        const __m512 va_y = _mm512_loadu_ps(group + 1 * width);
+        const __m512 va_z = _mm512_loadu_ps(group + 2 * width);
+        const __m512 edge_ba_x = _mm512_loadu_ps(group + 3 * width);
+        const __m512 edge_ba_y = _mm512_loadu_ps(group + 4 * width);
+        const __m512 edge_ba_z = _mm512_loadu_ps(group + 5 * width);
+        const __m512 edge_ca_x = _mm512_loadu_ps(group + 6 * width);
+        const __m512 edge_ca_y = _mm512_loadu_ps(group + 7 * width);
+        const __m512 edge_ca_z = _mm512_loadu_ps(group + 8 * width);
+        const __m512 unit_normal_x = _mm512_loadu_ps(group + 9 * width);
+        const __m512 unit_normal_y = _mm512_loadu_ps(group + 10 * width);
+        const __m512 unit_normal_z = _mm512_loadu_ps(group + 11 * width);
+
+        // 葉に含まれるレーン
+        const int lower = std::max(face_index_start - group_face_index, 0);
+        const int upper = std::min(face_index_end - group_face_index, width);
+        __mmask16 keep = __mmask16(((1u << upper) - 1) & ~((1u << lower) - 1));
+
+        __m512 dot = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(unit_normal_x, direction_x), _mm512_mul_ps(unit_normal_y, direction_y)), _mm512_mul_ps(unit_normal_z, direction_z));
+        keep = _mm512_mask_cmp_ps_mask(keep, dot, zero, _CMP_NGT_UQ);
+        const __m512 h_x = _mm512_sub_ps(_mm512_mul_ps(direction_y, edge_ca_z), _mm512_mul_ps(direction_z, edge_ca_y));
+        const __m512 h_y = _mm512_sub_ps(_mm512_mul_ps(direction_z, edge_ca_x), _mm512_mul_ps(direction_x, edge_ca_z));
+        const __m512 h_z = _mm512_sub_ps(_mm512_mul_ps(direction_x, edge_ca_y), _mm512_mul_ps(direction_y, edge_ca_x));
+        __m512 f = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(edge_ba_x, h_x), _mm512_mul_ps(edge_ba_y, h_y)), _mm512_mul_ps(edge_ba_z, h_z));
+        keep &= _mm512_cmp_ps_mask(f, negative_eps, _CMP_NGT_UQ) | _mm512_cmp_ps_mask(f, eps, _CMP_NLT_UQ);
+        f = _mm512_div_ps(one, f);
+        const __m512 s_x = _mm512_sub_ps(origin_x, va_x);
+        const __m512 s_y = _mm512_sub_ps(origin_y, va_y);
+        const __m512 s_z = _mm512_sub_ps(origin_z, va_z);
+        dot = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(s_x, h_x), _mm512_mul_ps(s_y, h_y)), _mm512_mul_ps(s_z, h_z));
+        const __m512 u = _mm512_mul_ps(f, dot);
+        keep = _mm512_mask_cmp_ps_mask(keep, u, zero, _CMP_NLT_UQ);
+        keep = _mm512_mask_cmp_ps_mask(keep, u, one, _CMP_NGT_UQ);
+        const __m512 q_x = _mm512_sub_ps(_mm512_mul_ps(s_y, edge_ba_z), _mm512_mul_ps(s_z, edge_ba_y));
+        const __m512 q_y = _mm512_sub_ps(_mm512_mul_ps(s_z, edge_ba_x), _mm512_mul_ps(s_x, edge_ba_z));
+        const __m512 q_z = _mm512_sub_ps(_mm512_mul_ps(s_x, edge_ba_y), _mm512_mul_ps(s_y, edge_ba_x));
+        dot = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(q_x, direction_x), _mm512_mul_ps(q_y, direction_y)), _mm512_mul_ps(q_z, direction_z));
+        const __m512 v = _mm512_mul_ps(f, dot);
+        keep = _mm512_mask_cmp_ps_mask(keep, v, zero, _CMP_NLT_UQ);
+        keep = _mm512_mask_cmp_ps_mask(keep, _mm512_add_ps(u, v), one, _CMP_NGT_UQ);
+        dot = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(edge_ca_x, q_x), _mm512_mul_ps(edge_ca_y, q_y)), _mm512_mul_ps(edge_ca_z, q_z));
+        const __m512 t = _mm512_mul_ps(f, dot);
+        keep = _mm512_mask_cmp_ps_mask(keep, t, _mm512_set1_ps(MIN_DISTANCE), _CMP_NLE_UQ);
+        keep = _mm512_mask_cmp_ps_mask(keep, t, _mm512_set1_ps(min_distance), _CMP_NGE_UQ);
+        if (keep == 0) {
+            continue;
+        }
+
+        // 最も近い交点（水平方向の最小値）
+        const __m512 masked_t = _mm512_mask_blend_ps(keep, no_hit, t);
+        // 全レーンのマスクを付けた形を使う（GCC 12ではマスクのない形が未初期化の警告を出す）
+        const __mmask16 all_lanes = 0xffff;
+        __m512 nearest = _mm512_maskz_min_ps(all_lanes, masked_t, _mm512_maskz_shuffle_f32x4(all_lanes, masked_t, masked_t, _MM_SHUFFLE(1, 0, 3, 2)));
+        nearest = _mm512_maskz_min_ps(all_lanes, nearest, _mm512_maskz_shuffle_f32x4(all_lanes, nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+        nearest = _mm512_maskz_min_ps(all_lanes, nearest, _mm512_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+        nearest = _mm512_maskz_min_ps(all_lanes, nearest, _mm512_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+        const int lane_bits = _mm512_mask_cmp_ps_mask(keep, masked_t, nearest, _CMP_EQ_OQ);
+        min_distance = _mm512_cvtss_f32(nearest);
+        hit_face_index = group_face_index + __builtin_ctz(lane_bits);
+    }
+    return hit_face_index;
+}
+#endif
+
+rtxCPUTriangleGroupKernel rtx_cpu_select_triangle_group_kernel()
+{
+#if defined(RTX_CPU_TRIANGLE_GROUP_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return { 16, rtx_cpu_intersect_triangle_groups_avx512 };
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return { 8, rtx_cpu_intersect_triangle_groups_avx2 };
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return { 4, rtx_cpu_intersect_triangle_groups_sse };
+    }
+#endif
+    return { 4, rtx_cpu_intersect_triangle_groups_scalar };
+}
+}
+
+const rtxCPUTriangleGroupKernel& rtx_cpu_triangle_group_kernel()
+{
+    static const rtxCPUTriangleGroupKernel kernel = rtx_cpu_select_triangle_group_kernel();
+    return kernel;
+}
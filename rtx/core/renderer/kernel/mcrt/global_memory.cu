@@ -17,6 +17,7 @@ __global__ void mcrt_global_memory_kernel(
     rtxObject* global_serialized_object_array,
     rtxMaterialAttributeByte* global_serialized_material_attribute_byte_array,
     rtxThreadedBVH* global_serialized_threaded_bvh_array,
+    rtxThreadedBVHLink* global_serialized_threaded_bvh_link_array,
     rtxThreadedBVHNode* global_serialized_threaded_bvh_node_array,
     rtxRGBAColor* global_serialized_color_mapping_array,
     rtxUVCoordinate* global_serialized_uv_coordinate_array,
@@ -123,6 +124,8 @@ __global__ void mcrt_global_memory_kernel(
                 rtxThreadedBVH bvh = shared_serialized_threaded_bvh_array[object_index];
 
                 // BVHの各ノードを遷移していく
+                // 分割ごとにレイの向きで手前の子から辿るリンクを使う
+                const int octant = __rtx_ray_octant(ray_direction_inv);
                 int bvh_current_node_index = 0;
                 for (int traversal = 0; traversal < bvh.num_nodes; traversal++) {
                     if (bvh_current_node_index == THREADED_BVH_TERMINAL_NODE) {
@@ -131,6 +134,7 @@ __global__ void mcrt_global_memory_kernel(
                     }
                     int serialized_node_index = bvh.serial_node_index_offset + bvh_current_node_index;
                     rtxThreadedBVHNode node = global_serialized_threaded_bvh_node_array[serialized_node_index];
+                    __rtx_load_octant_links(node, global_serialized_threaded_bvh_link_array, serialized_node_index, octant);
 
                     bool is_inner_node = node.assigned_face_index_start == -1;
                     if (is_inner_node) {
@@ -138,7 +142,7 @@ __global__ void mcrt_global_memory_kernel(
                         // 詳細は以下参照
                         // An Efficient and Robust Ray–Box Intersection Algorithm
                         // http://www.cs.utah.edu/~awilliam/box/box.pdf
-                        __rtx_bvh_traversal_one_step_or_continue(ray, node, ray_direction_inv, bvh_current_node_index);
+                        __rtx_bvh_traversal_one_step_or_continue(ray, node, ray_direction_inv, min_distance, bvh_current_node_index);
                     } else {
                         // 葉ノード
                         // 割り当てられたジオメトリの各面との衝突判定を行う
@@ -375,6 +379,7 @@ void rtx_cuda_launch_mcrt_global_memory_kernel(
     rtxMaterialAttributeByte* gpu_serialized_material_attribute_byte_array,
     rtxThreadedBVH* gpu_serialized_threaded_bvh_array,
     rtxThreadedBVHNode* gpu_serialized_threaded_bvh_node_array,
+    rtxThreadedBVHLink* gpu_serialized_threaded_bvh_link_array,
     rtxRGBAColor* gpu_serialized_color_mapping_array,
     rtxUVCoordinate* gpu_serialized_uv_coordinate_array,
     rtxRGBAPixel* gpu_serialized_render_array,
@@ -388,6 +393,7 @@ void rtx_cuda_launch_mcrt_global_memory_kernel(
         gpu_serialized_object_array,
         gpu_serialized_material_attribute_byte_array,
         gpu_serialized_threaded_bvh_array,
+        gpu_serialized_threaded_bvh_link_array,
         gpu_serialized_threaded_bvh_node_array,
         gpu_serialized_color_mapping_array,
         gpu_serialized_uv_coordinate_array,
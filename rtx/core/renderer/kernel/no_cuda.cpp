@@ -0,0 +1,130 @@
+#include "../../header/enum.h"
+#include "../header/bridge.h"
+#include <stdexcept>
+#include <stdio.h>
+
+// nvccが無い環境でビルドする場合にcuda.cuの代わりにリンクする
+// CUDAバックエンドを使おうとすると例外を投げる
+// Linked instead of cuda.cu when nvcc is not available.
+// Only RTXBackendCPU can be used in that build.
+
+static void rtx_throw_cuda_not_available()
+{
+    throw std::runtime_error("CUDA backend is not available in this build");
+}
+void rtx_cuda_malloc(void** gpu_array, size_t size)
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_cuda_malloc_pointer(void**& gpu_array, size_t size)
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_cuda_memcpy_host_to_device(void* gpu_array, void* cpu_array, size_t size)
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_cuda_memcpy_device_to_host(void* cpu_array, void* gpu_array, size_t size)
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_cuda_free(void** array_ref)
+{
+    // デストラクタから呼ばれるので例外は投げない
+    *array_ref = NULL;
+}
+void rtx_cuda_device_reset()
+{
+}
+void rtx_cuda_malloc_texture_objects()
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_cuda_free_texture_objects()
+{
+}
+void rtx_cuda_malloc_texture(int unit_index, int width, int height)
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_cuda_memcpy_to_texture(int unit_index, int width_offset, int height_offset, void* data, size_t bytes)
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_cuda_bind_texture(int unit_index)
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_cuda_transfer_all_texture_objects()
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_cuda_free_texture(int unit_index)
+{
+}
+size_t rtx_cuda_get_available_shared_memory_bytes()
+{
+    rtx_throw_cuda_not_available();
+    return 0;
+}
+size_t rtx_cuda_get_cudaTextureObject_t_bytes()
+{
+    return sizeof(unsigned long long);
+}
+int rtx_get_device_count()
+{
+    return 0;
+}
+void rtx_set_device(int device)
+{
+    rtx_throw_cuda_not_available();
+}
+void rtx_print_device_properties(int device)
+{
+    printf("CUDA is not available in this build\n");
+}
+
+#define rtx_define_cuda_mcrt_kernel_launcher_stub(memory_type)       \
+    void rtx_cuda_launch_mcrt_##memory_type##_kernel(                \
+        rtxFaceVertexIndex* gpu_face_vertex_index_array,             \
+        rtxVertex* gpu_vertex_array,                                 \
+        rtxObject* gpu_object_array,                                 \
+        rtxMaterialAttributeByte* gpu_material_attribute_byte_array, \
+        rtxThreadedBVH* gpu_threaded_bvh_array,                      \
+        rtxThreadedBVHNode* gpu_threaded_bvh_node_array,             \
+        rtxThreadedBVHLink* gpu_threaded_bvh_link_array,             \
+        rtxRGBAColor* gpu_color_mapping_array,                       \
+        rtxUVCoordinate* gpu_serialized_uv_coordinate_array,         \
+        rtxRGBAPixel* gpu_render_array,                              \
+        rtxMCRTKernelArguments& args,                                \
+        int num_threads, int num_blocks, size_t shared_memory_bytes) \
+    {                                                                \
+        rtx_throw_cuda_not_available();                              \
+    }
+
+rtx_define_cuda_mcrt_kernel_launcher_stub(texture_memory)
+rtx_define_cuda_mcrt_kernel_launcher_stub(shared_memory)
+rtx_define_cuda_mcrt_kernel_launcher_stub(global_memory)
+
+#define rtx_define_cuda_nee_kernel_launcher_stub(memory_type)        \
+    void rtx_cuda_launch_nee_##memory_type##_kernel(                 \
+        rtxFaceVertexIndex* gpu_face_vertex_index_array,             \
+        rtxVertex* gpu_vertex_array,                                 \
+        rtxObject* gpu_object_array,                                 \
+        rtxMaterialAttributeByte* gpu_material_attribute_byte_array, \
+        rtxThreadedBVH* gpu_threaded_bvh_array,                      \
+        rtxThreadedBVHNode* gpu_threaded_bvh_node_array,             \
+        rtxThreadedBVHLink* gpu_threaded_bvh_link_array,             \
+        rtxRGBAColor* gpu_color_mapping_array,                       \
+        rtxUVCoordinate* gpu_serialized_uv_coordinate_array,         \
+        int* gpu_light_sampling_table,                               \
+        rtxRGBAPixel* gpu_render_array,                              \
+        rtxNEEKernelArguments& args,                                 \
+        int num_threads, int num_blocks, size_t shared_memory_bytes) \
+    {                                                                \
+        rtx_throw_cuda_not_available();                              \
+    }
+
+rtx_define_cuda_nee_kernel_launcher_stub(texture_memory)
+rtx_define_cuda_nee_kernel_launcher_stub(shared_memory)
+rtx_define_cuda_nee_kernel_launcher_stub(global_memory)
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include "../material/emissive.h"
 #include "../material/lambert.h"
 #include "header/bridge.h"
+#include "header/cpu_bridge.h"
+#include "header/cpu_triangle_group.h"
 #include <chrono>
 #include <iostream>
 #include <memory>
@@ -25,12 +27,22 @@ Renderer::Renderer()
     _gpu_material_attribute_byte_array = NULL;
     _gpu_threaded_bvh_array = NULL;
     _gpu_threaded_bvh_node_array = NULL;
+    _gpu_threaded_bvh_link_array = NULL;
     _gpu_light_sampling_table = NULL;
     _gpu_color_mapping_array = NULL;
     _gpu_serialized_uv_coordinate_array = NULL;
     _gpu_render_array = NULL;
     _total_frames = 0;
-    rtx_cuda_malloc_texture_objects();
+    _backend = RTXBackendCUDA;
+    _prev_backend = RTXBackendCUDA;
+    _bvh_node_format = BVH_DEFAULT_NODE_FORMAT;
+    _triangle_format = BVH_DEFAULT_TRIANGLE_FORMAT;
+    // テクスチャオブジェクトはCUDAで描画する時に確保する
+    // Allocated lazily so that the CPU backend works without a CUDA device
+    _gpu_texture_objects_allocated = false;
+    _lazy_bvh_construction_enabled = false;
+    _lazy_bvh_table_size = 0;
+    _lazy_bvh_refined = false;
 }
 Renderer::~Renderer()
 {
@@ -40,76 +52,98 @@ Renderer::~Renderer()
     rtx_cuda_free((void**)&_gpu_material_attribute_byte_array);
     rtx_cuda_free((void**)&_gpu_threaded_bvh_array);
     rtx_cuda_free((void**)&_gpu_threaded_bvh_node_array);
+    rtx_cuda_free((void**)&_gpu_threaded_bvh_link_array);
     rtx_cuda_free((void**)&_gpu_color_mapping_array);
     rtx_cuda_free((void**)&_gpu_serialized_uv_coordinate_array);
     rtx_cuda_free((void**)&_gpu_render_array);
-    rtx_cuda_free_texture_objects();
+    if (_gpu_texture_objects_allocated) {
+        rtx_cuda_free_texture_objects();
+    }
+}
+void Renderer::set_bvh_cache_directory(std::string directory)
+{
+    _bvh_cache.set_directory(directory);
+}
+std::string Renderer::bvh_cache_directory()
+{
+    return _bvh_cache.directory();
+}
+int Renderer::bvh_cache_hits()
+{
+    return _bvh_cache.num_hits();
 }
-void Renderer::transform_objects_to_view_space()
+int Renderer::bvh_cache_misses()
 {
-    int num_objects = _scene->_object_array.size();
+    return _bvh_cache.num_misses();
+}
+std::vector<bvh::Stats> Renderer::bvh_stats()
+{
+    std::vector<bvh::Stats> stats_array;
+    for (auto& bvh : _geometry_bvh_array) {
+        stats_array.push_back(bvh->stats());
+    }
+    return stats_array;
+}
+// オブジェクトを直列化する順序で並べ、それぞれのインスタンス変換（グループの変換を含むワールド変換行列）を求める
+// moved_array marks the objects whose own transform or whose group's transform changed.
+void Renderer::collect_instances(std::vector<std::shared_ptr<Object>>& source_object_array, std::vector<char>& moved_array)
+{
+    source_object_array.clear();
+    moved_array.clear();
+    _instance_matrix_array.clear();
+    for (auto& object : _scene->_object_array) {
+        auto& geometry = object->geometry();
+        source_object_array.push_back(object);
+        moved_array.push_back(geometry->updated());
+        _instance_matrix_array.push_back(geometry->_model_matrix);
+    }
     for (auto& group : _scene->_object_group_array) {
-        num_objects += group->_object_array.size();
+        for (auto& object : group->_object_array) {
+            auto& geometry = object->geometry();
+            source_object_array.push_back(object);
+            moved_array.push_back(group->updated() || geometry->updated());
+            _instance_matrix_array.push_back(group->_model_matrix * geometry->_model_matrix);
+        }
     }
+}
+// ジオメトリとBVHはワールド座標系に置き、カメラの変換はレイの生成時に行う
+// Moving the camera therefore never touches the geometry.
+void Renderer::transform_objects_to_world_space()
+{
+    std::vector<std::shared_ptr<Object>> source_object_array;
+    std::vector<char> moved_array;
+    collect_instances(source_object_array, moved_array);
+    int num_objects = source_object_array.size();
     if (num_objects == 0) {
         return;
     }
     _transformed_object_array = std::vector<std::shared_ptr<Object>>(num_objects);
 
-    for (unsigned int n = 0; n < _scene->_object_array.size(); n++) {
-        auto& object = _scene->_object_array[n];
+    for (int n = 0; n < num_objects; n++) {
+        auto& object = source_object_array[n];
         auto& geometry = object->geometry();
-        glm::mat4 transformation_matrix = _camera->_view_matrix * geometry->_model_matrix;
-        auto transformed_geometry = geometry->transoform(transformation_matrix);
+        auto transformed_geometry = geometry->transoform(_instance_matrix_array[n]);
         _transformed_object_array.at(n) = std::make_shared<Object>(transformed_geometry, object->material(), object->mapping());
     }
-    int offset = _scene->_object_array.size();
-    for (unsigned int group_index = 0; group_index < _scene->_object_group_array.size(); group_index++) {
-        auto& group = _scene->_object_group_array[group_index];
-        glm::mat4 view_matrix = _camera->_view_matrix * group->_model_matrix;
-        for (unsigned int n = 0; n < group->_object_array.size(); n++) {
-            auto& object = group->_object_array[n];
-            auto& geometry = object->geometry();
-            glm::mat4 transformation_matrix = view_matrix * geometry->_model_matrix;
-            auto transformed_geometry = geometry->transoform(transformation_matrix);
-            _transformed_object_array.at(n + offset) = std::make_shared<Object>(transformed_geometry, object->material(), object->mapping());
-        }
-        offset += group->_object_array.size();
-    }
 }
-void Renderer::transform_objects_to_view_space_parallel()
+void Renderer::transform_objects_to_world_space_parallel()
 {
-    int num_objects = _scene->_object_array.size();
-    for (auto& group : _scene->_object_group_array) {
-        num_objects += group->_object_array.size();
-    }
+    std::vector<std::shared_ptr<Object>> source_object_array;
+    std::vector<char> moved_array;
+    collect_instances(source_object_array, moved_array);
+    int num_objects = source_object_array.size();
     if (num_objects == 0) {
         return;
     }
     _transformed_object_array = std::vector<std::shared_ptr<Object>>(num_objects);
 
 #pragma omp parallel for
-    for (unsigned int n = 0; n < _scene->_object_array.size(); n++) {
-        auto& object = _scene->_object_array[n];
+    for (int n = 0; n < num_objects; n++) {
+        auto& object = source_object_array[n];
         auto& geometry = object->geometry();
-        glm::mat4 transformation_matrix = _camera->_view_matrix * geometry->_model_matrix;
-        auto transformed_geometry = geometry->transoform(transformation_matrix);
+        auto transformed_geometry = geometry->transoform(_instance_matrix_array[n]);
         _transformed_object_array.at(n) = std::make_shared<Object>(transformed_geometry, object->material(), object->mapping());
     }
-    int offset = _scene->_object_array.size();
-    for (unsigned int group_index = 0; group_index < _scene->_object_group_array.size(); group_index++) {
-        auto& group = _scene->_object_group_array[group_index];
-        glm::mat4 view_matrix = _camera->_view_matrix * group->_model_matrix;
-#pragma omp parallel for
-        for (unsigned int n = 0; n < group->_object_array.size(); n++) {
-            auto& object = group->_object_array[n];
-            auto& geometry = object->geometry();
-            glm::mat4 transformation_matrix = view_matrix * geometry->_model_matrix;
-            auto transformed_geometry = geometry->transoform(transformation_matrix);
-            _transformed_object_array.at(n + offset) = std::make_shared<Object>(transformed_geometry, object->material(), object->mapping());
-        }
-        offset += group->_object_array.size();
-    }
 }
 void Renderer::serialize_geometries()
 {
@@ -117,9 +151,10 @@ void Renderer::serialize_geometries()
     assert(num_objects > 0);
     int total_faces = 0;
     int total_vertices = 0;
-    for (auto& object : _transformed_object_array) {
-        auto& geometry = object->geometry();
-        total_faces += geometry->num_faces();
+    for (int object_index = 0; object_index < num_objects; object_index++) {
+        auto& geometry = _transformed_object_array.at(object_index)->geometry();
+        // 空間分割で複製された面も含める
+        total_faces += _geometry_bvh_array.at(object_index)->num_face_references();
         total_vertices += geometry->num_vertices();
     }
 
@@ -127,20 +162,25 @@ void Renderer::serialize_geometries()
     _cpu_vertex_array = rtx::array<rtxVertex>(total_vertices);
     _cpu_object_array = rtx::array<rtxObject>(num_objects);
 
+    // 頂点はBVHの葉の順に並べ直す
+    // 粗い葉のオブジェクトはBVHを構築した時に書き込む
     int vertex_index_offset = 0;
-    for (auto& object : _transformed_object_array) {
-        auto& geometry = object->geometry();
-        geometry->serialize_vertices(_cpu_vertex_array, vertex_index_offset);
+    for (int object_index = 0; object_index < num_objects; object_index++) {
+        auto& geometry = _transformed_object_array.at(object_index)->geometry();
+        auto& bvh = _geometry_bvh_array.at(object_index);
+        if (bvh->is_coarse_leaf() == false) {
+            bvh->serialize_vertices(_cpu_vertex_array, vertex_index_offset);
+        }
         vertex_index_offset += geometry->num_vertices();
     }
 
     int face_index_offset = 0;
     for (int object_index = 0; object_index < num_objects; object_index++) {
-        auto& object = _transformed_object_array.at(object_index);
-        auto& geometry = object->geometry();
         auto& bvh = _geometry_bvh_array.at(object_index);
-        bvh->serialize_faces(_cpu_face_vertex_indices_array, face_index_offset);
-        face_index_offset += geometry->num_faces();
+        if (bvh->is_coarse_leaf() == false) {
+            bvh->serialize_faces(_cpu_face_vertex_indices_array, face_index_offset);
+        }
+        face_index_offset += bvh->num_face_references();
     }
 }
 void Renderer::serialize_textures()
@@ -158,12 +198,13 @@ void Renderer::serialize_textures()
     _cpu_serialized_uv_coordinate_array = rtx::array<rtxUVCoordinate>(total_uv_coordinates);
 
     int serial_uv_coordinate_array_offset = 0;
-    for (auto& object : _transformed_object_array) {
-        auto& mapping = object->mapping();
+    for (int object_index = 0; object_index < num_objects; object_index++) {
+        auto& mapping = _transformed_object_array.at(object_index)->mapping();
 
         if (mapping->type() == RTXMappingTypeTexture) {
             TextureMapping* m = static_cast<TextureMapping*>(mapping.get());
-            m->serialize_uv_coordinates(_cpu_serialized_uv_coordinate_array, serial_uv_coordinate_array_offset);
+            m->serialize_uv_coordinates(_cpu_serialized_uv_coordinate_array, serial_uv_coordinate_array_offset,
+                _geometry_bvh_array.at(object_index)->vertex_index_array());
             serial_uv_coordinate_array_offset += m->num_uv_coordinates();
         }
     }
@@ -302,7 +343,7 @@ void Renderer::serialize_objects()
         _cpu_object_array[object_index] = cuda_object;
 
         material_attribute_byte_array_offset += material->attribute_bytes();
-        face_index_offset += geometry->num_faces();
+        face_index_offset += _geometry_bvh_array.at(object_index)->num_face_references();
         vertex_index_offset += geometry->num_vertices();
     }
 }
@@ -311,23 +352,57 @@ void Renderer::construct_bvh()
     int num_objects = _transformed_object_array.size();
     assert(num_objects > 0);
     _geometry_bvh_array = std::vector<std::shared_ptr<BVH>>(num_objects);
-    int total_nodes = 0;
 
-#pragma omp parallel for
+    // 自動選択のコストモデルは他に何も動いていない今のうちに測る
+    // Lazily built meshes are built inside the kernel, where timing traversals under the render load would
+    // store skewed constants for the rest of the process.
+    for (auto& object : _transformed_object_array) {
+        BVH::prepare_cost_model(object->geometry());
+    }
+
+    // オブジェクトごとのタスクとメッシュ内のタスク(BVH::build)を同じスレッドチームで実行する
+    // Object-level and intra-mesh tasks share one team, so a scene with a single huge mesh still uses every core.
+#pragma omp parallel
+#pragma omp single
     for (int object_index = 0; object_index < (int)_transformed_object_array.size(); object_index++) {
-        auto& object = _transformed_object_array[object_index];
-        auto& geometry = object->geometry();
-        assert(geometry->bvh_max_triangles_per_node() > 0);
-        std::shared_ptr<BVH> bvh = std::make_shared<BVH>(geometry);
-        _geometry_bvh_array[object_index] = bvh;
+#pragma omp task firstprivate(object_index)
+        {
+            auto& object = _transformed_object_array[object_index];
+            auto& geometry = object->geometry();
+            assert(geometry->bvh_max_triangles_per_node() >= 0);
+            if (is_lazy_bvh_object(object_index)) {
+                _geometry_bvh_array[object_index] = BVH::coarse_leaf(geometry);
+            } else {
+                // 光源の面は番号で一様にサンプリングするので複製しない
+                // NEE picks a light face uniformly from [0, num_faces), so lights never get spatial splits.
+                std::shared_ptr<BVH> bvh = std::make_shared<BVH>(geometry, object->material()->is_emissive() == false, &_bvh_cache);
+                _geometry_bvh_array[object_index] = bvh;
+            }
+        }
     }
+    _top_level_bvh.build(_geometry_bvh_array);
 
+    serialize_bvh_nodes();
+}
+// オブジェクトごとのBVHの後ろにTLASを置く
+// The TLAS is the extra entry at _cpu_threaded_bvh_array[num_objects]; its nodes follow the last object's nodes.
+// It is uploaded with the rest of the array but the CUDA kernels stop at args.object_array_size and never read it.
+void Renderer::serialize_bvh_nodes()
+{
+    // 遅延構築したノードもここで全体の配列に入る
+    _lazy_wide_bvh_node_array_array.clear();
+    _lazy_quantized_wide_bvh_node_array_array.clear();
+    _lazy_bvh_refined = false;
+
+    int num_objects = _geometry_bvh_array.size();
+    int total_nodes = _top_level_bvh.num_nodes();
     for (auto& bvh : _geometry_bvh_array) {
         total_nodes += bvh->num_nodes();
     }
 
-    _cpu_threaded_bvh_array = rtx::array<rtxThreadedBVH>(num_objects);
+    _cpu_threaded_bvh_array = rtx::array<rtxThreadedBVH>(num_objects + 1);
     _cpu_threaded_bvh_node_array = rtx::array<rtxThreadedBVHNode>(total_nodes);
+    _cpu_threaded_bvh_link_array = rtx::array<rtxThreadedBVHLink>(total_nodes * RTX_THREADED_BVH_NUM_OCTANTS);
 
     int node_index_offset = 0;
     for (int object_index = 0; object_index < num_objects; object_index++) {
@@ -339,8 +414,330 @@ void Renderer::construct_bvh()
         _cpu_threaded_bvh_array[object_index] = cuda_bvh;
 
         bvh->serialize_nodes(_cpu_threaded_bvh_node_array, node_index_offset);
+        bvh->serialize_links(_cpu_threaded_bvh_link_array, node_index_offset);
         node_index_offset += bvh->num_nodes();
     }
+
+    rtxThreadedBVH cuda_top_level_bvh;
+    cuda_top_level_bvh.serial_node_index_offset = node_index_offset;
+    cuda_top_level_bvh.num_nodes = _top_level_bvh.num_nodes();
+    _cpu_threaded_bvh_array[num_objects] = cuda_top_level_bvh;
+    _top_level_bvh.serialize_nodes(_cpu_threaded_bvh_node_array, node_index_offset);
+    _top_level_bvh.serialize_links(_cpu_threaded_bvh_link_array, node_index_offset);
+
+    // CPUのカーネルだけが多分岐BVHを使う
+    // TLASは小さいのでThreaded BVHのまま辿る
+    if (_backend != RTXBackendCPU) {
+        return;
+    }
+    int total_wide_nodes = 0;
+    for (auto& bvh : _geometry_bvh_array) {
+        total_wide_nodes += bvh->num_wide_nodes();
+    }
+    _cpu_wide_bvh_array = rtx::array<rtxCPUWideBVH>(num_objects);
+    if (_bvh_node_format == RTXBVHNodeFormatQuantized) {
+        _cpu_quantized_wide_bvh_node_array = rtx::array<rtxCPUQuantizedWideBVHNode>(total_wide_nodes);
+    } else {
+        _cpu_wide_bvh_node_array = rtx::array<rtxCPUWideBVHNode>(total_wide_nodes);
+    }
+    int wide_node_index_offset = 0;
+    for (int object_index = 0; object_index < num_objects; object_index++) {
+        auto& bvh = _geometry_bvh_array[object_index];
+        _cpu_wide_bvh_array[object_index] = { bvh->num_wide_nodes(), wide_node_index_offset };
+        serialize_wide_bvh_nodes(object_index);
+        wide_node_index_offset += bvh->num_wide_nodes();
+    }
+}
+void Renderer::serialize_wide_bvh_nodes(int object_index)
+{
+    auto& bvh = _geometry_bvh_array[object_index];
+    const int serialization_offset = _cpu_wide_bvh_array[object_index].serial_node_index_offset;
+    if (_bvh_node_format == RTXBVHNodeFormatQuantized) {
+        bvh->serialize_wide_nodes(_cpu_quantized_wide_bvh_node_array, serialization_offset);
+    } else {
+        bvh->serialize_wide_nodes(_cpu_wide_bvh_node_array, serialization_offset);
+    }
+}
+// 光源は面を番号でサンプリングするので最初から構築する
+// Quadrics already are a single box around one primitive, so only meshes are deferred.
+bool Renderer::is_lazy_bvh_object(int object_index)
+{
+    if (_lazy_bvh_construction_enabled == false) {
+        return false;
+    }
+    auto& object = _transformed_object_array[object_index];
+    return object->geometry()->type() == RTXGeometryTypeStandard && object->material()->is_emissive() == false;
+}
+// カーネルに渡すノードの配列の表を作り直す
+void Renderer::publish_lazy_bvh_nodes()
+{
+    const int num_objects = _geometry_bvh_array.size();
+    if (_lazy_bvh_table_size != num_objects) {
+        _lazy_bvh_node_array_array.reset(new std::atomic<const void*>[num_objects]);
+        _lazy_bvh_mutex_array.reset(new std::mutex[num_objects]);
+        _lazy_bvh_table_size = num_objects;
+    }
+    _lazy_wide_bvh_node_array_array.resize(num_objects);
+    _lazy_quantized_wide_bvh_node_array_array.resize(num_objects);
+    for (int object_index = 0; object_index < num_objects; object_index++) {
+        const void* node_array = NULL;
+        if (_geometry_bvh_array[object_index]->is_coarse_leaf() == false) {
+            const int serialization_offset = _cpu_wide_bvh_array[object_index].serial_node_index_offset;
+            if (_bvh_node_format == RTXBVHNodeFormatQuantized) {
+                node_array = _cpu_quantized_wide_bvh_node_array.data() + serialization_offset;
+            } else {
+                node_array = _cpu_wide_bvh_node_array.data() + serialization_offset;
+            }
+        }
+        _lazy_bvh_node_array_array[object_index].store(node_array, std::memory_order_relaxed);
+    }
+    _lazy_bvh_args.node_array_array = _lazy_bvh_node_array_array.get();
+    _lazy_bvh_args.build = &Renderer::build_lazy_object_bvh;
+    _lazy_bvh_args.context = this;
+}
+const void* Renderer::build_lazy_object_bvh(void* context, int object_index)
+{
+    return static_cast<Renderer*>(context)->build_lazy_object_bvh(object_index);
+}
+// カーネルの実行中に呼ばれ、粗い葉を構築したBVHに置き換える
+// Every ray that reaches the object waits on its mutex until the nodes are published, so nothing reads the
+// object's faces, vertices or UVs while they are rewritten in place. The ranges do not move because lazy
+// builds never use spatial splits.
+// This runs on one thread of the kernel's parallel region: the build (or cache load) and the serialization
+// below must not open parallel loops of their own, and the cost model of RTXBVHBuilderAuto has already been
+// measured by construct_bvh, so no timing happens while the other threads render.
+const void* Renderer::build_lazy_object_bvh(int object_index)
+{
+    std::lock_guard<std::mutex> lock(_lazy_bvh_mutex_array[object_index]);
+    // 待っている間に他のスレッドが構築した
+    const void* node_array = _lazy_bvh_node_array_array[object_index].load(std::memory_order_acquire);
+    if (node_array != NULL) {
+        return node_array;
+    }
+    auto& object = _transformed_object_array[object_index];
+    auto& geometry = object->geometry();
+    std::shared_ptr<BVH> bvh = std::make_shared<BVH>(geometry, false, &_bvh_cache);
+    _geometry_bvh_array[object_index] = bvh;
+
+    const rtxObject& cuda_object = _cpu_object_array[object_index];
+    bvh->serialize_vertices(_cpu_vertex_array, cuda_object.serialized_vertex_index_offset);
+    bvh->serialize_faces(_cpu_face_vertex_indices_array, cuda_object.serialized_face_index_offset);
+    auto& mapping = object->mapping();
+    if (mapping->type() == RTXMappingTypeTexture) {
+        TextureMapping* m = static_cast<TextureMapping*>(mapping.get());
+        m->serialize_uv_coordinates(_cpu_serialized_uv_coordinate_array, cuda_object.serialized_uv_coordinates_offset, bvh->vertex_index_array());
+    }
+    // カーネルの並列領域の中なので、面のループは入れ子の並列にせずこのスレッドで回す
+    serialize_triangles(object_index, false);
+
+    if (_bvh_node_format == RTXBVHNodeFormatQuantized) {
+        auto& wide_node_array = _lazy_quantized_wide_bvh_node_array_array[object_index];
+        wide_node_array.reset(new rtx::array<rtxCPUQuantizedWideBVHNode>(bvh->num_wide_nodes()));
+        bvh->serialize_wide_nodes(*wide_node_array, 0);
+        node_array = wide_node_array->data();
+    } else {
+        auto& wide_node_array = _lazy_wide_bvh_node_array_array[object_index];
+        wide_node_array.reset(new rtx::array<rtxCPUWideBVHNode>(bvh->num_wide_nodes()));
+        bvh->serialize_wide_nodes(*wide_node_array, 0);
+        node_array = wide_node_array->data();
+    }
+    _lazy_bvh_refined = true;
+    _lazy_bvh_node_array_array[object_index].store(node_array, std::memory_order_release);
+    return node_array;
+}
+// 直列化した面と頂点から交差判定用の三角形を作る
+// Covers every object, so it only runs when the scene is laid out again or the triangle format changes.
+// Objects that moved or were refit within the same layout are redone one by one by update_moved_objects.
+void Renderer::serialize_triangles()
+{
+    // 面の頂点番号から読む形式ではカーネルは参照しない
+    if (_triangle_format == RTXTriangleFormatIndexed) {
+        return;
+    }
+    const int num_face_references = _cpu_face_vertex_indices_array.size();
+    if (_triangle_format == RTXTriangleFormatPrecomputed) {
+        if (_cpu_triangle_array.size() != num_face_references) {
+            _cpu_triangle_array = rtx::array<rtxCPUTriangle>(num_face_references);
+        }
+    } else {
+        // 最後のまとまりの余ったレーンも読まれるので0で埋めておく
+        const int width = rtx_cpu_triangle_group_kernel().width;
+        const int num_groups = (num_face_references + width - 1) / width;
+        const int group_array_size = num_groups * RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS * width;
+        if (_cpu_triangle_group_array.size() != group_array_size) {
+            _cpu_triangle_group_array = rtx::array<float>(group_array_size);
+            _cpu_triangle_group_array.fill(0.0f);
+        }
+    }
+    const int num_objects = _transformed_object_array.size();
+    for (int object_index = 0; object_index < num_objects; object_index++) {
+        serialize_triangles(object_index, true);
+    }
+}
+void Renderer::serialize_triangles(int object_index, bool parallel)
+{
+    if (_triangle_format == RTXTriangleFormatIndexed) {
+        return;
+    }
+    const rtxObject& cuda_object = _cpu_object_array[object_index];
+    if (cuda_object.geometry_type != RTXGeometryTypeStandard) {
+        return;
+    }
+    // 粗い葉の面はまだ直列化されていない
+    if (_geometry_bvh_array[object_index]->is_coarse_leaf()) {
+        return;
+    }
+    const int num_face_references = _geometry_bvh_array[object_index]->num_face_references();
+    const int group_width = rtx_cpu_triangle_group_kernel().width;
+#pragma omp parallel for if (parallel)
+    for (int n = 0; n < num_face_references; n++) {
+        const int serialized_face_index = n + cuda_object.serialized_face_index_offset;
+        const rtxFaceVertexIndex& face = _cpu_face_vertex_indices_array[serialized_face_index];
+        const rtxVertex& va = _cpu_vertex_array[face.a + cuda_object.serialized_vertex_index_offset];
+        const rtxVertex& vb = _cpu_vertex_array[face.b + cuda_object.serialized_vertex_index_offset];
+        const rtxVertex& vc = _cpu_vertex_array[face.c + cuda_object.serialized_vertex_index_offset];
+        rtxCPUTriangle triangle;
+        triangle.va_x = va.x;
+        triangle.va_y = va.y;
+        triangle.va_z = va.z;
+        triangle.edge_ba_x = vb.x - va.x;
+        triangle.edge_ba_y = vb.y - va.y;
+        triangle.edge_ba_z = vb.z - va.z;
+        triangle.edge_ca_x = vc.x - va.x;
+        triangle.edge_ca_y = vc.y - va.y;
+        triangle.edge_ca_z = vc.z - va.z;
+        // __rtx_intersect_triangle_or_continueと同じ計算順
+        const float normal_x = triangle.edge_ba_y * triangle.edge_ca_z - triangle.edge_ba_z * triangle.edge_ca_y;
+        const float normal_y = triangle.edge_ba_z * triangle.edge_ca_x - triangle.edge_ba_x * triangle.edge_ca_z;
+        const float normal_z = triangle.edge_ba_x * triangle.edge_ca_y - triangle.edge_ba_y * triangle.edge_ca_x;
+        const float norm = sqrtf(normal_x * normal_x + normal_y * normal_y + normal_z * normal_z);
+        triangle.unit_normal_x = normal_x / norm;
+        triangle.unit_normal_y = normal_y / norm;
+        triangle.unit_normal_z = normal_z / norm;
+        if (_triangle_format == RTXTriangleFormatGrouped) {
+            rtx_cpu_store_triangle_in_group(_cpu_triangle_group_array.data(), group_width, serialized_face_index, triangle);
+        } else {
+            _cpu_triangle_array[serialized_face_index] = triangle;
+        }
+    }
+}
+// 動いたオブジェクトと頂点が更新されたメッシュだけを変換し直し、直列データを部分的に書き換える
+// Moved objects get a new BVH since a rotation can loosen every box; meshes whose vertices alone changed are refit.
+// Returns true if a rebuilt BVH duplicated a different number of faces and every object was laid out again.
+bool Renderer::update_moved_objects()
+{
+    std::vector<std::shared_ptr<Object>> source_object_array;
+    std::vector<char> moved_array;
+    collect_instances(source_object_array, moved_array);
+    assert(source_object_array.size() == _transformed_object_array.size());
+
+    std::vector<int> updated_object_index_array;
+    bool any_object_moved = false;
+    for (int object_index = 0; object_index < (int)source_object_array.size(); object_index++) {
+        auto& geometry = source_object_array[object_index]->geometry();
+        if (moved_array[object_index]) {
+            updated_object_index_array.push_back(object_index);
+            any_object_moved = true;
+            continue;
+        }
+        if (geometry->vertices_updated() && geometry->type() == RTXGeometryTypeStandard) {
+            updated_object_index_array.push_back(object_index);
+        }
+    }
+
+    const int num_updated_objects = updated_object_index_array.size();
+    std::vector<char> refitted_array(num_updated_objects);
+#pragma omp parallel for schedule(dynamic)
+    for (int k = 0; k < num_updated_objects; k++) {
+        int object_index = updated_object_index_array[k];
+        auto& geometry = source_object_array[object_index]->geometry();
+        auto& transformed_object = _transformed_object_array[object_index];
+        glm::mat4& transformation_matrix = _instance_matrix_array[object_index];
+        if (geometry->type() == RTXGeometryTypeStandard) {
+            auto& transformed_geometry = transformed_object->geometry();
+            static_cast<StandardGeometry*>(geometry.get())->transform_vertices(transformation_matrix, *static_cast<StandardGeometry*>(transformed_geometry.get()));
+        } else {
+            // 球・円柱・円錐は変換行列をパラメータとして持つので作り直す
+            auto transformed_geometry = geometry->transoform(transformation_matrix);
+            transformed_object = std::make_shared<Object>(transformed_geometry, transformed_object->material(), transformed_object->mapping());
+        }
+        if (moved_array[object_index]) {
+            // 遅延構築では動いたメッシュは粗い葉に戻し、再びレイが当たった時に構築する
+            if (is_lazy_bvh_object(object_index)) {
+                _geometry_bvh_array[object_index] = BVH::coarse_leaf(transformed_object->geometry());
+            } else {
+                _geometry_bvh_array[object_index] = std::make_shared<BVH>(transformed_object->geometry(), transformed_object->material()->is_emissive() == false);
+            }
+            refitted_array[k] = false;
+        } else {
+            refitted_array[k] = _geometry_bvh_array[object_index]->refit();
+        }
+    }
+
+    // 空間分割で複製された面の数が変わると面の配列の区間がずれる
+    const int num_objects = _transformed_object_array.size();
+    bool should_serialize_all_objects = false;
+    for (int k = 0; k < num_updated_objects; k++) {
+        int object_index = updated_object_index_array[k];
+        const int face_index_end = object_index + 1 < num_objects ? _cpu_object_array[object_index + 1].serialized_face_index_offset : _cpu_face_vertex_indices_array.size();
+        const int num_serialized_faces = face_index_end - _cpu_object_array[object_index].serialized_face_index_offset;
+        if (_geometry_bvh_array[object_index]->num_face_references() != num_serialized_faces) {
+            should_serialize_all_objects = true;
+        }
+    }
+
+    bool should_serialize_all_nodes = false;
+    bool should_serialize_textures = false;
+    for (int k = 0; k < num_updated_objects && should_serialize_all_objects == false; k++) {
+        int object_index = updated_object_index_array[k];
+        auto& bvh = _geometry_bvh_array[object_index];
+        const rtxObject& cuda_object = _cpu_object_array[object_index];
+        bvh->serialize_vertices(_cpu_vertex_array, cuda_object.serialized_vertex_index_offset);
+        if (refitted_array[k]) {
+            bvh->serialize_nodes(_cpu_threaded_bvh_node_array, _cpu_threaded_bvh_array[object_index].serial_node_index_offset);
+            if (_backend == RTXBackendCPU) {
+                serialize_wide_bvh_nodes(object_index);
+            }
+        } else {
+            // 作り直した場合は面と頂点の順序とノード数が変わる
+            bvh->serialize_faces(_cpu_face_vertex_indices_array, cuda_object.serialized_face_index_offset);
+            should_serialize_all_nodes = true;
+            if (_transformed_object_array[object_index]->mapping()->type() == RTXMappingTypeTexture) {
+                should_serialize_textures = true;
+            }
+        }
+    }
+
+    // 区間が変わらなければ書き換えたオブジェクトの三角形だけを作り直す
+    // Otherwise the caller lays out every object again and rebuilds all of them.
+    if (should_serialize_all_objects == false && _backend == RTXBackendCPU) {
+        for (int k = 0; k < num_updated_objects; k++) {
+            serialize_triangles(updated_object_index_array[k], true);
+        }
+    }
+
+    // TLASはオブジェクト数が同じならノード数も変わらない
+    if (any_object_moved) {
+        _top_level_bvh.build(_geometry_bvh_array);
+    } else {
+        _top_level_bvh.refit(_geometry_bvh_array);
+    }
+    if (should_serialize_all_objects) {
+        serialize_objects();
+        serialize_bvh_nodes();
+    } else if (should_serialize_all_nodes) {
+        if (should_serialize_textures) {
+            serialize_textures();
+        }
+        serialize_bvh_nodes();
+    } else {
+        // 作り直したTLASは木の形が変わるのでリンクも書き直す
+        // Refitted object BVHs keep their links: the child order may go stale but every link stays valid.
+        const int top_level_node_index_offset = _cpu_threaded_bvh_array[_geometry_bvh_array.size()].serial_node_index_offset;
+        _top_level_bvh.serialize_nodes(_cpu_threaded_bvh_node_array, top_level_node_index_offset);
+        _top_level_bvh.serialize_links(_cpu_threaded_bvh_link_array, top_level_node_index_offset);
+    }
+    return should_serialize_all_objects;
 }
 void Renderer::compute_face_area_of_lights()
 {
@@ -375,12 +772,10 @@ void Renderer::compute_face_area_of_lights()
 }
 void Renderer::launch_mcrt_kernel()
 {
-    size_t available_shared_memory_bytes = rtx_cuda_get_available_shared_memory_bytes();
-
     // 必要なブロック数を計算
     int num_rays_per_pixel = _rt_args->num_rays_per_pixel();
-    int num_threads = _cuda_args->num_threads();
-    int num_rays_per_thread = _cuda_args->num_rays_per_thread();
+    int num_threads = _backend == RTXBackendCUDA ? _cuda_args->num_threads() : _cpu_args->num_threads();
+    int num_rays_per_thread = this->num_rays_per_thread();
     int num_threads_per_pixel = int(ceilf(float(num_rays_per_pixel) / float(num_rays_per_thread)));
     int num_required_blocks = int(ceilf(float(num_threads_per_pixel * _screen_width * _screen_height) / float(num_threads)));
 
@@ -398,9 +793,13 @@ void Renderer::launch_mcrt_kernel()
     args.num_active_texture_units = _texture_mapping_ptr_array.size();
     args.ambient_color = _scene->_ambient_color;
     args.camera_type = _camera->type();
+    glm::mat4 inv_view_matrix = glm::inverse(_camera->_view_matrix);
+    args.inv_view_matrix_a = { inv_view_matrix[0][0], inv_view_matrix[1][0], inv_view_matrix[2][0], inv_view_matrix[3][0] };
+    args.inv_view_matrix_b = { inv_view_matrix[0][1], inv_view_matrix[1][1], inv_view_matrix[2][1], inv_view_matrix[3][1] };
+    args.inv_view_matrix_c = { inv_view_matrix[0][2], inv_view_matrix[1][2], inv_view_matrix[2][2], inv_view_matrix[3][2] };
     args.max_bounce = _rt_args->max_bounce();
     args.num_rays_per_pixel = _rt_args->num_rays_per_pixel();
-    args.num_rays_per_thread = _cuda_args->num_rays_per_thread();
+    args.num_rays_per_thread = num_rays_per_thread;
     args.ray_origin_z = ray_origin_z;
     args.screen_height = _screen_height;
     args.screen_width = _screen_width;
@@ -415,6 +814,42 @@ void Renderer::launch_mcrt_kernel()
     args.curand_seed = _total_frames;
     args.supersampling_enabled = _rt_args->supersampling_enabled();
 
+    if (_backend == RTXBackendCPU) {
+        std::vector<rtxCPUTextureObject> texture_object_array;
+        for (TextureMapping* mapping : _texture_mapping_ptr_array) {
+            texture_object_array.push_back({ mapping->data(), mapping->width(), mapping->height() });
+        }
+        rtx_cpu_launch_mcrt_kernel(
+            _cpu_face_vertex_indices_array.data(),
+            _cpu_vertex_array.data(),
+            _cpu_object_array.data(),
+            _cpu_material_attribute_byte_array.data(),
+            _cpu_threaded_bvh_array.data(),
+            _cpu_threaded_bvh_node_array.data(),
+            _cpu_threaded_bvh_link_array.data(),
+            _cpu_wide_bvh_array.data(),
+            _cpu_wide_bvh_node_array.data(),
+            _cpu_quantized_wide_bvh_node_array.data(),
+            _bvh_node_format,
+            _cpu_triangle_array.data(),
+            _cpu_triangle_group_array.data(),
+            _triangle_format,
+            _cpu_color_mapping_array.data(),
+            _cpu_serialized_uv_coordinate_array.data(),
+            texture_object_array.data(),
+            _lazy_bvh_construction_enabled ? &_lazy_bvh_args : NULL,
+            _cpu_args->ray_packets_enabled(),
+            _cpu_args->wavefront_enabled(),
+            _cpu_args->tile_size(),
+            _cpu_args->tile_order(),
+            _cpu_render_array.data(),
+            args,
+            num_threads);
+        return;
+    }
+
+    size_t available_shared_memory_bytes = rtx_cuda_get_available_shared_memory_bytes();
+
     // アライメントに気をつける
     size_t required_shared_memory_bytes = 0;
     required_shared_memory_bytes += _cpu_face_vertex_indices_array.bytes();
@@ -443,6 +878,7 @@ void Renderer::launch_mcrt_kernel()
             _gpu_material_attribute_byte_array,
             _gpu_threaded_bvh_array,
             _gpu_threaded_bvh_node_array,
+            _gpu_threaded_bvh_link_array,
             _gpu_color_mapping_array,
             _gpu_serialized_uv_coordinate_array,
             _gpu_render_array,
@@ -474,6 +910,7 @@ void Renderer::launch_mcrt_kernel()
             _gpu_material_attribute_byte_array,
             _gpu_threaded_bvh_array,
             _gpu_threaded_bvh_node_array,
+            _gpu_threaded_bvh_link_array,
             _gpu_color_mapping_array,
             _gpu_serialized_uv_coordinate_array,
             _gpu_render_array,
@@ -504,12 +941,10 @@ void Renderer::launch_mcrt_kernel()
 }
 void Renderer::launch_nee_kernel()
 {
-    size_t available_shared_memory_bytes = rtx_cuda_get_available_shared_memory_bytes();
-
     // 必要なブロック数を計算
     int num_rays_per_pixel = _rt_args->num_rays_per_pixel();
-    int num_threads = _cuda_args->num_threads();
-    int num_rays_per_thread = _cuda_args->num_rays_per_thread();
+    int num_threads = _backend == RTXBackendCUDA ? _cuda_args->num_threads() : _cpu_args->num_threads();
+    int num_rays_per_thread = this->num_rays_per_thread();
     int num_threads_per_pixel = int(ceilf(float(num_rays_per_pixel) / float(num_rays_per_thread)));
     int num_required_blocks = int(ceilf(float(num_threads_per_pixel * _screen_width * _screen_height) / float(num_threads)));
 
@@ -527,9 +962,13 @@ void Renderer::launch_nee_kernel()
     args.num_active_texture_units = _texture_mapping_ptr_array.size();
     args.ambient_color = _scene->_ambient_color;
     args.camera_type = _camera->type();
+    glm::mat4 inv_view_matrix = glm::inverse(_camera->_view_matrix);
+    args.inv_view_matrix_a = { inv_view_matrix[0][0], inv_view_matrix[1][0], inv_view_matrix[2][0], inv_view_matrix[3][0] };
+    args.inv_view_matrix_b = { inv_view_matrix[0][1], inv_view_matrix[1][1], inv_view_matrix[2][1], inv_view_matrix[3][1] };
+    args.inv_view_matrix_c = { inv_view_matrix[0][2], inv_view_matrix[1][2], inv_view_matrix[2][2], inv_view_matrix[3][2] };
     args.max_bounce = _rt_args->max_bounce();
     args.num_rays_per_pixel = _rt_args->num_rays_per_pixel();
-    args.num_rays_per_thread = _cuda_args->num_rays_per_thread();
+    args.num_rays_per_thread = num_rays_per_thread;
     args.ray_origin_z = ray_origin_z;
     args.screen_height = _screen_height;
     args.screen_width = _screen_width;
@@ -546,6 +985,43 @@ void Renderer::launch_nee_kernel()
     args.curand_seed = _total_frames;
     args.supersampling_enabled = _rt_args->supersampling_enabled();
 
+    if (_backend == RTXBackendCPU) {
+        std::vector<rtxCPUTextureObject> texture_object_array;
+        for (TextureMapping* mapping : _texture_mapping_ptr_array) {
+            texture_object_array.push_back({ mapping->data(), mapping->width(), mapping->height() });
+        }
+        rtx_cpu_launch_nee_kernel(
+            _cpu_face_vertex_indices_array.data(),
+            _cpu_vertex_array.data(),
+            _cpu_object_array.data(),
+            _cpu_material_attribute_byte_array.data(),
+            _cpu_threaded_bvh_array.data(),
+            _cpu_threaded_bvh_node_array.data(),
+            _cpu_threaded_bvh_link_array.data(),
+            _cpu_wide_bvh_array.data(),
+            _cpu_wide_bvh_node_array.data(),
+            _cpu_quantized_wide_bvh_node_array.data(),
+            _bvh_node_format,
+            _cpu_triangle_array.data(),
+            _cpu_triangle_group_array.data(),
+            _triangle_format,
+            _cpu_color_mapping_array.data(),
+            _cpu_serialized_uv_coordinate_array.data(),
+            texture_object_array.data(),
+            _cpu_light_sampling_table.data(),
+            _lazy_bvh_construction_enabled ? &_lazy_bvh_args : NULL,
+            _cpu_args->ray_packets_enabled(),
+            _cpu_args->wavefront_enabled(),
+            _cpu_args->tile_size(),
+            _cpu_args->tile_order(),
+            _cpu_render_array.data(),
+            args,
+            num_threads);
+        return;
+    }
+
+    size_t available_shared_memory_bytes = rtx_cuda_get_available_shared_memory_bytes();
+
     // アライメントに気をつける
     size_t required_shared_memory_bytes = 0;
     required_shared_memory_bytes += _cpu_face_vertex_indices_array.bytes();
@@ -569,6 +1045,7 @@ void Renderer::launch_nee_kernel()
             _gpu_material_attribute_byte_array,
             _gpu_threaded_bvh_array,
             _gpu_threaded_bvh_node_array,
+            _gpu_threaded_bvh_link_array,
             _gpu_color_mapping_array,
             _gpu_serialized_uv_coordinate_array,
             _gpu_light_sampling_table,
@@ -599,6 +1076,7 @@ void Renderer::launch_nee_kernel()
             _gpu_material_attribute_byte_array,
             _gpu_threaded_bvh_array,
             _gpu_threaded_bvh_node_array,
+            _gpu_threaded_bvh_link_array,
             _gpu_color_mapping_array,
             _gpu_serialized_uv_coordinate_array,
             _gpu_light_sampling_table,
@@ -638,44 +1116,97 @@ void Renderer::render_objects(int height, int width)
     bool geometry_size_changed = false;
     bool should_transfer_to_gpu = false;
     bool should_reset_total_frames = false;
-    if (_scene->updated()) {
+    bool objects_moved = false;
+    if (_scene->structure_updated() || _geometry_bvh_array.empty()) {
         geometry_updated = true;
         geometry_size_changed = true;
         should_transfer_to_gpu = true;
         should_reset_total_frames = true;
-    } else {
-        if (_camera->updated()) {
-            geometry_updated = true;
-            should_transfer_to_gpu = true;
-            should_reset_total_frames = true;
-        }
+    } else if (_scene->transforms_updated() || _scene->vertices_updated()) {
+        // 動いたオブジェクトだけを更新する
+        objects_moved = true;
+        should_transfer_to_gpu = true;
+        should_reset_total_frames = true;
+    }
+    // カメラの変換はカーネルの引数で渡すのでジオメトリは変わらない
+    if (_camera->updated()) {
+        should_reset_total_frames = true;
     }
     if (_screen_height != height || _screen_width != width) {
         should_update_render_buffer = true;
     }
+    // バックエンドか遅延構築の有無を切り替えた場合は全て作り直す
+    const bool lazy_bvh_construction_enabled = _backend == RTXBackendCPU && _cpu_args->lazy_bvh_construction_enabled();
+    if (_backend != _prev_backend || lazy_bvh_construction_enabled != _lazy_bvh_construction_enabled) {
+        geometry_updated = true;
+        geometry_size_changed = true;
+        should_transfer_to_gpu = true;
+        should_reset_total_frames = true;
+        should_update_render_buffer = true;
+    }
+    if (_backend == RTXBackendCUDA && _gpu_texture_objects_allocated == false) {
+        rtx_cuda_malloc_texture_objects();
+        _gpu_texture_objects_allocated = true;
+    }
+    bool use_gpu = _backend == RTXBackendCUDA;
 
     if (geometry_updated) {
-        transform_objects_to_view_space();
+        transform_objects_to_world_space();
     }
 
-    // 現在のカメラ座標系でのBVHを構築
-    // Construct BVH in current camera coordinate system
+    // ワールド座標系でのBVHを構築
+    // Construct BVH in world space
     if (geometry_updated) {
+        if (_backend == RTXBackendCPU) {
+            _bvh_node_format = _cpu_args->bvh_node_format();
+        }
+        _lazy_bvh_construction_enabled = lazy_bvh_construction_enabled;
         construct_bvh();
+    }
+    // 前のフレームで遅延構築したノードを全体の配列に移す
+    // This has to happen before update_moved_objects, which writes refitted nodes into the serialized ranges.
+    if (geometry_updated == false && _lazy_bvh_refined) {
+        serialize_bvh_nodes();
+    }
+    // ノードの形式だけを変えた場合は木はそのままで直列化し直す
+    if (geometry_updated == false && _backend == RTXBackendCPU && _cpu_args->bvh_node_format() != _bvh_node_format) {
+        _bvh_node_format = _cpu_args->bvh_node_format();
+        serialize_bvh_nodes();
+    }
+    bool objects_laid_out_again = false;
+    if (objects_moved) {
+        if (update_moved_objects()) {
+            geometry_size_changed = true;
+            objects_laid_out_again = true;
+        }
+        compute_face_area_of_lights();
+    }
+    if ((geometry_updated || objects_moved) && use_gpu) {
         rtx_cuda_free((void**)&_gpu_threaded_bvh_array);
         rtx_cuda_free((void**)&_gpu_threaded_bvh_node_array);
+        rtx_cuda_free((void**)&_gpu_threaded_bvh_link_array);
         rtx_cuda_malloc((void**)&_gpu_threaded_bvh_array, _cpu_threaded_bvh_array.bytes());
         rtx_cuda_malloc((void**)&_gpu_threaded_bvh_node_array, _cpu_threaded_bvh_node_array.bytes());
+        rtx_cuda_malloc((void**)&_gpu_threaded_bvh_link_array, _cpu_threaded_bvh_link_array.bytes());
         rtx_cuda_memcpy_host_to_device((void*)_gpu_threaded_bvh_array, (void*)_cpu_threaded_bvh_array.data(), _cpu_threaded_bvh_array.bytes());
         rtx_cuda_memcpy_host_to_device((void*)_gpu_threaded_bvh_node_array, (void*)_cpu_threaded_bvh_node_array.data(), _cpu_threaded_bvh_node_array.bytes());
+        rtx_cuda_memcpy_host_to_device((void*)_gpu_threaded_bvh_link_array, (void*)_cpu_threaded_bvh_link_array.data(), _cpu_threaded_bvh_link_array.bytes());
     }
 
     if (geometry_updated) {
         serialize_objects();
         compute_face_area_of_lights();
     }
+    // 三角形は面と頂点を直列化し終えてから作る
+    if (_backend == RTXBackendCPU) {
+        const bool triangle_format_changed = _cpu_args->triangle_format() != _triangle_format;
+        _triangle_format = _cpu_args->triangle_format();
+        if (geometry_updated || objects_laid_out_again || triangle_format_changed) {
+            serialize_triangles();
+        }
+    }
 
-    if (geometry_size_changed) {
+    if (geometry_size_changed && use_gpu) {
         assert(_cpu_face_vertex_indices_array.size() > 0);
         assert(_cpu_vertex_array.size() > 0);
         assert(_cpu_object_array.size() > 0);
@@ -711,7 +1242,7 @@ void Renderer::render_objects(int height, int width)
         }
     }
 
-    if (should_transfer_to_gpu) {
+    if (should_transfer_to_gpu && use_gpu) {
         rtx_cuda_memcpy_host_to_device((void*)_gpu_face_vertex_indices_array, (void*)_cpu_face_vertex_indices_array.data(), _cpu_face_vertex_indices_array.bytes());
         rtx_cuda_memcpy_host_to_device((void*)_gpu_vertex_array, (void*)_cpu_vertex_array.data(), _cpu_vertex_array.bytes());
         rtx_cuda_memcpy_host_to_device((void*)_gpu_object_array, (void*)_cpu_object_array.data(), _cpu_object_array.bytes());
@@ -730,21 +1261,32 @@ void Renderer::render_objects(int height, int width)
     int num_rays_per_pixel = _rt_args->num_rays_per_pixel();
 
     if (should_update_render_buffer) {
-        int num_rays_per_thread = _cuda_args->num_rays_per_thread();
-        int n = int(ceil(float(num_rays_per_pixel) / float(num_rays_per_thread)));
-        int render_buffer_size = height * width * n;
+        int render_buffer_size = height * width * num_threads_per_pixel();
         _cpu_render_array = rtx::array<rtxRGBAPixel>(render_buffer_size);
         _cpu_render_buffer_array = rtx::array<rtxRGBAPixel>(height * width * 3);
         rtx_cuda_free((void**)&_gpu_render_array);
-        rtx_cuda_malloc((void**)&_gpu_render_array, _cpu_render_array.bytes());
+        if (use_gpu) {
+            rtx_cuda_malloc((void**)&_gpu_render_array, _cpu_render_array.bytes());
+        }
         _screen_height = height;
         _screen_width = width;
+    } else if (_cpu_render_array.size() != height * width * num_threads_per_pixel()) {
+        // 1画素あたりの部分和の数だけが変わった場合
+        _cpu_render_array = rtx::array<rtxRGBAPixel>(height * width * num_threads_per_pixel());
+        rtx_cuda_free((void**)&_gpu_render_array);
+        if (use_gpu) {
+            rtx_cuda_malloc((void**)&_gpu_render_array, _cpu_render_array.bytes());
+        }
     }
 
     // auto end = std::chrono::system_clock::now();
     // double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     // printf("preprocessing: %lf msec\n", elapsed);
 
+    if (_lazy_bvh_construction_enabled) {
+        publish_lazy_bvh_nodes();
+    }
+
     // start = std::chrono::system_clock::now();
     if (_rt_args->next_event_estimation_enabled()) {
         launch_nee_kernel();
@@ -756,21 +1298,24 @@ void Renderer::render_objects(int height, int width)
     // printf("kernel: %lf msec\n", elapsed);
 
     // start = std::chrono::system_clock::now();
-    rtx_cuda_memcpy_device_to_host((void*)_cpu_render_array.data(), (void*)_gpu_render_array, _cpu_render_array.bytes());
+    if (use_gpu) {
+        rtx_cuda_memcpy_device_to_host((void*)_cpu_render_array.data(), (void*)_gpu_render_array, _cpu_render_array.bytes());
+    }
     // end = std::chrono::system_clock::now();
     // elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     // printf("memcpy: %lf msec\n", elapsed);
 
     _scene->set_updated(false);
+    _scene->set_vertices_updated(false);
     _camera->set_updated(false);
+    _prev_backend = _backend;
 
     if (should_reset_total_frames) {
         _total_frames = 0;
     }
     _total_frames++;
 
-    int num_rays_per_thread = _cuda_args->num_rays_per_thread();
-    int num_threads_per_pixel = int(ceilf(float(num_rays_per_pixel) / float(num_rays_per_thread)));
+    int num_threads_per_pixel = this->num_threads_per_pixel();
 
     // start = std::chrono::system_clock::now();
     for (int y = 0; y < height; y++) {
@@ -795,8 +1340,29 @@ void Renderer::render_objects(int height, int width)
     // elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     // printf("reduce_sum: %lf msec\n", elapsed);
 }
+int Renderer::num_rays_per_thread()
+{
+    // CPUでは1スレッドが1画素のnum_rays_per_thread本（0なら全て）のレイを担当する
+    if (_backend == RTXBackendCPU) {
+        int num_rays_per_pixel = _rt_args->num_rays_per_pixel();
+        int num_rays_per_thread = _cpu_args->num_rays_per_thread();
+        if (num_rays_per_thread == 0) {
+            return num_rays_per_pixel;
+        }
+        return std::min(num_rays_per_thread, num_rays_per_pixel);
+    }
+    return _cuda_args->num_rays_per_thread();
+}
+int Renderer::num_threads_per_pixel()
+{
+    int num_rays_per_pixel = _rt_args->num_rays_per_pixel();
+    return int(ceilf(float(num_rays_per_pixel) / float(num_rays_per_thread())));
+}
 void Renderer::check_arguments()
 {
+    if (_backend == RTXBackendCPU) {
+        return;
+    }
     if (_rt_args->num_rays_per_pixel() < _cuda_args->num_rays_per_thread()) {
         throw std::runtime_error("rt_args.num_rays_per_pixel must be grater than cuda_args.num_rays_per_thread");
     }
@@ -812,6 +1378,35 @@ void Renderer::render(
     _camera = camera;
     _rt_args = rt_args;
     _cuda_args = cuda_args;
+    _backend = RTXBackendCUDA;
+    check_arguments();
+
+    int height = np_render_buffer.shape(0);
+    int width = np_render_buffer.shape(1);
+    render_objects(height, width);
+
+    auto pixel = np_render_buffer.mutable_unchecked<3>();
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            rtxRGBAPixel pixel_buffer = _cpu_render_buffer_array[y * width * 3 + x * 3];
+            pixel(y, x, 0) = pixel_buffer.r / _total_frames;
+            pixel(y, x, 1) = pixel_buffer.g / _total_frames;
+            pixel(y, x, 2) = pixel_buffer.b / _total_frames;
+        }
+    }
+}
+void Renderer::render(
+    std::shared_ptr<Scene> scene,
+    std::shared_ptr<Camera> camera,
+    std::shared_ptr<RayTracingArguments> rt_args,
+    std::shared_ptr<CPUKernelLaunchArguments> cpu_args,
+    py::array_t<float, py::array::c_style> np_render_buffer)
+{
+    _scene = scene;
+    _camera = camera;
+    _rt_args = rt_args;
+    _cpu_args = cpu_args;
+    _backend = RTXBackendCPU;
     check_arguments();
 
     int height = np_render_buffer.shape(0);
@@ -844,6 +1439,7 @@ void Renderer::render(
     _camera = camera;
     _rt_args = rt_args;
     _cuda_args = cuda_args;
+    _backend = RTXBackendCUDA;
 
     if (channels != 3) {
         throw std::runtime_error("channels != 3");
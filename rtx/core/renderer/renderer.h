@@ -5,12 +5,16 @@
 #include "../header/glm.h"
 #include "../header/struct.h"
 #include "../mapping/texture.h"
+#include "arguments/cpu_kernel.h"
 #include "arguments/cuda_kernel.h"
 #include "arguments/ray_tracing.h"
 #include "bvh/bvh.h"
+#include "bvh/cache.h"
 #include <array>
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <pybind11/numpy.h>
 #include <random>
 
@@ -24,6 +28,16 @@ private:
     rtx::array<rtxMaterialAttributeByte> _cpu_material_attribute_byte_array;
     rtx::array<rtxThreadedBVH> _cpu_threaded_bvh_array;
     rtx::array<rtxThreadedBVHNode> _cpu_threaded_bvh_node_array;
+    // 8つの象限ごとのhit/missリンク（ノードごとに8つ）
+    rtx::array<rtxThreadedBVHLink> _cpu_threaded_bvh_link_array;
+    // CPUのカーネルはオブジェクトごとのBVHを多分岐BVHで辿る
+    rtx::array<rtxCPUWideBVH> _cpu_wide_bvh_array;
+    rtx::array<rtxCPUWideBVHNode> _cpu_wide_bvh_node_array;
+    rtx::array<rtxCPUQuantizedWideBVHNode> _cpu_quantized_wide_bvh_node_array;
+    // RTXTriangleFormatPrecomputedの時だけ使う（面の配列と同じ番号）
+    rtx::array<rtxCPUTriangle> _cpu_triangle_array;
+    // RTXTriangleFormatGroupedの時だけ使う（rtx_cpu_triangle_group_kernelの幅ずつ成分ごとにまとめる）
+    rtx::array<float> _cpu_triangle_group_array;
     rtx::array<rtxRGBAPixel> _cpu_render_array;
     rtx::array<rtxRGBAPixel> _cpu_render_buffer_array;
     rtx::array<int> _cpu_light_sampling_table;
@@ -37,6 +51,7 @@ private:
     rtxMaterialAttributeByte* _gpu_material_attribute_byte_array;
     rtxThreadedBVH* _gpu_threaded_bvh_array;
     rtxThreadedBVHNode* _gpu_threaded_bvh_node_array;
+    rtxThreadedBVHLink* _gpu_threaded_bvh_link_array;
     rtxRGBAPixel* _gpu_render_array;
     int* _gpu_light_sampling_table;
     rtxRGBAColor* _gpu_color_mapping_array;
@@ -46,19 +61,56 @@ private:
     std::shared_ptr<Camera> _camera;
     std::shared_ptr<RayTracingArguments> _rt_args;
     std::shared_ptr<CUDAKernelLaunchArguments> _cuda_args;
+    std::shared_ptr<CPUKernelLaunchArguments> _cpu_args;
     std::vector<std::shared_ptr<Object>> _transformed_object_array;
+    // 各オブジェクトのワールド変換行列（インスタンス変換）
+    std::vector<glm::mat4> _instance_matrix_array;
     std::vector<std::shared_ptr<BVH>> _geometry_bvh_array;
+    TopLevelBVH _top_level_bvh;
+    // 空でなければ構築したメッシュのBVHをディスクに保存して使い回す
+    BVHCache _bvh_cache;
     std::vector<TextureMapping*> _texture_mapping_ptr_array;
 
     float _total_light_face_area;
     int _screen_height;
     int _screen_width;
     int _total_frames;
+    RTXBackend _backend;
+    RTXBackend _prev_backend;
+    // 直列化済みの多分岐BVHのノードの形式
+    RTXBVHNodeFormat _bvh_node_format;
+    // 直列化済みの三角形の形式
+    RTXTriangleFormat _triangle_format;
+    bool _gpu_texture_objects_allocated;
+    // オブジェクトのBVHをレイが当たってから構築するか（CPUのみ）
+    bool _lazy_bvh_construction_enabled;
+    // カーネルに渡すオブジェクトごとの多分岐BVHのノードの配列（粗い葉のままならNULL）
+    std::unique_ptr<std::atomic<const void*>[]> _lazy_bvh_node_array_array;
+    std::unique_ptr<std::mutex[]> _lazy_bvh_mutex_array;
+    int _lazy_bvh_table_size;
+    // カーネルの実行中に構築したノード
+    // They are folded into the serialized arrays at the start of the next frame.
+    std::vector<std::unique_ptr<rtx::array<rtxCPUWideBVHNode>>> _lazy_wide_bvh_node_array_array;
+    std::vector<std::unique_ptr<rtx::array<rtxCPUQuantizedWideBVHNode>>> _lazy_quantized_wide_bvh_node_array_array;
+    std::atomic<bool> _lazy_bvh_refined;
+    rtxCPULazyBVHArguments _lazy_bvh_args;
 
     void check_arguments();
     void construct_bvh();
-    void transform_objects_to_view_space();
-    void transform_objects_to_view_space_parallel();
+    void serialize_bvh_nodes();
+    void serialize_wide_bvh_nodes(int object_index);
+    void serialize_triangles();
+    // parallelがfalseなら呼び出したスレッドだけで作る（カーネルの並列領域の中から呼ぶ場合）
+    void serialize_triangles(int object_index, bool parallel);
+    // 遅延構築でBVHを粗い葉にしておくオブジェクトか
+    bool is_lazy_bvh_object(int object_index);
+    void publish_lazy_bvh_nodes();
+    const void* build_lazy_object_bvh(int object_index);
+    static const void* build_lazy_object_bvh(void* context, int object_index);
+    bool update_moved_objects();
+    void collect_instances(std::vector<std::shared_ptr<Object>>& source_object_array, std::vector<char>& moved_array);
+    void transform_objects_to_world_space();
+    void transform_objects_to_world_space_parallel();
     void transform_geometries_to_view_space();
     void transform_lights_to_view_space();
     void serialize_geometries();
@@ -70,17 +122,30 @@ private:
     void serialize_rays(int height, int width);
     void compute_face_area_of_lights();
     void render_objects(int height, int width);
+    int num_rays_per_thread();
+    int num_threads_per_pixel();
     void launch_mcrt_kernel();
     void launch_nee_kernel();
 
 public:
     Renderer();
     ~Renderer();
+    void set_bvh_cache_directory(std::string directory);
+    std::string bvh_cache_directory();
+    int bvh_cache_hits();
+    int bvh_cache_misses();
+    // 最後に描画したシーンの各オブジェクトのBVHの統計（直列化の順）
+    std::vector<bvh::Stats> bvh_stats();
     void render(std::shared_ptr<Scene> scene,
         std::shared_ptr<Camera> camera,
         std::shared_ptr<RayTracingArguments> rt_args,
         std::shared_ptr<CUDAKernelLaunchArguments> cuda_args,
         pybind11::array_t<float, pybind11::array::c_style> array);
+    void render(std::shared_ptr<Scene> scene,
+        std::shared_ptr<Camera> camera,
+        std::shared_ptr<RayTracingArguments> rt_args,
+        std::shared_ptr<CPUKernelLaunchArguments> cpu_args,
+        pybind11::array_t<float, pybind11::array::c_style> array);
     void render(std::shared_ptr<Scene> scene,
         std::shared_ptr<Camera> camera,
         std::shared_ptr<RayTracingArguments> rt_args,
@@ -17,11 +17,13 @@
 #include "../core/material/emissive.h"
 #include "../core/material/lambert.h"
 #include "../core/material/oren_nayar.h"
+#include "../core/renderer/arguments/cpu_kernel.h"
 #include "../core/renderer/arguments/cuda_kernel.h"
 #include "../core/renderer/arguments/ray_tracing.h"
 #include "../core/renderer/header/bridge.h"
 #include "../core/renderer/renderer.h"
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 
 namespace py = pybind11;
 using namespace rtx;
@@ -55,11 +57,42 @@ PYBIND11_MODULE(rtx, module)
         .def("num_triangles", &Scene::num_triangles);
 
     // Geometries
+    py::enum_<RTXBVHBuilder>(module, "BVHBuilder")
+        .value("Median", RTXBVHBuilderMedian)
+        .value("BinnedSAH", RTXBVHBuilderBinnedSAH)
+        .value("SBVH", RTXBVHBuilderSBVH)
+        .value("Auto", RTXBVHBuilderAuto);
+    py::enum_<RTXBVHNodeFormat>(module, "BVHNodeFormat")
+        .value("Full", RTXBVHNodeFormatFull)
+        .value("Quantized", RTXBVHNodeFormatQuantized);
+    py::enum_<RTXTriangleFormat>(module, "TriangleFormat")
+        .value("Indexed", RTXTriangleFormatIndexed)
+        .value("Precomputed", RTXTriangleFormatPrecomputed)
+        .value("Grouped", RTXTriangleFormatGrouped);
+    py::enum_<RTXBVHNodeLayout>(module, "BVHNodeLayout")
+        .value("DepthFirst", RTXBVHNodeLayoutDepthFirst)
+        .value("VanEmdeBoas", RTXBVHNodeLayoutVanEmdeBoas)
+        .value("SubtreeClusters", RTXBVHNodeLayoutSubtreeClusters);
+    py::enum_<RTXTileOrder>(module, "TileOrder")
+        .value("Scanline", RTXTileOrderScanline)
+        .value("Morton", RTXTileOrderMorton)
+        .value("Spiral", RTXTileOrderSpiral);
     py::class_<SphereGeometry, Geometry, Shape, std::shared_ptr<SphereGeometry>>(module, "SphereGeometry")
         .def(py::init<float>(), py::arg("radius"));
     py::class_<StandardGeometry, Geometry, Shape, std::shared_ptr<StandardGeometry>>(module, "StandardGeometry")
         .def(py::init<py::array_t<int, py::array::c_style>, py::array_t<float, py::array::c_style>>(), py::arg("face_vertex_indeces"), py::arg("vertices"))
-        .def(py::init<py::array_t<int, py::array::c_style>, py::array_t<float, py::array::c_style>, int>(), py::arg("face_vertex_indeces"), py::arg("vertices"), py::arg("bvh_max_triangles_per_node"));
+        .def(py::init<py::array_t<int, py::array::c_style>, py::array_t<float, py::array::c_style>, int>(), py::arg("face_vertex_indeces"), py::arg("vertices"), py::arg("bvh_max_triangles_per_node"))
+        .def("set_bvh_max_triangles_per_node", &StandardGeometry::set_bvh_max_triangles_per_node, py::arg("bvh_max_triangles_per_node"))
+        .def("set_bvh_builder", [](StandardGeometry& geometry, RTXBVHBuilder builder) { geometry.set_bvh_builder(builder); }, py::arg("builder"))
+        .def("set_bvh_sah_traversal_cost", &StandardGeometry::set_bvh_sah_traversal_cost, py::arg("traversal_cost"))
+        .def("set_bvh_refit_rebuild_threshold", &StandardGeometry::set_bvh_refit_rebuild_threshold, py::arg("threshold"))
+        .def("set_bvh_spatial_split_budget", &StandardGeometry::set_bvh_spatial_split_budget, py::arg("budget"))
+        .def("set_bvh_node_layout", [](StandardGeometry& geometry, RTXBVHNodeLayout layout) { geometry.set_bvh_node_layout(layout); }, py::arg("layout"))
+        .def("set_bvh_node_cluster_bytes", &StandardGeometry::set_bvh_node_cluster_bytes, py::arg("cluster_bytes"))
+        .def("set_bvh_treelet_iterations", &StandardGeometry::set_bvh_treelet_iterations, py::arg("iterations"))
+        .def("set_bvh_treelet_time_budget_ms", &StandardGeometry::set_bvh_treelet_time_budget_ms, py::arg("time_budget_ms"))
+        .def("update_vertices", (void (StandardGeometry::*)(py::array_t<float, py::array::c_style>)) & StandardGeometry::update_vertices, py::arg("vertices"))
+        .def("update_vertices", (void (StandardGeometry::*)(py::array_t<float, py::array::c_style>, int)) & StandardGeometry::update_vertices, py::arg("vertices"), py::arg("offset"));
     py::class_<PlainGeometry, Geometry, Shape, std::shared_ptr<PlainGeometry>>(module, "PlainGeometry")
         .def(py::init<float, float>(), py::arg("width"), py::arg("height"));
     py::class_<BoxGeometry, Geometry, Shape, std::shared_ptr<BoxGeometry>>(module, "BoxGeometry")
@@ -99,6 +132,17 @@ PYBIND11_MODULE(rtx, module)
         .def(py::init<>())
         .def_property("num_threads", &CUDAKernelLaunchArguments::num_threads, &CUDAKernelLaunchArguments::set_num_threads)
         .def_property("num_rays_per_thread", &CUDAKernelLaunchArguments::num_rays_per_thread, &CUDAKernelLaunchArguments::set_num_rays_per_thread);
+    py::class_<CPUKernelLaunchArguments, std::shared_ptr<CPUKernelLaunchArguments>>(module, "CPUKernelLaunchArguments")
+        .def(py::init<>())
+        .def_property("num_threads", &CPUKernelLaunchArguments::num_threads, &CPUKernelLaunchArguments::set_num_threads)
+        .def_property("bvh_node_format", &CPUKernelLaunchArguments::bvh_node_format, &CPUKernelLaunchArguments::set_bvh_node_format)
+        .def_property("triangle_format", &CPUKernelLaunchArguments::triangle_format, &CPUKernelLaunchArguments::set_triangle_format)
+        .def_property("lazy_bvh_construction_enabled", &CPUKernelLaunchArguments::lazy_bvh_construction_enabled, &CPUKernelLaunchArguments::set_lazy_bvh_construction_enabled)
+        .def_property("ray_packets_enabled", &CPUKernelLaunchArguments::ray_packets_enabled, &CPUKernelLaunchArguments::set_ray_packets_enabled)
+        .def_property("wavefront_enabled", &CPUKernelLaunchArguments::wavefront_enabled, &CPUKernelLaunchArguments::set_wavefront_enabled)
+        .def_property("tile_size", &CPUKernelLaunchArguments::tile_size, &CPUKernelLaunchArguments::set_tile_size)
+        .def_property("tile_order", &CPUKernelLaunchArguments::tile_order, &CPUKernelLaunchArguments::set_tile_order)
+        .def_property("num_rays_per_thread", &CPUKernelLaunchArguments::num_rays_per_thread, &CPUKernelLaunchArguments::set_num_rays_per_thread);
 
     // Cameras
     py::class_<PerspectiveCamera, Camera, std::shared_ptr<PerspectiveCamera>>(module, "PerspectiveCamera")
@@ -114,7 +158,35 @@ PYBIND11_MODULE(rtx, module)
 
     py::class_<Renderer, std::shared_ptr<Renderer>>(module, "Renderer")
         .def(py::init<>())
-        .def("render", (void (Renderer::*)(std::shared_ptr<Scene>, std::shared_ptr<Camera>, std::shared_ptr<RayTracingArguments>, std::shared_ptr<CUDAKernelLaunchArguments>, py::array_t<float, py::array::c_style>)) & Renderer::render, py::arg("scene"), py::arg("camera"), py::arg("rt_args"), py::arg("cuda_args"), py::arg("render_buffer"));
+        .def_property("bvh_cache_directory", &Renderer::bvh_cache_directory, &Renderer::set_bvh_cache_directory)
+        .def_property_readonly("bvh_cache_hits", &Renderer::bvh_cache_hits)
+        .def_property_readonly("bvh_cache_misses", &Renderer::bvh_cache_misses)
+        .def("bvh_stats", &Renderer::bvh_stats)
+        .def("render", (void (Renderer::*)(std::shared_ptr<Scene>, std::shared_ptr<Camera>, std::shared_ptr<RayTracingArguments>, std::shared_ptr<CUDAKernelLaunchArguments>, py::array_t<float, py::array::c_style>)) & Renderer::render, py::arg("scene"), py::arg("camera"), py::arg("rt_args"), py::arg("cuda_args"), py::arg("render_buffer"))
+        .def("render", (void (Renderer::*)(std::shared_ptr<Scene>, std::shared_ptr<Camera>, std::shared_ptr<RayTracingArguments>, std::shared_ptr<CPUKernelLaunchArguments>, py::array_t<float, py::array::c_style>)) & Renderer::render, py::arg("scene"), py::arg("camera"), py::arg("rt_args"), py::arg("cpu_args"), py::arg("render_buffer"));
+
+    py::class_<bvh::Stats>(module, "BVHStats")
+        .def_readonly("builder", &bvh::Stats::builder)
+        .def_readonly("max_triangles_per_node", &bvh::Stats::max_triangles_per_node)
+        .def_readonly("num_faces", &bvh::Stats::num_faces)
+        .def_readonly("num_face_references", &bvh::Stats::num_face_references)
+        .def_readonly("num_nodes", &bvh::Stats::num_nodes)
+        .def_readonly("num_leaves", &bvh::Stats::num_leaves)
+        .def_readonly("num_wide_nodes", &bvh::Stats::num_wide_nodes)
+        .def_readonly("max_depth", &bvh::Stats::max_depth)
+        .def_readonly("average_leaf_depth", &bvh::Stats::average_leaf_depth)
+        .def_readonly("average_leaf_size", &bvh::Stats::average_leaf_size)
+        .def_readonly("leaf_size_histogram", &bvh::Stats::leaf_size_histogram)
+        .def_readonly("sah_cost", &bvh::Stats::sah_cost)
+        .def_readonly("overlap", &bvh::Stats::overlap)
+        .def_readonly("empty_space", &bvh::Stats::empty_space)
+        .def_readonly("build_time_ms", &bvh::Stats::build_time_ms)
+        .def_readonly("threaded_node_bytes", &bvh::Stats::threaded_node_bytes)
+        .def_readonly("wide_node_bytes", &bvh::Stats::wide_node_bytes)
+        .def_readonly("quantized_wide_node_bytes", &bvh::Stats::quantized_wide_node_bytes)
+        .def_readonly("face_bytes", &bvh::Stats::face_bytes);
+
+    module.attr("BVH_AUTO_TRIANGLES_PER_NODE") = BVH_AUTO_TRIANGLES_PER_NODE;
 
     // Utils
     module.def("get_device_count", &rtx_get_device_count);
@@ -0,0 +1,892 @@
+// CPUバックエンドの回帰テスト
+// Renders small procedural scenes under settings that must not change the image and checks the BVH invariants the
+// kernels rely on. Run `make check` in this directory; the program prints every failed check and exits with 1.
+#include "../rtx/core/camera/perspective.h"
+#include "../rtx/core/class/object.h"
+#include "../rtx/core/class/scene.h"
+#include "../rtx/core/geometry/box.h"
+#include "../rtx/core/geometry/sphere.h"
+#include "../rtx/core/geometry/standard.h"
+#include "../rtx/core/mapping/solid_color.h"
+#include "../rtx/core/material/emissive.h"
+#include "../rtx/core/material/lambert.h"
+#include "../rtx/core/renderer/arguments/cpu_kernel.h"
+#include "../rtx/core/renderer/arguments/ray_tracing.h"
+#include "../rtx/core/renderer/bvh/bvh.h"
+#include "../rtx/core/renderer/header/cpu_triangle_group.h"
+#include "../rtx/core/renderer/renderer.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <pybind11/embed.h>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace rtx;
+namespace py = pybind11;
+
+namespace {
+int num_checks = 0;
+int num_failures = 0;
+
+void expect(bool condition, const std::string& message)
+{
+    num_checks++;
+    if (condition == false) {
+        num_failures++;
+        printf("FAIL: %s\n", message.c_str());
+    }
+}
+
+// メッシュのBVHの設定
+struct MeshSettings {
+    int builder = BVH_DEFAULT_BUILDER;
+    int node_layout = BVH_DEFAULT_NODE_LAYOUT;
+    int max_triangles_per_node = BVH_DEFAULT_TRIANGLES_PER_NODE;
+    int treelet_iterations = 0;
+};
+void apply(const MeshSettings& settings, StandardGeometry& geometry)
+{
+    geometry.set_bvh_builder(settings.builder);
+    geometry.set_bvh_node_layout(settings.node_layout);
+    geometry.set_bvh_max_triangles_per_node(settings.max_triangles_per_node);
+    geometry.set_bvh_treelet_iterations(settings.treelet_iterations);
+}
+
+// 表面に凹凸のある球
+std::shared_ptr<StandardGeometry> make_bumpy_sphere(int num_rings, int num_segments, float radius, const MeshSettings& settings)
+{
+    auto geometry = std::make_shared<StandardGeometry>();
+    for (int ring = 0; ring <= num_rings; ring++) {
+        const float theta = M_PI * ring / num_rings;
+        for (int segment = 0; segment < num_segments; segment++) {
+            const float phi = 2.0f * M_PI * segment / num_segments;
+            const float r = radius * (1.0f + 0.08f * sinf(5.0f * theta) * cosf(7.0f * phi));
+            geometry->add_vertex(glm::vec3f(r * sinf(theta) * cosf(phi), r * cosf(theta), r * sinf(theta) * sinf(phi)));
+        }
+    }
+    for (int ring = 0; ring < num_rings; ring++) {
+        for (int segment = 0; segment < num_segments; segment++) {
+            const int a = ring * num_segments + segment;
+            const int b = ring * num_segments + (segment + 1) % num_segments;
+            const int c = a + num_segments;
+            const int d = b + num_segments;
+            geometry->add_face(glm::vec3i(a, c, b));
+            geometry->add_face(glm::vec3i(b, c, d));
+        }
+    }
+    apply(settings, *geometry);
+    return geometry;
+}
+
+// 斜めに長く伸びた細い三角形の集まり（空間分割で参照が複製される）
+std::shared_ptr<StandardGeometry> make_slivers(int num_faces, const MeshSettings& settings)
+{
+    auto geometry = std::make_shared<StandardGeometry>();
+    uint32_t state = 12345;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) / float(1 << 24);
+    };
+    for (int n = 0; n < num_faces; n++) {
+        const glm::vec3f a(random() * 2.0f - 1.0f, random() * 2.0f - 1.0f, random() * 2.0f - 1.0f);
+        glm::vec3f d(random() - 0.5f, random() - 0.5f, random() - 0.5f);
+        d = glm::normalize(d) * 0.8f;
+        const glm::vec3f w = glm::normalize(glm::cross(d, glm::vec3f(0.3f, 1.0f, 0.2f))) * 0.03f;
+        const int base = geometry->num_vertices();
+        geometry->add_vertex(a - d);
+        geometry->add_vertex(a + d);
+        geometry->add_vertex(a - d + w);
+        geometry->add_face(glm::vec3i(base, base + 1, base + 2));
+    }
+    apply(settings, *geometry);
+    return geometry;
+}
+
+// 2つのメッシュ、床、球と光源からなるシーン
+struct TestScene {
+    std::shared_ptr<Scene> scene;
+    std::vector<std::shared_ptr<StandardGeometry>> meshes;
+};
+TestScene make_scene(const MeshSettings& settings)
+{
+    TestScene test_scene;
+    test_scene.scene = std::make_shared<Scene>(py::make_tuple(0.0f, 0.0f, 0.0f));
+    float white[3] = { 1.0f, 1.0f, 1.0f };
+    float red[3] = { 1.0f, 0.3f, 0.3f };
+    auto lambert = std::make_shared<LambertMaterial>(0.8f);
+    auto white_mapping = std::make_shared<SolidColorMapping>(white);
+    auto red_mapping = std::make_shared<SolidColorMapping>(red);
+
+    auto sphere_mesh = make_bumpy_sphere(48, 64, 0.6f, settings);
+    float sphere_position[3] = { -0.5f, -0.4f, 0.0f };
+    sphere_mesh->set_position(sphere_position);
+    test_scene.scene->add(std::make_shared<Object>(sphere_mesh, lambert, white_mapping));
+    test_scene.meshes.push_back(sphere_mesh);
+
+    auto slivers = make_slivers(600, settings);
+    float sliver_position[3] = { 0.6f, -0.3f, -0.6f };
+    float sliver_scale[3] = { 0.5f, 0.5f, 0.5f };
+    slivers->set_position(sliver_position);
+    slivers->set_scale(sliver_scale);
+    test_scene.scene->add(std::make_shared<Object>(slivers, lambert, red_mapping));
+    test_scene.meshes.push_back(slivers);
+
+    auto floor = std::make_shared<BoxGeometry>(6.0f, 0.2f, 6.0f);
+    float floor_position[3] = { 0.0f, -1.1f, 0.0f };
+    floor->set_position(floor_position);
+    test_scene.scene->add(std::make_shared<Object>(floor, lambert, white_mapping));
+
+    auto ball = std::make_shared<SphereGeometry>(0.2f);
+    float ball_position[3] = { 0.4f, 0.3f, 0.5f };
+    ball->set_position(ball_position);
+    test_scene.scene->add(std::make_shared<Object>(ball, lambert, red_mapping));
+
+    auto light = std::make_shared<SphereGeometry>(0.4f);
+    float light_position[3] = { 0.0f, 1.6f, 0.5f };
+    light->set_position(light_position);
+    test_scene.scene->add(std::make_shared<Object>(light, std::make_shared<EmissiveMaterial>(3.0f), white_mapping));
+    return test_scene;
+}
+
+struct Image {
+    std::vector<float> pixels;
+};
+const int IMAGE_SIZE = 48;
+
+Image render(Renderer& renderer, TestScene& test_scene, const std::shared_ptr<CPUKernelLaunchArguments>& cpu_args, bool next_event_estimation_enabled, int num_rays_per_pixel = 8)
+{
+    float eye[3] = { 0.0f, 0.3f, 3.0f };
+    float center[3] = { 0.0f, -0.2f, 0.0f };
+    float up[3] = { 0.0f, 1.0f, 0.0f };
+    auto camera = std::make_shared<PerspectiveCamera>(eye, center, up, 1.0f, 1.0f, 1.0f, 1.0f);
+    auto rt_args = std::make_shared<RayTracingArguments>();
+    rt_args->set_num_rays_per_pixel(num_rays_per_pixel);
+    rt_args->set_max_bounce(4);
+    rt_args->set_next_event_estimation_enabled(next_event_estimation_enabled);
+    py::array_t<float, py::array::c_style> buffer({ IMAGE_SIZE, IMAGE_SIZE, 3 });
+    renderer.render(test_scene.scene, camera, rt_args, cpu_args, buffer);
+    Image image;
+    image.pixels.assign(buffer.data(), buffer.data() + buffer.size());
+    return image;
+}
+Image render(TestScene& test_scene, const std::shared_ptr<CPUKernelLaunchArguments>& cpu_args, bool next_event_estimation_enabled, int num_rays_per_pixel = 8)
+{
+    Renderer renderer;
+    return render(renderer, test_scene, cpu_args, next_event_estimation_enabled, num_rays_per_pixel);
+}
+
+// 同じ交点を返す設定の間ではビット単位で一致する
+void expect_identical(const Image& expected, const Image& actual, const std::string& name)
+{
+    expect(expected.pixels.size() == actual.pixels.size()
+            && memcmp(expected.pixels.data(), actual.pixels.data(), expected.pixels.size() * sizeof(float)) == 0,
+        name + ": image differs from the reference");
+}
+// 木の形が変わると面の境界で別の面が選ばれ、その画素のサンプルだけが変わる
+// Allows a small fraction of differing pixels and a small change of the mean.
+void expect_close(const Image& expected, const Image& actual, const std::string& name)
+{
+    if (expected.pixels.size() != actual.pixels.size()) {
+        expect(false, name + ": image size differs from the reference");
+        return;
+    }
+    const int num_values = expected.pixels.size();
+    int num_differing_values = 0;
+    double expected_sum = 0.0;
+    double actual_sum = 0.0;
+    for (int n = 0; n < num_values; n++) {
+        if (fabsf(expected.pixels[n] - actual.pixels[n]) > 1e-4f) {
+            num_differing_values++;
+        }
+        expected_sum += expected.pixels[n];
+        actual_sum += actual.pixels[n];
+    }
+    char message[256];
+    snprintf(message, sizeof(message), "%s: %d of %d values differ, mean %f vs %f", name.c_str(), num_differing_values, num_values, expected_sum / num_values, actual_sum / num_values);
+    expect(num_differing_values <= num_values / 20 && fabs(expected_sum - actual_sum) <= 0.01 * expected_sum, message);
+}
+double mean_of(const Image& image)
+{
+    double sum = 0.0;
+    for (float value : image.pixels) {
+        sum += value;
+    }
+    return sum / image.pixels.size();
+}
+std::shared_ptr<CPUKernelLaunchArguments> default_cpu_args()
+{
+    return std::make_shared<CPUKernelLaunchArguments>();
+}
+
+// 範囲外の設定は描画する前に例外で弾く
+template <typename Function>
+void expect_runtime_error(Function function, const std::string& name)
+{
+    bool thrown = false;
+    try {
+        function();
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    expect(thrown, name + " should throw std::runtime_error");
+}
+void test_argument_checks()
+{
+    auto cpu_args = default_cpu_args();
+    const int num_threads = cpu_args->num_threads();
+    expect_runtime_error([&]() { cpu_args->set_num_threads(0); }, "set_num_threads(0)");
+    expect_runtime_error([&]() { cpu_args->set_num_threads(-1); }, "set_num_threads(-1)");
+    expect(cpu_args->num_threads() == num_threads, "a rejected thread count should leave num_threads unchanged");
+    expect_runtime_error([&]() { cpu_args->set_tile_size(0); }, "set_tile_size(0)");
+    expect_runtime_error([&]() { cpu_args->set_num_rays_per_thread(-1); }, "set_num_rays_per_thread(-1)");
+}
+
+// 三角形とノードの形式は交点を変えない
+void test_kernel_formats()
+{
+    for (int nee = 0; nee < 2; nee++) {
+        const std::string suffix = nee ? " (nee)" : " (mcrt)";
+        TestScene test_scene = make_scene(MeshSettings());
+        const Image reference = render(test_scene, default_cpu_args(), nee);
+
+        auto cpu_args = default_cpu_args();
+        cpu_args->set_triangle_format(RTXTriangleFormatPrecomputed);
+        expect_identical(reference, render(test_scene, cpu_args, nee), "precomputed triangles" + suffix);
+
+        cpu_args = default_cpu_args();
+        cpu_args->set_bvh_node_format(RTXBVHNodeFormatQuantized);
+        expect_identical(reference, render(test_scene, cpu_args, nee), "quantized nodes" + suffix);
+    }
+}
+
+// まとまりのカーネルは葉の面を1枚ずつ判定した場合と同じ面と距離を返す
+// Leaf ranges start and end at any lane, so the lanes of the neighbouring faces, which the rays also hit, must be
+// masked. Every fourth face repeats the previous one, so ties must go to the lower index.
+void test_triangle_group_kernel()
+{
+    const rtxCPUTriangleGroupKernel& kernel = rtx_cpu_triangle_group_kernel();
+    const int num_faces = 67;
+    const int num_groups = (num_faces + kernel.width - 1) / kernel.width;
+    std::vector<float> group_array(num_groups * RTX_CPU_TRIANGLE_GROUP_NUM_COMPONENTS * kernel.width, 0.0f);
+    uint32_t state = 54321;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) / float(1 << 24);
+    };
+    // 原点の前にある、裏向きのものも混ざった三角形
+    rtxCPUTriangle triangle = {};
+    for (int face_index = 0; face_index < num_faces; face_index++) {
+        if (face_index % 4 != 3) {
+            const glm::vec3f va(random() - 0.5f, random() - 0.5f, -1.0f - 2.0f * random());
+            const glm::vec3f vb = va + glm::vec3f(random() - 0.2f, random() - 0.5f, 0.2f * (random() - 0.5f));
+            const glm::vec3f vc = va + glm::vec3f(random() - 0.5f, random() - 0.2f, 0.2f * (random() - 0.5f));
+            const glm::vec3f edge_ba = vb - va;
+            const glm::vec3f edge_ca = vc - va;
+            const glm::vec3f normal = glm::normalize(glm::cross(edge_ba, edge_ca));
+            triangle = { va.x, va.y, va.z, edge_ba.x, edge_ba.y, edge_ba.z, edge_ca.x, edge_ca.y, edge_ca.z, normal.x, normal.y, normal.z };
+        }
+        rtx_cpu_store_triangle_in_group(group_array.data(), kernel.width, face_index, triangle);
+    }
+
+    int num_ranges = 0;
+    int num_hits = 0;
+    std::string first_mismatch;
+    for (int ray_index = 0; ray_index < 64; ray_index++) {
+        rtxCPURay ray;
+        ray.origin = { 0.0f, 0.0f, 0.0f, 1.0f };
+        const glm::vec3f direction = glm::normalize(glm::vec3f(0.6f * (random() - 0.5f), 0.6f * (random() - 0.5f), -1.0f));
+        ray.direction = { direction.x, direction.y, direction.z, 1.0f };
+        for (int face_index_start = 0; face_index_start < num_faces; face_index_start += 3) {
+            const int range_num_faces = 1 + (face_index_start * 7 + ray_index) % min(19, num_faces - face_index_start);
+            float expected_distance = ray_index % 2 ? FLT_MAX : 1.8f;
+            int expected_face_index = -1;
+            for (int m = 0; m < range_num_faces; m++) {
+                if (kernel.intersect(group_array.data(), face_index_start + m, 1, ray, expected_distance) != -1) {
+                    expected_face_index = face_index_start + m;
+                }
+            }
+            float min_distance = ray_index % 2 ? FLT_MAX : 1.8f;
+            const int face_index = kernel.intersect(group_array.data(), face_index_start, range_num_faces, ray, min_distance);
+            if ((face_index != expected_face_index || memcmp(&min_distance, &expected_distance, sizeof(float)) != 0) && first_mismatch.empty()) {
+                first_mismatch = "faces " + std::to_string(face_index_start) + " to " + std::to_string(face_index_start + range_num_faces - 1)
+                    + " for ray " + std::to_string(ray_index) + " returned " + std::to_string(face_index) + " instead of " + std::to_string(expected_face_index);
+            }
+            num_ranges++;
+            num_hits += expected_face_index != -1;
+        }
+    }
+    expect(first_mismatch.empty(), "triangle group kernel of width " + std::to_string(kernel.width) + ": " + first_mismatch);
+    expect(num_hits > 0 && num_hits < num_ranges, "the triangle group kernel test should hit the faces of some ranges only");
+}
+
+// まとまりにした三角形は面の番号で並べた三角形と同じ交点を返す
+void test_triangle_groups()
+{
+    test_triangle_group_kernel();
+    for (int nee = 0; nee < 2; nee++) {
+        const std::string suffix = nee ? " (nee)" : " (mcrt)";
+        TestScene test_scene = make_scene(MeshSettings());
+        const Image reference = render(test_scene, default_cpu_args(), nee);
+
+        auto cpu_args = default_cpu_args();
+        cpu_args->set_triangle_format(RTXTriangleFormatGrouped);
+        expect_identical(reference, render(test_scene, cpu_args, nee), "grouped triangles" + suffix);
+        // パケットを使わなければ一次レイもまとまりのカーネルで判定する
+        cpu_args->set_ray_packets_enabled(false);
+        expect_identical(reference, render(test_scene, cpu_args, nee), "grouped triangles without ray packets" + suffix);
+
+        cpu_args = default_cpu_args();
+        cpu_args->set_bvh_node_format(RTXBVHNodeFormatQuantized);
+        cpu_args->set_triangle_format(RTXTriangleFormatGrouped);
+        expect_identical(reference, render(test_scene, cpu_args, nee), "quantized nodes and grouped triangles" + suffix);
+    }
+}
+
+// レイパケットは一次レイの交点を変えない
+// Odd tile sizes leave partial 4x2 blocks at the tile edges; every triangle and node format has its own packet test.
+void test_ray_packets()
+{
+    for (int nee = 0; nee < 2; nee++) {
+        const std::string suffix = nee ? " (nee)" : " (mcrt)";
+        TestScene test_scene = make_scene(MeshSettings());
+        auto reference_args = default_cpu_args();
+        reference_args->set_ray_packets_enabled(false);
+        const Image reference = render(test_scene, reference_args, nee);
+        expect_identical(reference, render(test_scene, default_cpu_args(), nee), "ray packets" + suffix);
+        expect_identical(render(test_scene, reference_args, nee, 1), render(test_scene, default_cpu_args(), nee, 1), "ray packets with 1 ray per pixel" + suffix);
+
+        const int tile_sizes[] = { 1, 3, 5, 7 };
+        for (int tile_size : tile_sizes) {
+            auto cpu_args = default_cpu_args();
+            cpu_args->set_tile_size(tile_size);
+            expect_identical(reference, render(test_scene, cpu_args, nee), "ray packets with tile size " + std::to_string(tile_size) + suffix);
+        }
+
+        const RTXTriangleFormat triangle_formats[] = { RTXTriangleFormatPrecomputed, RTXTriangleFormatGrouped };
+        for (RTXTriangleFormat triangle_format : triangle_formats) {
+            for (int quantized = 0; quantized < 2; quantized++) {
+                const std::string name = "ray packets with triangle format " + std::to_string(triangle_format) + (quantized ? " and quantized nodes" : "");
+                auto cpu_args = default_cpu_args();
+                cpu_args->set_triangle_format(triangle_format);
+                if (quantized) {
+                    cpu_args->set_bvh_node_format(RTXBVHNodeFormatQuantized);
+                }
+                expect_identical(reference, render(test_scene, cpu_args, nee), name + suffix);
+            }
+        }
+
+        // 画素のサンプルを分けてもブロックの乱数列の巻き戻しは変わらない
+        auto split_args = default_cpu_args();
+        split_args->set_num_rays_per_thread(3);
+        split_args->set_ray_packets_enabled(false);
+        const Image split_reference = render(test_scene, split_args, nee);
+        split_args->set_ray_packets_enabled(true);
+        expect_identical(split_reference, render(test_scene, split_args, nee), "ray packets with 3 rays per thread" + suffix);
+    }
+}
+
+// 波面法は経路を進める順だけが違い、画像を変えない
+// With one ray per thread the image has more units than RTX_CPU_WAVEFRONT_MAX_PATHS, so it is traced in two batches.
+void test_wavefront()
+{
+    for (int nee = 0; nee < 2; nee++) {
+        const std::string suffix = nee ? " (nee)" : " (mcrt)";
+        TestScene test_scene = make_scene(MeshSettings());
+        const Image reference = render(test_scene, default_cpu_args(), nee);
+
+        auto cpu_args = default_cpu_args();
+        cpu_args->set_wavefront_enabled(true);
+        expect_identical(reference, render(test_scene, cpu_args, nee), "wavefront" + suffix);
+        cpu_args->set_num_threads(1);
+        expect_identical(reference, render(test_scene, cpu_args, nee), "wavefront with 1 thread" + suffix);
+
+        cpu_args = default_cpu_args();
+        cpu_args->set_wavefront_enabled(true);
+        cpu_args->set_ray_packets_enabled(false);
+        expect_identical(reference, render(test_scene, cpu_args, nee), "wavefront without ray packets" + suffix);
+
+        cpu_args = default_cpu_args();
+        cpu_args->set_wavefront_enabled(true);
+        cpu_args->set_bvh_node_format(RTXBVHNodeFormatQuantized);
+        cpu_args->set_triangle_format(RTXTriangleFormatGrouped);
+        expect_identical(reference, render(test_scene, cpu_args, nee), "wavefront with quantized nodes and grouped triangles" + suffix);
+
+        cpu_args = default_cpu_args();
+        cpu_args->set_wavefront_enabled(true);
+        expect_identical(render(test_scene, default_cpu_args(), nee, 1), render(test_scene, cpu_args, nee, 1), "wavefront with 1 ray per pixel" + suffix);
+
+        // 最後の範囲が短い分け方と、複数回に分けて追跡する分け方
+        const int rays_per_thread[] = { 1, 3 };
+        for (int num_rays_per_thread : rays_per_thread) {
+            auto megakernel_args = default_cpu_args();
+            megakernel_args->set_num_rays_per_thread(num_rays_per_thread);
+            cpu_args = default_cpu_args();
+            cpu_args->set_num_rays_per_thread(num_rays_per_thread);
+            cpu_args->set_wavefront_enabled(true);
+            expect_identical(render(test_scene, megakernel_args, nee), render(test_scene, cpu_args, nee),
+                "wavefront with " + std::to_string(num_rays_per_thread) + " rays per thread" + suffix);
+        }
+    }
+}
+
+// ノードの並べ方は木を変えないので一致し、ビルダーは木を変えるので許容誤差で比べる
+void test_builders_and_layouts()
+{
+    TestScene reference_scene = make_scene(MeshSettings());
+    const Image reference = render(reference_scene, default_cpu_args(), false);
+
+    const int layouts[] = { RTXBVHNodeLayoutVanEmdeBoas, RTXBVHNodeLayoutSubtreeClusters };
+    for (int layout : layouts) {
+        MeshSettings settings;
+        settings.node_layout = layout;
+        TestScene test_scene = make_scene(settings);
+        expect_identical(reference, render(test_scene, default_cpu_args(), false), "node layout " + std::to_string(layout));
+    }
+
+    const int builders[] = { RTXBVHBuilderMedian, RTXBVHBuilderSBVH, RTXBVHBuilderAuto };
+    for (int builder : builders) {
+        MeshSettings settings;
+        settings.builder = builder;
+        TestScene test_scene = make_scene(settings);
+        expect_close(reference, render(test_scene, default_cpu_args(), false), "builder " + std::to_string(builder));
+        auto cpu_args = default_cpu_args();
+        cpu_args->set_bvh_node_format(RTXBVHNodeFormatQuantized);
+        cpu_args->set_triangle_format(RTXTriangleFormatGrouped);
+        expect_close(reference, render(test_scene, cpu_args, false), "builder " + std::to_string(builder) + " with quantized nodes");
+    }
+
+    MeshSettings settings;
+    settings.treelet_iterations = 2;
+    TestScene test_scene = make_scene(settings);
+    expect_close(reference, render(test_scene, default_cpu_args(), false), "treelet restructuring");
+
+    settings = MeshSettings();
+    settings.max_triangles_per_node = BVH_AUTO_TRIANGLES_PER_NODE;
+    test_scene = make_scene(settings);
+    expect_close(reference, render(test_scene, default_cpu_args(), false), "automatic leaf size");
+}
+
+// どのビルダーでも葉の面数はbvh_max_triangles_per_node以下
+// The SAH builders may stop above a leaf's faces only when a split would cost more, never above the limit.
+void test_leaf_size_limit()
+{
+    const int builders[] = { RTXBVHBuilderMedian, RTXBVHBuilderBinnedSAH, RTXBVHBuilderSBVH, RTXBVHBuilderAuto };
+    const int limits[] = { 1, 3, BVH_DEFAULT_TRIANGLES_PER_NODE };
+    for (int builder : builders) {
+        for (int limit : limits) {
+            for (int treelet_iterations = 0; treelet_iterations <= 1; treelet_iterations++) {
+                MeshSettings settings;
+                settings.builder = builder;
+                settings.max_triangles_per_node = limit;
+                settings.treelet_iterations = treelet_iterations;
+                const std::shared_ptr<Geometry> mesh_array[] = { make_bumpy_sphere(24, 32, 0.6f, settings), make_slivers(600, settings) };
+                for (std::shared_ptr<Geometry> geometry : mesh_array) {
+                    BVH bvh(geometry);
+                    const bvh::Stats stats = bvh.stats();
+                    const int largest_leaf = stats.leaf_size_histogram.size() - 1;
+                    expect(stats.max_triangles_per_node == limit && largest_leaf <= limit,
+                        "builder " + std::to_string(builder) + " with treelet iterations " + std::to_string(treelet_iterations)
+                            + " made a leaf of " + std::to_string(largest_leaf) + " faces above the limit of " + std::to_string(limit));
+                }
+            }
+        }
+    }
+}
+
+// スレッド数とタイルの分け方、配る順は画素ごとの乱数列を変えない
+// Tile size 64 covers the whole 48x48 image with one tile, so most threads find nothing to steal.
+void test_tile_scheduler()
+{
+    for (int nee = 0; nee < 2; nee++) {
+        const std::string suffix = nee ? " (nee)" : " (mcrt)";
+        TestScene test_scene = make_scene(MeshSettings());
+        auto reference_args = default_cpu_args();
+        reference_args->set_num_threads(1);
+        const Image reference = render(test_scene, reference_args, nee);
+
+        const int thread_counts[] = { 2, 3, 8 };
+        for (int num_threads : thread_counts) {
+            auto cpu_args = default_cpu_args();
+            cpu_args->set_num_threads(num_threads);
+            expect_identical(reference, render(test_scene, cpu_args, nee), std::to_string(num_threads) + " threads" + suffix);
+        }
+        const int tile_sizes[] = { 1, 5, 16, 64 };
+        const RTXTileOrder tile_orders[] = { RTXTileOrderScanline, RTXTileOrderMorton, RTXTileOrderSpiral };
+        for (int tile_size : tile_sizes) {
+            for (RTXTileOrder tile_order : tile_orders) {
+                auto cpu_args = default_cpu_args();
+                cpu_args->set_num_threads(4);
+                cpu_args->set_tile_size(tile_size);
+                cpu_args->set_tile_order(tile_order);
+                expect_identical(reference, render(test_scene, cpu_args, nee),
+                    "tile size " + std::to_string(tile_size) + " order " + std::to_string(tile_order) + suffix);
+            }
+        }
+    }
+}
+
+// 画素のサンプルをスレッドに分けても、分け方が同じなら画像はスレッド数によらない
+// Each range restarts the pixel's random sequence, so a split render only has a mean close to the unsplit one.
+// A range that holds every sample is not a split at all and must match the unsplit render exactly.
+void test_sample_ranges()
+{
+    for (int nee = 0; nee < 2; nee++) {
+        const std::string suffix = nee ? " (nee)" : " (mcrt)";
+        TestScene test_scene = make_scene(MeshSettings());
+        auto reference_args = default_cpu_args();
+        reference_args->set_num_threads(1);
+        const Image reference = render(test_scene, reference_args, nee);
+
+        const int rays_per_thread[] = { 1, 3, 8, 16 };
+        for (int num_rays_per_thread : rays_per_thread) {
+            const std::string name = std::to_string(num_rays_per_thread) + " rays per thread";
+            auto split_args = default_cpu_args();
+            split_args->set_num_threads(1);
+            split_args->set_num_rays_per_thread(num_rays_per_thread);
+            const Image split_reference = render(test_scene, split_args, nee);
+            if (num_rays_per_thread >= 8) {
+                expect_identical(reference, split_reference, name + suffix);
+            } else {
+                expect(fabs(mean_of(split_reference) - mean_of(reference)) <= 0.02 * mean_of(reference), name + ": mean differs from the unsplit render" + suffix);
+            }
+            split_args->set_num_threads(4);
+            split_args->set_tile_size(5);
+            expect_identical(split_reference, render(test_scene, split_args, nee), name + ", 4 threads" + suffix);
+        }
+    }
+}
+
+// 遅延構築は構築する時期だけが違い、同じ木を作る
+void test_lazy_construction()
+{
+    for (int nee = 0; nee < 2; nee++) {
+        const std::string suffix = nee ? " (nee)" : " (mcrt)";
+        TestScene test_scene = make_scene(MeshSettings());
+        Renderer eager_renderer;
+        const Image reference = render(eager_renderer, test_scene, default_cpu_args(), nee);
+        const Image second_reference = render(eager_renderer, test_scene, default_cpu_args(), nee);
+        const int node_formats[] = { RTXBVHNodeFormatFull, RTXBVHNodeFormatQuantized };
+        for (int node_format : node_formats) {
+            auto cpu_args = default_cpu_args();
+            cpu_args->set_lazy_bvh_construction_enabled(true);
+            cpu_args->set_bvh_node_format(RTXBVHNodeFormat(node_format));
+            cpu_args->set_triangle_format(RTXTriangleFormatGrouped);
+            Renderer renderer;
+            expect_identical(reference, render(renderer, test_scene, cpu_args, nee), "lazy construction, first frame" + suffix);
+            // 2フレーム目は前のフレームで構築したノードを全体の配列に移してから描く
+            expect_identical(second_reference, render(renderer, test_scene, cpu_args, nee), "lazy construction, second frame" + suffix);
+        }
+    }
+}
+
+void deform(StandardGeometry& geometry, float amount)
+{
+    for (int vertex_index = 0; vertex_index < geometry.num_vertices(); vertex_index++) {
+        const glm::vec4f& vertex = geometry._vertex_array[vertex_index];
+        geometry.update_vertex(vertex_index, glm::vec3f(vertex.x + amount * vertex.y, vertex.y * (1.0f + amount), vertex.z));
+    }
+}
+// 頂点を動かした後のリフィットは、同じ頂点で作り直した木と同じ画像になる
+// The kernel's seed depends on the frames rendered before, so both renderers go through the same frames.
+void test_refit()
+{
+    const int triangle_formats[] = { RTXTriangleFormatIndexed, RTXTriangleFormatGrouped };
+    for (int triangle_format : triangle_formats) {
+        auto cpu_args = default_cpu_args();
+        cpu_args->set_triangle_format(RTXTriangleFormat(triangle_format));
+        TestScene refit_scene = make_scene(MeshSettings());
+        TestScene rebuilt_scene = make_scene(MeshSettings());
+        Renderer refit_renderer;
+        Renderer rebuilt_renderer;
+        render(refit_renderer, refit_scene, cpu_args, false);
+        render(rebuilt_renderer, rebuilt_scene, cpu_args, false);
+        for (int frame = 1; frame <= 3; frame++) {
+            for (auto& mesh : refit_scene.meshes) {
+                deform(*mesh, 0.1f);
+            }
+            const Image refitted = render(refit_renderer, refit_scene, cpu_args, false);
+
+            for (int mesh_index = 0; mesh_index < (int)rebuilt_scene.meshes.size(); mesh_index++) {
+                rebuilt_scene.meshes[mesh_index]->_vertex_array = refit_scene.meshes[mesh_index]->_vertex_array;
+            }
+            rebuilt_scene.scene->set_updated(true);
+            const Image rebuilt = render(rebuilt_renderer, rebuilt_scene, cpu_args, false);
+            expect_close(rebuilt, refitted, "refit, frame " + std::to_string(frame) + " format " + std::to_string(triangle_format));
+        }
+    }
+}
+
+bool overlaps(const rtxThreadedBVHNode& node, const glm::vec3f& aabb_min, const glm::vec3f& aabb_max)
+{
+    const float eps = 1e-5f;
+    return aabb_min.x <= node.aabb_max.x + eps && aabb_max.x >= node.aabb_min.x - eps
+        && aabb_min.y <= node.aabb_max.y + eps && aabb_max.y >= node.aabb_min.y - eps
+        && aabb_min.z <= node.aabb_max.z + eps && aabb_max.z >= node.aabb_min.z - eps;
+}
+// 空間分割した木でも全ての面が少なくとも1つの葉にあり、葉の面はその葉の箱と交わる
+void test_spatial_split_references()
+{
+    MeshSettings settings;
+    settings.builder = RTXBVHBuilderSBVH;
+    auto standard = make_slivers(2000, settings);
+    std::shared_ptr<Geometry> geometry = standard;
+    BVH bvh(geometry);
+    const int num_faces = standard->num_faces();
+    const int num_face_references = bvh.num_face_references();
+    expect(num_face_references > num_faces, "SBVH did not duplicate any reference of the slivers");
+
+    rtx::array<rtxThreadedBVHNode> node_array(bvh.num_nodes());
+    rtx::array<rtxFaceVertexIndex> face_array(num_face_references);
+    rtx::array<rtxVertex> vertex_array(standard->num_vertices());
+    bvh.serialize_nodes(node_array, 0);
+    bvh.serialize_faces(face_array, 0);
+    bvh.serialize_vertices(vertex_array, 0);
+
+    // 直列化した面を元の面に対応づける（面ごとに頂点が別なので最初の頂点で引ける）
+    std::vector<int> num_references_of_face(num_faces, 0);
+    std::vector<char> referenced_from_leaf(num_face_references, false);
+    bool leaves_overlap_faces = true;
+    for (int node_index = 0; node_index < bvh.num_nodes(); node_index++) {
+        const rtxThreadedBVHNode& node = node_array[node_index];
+        if (node.assigned_face_index_start == -1) {
+            continue;
+        }
+        for (int face_index = node.assigned_face_index_start; face_index <= node.assigned_face_index_end; face_index++) {
+            referenced_from_leaf[face_index] = true;
+            const rtxFaceVertexIndex& face = face_array[face_index];
+            const rtxVertex& va = vertex_array[face.a];
+            const rtxVertex& vb = vertex_array[face.b];
+            const rtxVertex& vc = vertex_array[face.c];
+            const glm::vec3f aabb_min(std::min(va.x, std::min(vb.x, vc.x)), std::min(va.y, std::min(vb.y, vc.y)), std::min(va.z, std::min(vb.z, vc.z)));
+            const glm::vec3f aabb_max(std::max(va.x, std::max(vb.x, vc.x)), std::max(va.y, std::max(vb.y, vc.y)), std::max(va.z, std::max(vb.z, vc.z)));
+            if (overlaps(node, aabb_min, aabb_max) == false) {
+                leaves_overlap_faces = false;
+            }
+        }
+    }
+    const std::vector<int>& vertex_index_array = bvh.vertex_index_array();
+    for (int face_index = 0; face_index < num_face_references; face_index++) {
+        const int original_face_index = vertex_index_array[face_array[face_index].a] / 3;
+        num_references_of_face[original_face_index]++;
+    }
+    int num_unreferenced_faces = 0;
+    for (int count : num_references_of_face) {
+        if (count == 0) {
+            num_unreferenced_faces++;
+        }
+    }
+    int num_orphan_references = 0;
+    for (char referenced : referenced_from_leaf) {
+        if (referenced == false) {
+            num_orphan_references++;
+        }
+    }
+    expect(num_unreferenced_faces == 0, std::to_string(num_unreferenced_faces) + " faces are missing from the SBVH leaves");
+    expect(num_orphan_references == 0, std::to_string(num_orphan_references) + " face references belong to no leaf");
+    expect(leaves_overlap_faces, "an SBVH leaf holds a face outside its box");
+
+    // 光源のBVHは面の番号で標本化するので複製しない
+    BVH light_bvh(geometry, false);
+    expect(light_bvh.num_face_references() == num_faces, "SBVH duplicated references although spatial splits were not allowed");
+}
+
+// 量子化した箱は元の箱を必ず含む
+void expect_quantized_boxes_contain_nodes(std::shared_ptr<Geometry> geometry, const std::string& name)
+{
+    BVH bvh(geometry);
+    const int num_wide_nodes = bvh.num_wide_nodes();
+    rtx::array<rtxCPUWideBVHNode> wide_node_array(num_wide_nodes);
+    rtx::array<rtxCPUQuantizedWideBVHNode> quantized_node_array(num_wide_nodes);
+    bvh.serialize_wide_nodes(wide_node_array, 0);
+    bvh.serialize_wide_nodes(quantized_node_array, 0);
+    int num_uncovered_lanes = 0;
+    int num_mismatched_lanes = 0;
+    for (int node_index = 0; node_index < num_wide_nodes; node_index++) {
+        const rtxCPUWideBVHNode& node = wide_node_array[node_index];
+        const rtxCPUQuantizedWideBVHNode& quantized = quantized_node_array[node_index];
+        int num_lanes = 0;
+        for (int lane = 0; lane < RTX_CPU_WIDE_BVH_WIDTH; lane++) {
+            if (node.aabb_min_x[lane] > node.aabb_max_x[lane]) {
+                continue;
+            }
+            num_lanes++;
+            const bool covered = quantized.origin_x + quantized.aabb_min_x[lane] * quantized.scale_x <= node.aabb_min_x[lane]
+                && quantized.origin_y + quantized.aabb_min_y[lane] * quantized.scale_y <= node.aabb_min_y[lane]
+                && quantized.origin_z + quantized.aabb_min_z[lane] * quantized.scale_z <= node.aabb_min_z[lane]
+                && quantized.origin_x + quantized.aabb_max_x[lane] * quantized.scale_x >= node.aabb_max_x[lane]
+                && quantized.origin_y + quantized.aabb_max_y[lane] * quantized.scale_y >= node.aabb_max_y[lane]
+                && quantized.origin_z + quantized.aabb_max_z[lane] * quantized.scale_z >= node.aabb_max_z[lane];
+            if (covered == false) {
+                num_uncovered_lanes++;
+            }
+            const int child_node_index = node.child_node_index[lane] == -1 ? -1 - node.assigned_face_index_start[lane] : node.child_node_index[lane];
+            const int num_assigned_faces = node.child_node_index[lane] == -1 ? node.num_assigned_faces[lane] : 0;
+            if (quantized.child_node_index[lane] != child_node_index || quantized.num_assigned_faces[lane] != num_assigned_faces) {
+                num_mismatched_lanes++;
+            }
+        }
+        if (quantized.num_lanes != num_lanes) {
+            num_mismatched_lanes++;
+        }
+    }
+    expect(num_uncovered_lanes == 0, name + ": " + std::to_string(num_uncovered_lanes) + " quantized boxes do not contain their node");
+    expect(num_mismatched_lanes == 0, name + ": " + std::to_string(num_mismatched_lanes) + " quantized lanes do not match the full node");
+}
+void test_quantized_boxes()
+{
+    const int builders[] = { RTXBVHBuilderMedian, RTXBVHBuilderBinnedSAH, RTXBVHBuilderSBVH };
+    for (int builder : builders) {
+        MeshSettings settings;
+        settings.builder = builder;
+        expect_quantized_boxes_contain_nodes(make_bumpy_sphere(64, 96, 1.0f, settings), "bumpy sphere, builder " + std::to_string(builder));
+        // 原点から離れた小さな箱は8bitの目盛りに対して丸めの影響が大きい
+        auto slivers = make_slivers(3000, settings);
+        float position[3] = { 1000.0f, -250.0f, 37.5f };
+        float scale[3] = { 0.01f, 0.01f, 0.01f };
+        slivers->set_position(position);
+        slivers->set_scale(scale);
+        glm::mat4 model_matrix = slivers->model_matrix();
+        expect_quantized_boxes_contain_nodes(slivers->transoform(model_matrix), "slivers far from the origin, builder " + std::to_string(builder));
+    }
+}
+
+// 一時ディレクトリのファイル
+std::vector<std::string> list_files(const std::string& directory)
+{
+    std::vector<std::string> paths;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == NULL) {
+        return paths;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            paths.push_back(directory + "/" + entry->d_name);
+        }
+    }
+    closedir(dir);
+    return paths;
+}
+void remove_directory(const std::string& directory)
+{
+    for (auto& path : list_files(directory)) {
+        unlink(path.c_str());
+    }
+    rmdir(directory.c_str());
+}
+off_t file_size(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+// ファイルの途中のバイトを書き換える（大きさは変えない）
+bool overwrite_bytes(const std::string& path, off_t offset, const void* data, size_t bytes)
+{
+    FILE* fp = fopen(path.c_str(), "r+b");
+    if (fp == NULL) {
+        return false;
+    }
+    const bool written = fseeko(fp, offset, SEEK_SET) == 0 && fwrite(data, bytes, 1, fp) == 1;
+    return fclose(fp) == 0 && written;
+}
+// キャッシュから読んだ木は構築した木と同じ画像になり、壊れたファイルは作り直して上書きする
+void test_bvh_cache()
+{
+    char directory_template[] = "/tmp/rtx_bvh_cache_test_XXXXXX";
+    if (mkdtemp(directory_template) == NULL) {
+        expect(false, "could not create a temporary directory for the BVH cache");
+        return;
+    }
+    const std::string directory = directory_template;
+    TestScene test_scene = make_scene(MeshSettings());
+    auto cpu_args = default_cpu_args();
+    const Image reference = render(test_scene, cpu_args, false);
+
+    auto render_with_cache = [&](int& num_hits, int& num_misses) {
+        Renderer renderer;
+        renderer.set_bvh_cache_directory(directory);
+        Image image = render(renderer, test_scene, cpu_args, false);
+        num_hits = renderer.bvh_cache_hits();
+        num_misses = renderer.bvh_cache_misses();
+        return image;
+    };
+    int num_hits = 0;
+    int num_misses = 0;
+    expect_identical(reference, render_with_cache(num_hits, num_misses), "BVH cache, first build");
+    // 床の箱も三角形のメッシュなのでキャッシュされる
+    std::vector<std::string> paths = list_files(directory);
+    const int num_meshes = paths.size();
+    expect(num_hits == 0 && num_misses == num_meshes, "BVH cache: the first render should miss every mesh");
+    expect(num_meshes > (int)test_scene.meshes.size(), "BVH cache: expected one file per mesh");
+    if (num_meshes < 2) {
+        remove_directory(directory);
+        return;
+    }
+
+    expect_identical(reference, render_with_cache(num_hits, num_misses), "BVH cache, round trip");
+    expect(num_hits == num_meshes && num_misses == 0, "BVH cache: the second render should hit every mesh");
+
+    // ファイル名と中身のキーが違うファイルは別のメッシュのものとして捨てる
+    const std::string swap_path = directory + "/swap";
+    rename(paths[0].c_str(), swap_path.c_str());
+    rename(paths[1].c_str(), paths[0].c_str());
+    rename(swap_path.c_str(), paths[1].c_str());
+    expect_identical(reference, render_with_cache(num_hits, num_misses), "BVH cache, key mismatch");
+    expect(num_hits == num_meshes - 2 && num_misses == 2, "BVH cache: blobs stored under another key should miss");
+    expect_identical(reference, render_with_cache(num_hits, num_misses), "BVH cache, after key mismatch");
+    expect(num_hits == num_meshes, "BVH cache: mismatched blobs should have been overwritten");
+
+    // 大きさは正しいが中身の壊れたファイル
+    // One blob gets flipped bits in the middle of its payload and another an out-of-range last face index.
+    const unsigned char flipped_bits[4] = { 0x5a, 0xa5, 0x5a, 0xa5 };
+    expect(overwrite_bytes(paths[0], file_size(paths[0]) / 2, flipped_bits, sizeof(flipped_bits)), "BVH cache: could not corrupt " + paths[0]);
+    const int32_t out_of_range_face_index = 0x7fffffff;
+    expect(overwrite_bytes(paths[1], file_size(paths[1]) - sizeof(int32_t), &out_of_range_face_index, sizeof(int32_t)), "BVH cache: could not corrupt " + paths[1]);
+    expect_identical(reference, render_with_cache(num_hits, num_misses), "BVH cache, corrupted payload");
+    expect(num_hits == num_meshes - 2 && num_misses == 2, "BVH cache: blobs with a corrupted payload should miss");
+    expect_identical(reference, render_with_cache(num_hits, num_misses), "BVH cache, after corrupted payload");
+    expect(num_hits == num_meshes, "BVH cache: corrupted blobs should have been overwritten");
+
+    // 途中で切れたファイル
+    for (auto& path : paths) {
+        const off_t size = file_size(path);
+        expect(truncate(path.c_str(), size - 7) == 0, "BVH cache: could not truncate " + path);
+    }
+    expect_identical(reference, render_with_cache(num_hits, num_misses), "BVH cache, truncated files");
+    expect(num_hits == 0 && num_misses == num_meshes, "BVH cache: truncated blobs should miss");
+    const int header_only_size = 16;
+    expect(truncate(paths[0].c_str(), header_only_size) == 0, "BVH cache: could not truncate " + paths[0]);
+    expect_identical(reference, render_with_cache(num_hits, num_misses), "BVH cache, file shorter than the header");
+    expect(num_hits == num_meshes - 1 && num_misses == 1, "BVH cache: a file shorter than the header should miss");
+
+    remove_directory(directory);
+}
+}
+
+int main()
+{
+    // 描画先のnumpy配列を作るのにPythonのインタプリタが要る
+    py::scoped_interpreter interpreter;
+    test_argument_checks();
+    test_kernel_formats();
+    test_triangle_groups();
+    test_ray_packets();
+    test_wavefront();
+    test_builders_and_layouts();
+    test_leaf_size_limit();
+    test_tile_scheduler();
+    test_sample_ranges();
+    test_lazy_construction();
+    test_refit();
+    test_spatial_split_references();
+    test_quantized_boxes();
+    test_bvh_cache();
+    printf("%d checks, %d failures\n", num_checks, num_failures);
+    return num_failures == 0 ? 0 : 1;
+}